@@ -27,6 +27,90 @@ code from stb_sprintf and format it so it integrates cleanly with the namespacin
 
 This is useful for when you need a consistent implementation of sprintf() without having to worry about
 compatibility between different compilers.
+
+Some of the hot paths, such as c89str_strlen(), have SSE2, AVX2 and NEON implementations. Support for these is
+determined at compile time, and where the compiler allows it, confirmed with CPUID at run time. With GCC and Clang
+you need to enable the relevant instruction sets with something like `-mavx2` or `-march=native`. If you need to
+disable them, define any of the following before the implementation:
+
+    #define C89STR_NO_SIMD      (Disables all SIMD code paths.)
+    #define C89STR_NO_SSE2
+    #define C89STR_NO_AVX2
+    #define C89STR_NO_NEON
+
+Outside of the SIMD paths, UTF-8 is decoded with lookup tables indexed by the lead byte rather than a chain of
+comparisons. Both ways decode identically. Define the following to use the comparisons instead, which avoids the
+tables:
+
+    #define C89STR_NO_UTF8_DECODE_TABLE
+
+c89str_line_index_parallel() uses threads. These are Win32 threads on Windows and pthreads everywhere else, so you may
+need to link with `-pthread` on older systems. Define the following to run everything on the calling thread instead:
+
+    #define C89STR_NO_THREADING
+
+When a dynamic string (c89str) needs more room its capacity is grown geometrically so that appending is amortized O(1).
+By default the capacity grows by 1.5x, and by at least 16 bytes. The growth policy can be changed by defining the
+following before the implementation:
+
+    #define C89STR_CAPACITY_GROWTH_NUMERATOR    3   (The growth factor is NUMERATOR/DENOMINATOR.)
+    #define C89STR_CAPACITY_GROWTH_DENOMINATOR  2
+    #define C89STR_MIN_CAPACITY_GROWTH          16
+
+Setting the numerator and denominator to the same value and the minimum growth to 0 will make strings grow to the
+exact size required, which is how older versions of this library behaved. New strings are always sized exactly. Use
+c89str_reserve() when you have an idea of how big a string is going to get, and c89str_shrink_to_fit() to release
+any unused capacity.
+
+Every dynamic string has a header sitting just before the string data. By default this is three size_t's (capacity,
+length and result code). If you have lots of short strings you can define the following before the implementation to
+use a compact header instead:
+
+    #define C89STR_COMPACT_HEADER
+
+The compact header stores the capacity and length in the smallest integer type that can hold the capacity and only
+stores the result code when the string is in an error state. Strings shorter than 256 bytes have a 3 byte header. This
+makes looking up the length and capacity slightly more expensive.
+
+A string can also be created inside a buffer owned by the application, such as an array on the stack, with
+c89str_new_with_buffer(). Some of the buffer is used for the header. Such a string works like any other, and if it
+outgrows the buffer it is moved to the heap using the allocation callbacks passed to whichever function needed the
+extra room. You should always call c89str_delete() on these strings when you're done with them. It does nothing if the
+string is still in the buffer. The buffer must outlive the string.
+
+    ```c
+    char buffer[64];
+    c89str str = c89str_new_with_buffer(buffer, sizeof(buffer));
+    str = c89str_cat(str, NULL, "Hello");
+    ...
+    c89str_delete(str, NULL);
+    ```
+
+For code that creates and throws away lots of temporary strings, such as a request handler, there is a bump allocator
+called c89str_arena. Allocations are carved out of large blocks, and are all released at once with c89str_arena_reset()
+or c89str_arena_rewind(). The blocks are kept around after a reset so once an arena has warmed up it won't need to
+touch the heap again. Use c89str_arena_allocation_callbacks() to plug it into any function that takes allocation
+callbacks:
+
+    ```c
+    c89str_arena arena;
+    c89str_allocation_callbacks allocationCallbacks;
+
+    c89str_arena_init(&arena, 0, NULL);
+    allocationCallbacks = c89str_arena_allocation_callbacks(&arena);
+
+    for (each request) {
+        c89str str = c89str_newf(&allocationCallbacks, "Hello, %s", pName);
+        ...
+        c89str_arena_reset(&arena);    (No need to delete the string.)
+    }
+
+    c89str_arena_uninit(&arena);
+    ```
+
+Resizing the most recent allocation is done in place if there's room, which is what happens when you keep appending to
+the same string. Freeing the most recent allocation gives the memory back. Freeing anything else does nothing until the
+arena is reset. An arena is not thread safe.
 */
 
 #ifndef c89str_h
@@ -149,6 +233,40 @@ C89STR_API void* c89str_realloc(void* p, size_t sz, const c89str_allocation_call
 C89STR_API void  c89str_free(void* p, const c89str_allocation_callbacks* pAllocationCallbacks);
 
 
+/* Arena Allocator */
+/* BEG c89str_arena.h */
+typedef struct c89str_arena_block c89str_arena_block;
+
+typedef struct
+{
+    c89str_allocation_callbacks allocationCallbacks;    /* Where the blocks come from. */
+    size_t blockSize;
+    c89str_arena_block* pFirstBlock;
+    c89str_arena_block* pCurrentBlock;  /* NULL if nothing has been allocated since the last reset. */
+    size_t offset;                      /* The offset of the next allocation in the current block. */
+    size_t lastOffset;                  /* The offset of the most recent allocation in the current block, or c89str_npos. */
+    c89str_arena_block* pUserBlock;     /* The block that lives in the buffer passed to c89str_arena_init_with_buffer(). Not freed. */
+} c89str_arena;
+
+typedef struct
+{
+    c89str_arena_block* pBlock;
+    size_t offset;
+} c89str_arena_mark;
+
+C89STR_API errno_t c89str_arena_init(c89str_arena* pArena, size_t blockSize, const c89str_allocation_callbacks* pAllocationCallbacks);  /* Set blockSize to 0 to use the default. Allocations bigger than the block size get a block of their own. */
+C89STR_API errno_t c89str_arena_init_with_buffer(c89str_arena* pArena, void* pBuffer, size_t bufferSizeInBytes, size_t blockSize, const c89str_allocation_callbacks* pAllocationCallbacks);  /* The buffer is used for the first block. Pass in callbacks with a NULL onMalloc to never touch the heap. */
+C89STR_API void    c89str_arena_uninit(c89str_arena* pArena);
+C89STR_API void*   c89str_arena_malloc(c89str_arena* pArena, size_t sz);
+C89STR_API void*   c89str_arena_realloc(c89str_arena* pArena, void* p, size_t sz);
+C89STR_API void    c89str_arena_free(c89str_arena* pArena, void* p);     /* Only does something for the most recent allocation. */
+C89STR_API void    c89str_arena_reset(c89str_arena* pArena);             /* Releases every allocation, but keeps the blocks for reuse. */
+C89STR_API c89str_arena_mark c89str_arena_get_mark(const c89str_arena* pArena);
+C89STR_API void    c89str_arena_rewind(c89str_arena* pArena, c89str_arena_mark mark);  /* Releases everything allocated since the mark was taken. */
+C89STR_API c89str_allocation_callbacks c89str_arena_allocation_callbacks(c89str_arena* pArena);
+/* END c89str_arena.h */
+
+
 /* Standard Library Alternatives */
 /* BEG c89str_stdlib.h */
 C89STR_API size_t c89str_strlen(const char* src);
@@ -171,6 +289,72 @@ C89STR_API int c89str_strnicmp(const char* str1, const char* str2, size_t count)
 C89STR_API c89str_bool32 c89str_is_null_or_whitespace(const char* str, size_t strLen);
 C89STR_API errno_t c89str_findn(const char* str, size_t strLen, const char* other, size_t otherLen, size_t* pResult);
 C89STR_API errno_t c89str_find(const char* str, const char* other, size_t* pResult);  /* Returns NOENT if the string cannot be found, and sets pResult to c89str_npos. */
+
+/*
+A searcher is a needle that has been preprocessed so it can be searched for in any number of strings without repeating
+the setup work. Use this instead of c89str_findn() when searching for the same needle many times. The needle is not
+copied and must remain valid for the lifetime of the searcher. There is no need to uninitialize a searcher.
+*/
+typedef struct
+{
+    const char* pNeedle;
+    size_t needleLen;
+    size_t rareOffset1;         /* The offsets of the two bytes in the needle that are least likely to appear in text. These are used as a filter. */
+    size_t rareOffset2;
+    size_t twoWayCritPos;       /* Two-Way state for long needles. */
+    size_t twoWayPeriod;
+    size_t twoWayMemory;
+    c89str_uint8 twoWaySkip[256];   /* How far to move when the last byte of the window is the given byte. Clamped to 255 so the searcher stays small enough to live on the stack. */
+} c89str_searcher;
+
+C89STR_API errno_t c89str_searcher_init(c89str_searcher* pSearcher, const char* pNeedle, size_t needleLen);
+C89STR_API errno_t c89str_searcher_find(const c89str_searcher* pSearcher, const char* str, size_t strLen, size_t* pResult);  /* Returns ENOENT if the needle cannot be found, and sets pResult to c89str_npos. */
+C89STR_API errno_t c89str_searcher_find_all(const c89str_searcher* pSearcher, const char* str, size_t strLen, size_t* pOffsets, size_t offsetsCap, size_t* pCount);  /* Matches do not overlap. Set pOffsets to NULL to only count. Returns ENOMEM if pOffsets is too small. */
+
+/*
+A multi searcher looks for any number of patterns at the same time in a single pass over the string. It's an Aho-Corasick
+automaton with the failure links folded into a DFA, so each byte costs a single table lookup no matter how many patterns
+there are. For small pattern sets a SIMD prefilter is used to skip over text that can't possibly be the start of a match.
+
+Matches are reported leftmost first. When more than one pattern matches at the same position, the longest one wins. If
+the same pattern is given more than once, the first one wins.
+
+Set pPatternLens to NULL if every pattern is null terminated. Individual lengths can also be set to (size_t)-1. Patterns
+cannot be empty. The patterns are not referenced after initialization. Uninitialize with c89str_multi_searcher_uninit().
+*/
+typedef struct
+{
+    size_t patternCount;
+    size_t stateCount;
+    size_t classCount;              /* The number of byte classes. Bytes that are not distinguished by any pattern share a class. */
+    size_t* pPatternLens;
+    c89str_uint32* pTable;          /* A row for each state with a transition for each class, followed by the index + 1 of the longest pattern ending at the state (or 0) and the state's depth. */
+    unsigned char byteClasses[256];
+    c89str_uint32 prefilterLen;     /* The number of leading bytes of each pattern used by the prefilter, or 0 if it's not used. */
+    unsigned char prefilterMasks[3][2][16];
+} c89str_multi_searcher;
+
+C89STR_API errno_t c89str_multi_searcher_init(c89str_multi_searcher* pSearcher, const char* const* ppPatterns, const size_t* pPatternLens, size_t patternCount, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API void    c89str_multi_searcher_uninit(c89str_multi_searcher* pSearcher, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_multi_searcher_find(const c89str_multi_searcher* pSearcher, const char* str, size_t strLen, size_t* pResult, size_t* pPatternIndex);  /* Returns ENOENT if nothing can be found, and sets pResult to c89str_npos. pPatternIndex can be NULL. */
+
+/*
+Line indexing. A line ends at any of \n, \r, \r\n, \v, \f, U+0085, U+2028 and U+2029, with \r\n counting as a single
+break. A break at the very end of the string does not start another line, so "a\nb\n" has two lines and an empty string
+has none. The lengths passed to the callback of c89str_for_each_line() do not include the break.
+
+c89str_line_index() returns an array with the offset of the start of each line. Free it with c89str_free(). Set
+ppLineOffsets to NULL to only count the lines. c89str_line_index_parallel() does the same thing across multiple threads
+which is worthwhile for strings of many megabytes. Set threadCount to 0 to use a thread for each processor. Strings that
+are too small to be worth splitting are done on the calling thread. The allocation callbacks are only ever called from
+the calling thread.
+*/
+typedef errno_t (* c89str_line_proc)(void* pUserData, size_t lineOffset, size_t lineLen);
+
+C89STR_API errno_t c89str_for_each_line(const char* str, size_t strLen, c89str_line_proc onLine, void* pUserData);  /* Stops at the first callback that doesn't return C89STR_SUCCESS and returns its result. */
+C89STR_API errno_t c89str_line_index(const char* str, size_t strLen, size_t** ppLineOffsets, size_t* pLineCount, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_line_index_parallel(const char* str, size_t strLen, size_t threadCount, size_t** ppLineOffsets, size_t* pLineCount, const c89str_allocation_callbacks* pAllocationCallbacks);
+
 C89STR_API int c89str_strncmpn(const char* str1, size_t str1Len, const char* str2, size_t str2Len);
 C89STR_API c89str_bool32 c89str_begins_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len); /* Returns 0 if str1 begins with str2. */
 C89STR_API c89str_bool32 c89str_ends_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len); /* Returns 0 if str1 ends with str2. */
@@ -192,6 +376,7 @@ C89STR_API c89str_bool32 c89str_is_all_digits(const char* str, size_t strLen);
 
 #define C89STR_FORBID_BOM                                    (1 << 1)
 #define C89STR_ERROR_ON_INVALID_CODE_POINT                   (1 << 2)
+#define C89STR_SHRINK_TO_FIT                                 (1 << 3)   /* For the _alloc() conversions. Shrinks the output buffer to the length of the output. */
 
 C89STR_API c89str_bool32 c89str_utf16_is_bom_le(const unsigned char bom[2]);
 C89STR_API c89str_bool32 c89str_utf16_is_bom_be(const unsigned char bom[2]);
@@ -207,6 +392,28 @@ C89STR_API void c89str_utf32_swap_endian(c89str_utf32* pUTF32, size_t count);
 
 
 /* UTF-8 */
+/*
+Checks that the input is well-formed UTF-8 as defined by RFC 3629. Overlong encodings, surrogates, code points above
+U+10FFFF and truncated sequences are all invalid. Returns C89STR_ECODEPOINT if the input is invalid, in which case
+pErrorOffset receives the offset of the first byte of the first invalid sequence. On success it receives the length of
+the input. Set utf8Len to (size_t)-1 for null terminated strings.
+*/
+C89STR_API errno_t c89str_utf8_validate(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pErrorOffset);
+
+/*
+Counts code points without decoding them. Every byte that isn't a continuation byte (10xxxxxx) is the start of a code
+point so that's what gets counted. No validation is done, and stray continuation bytes in invalid input are not counted.
+Returns 0 if pUTF8 is NULL. Set utf8Len to (size_t)-1 for null terminated strings.
+*/
+C89STR_API size_t c89str_utf8_count_code_points(const c89str_utf8* pUTF8, size_t utf8Len);
+
+/*
+Returns the byte offset of the code point at the given index, counted the same way as c89str_utf8_count_code_points().
+An index equal to the number of code points returns the length of the string. Anything beyond that returns
+c89str_npos. Set utf8Len to (size_t)-1 for null terminated strings.
+*/
+C89STR_API size_t c89str_utf8_offset_of_code_point(const c89str_utf8* pUTF8, size_t utf8Len, size_t codePointIndex);
+
 C89STR_API errno_t c89str_utf8_to_utf16_len(size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags);
 static C89STR_INLINE errno_t c89str_utf8_to_utf16ne_len(size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags) { return c89str_utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags); }
 static C89STR_INLINE errno_t c89str_utf8_to_utf16le_len(size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags) { return c89str_utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags); }
@@ -230,6 +437,15 @@ static C89STR_INLINE errno_t c89str_utf8_to_utf32(c89str_utf32* pUTF32, size_t u
 C89STR_API errno_t c89str_utf8_to_wchar_len(size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf8_to_wchar(wchar_t* pWCHAR, size_t wcharCap, size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags);
 
+/*
+Single pass conversions into a buffer allocated with c89str_malloc(). The buffer is sized for the worst case up front
+so the input is only read once, rather than once for the length and again for the conversion. Add
+C89STR_SHRINK_TO_FIT to the flags to give back the unused part of the buffer afterwards. The output is null terminated
+and must be freed with c89str_free(). On error the buffer is freed and *ppOut is set to NULL.
+*/
+C89STR_API errno_t c89str_utf8_to_utf16_alloc(c89str_utf16** ppUTF16, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_utf8_to_utf32_alloc(c89str_utf32** ppUTF32, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks);
+
 
 /* UTF-16 */
 C89STR_API errno_t c89str_utf16ne_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
@@ -241,6 +457,7 @@ C89STR_API errno_t c89str_utf16ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, si
 C89STR_API errno_t c89str_utf16le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf16be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf16_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
+C89STR_API errno_t c89str_utf16_to_utf8_alloc(c89str_utf8** ppUTF8, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks);   /* See c89str_utf8_to_utf16_alloc(). */
 
 C89STR_API errno_t c89str_utf16ne_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf16le_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags);
@@ -266,6 +483,7 @@ C89STR_API errno_t c89str_utf32ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, si
 C89STR_API errno_t c89str_utf32le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf32be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf32_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
+C89STR_API errno_t c89str_utf32_to_utf8_alloc(c89str_utf8** ppUTF8, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks);   /* See c89str_utf8_to_utf16_alloc(). */
 
 C89STR_API errno_t c89str_utf32ne_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
 C89STR_API errno_t c89str_utf32le_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
@@ -281,6 +499,40 @@ C89STR_API errno_t c89str_utf32be_to_utf16be(c89str_utf16* pUTF16, size_t utf16C
 C89STR_API errno_t c89str_utf32_to_utf16(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags);
 
 
+/* Streaming */
+/*
+Streaming conversions are for input that arrives in chunks, such as when reading a file or socket with a fixed size
+buffer. A code point that is split across two chunks is kept in the stream, up to 3 bytes of UTF-8 or 1 unit of
+UTF-16, and completed by the next chunk. The output of each call is null terminated like the other conversions.
+
+Bytes that are kept in the stream are included in *pInLenProcessed. When the output buffer fills up the conversion
+stops and returns ENOMEM, in which case the caller should drain the output and pass in the rest of the chunk again.
+The output buffer needs room for at least 4 code units plus the null terminator to be sure of making progress.
+
+A BOM is only skipped at the start of the stream. A UTF-16 BOM selects the byte order of the whole stream, otherwise
+the input is native endian. Call c89str_utf_stream_finish() after the last chunk. It returns EINVAL if the input ended
+part way through a code point, just like the non-streaming conversions do, and resets the stream for reuse.
+*/
+typedef struct
+{
+    unsigned int flags;
+    c89str_bool32 isStarted;    /* Set once the first code point or BOM has been seen. */
+    c89str_bool32 isLE;         /* For UTF-16 input. */
+    size_t partialLen;          /* In input code units. */
+    union
+    {
+        c89str_utf8  utf8[4];
+        c89str_utf16 utf16[2];
+    } partial;
+} c89str_utf_stream;
+
+C89STR_API errno_t c89str_utf_stream_init(c89str_utf_stream* pStream, unsigned int flags);
+C89STR_API errno_t c89str_utf_stream_finish(c89str_utf_stream* pStream);
+C89STR_API errno_t c89str_utf8_to_utf16_stream(c89str_utf_stream* pStream, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed);
+C89STR_API errno_t c89str_utf8_to_utf32_stream(c89str_utf_stream* pStream, c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed);
+C89STR_API errno_t c89str_utf16_to_utf8_stream(c89str_utf_stream* pStream, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed);
+
+
 /* UTF-32 */
 C89STR_API c89str_bool32 c89str_utf32_is_null_or_whitespace(const c89str_utf32* pUTF32, size_t utf32Len);
 
@@ -298,6 +550,7 @@ C89STR_API size_t c89str_utf8_find_next_line(const c89str_utf8* pUTF8, size_t ut
 typedef char* c89str;
 C89STR_API void    c89str_delete(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks);
 C89STR_API c89str  c89str_new_with_cap(const c89str_allocation_callbacks* pAllocationCallbacks, size_t capacityNotIncludingNullTerminator);
+C89STR_API c89str  c89str_new_with_buffer(void* pBuffer, size_t bufferSizeInBytes);  /* Creates an empty string inside the given buffer. Returns NULL if the buffer is too small for the header. See the notes at the top of this file. */
 C89STR_API c89str  c89str_new(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther);
 C89STR_API c89str  c89str_newn(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen);
 C89STR_API c89str  c89str_newv(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args);
@@ -317,11 +570,48 @@ C89STR_API c89str  c89str_prependf(c89str str, const c89str_allocation_callbacks
 C89STR_API c89str  c89str_remove(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t beg, size_t end);
 C89STR_API c89str  c89str_replace(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t replaceOffset, size_t replaceLength, const char* pOther, size_t otherLength);
 C89STR_API c89str  c89str_replace_all(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen);
+C89STR_API c89str  c89str_replace_all_ex(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen, size_t maxReplacements);  /* Replaces at most maxReplacements occurrences, starting from the left. Set maxReplacements to (size_t)-1 for no limit. */
+C89STR_API c89str  c89str_replace_all_multi(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_multi_searcher* pSearcher, const char* const* ppReplacements, const size_t* pReplacementLens);  /* ppReplacements[i] replaces pattern i of the searcher. Set pReplacementLens to NULL if every replacement is null terminated. Done in a single pass, in place if no replacement is longer than its pattern. */
 C89STR_API c89str  c89str_trim(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API c89str  c89str_reserve(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t capacityNotIncludingNullTerminator);  /* Makes sure the string can grow to the given length without reallocating. Never shrinks. */
+C89STR_API c89str  c89str_shrink_to_fit(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks);  /* Releases any capacity beyond the length of the string. */
 C89STR_API void    c89str_set_len(c89str str, size_t len);  /* Do not call this manually unless you're manually changing the content of the string. */
 C89STR_API size_t  c89str_len(const c89str str);
-C89STR_API size_t  c89str_cap(const c89str str);
-C89STR_API errno_t c89str_result(const c89str str);
+C89STR_API size_t  c89str_cap(const c89str str);      /* With C89STR_COMPACT_HEADER the capacity is lost when a string goes into an error state, and this returns the length from then on. */
+C89STR_API errno_t c89str_result(const c89str str);   /* With C89STR_COMPACT_HEADER, codes that don't fit in the header are reported as 255 for strings with a capacity below 256. */
+
+
+/* String Builder */
+/* BEG c89str_builder.h */
+/*
+A builder collects output in a chain of fixed size chunks so appending never has to move anything that's already been
+written, unlike repeatedly calling c89str_cat(). When you're done, c89str_builder_to_c89str() gives you a regular string
+and c89str_builder_write() passes the content to a callback, one chunk at a time. Either way the content is copied
+exactly once. Appends are all or nothing. If an append fails the builder is left as it was.
+*/
+typedef struct c89str_builder_chunk c89str_builder_chunk;
+
+typedef struct
+{
+    c89str_builder_chunk* pFirstChunk;
+    c89str_builder_chunk* pLastChunk;
+    size_t chunkSize;
+    size_t len;
+} c89str_builder;
+
+typedef errno_t (* c89str_builder_write_proc)(void* pUserData, const char* pData, size_t dataLen);
+
+C89STR_API errno_t c89str_builder_init(c89str_builder* pBuilder, size_t chunkSize);    /* Set chunkSize to 0 to use the default. Appends bigger than a chunk get a chunk of their own. */
+C89STR_API void    c89str_builder_uninit(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API size_t  c89str_builder_len(const c89str_builder* pBuilder);
+C89STR_API errno_t c89str_builder_append(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen);
+C89STR_API errno_t c89str_builder_appendv(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args);
+C89STR_API errno_t c89str_builder_appendf(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...) C89STR_ATTRIBUTE_FORMAT(3, 4);
+C89STR_API errno_t c89str_builder_append_utf16(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf16* pUTF16, size_t utf16Len, unsigned int flags);  /* Native endian. Converted to UTF-8 the same way as c89str_utf16ne_to_utf8(). */
+C89STR_API errno_t c89str_builder_append_utf32(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf32* pUTF32, size_t utf32Len, unsigned int flags);  /* Native endian. Converted to UTF-8 the same way as c89str_utf32ne_to_utf8(). */
+C89STR_API c89str  c89str_builder_to_c89str(const c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks);  /* Returns NULL if there's not enough memory. */
+C89STR_API errno_t c89str_builder_write(const c89str_builder* pBuilder, c89str_builder_write_proc onWrite, void* pUserData);  /* Stops at the first callback that doesn't return C89STR_SUCCESS and returns its result. */
+/* END c89str_builder.h */
 
 
 /* BEG c89str_lexer.h */
@@ -363,9 +653,41 @@ typedef enum
     c89str_token_type_oreq,                   /* |= */
     c89str_token_type_xoreq,                  /* ^= */
     c89str_token_type_coloncolon,             /* :: */
-    c89str_token_type_ellipsis                /* ... */
+    c89str_token_type_ellipsis,               /* ... */
+    c89str_token_type_user                    /* The first value available for your own token types, such as keywords. */
 } c89str_token_type;
 
+/*
+Keywords. By default every word comes back as c89str_token_type_identifier. A keyword table maps specific words to
+token types of your own choosing, which should start at c89str_token_type_user. The table is built once with a perfect
+hash so checking an identifier costs one hash of the identifier and at most one comparison. Point the pKeywords option
+of the lexer at the table to use it. The table can be shared between lexers, and between threads. The keywords are not
+copied so they need to outlive the table. EINVAL is returned if the same keyword is given more than once.
+*/
+typedef struct
+{
+    const char* pName;
+    c89str_uint32 token;
+} c89str_lexer_keyword;
+
+typedef struct
+{
+    const c89str_lexer_keyword* pKeywords;
+    size_t keywordCount;
+    c89str_uint32* pSlots;          /* The index of the keyword in each slot, or 0xFFFFFFFF for an empty slot. */
+    c89str_uint32* pBucketSeeds;    /* A hash picks the bucket, and the bucket's seed picks the slot. */
+    c89str_uint32* pKeywordLengths;
+    c89str_uint32 slotMask;
+    c89str_uint32 bucketMask;
+    c89str_uint32 hashSeed;
+    size_t minKeywordLen;
+    size_t maxKeywordLen;
+} c89str_lexer_keyword_table;
+
+C89STR_API errno_t c89str_lexer_keyword_table_init(c89str_lexer_keyword_table* pTable, const c89str_lexer_keyword* pKeywords, size_t keywordCount, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API void c89str_lexer_keyword_table_uninit(c89str_lexer_keyword_table* pTable, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API size_t c89str_lexer_keyword_table_find(const c89str_lexer_keyword_table* pTable, const char* str, size_t strLen);  /* Returns the index of the keyword, or c89str_npos if it's not a keyword. */
+
 typedef struct
 {
     const char* pText;
@@ -375,20 +697,84 @@ typedef struct
     size_t tokenLen;
     c89str_utf32 token;
     size_t lineNumber;  /* One based line number. */
+    size_t tokenLineNumber; /* One based line number the current token starts on. Differs from lineNumber after a token that contains a new line. */
     struct
     {
         c89str_bool32 skipWhitespace;
         c89str_bool32 skipNewlines;
         c89str_bool32 skipComments;
         c89str_bool32 allowDashesInIdentifiers;
+        const c89str_lexer_keyword_table* pKeywords;    /* Identifiers found in this table are returned as the keyword's token. Set to NULL to disable. */
         const char* pLineCommentOpeningToken;
         const char* pBlockCommentOpeningToken;
         const char* pBlockCommentClosingToken;
     } options;
+    struct
+    {
+        const char* pLineCommentOpeningToken;   /* The comment tokens the lengths below were measured for. The options can be changed at any time so these are compared each time a token is read. */
+        const char* pBlockCommentOpeningToken;
+        const char* pBlockCommentClosingToken;
+        size_t lineCommentOpeningLen;           /* 0 if line comments are disabled. */
+        size_t blockCommentOpeningLen;          /* 0 if block comments are disabled. */
+        size_t blockCommentClosingLen;
+    } cache;    /* Internal use only. */
 } c89str_lexer;
 
 C89STR_API errno_t c89str_lexer_init(c89str_lexer* pLexer, const char* pText, size_t textLen);
 C89STR_API errno_t c89str_lexer_next(c89str_lexer* pLexer);
+
+
+/*
+A token array stores a stream of tokens as a struct of arrays so parsers can walk it without going
+through the lexer for each token. Each token is identified by its index into the four arrays.
+
+Use c89str_token_array_init() for an array that grows with the allocation callbacks passed in to
+c89str_lexer_tokenize_all(). All four arrays live in a single allocation so an arena (see
+c89str_arena_allocation_callbacks()) works well here. Use c89str_token_array_init_with_buffers() to
+have tokens written to memory you own. Such an array never grows.
+
+c89str_lexer_tokenize_all() appends every token from the cursor of the lexer to the end of the text.
+The options of the lexer apply so skipped whitespace, new lines and comments are not stored. The end
+of file token is not stored either. Error tokens are stored and lexing continues past them, in the
+same way as when calling c89str_lexer_next() in a loop.
+
+If the array runs out of room, or fails to grow, ENOMEM is returned. The tokens that were stored are
+kept and the lexer is left on the first token that was not stored so the call can be repeated with a
+bigger buffer.
+
+c89str_lexer_tokenize_all_parallel() produces the same tokens as c89str_lexer_tokenize_all() but
+splits the text into chunks that are lexed on separate threads. Set threadCount to 0 to use a thread
+for each processor. Text that is too small to be worth splitting is lexed on the calling thread. The
+allocation callbacks are only ever called from the calling thread. Don't change the options of the
+lexer from another thread while this is running.
+
+c89str_lexer_retokenize() updates a token array after an edit to the text. The array must hold every
+token of the text from the start, as produced by c89str_lexer_tokenize_all() from a freshly initialized
+lexer with the same options. Apply the edit to the text first and point the lexer at the new text. The
+edit is described by where it starts, how many bytes were removed and how many were inserted in their
+place. Lexing restarts from the last token that can't have been affected by the edit and stops as soon
+as a token starts at the same place as one of the old tokens after the edit. The tokens after that are
+kept and only have their offsets and line numbers adjusted. The range of tokens that were lexed again
+is output via pFirstToken and pTokenCount, either of which can be NULL. The array is left unchanged if
+an error is returned. The cursor of the lexer is left after the last token that was lexed.
+*/
+typedef struct
+{
+    c89str_uint32* pTypes;  /* The same values as c89str_lexer.token. */
+    size_t* pOffsets;       /* Byte offset of the token from the start of the text. */
+    size_t* pLengths;       /* Length of the token in bytes. */
+    size_t* pLines;         /* One based line number the token starts on. */
+    size_t count;
+    size_t capacity;
+    c89str_bool32 ownsBuffers;  /* False when the buffers were supplied by the caller, in which case the array cannot grow. */
+} c89str_token_array;
+
+C89STR_API errno_t c89str_token_array_init(c89str_token_array* pTokens);
+C89STR_API errno_t c89str_token_array_init_with_buffers(c89str_token_array* pTokens, c89str_uint32* pTypes, size_t* pOffsets, size_t* pLengths, size_t* pLines, size_t capacity);
+C89STR_API void c89str_token_array_uninit(c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_lexer_tokenize_all(c89str_lexer* pLexer, c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_lexer_tokenize_all_parallel(c89str_lexer* pLexer, size_t threadCount, c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks);
+C89STR_API errno_t c89str_lexer_retokenize(c89str_lexer* pLexer, c89str_token_array* pTokens, size_t editOff, size_t removedLen, size_t insertedLen, size_t* pFirstToken, size_t* pTokenCount, const c89str_allocation_callbacks* pAllocationCallbacks);
 /* END c89str_lexer.h */
 
 C89STR_API errno_t c89str_lexer_transform_token(c89str_lexer* pLexer, c89str* pStr, const c89str_allocation_callbacks* pAllocationCallbacks);
@@ -460,7 +846,7 @@ C89STR_API void c89str_set_sprintf_separators(char comma, char period);
 /* END c89str_fallthrough.h */
 
 #include <stdlib.h> /* malloc(), realloc(), free(). */
-#include <string.h> /* For memcpy(). */
+#include <string.h> /* For memcpy(), memcmp(). */
 #include <assert.h> /* For assert(). */
 #include <stdio.h>
 
@@ -489,6 +875,10 @@ static void c89str_zero_memory_default(void* p, size_t sz)
 #define C89STR_MOVE_MEMORY(dst, src, sz)    memmove((dst), (src), (sz))
 #endif
 
+#ifndef C89STR_COMPARE_MEMORY
+#define C89STR_COMPARE_MEMORY(a, b, sz)     memcmp((a), (b), (sz))
+#endif
+
 #ifndef C89STR_MALLOC
 #define C89STR_MALLOC(sz)                   malloc((sz))
 #endif
@@ -507,129 +897,469 @@ static void c89str_zero_memory_default(void* p, size_t sz)
 #define C89STR_MIN(x, y)                    (((x) < (y)) ? (x) : (y))
 
 
-static C89STR_INLINE c89str_bool32 c89str_is_little_endian(void)
-{
-#if defined(C89STR_X86) || defined(C89STR_X64)
-    return C89STR_TRUE;
-#elif defined(__BYTE_ORDER) && defined(__LITTLE_ENDIAN) && __BYTE_ORDER == __LITTLE_ENDIAN
-    return C89STR_TRUE;
+/* BEG c89str_simd.h */
+/* Architecture Detection */
+#if defined(__x86_64__) || defined(_M_X64)
+    #define C89STR_X64
+#elif defined(__i386) || defined(_M_IX86)
+    #define C89STR_X86
+#elif defined(__arm__) || defined(_M_ARM) || defined(__arm64) || defined(__arm64__) || defined(__aarch64__) || defined(_M_ARM64)
+    #define C89STR_ARM
+#endif
+
+#if defined(C89STR_NO_SIMD)
+    #ifndef C89STR_NO_SSE2
+    #define C89STR_NO_SSE2
+    #endif
+    #ifndef C89STR_NO_AVX2
+    #define C89STR_NO_AVX2
+    #endif
+    #ifndef C89STR_NO_NEON
+    #define C89STR_NO_NEON
+    #endif
+#endif
+
+/* Intrinsics Support */
+#if defined(C89STR_X64) || defined(C89STR_X86)
+    #if defined(_MSC_VER) && !defined(__clang__)
+        /* MSVC. */
+        #if _MSC_VER >= 1400 && !defined(C89STR_NO_SSE2)   /* 2005 */
+            #define C89STR_SUPPORT_SSE2
+        #endif
+        #if _MSC_VER >= 1700 && !defined(C89STR_NO_AVX2)   /* 2012 */
+            #define C89STR_SUPPORT_AVX2
+        #endif
+    #else
+        /*
+        Assume GNUC-style. The AVX2 intrinsics can only be used when the compiler has been told it's allowed to
+        generate AVX2 code (-mavx2 or -march=...) so we never need a runtime check for GCC and Clang.
+        */
+        #if defined(__SSE2__) && !defined(C89STR_NO_SSE2)
+            #define C89STR_SUPPORT_SSE2
+        #endif
+        #if defined(__AVX2__) && !defined(C89STR_NO_AVX2)
+            #define C89STR_SUPPORT_AVX2
+        #endif
+    #endif
+
+    #if defined(C89STR_SUPPORT_AVX2)
+        #include <immintrin.h>
+    #elif defined(C89STR_SUPPORT_SSE2)
+        #include <emmintrin.h>
+    #endif
+#endif
+
+#if defined(C89STR_ARM)
+    #if !defined(C89STR_NO_NEON) && (defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64))
+        #define C89STR_SUPPORT_NEON
+        #include <arm_neon.h>
+
+        /* The 16-byte table lookup (vqtbl1q_u8) is only available on AArch64. */
+        #if defined(__aarch64__) || defined(_M_ARM64)
+            #define C89STR_SUPPORT_NEON_TBL
+        #endif
+    #endif
+#endif
+
+/* CPUID is only needed for compilers that allow intrinsics to be used without the matching code generation flags. */
+#if (defined(C89STR_X64) || defined(C89STR_X86)) && defined(_MSC_VER) && !defined(__clang__) && _MSC_VER >= 1500
+    #include <intrin.h>
+    static C89STR_INLINE void c89str_cpuid(int info[4], int fid)
+    {
+        __cpuidex(info, fid, 0);
+    }
+
+    #if _MSC_VER >= 1600 && (defined(_MSC_FULL_VER) && _MSC_FULL_VER >= 160040219)
+        static C89STR_INLINE unsigned __int64 c89str_xgetbv(int reg)
+        {
+            return _xgetbv(reg);
+        }
+    #else
+        #define C89STR_NO_XGETBV
+    #endif
 #else
-    int n = 1;
-    return (*(char*)&n) == 1;
+    #define C89STR_NO_CPUID
+    #define C89STR_NO_XGETBV
 #endif
-}
 
-static C89STR_INLINE c89str_bool32 c89str_is_big_endian(void)
+static C89STR_INLINE c89str_bool32 c89str_has_sse2(void)
 {
-    return !c89str_is_little_endian();
+#if defined(C89STR_SUPPORT_SSE2)
+    #if defined(C89STR_X64)
+        return C89STR_TRUE;    /* 64-bit targets always support SSE2. */
+    #elif (defined(_M_IX86_FP) && _M_IX86_FP == 2) || defined(__SSE2__)
+        return C89STR_TRUE;    /* If the compiler is allowed to freely generate SSE2 code we can assume support. */
+    #elif defined(C89STR_NO_CPUID)
+        return C89STR_FALSE;
+    #else
+        int info[4];
+        c89str_cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+    #endif
+#else
+    return C89STR_FALSE;       /* No compiler support. */
+#endif
 }
 
-static C89STR_INLINE unsigned short c89str_swap_endian_uint16(unsigned short n)
+static C89STR_INLINE c89str_bool32 c89str_has_avx2(void)
 {
-#ifdef C89STR_HAS_BYTESWAP16_INTRINSIC
-    #if defined(_MSC_VER)
-        return _byteswap_ushort(n);
-    #elif defined(__GNUC__) || defined(__clang__)
-        return __builtin_bswap16(n);
+#if defined(C89STR_SUPPORT_AVX2)
+    #if defined(__AVX2__)
+        return C89STR_TRUE;    /* If the compiler is allowed to freely generate AVX2 code we can assume support. */
+    #elif defined(C89STR_NO_CPUID) || defined(C89STR_NO_XGETBV)
+        return C89STR_FALSE;
     #else
-        #error "This compiler does not support the byte swap intrinsic."
+        int info1[4];
+        int info7[4];
+        c89str_cpuid(info1, 1);
+        if (((info1[2] & (1 << 27)) != 0) && ((info1[2] & (1 << 28)) != 0)) {   /* OSXSAVE and AVX. */
+            if ((c89str_xgetbv(0) & 0x06) == 0x06) {                          /* The OS must be saving the XMM and YMM registers. */
+                c89str_cpuid(info7, 7);
+                return (info7[1] & (1 << 5)) != 0;
+            }
+        }
+        return C89STR_FALSE;
     #endif
 #else
-    return ((n & 0xFF00) >> 8) |
-           ((n & 0x00FF) << 8);
+    return C89STR_FALSE;       /* No compiler support. */
 #endif
 }
 
-static C89STR_INLINE unsigned int c89str_swap_endian_uint32(unsigned int n)
+static C89STR_INLINE c89str_bool32 c89str_has_neon(void)
 {
-#ifdef C89STR_HAS_BYTESWAP32_INTRINSIC
-    #if defined(_MSC_VER)
-        return _byteswap_ulong(n);
-    #elif defined(__GNUC__) || defined(__clang__)
-        return __builtin_bswap32(n);
-    #else
-        #error "This compiler does not support the byte swap intrinsic."
-    #endif
+#if defined(C89STR_SUPPORT_NEON)
+    return C89STR_TRUE;        /* NEON support is always determined at compile time. */
 #else
-    return ((n & 0xFF000000) >> 24) |
-           ((n & 0x00FF0000) >>  8) |
-           ((n & 0x0000FF00) <<  8) |
-           ((n & 0x000000FF) << 24);
+    return C89STR_FALSE;
 #endif
 }
 
 
-static C89STR_INLINE unsigned short c89str_be2host_16(unsigned short n)
-{
-    if (c89str_is_little_endian()) {
-        return c89str_swap_endian_uint16(n);
-    }
+/*
+The hot paths select a SIMD implementation by looking at these flags. The CPU is only queried once and the result
+is cached. The cache is not atomic. Functions that start threads of their own fill it on the calling thread before
+any thread is created so the workers only ever read it.
+*/
+#define C89STR_SIMD_SSE2    0x01
+#define C89STR_SIMD_AVX2    0x02
+#define C89STR_SIMD_NEON    0x04
+#define C89STR_SIMD_UNKNOWN 0x80000000
 
-    return n;
-}
+static c89str_uint32 c89str_g_simdFlags = C89STR_SIMD_UNKNOWN;
 
-static C89STR_INLINE unsigned int c89str_be2host_32(unsigned int n)
+static c89str_uint32 c89str_get_simd_flags(void)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_swap_endian_uint32(n);
-    }
+    c89str_uint32 flags = c89str_g_simdFlags;
 
-    return n;
-}
+    if (flags == C89STR_SIMD_UNKNOWN) {
+        flags = 0;
 
-static C89STR_INLINE unsigned short c89str_le2host_16(unsigned short n)
-{
-    if (!c89str_is_little_endian()) {
-        return c89str_swap_endian_uint16(n);
+        if (c89str_has_sse2()) {
+            flags |= C89STR_SIMD_SSE2;
+        }
+        if (c89str_has_avx2()) {
+            flags |= C89STR_SIMD_AVX2;
+        }
+        if (c89str_has_neon()) {
+            flags |= C89STR_SIMD_NEON;
+        }
+
+        c89str_g_simdFlags = flags;
     }
 
-    return n;
+    return flags;
 }
 
-static C89STR_INLINE unsigned int c89str_le2host_32(unsigned int n)
-{
-    if (!c89str_is_little_endian()) {
-        return c89str_swap_endian_uint32(n);
-    }
 
-    return n;
-}
+/*
+Some of our scanning routines read an entire aligned block which may extend past the end of the string (but never
+past the page containing it). Address sanitizer needs to be told that this is intentional.
+*/
+#if defined(__clang__)
+    #if defined(__has_feature) && defined(__has_attribute)
+        #if __has_feature(address_sanitizer) && __has_attribute(__no_sanitize_address__)
+            #define C89STR_NO_SANITIZE_ADDRESS __attribute__((__no_sanitize_address__))
+        #endif
+    #endif
+#elif defined(__GNUC__) && (__GNUC__ >= 5 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+    #if defined(__SANITIZE_ADDRESS__) && __SANITIZE_ADDRESS__
+        #define C89STR_NO_SANITIZE_ADDRESS __attribute__((__no_sanitize_address__))
+    #endif
+#elif defined(_MSC_VER)
+    #if defined(__SANITIZE_ADDRESS__) && __SANITIZE_ADDRESS__
+        #define C89STR_NO_SANITIZE_ADDRESS __declspec(no_sanitize_address)
+    #endif
+#endif
+#ifndef C89STR_NO_SANITIZE_ADDRESS
+#define C89STR_NO_SANITIZE_ADDRESS
+#endif
 
 
-static C89STR_INLINE unsigned short c89str_host2be_16(unsigned short n)
+/* Returns the index of the lowest set bit. The input must not be zero. */
+static C89STR_INLINE unsigned int c89str_ctz32(c89str_uint32 x)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_swap_endian_uint16(n);
-    }
+    C89STR_ASSERT(x != 0);
 
-    return n;
+#if defined(_MSC_VER) && !defined(__clang__) && _MSC_VER >= 1400 && (defined(C89STR_X64) || defined(C89STR_X86))
+    {
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return (unsigned int)index;
+    }
+#elif defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_ctz(x);
+#else
+    {
+        unsigned int n = 0;
+        while ((x & 1) == 0) {
+            x >>= 1;
+            n  += 1;
+        }
+        return n;
+    }
+#endif
 }
 
-static C89STR_INLINE unsigned int c89str_host2be_32(unsigned int n)
+static C89STR_INLINE unsigned int c89str_ctz64(c89str_uint64 x)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_swap_endian_uint32(n);
-    }
+    C89STR_ASSERT(x != 0);
 
-    return n;
+    if ((x & 0xFFFFFFFF) != 0) {
+        return c89str_ctz32((c89str_uint32)(x & 0xFFFFFFFF));
+    } else {
+        return c89str_ctz32((c89str_uint32)(x >> 32)) + 32;
+    }
 }
 
-static C89STR_INLINE unsigned short c89str_host2le_16(unsigned short n)
+/* Returns the index of the highest set bit. The input must not be zero. */
+static C89STR_INLINE unsigned int c89str_bsr32(c89str_uint32 x)
 {
-    if (!c89str_is_little_endian()) {
-        return c89str_swap_endian_uint16(n);
-    }
+    C89STR_ASSERT(x != 0);
 
-    return n;
+#if defined(_MSC_VER) && !defined(__clang__) && _MSC_VER >= 1400 && (defined(C89STR_X64) || defined(C89STR_X86))
+    {
+        unsigned long index;
+        _BitScanReverse(&index, x);
+        return (unsigned int)index;
+    }
+#elif defined(__GNUC__) || defined(__clang__)
+    return 31 - (unsigned int)__builtin_clz(x);
+#else
+    {
+        unsigned int n = 0;
+        while ((x >>= 1) != 0) {
+            n += 1;
+        }
+        return n;
+    }
+#endif
 }
 
-static C89STR_INLINE unsigned int c89str_host2le_32(unsigned int n)
+static C89STR_INLINE unsigned int c89str_bsr64(c89str_uint64 x)
 {
-    if (!c89str_is_little_endian()) {
-        return c89str_swap_endian_uint32(n);
-    }
+    C89STR_ASSERT(x != 0);
 
-    return n;
+    if ((x >> 32) != 0) {
+        return c89str_bsr32((c89str_uint32)(x >> 32)) + 32;
+    } else {
+        return c89str_bsr32((c89str_uint32)(x & 0xFFFFFFFF));
+    }
+}
+
+static C89STR_INLINE unsigned int c89str_popcount32(c89str_uint32 x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_popcount(x);
+#else
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (unsigned int)((x * 0x01010101) >> 24);
+#endif
+}
+
+
+/*
+SWAR (SIMD Within A Register) helpers. These work on size_t sized words so they'll do 4 or 8 bytes at a time depending
+on the platform. The constants are built from (size_t)-1 so we don't need 64-bit literals which C89 does not have.
+*/
+#define C89STR_SWAR_ONES    ((size_t)-1 / 0xFF)             /* 0x0101...01 */
+#define C89STR_SWAR_HIGHS   (C89STR_SWAR_ONES * 0x80)       /* 0x8080...80 */
+
+/*
+Loads a word from string data. Reading chars through a size_t pointer breaks the strict aliasing rules so GCC and Clang
+get a type that is allowed to alias anything, and with an alignment of 1 so that unaligned loads are well defined.
+Everything else goes through a memcpy() which compilers turn into a single load anyway.
+*/
+#if defined(__GNUC__)
+typedef size_t __attribute__((__may_alias__, __aligned__(1))) c89str_swar_word;
+
+static C89STR_INLINE size_t c89str_swar_load(const char* p)
+{
+    return *(const c89str_swar_word*)p;
+}
+#else
+static C89STR_INLINE size_t c89str_swar_load(const char* p)
+{
+    size_t word;
+    C89STR_COPY_MEMORY(&word, p, sizeof(word));
+    return word;
+}
+#endif
+
+static C89STR_INLINE c89str_bool32 c89str_swar_has_zero(size_t word)
+{
+    return ((word - C89STR_SWAR_ONES) & ~word & C89STR_SWAR_HIGHS) != 0;
+}
+
+static C89STR_INLINE c89str_bool32 c89str_swar_has_byte(size_t word, unsigned char c)
+{
+    return c89str_swar_has_zero(word ^ (C89STR_SWAR_ONES * c));
+}
+
+#if defined(C89STR_SUPPORT_NEON)
+/* NEON does not have a movemask instruction. This narrows a byte mask into a 64-bit mask with 4 bits per byte. */
+static C89STR_INLINE c89str_uint64 c89str_neon_movemask_u8x16(uint8x16_t mask)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+}
+
+#if defined(C89STR_SUPPORT_NEON_TBL)
+/* Like the above, but with 1 bit per byte like _mm_movemask_epi8(). This relies on horizontal adds which need AArch64. */
+static C89STR_INLINE c89str_uint32 c89str_neon_bitmask_u8x16(uint8x16_t mask)
+{
+    static const c89str_uint8 weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(mask, vld1q_u8(weights));
+    return (c89str_uint32)vaddv_u8(vget_low_u8(bits)) | ((c89str_uint32)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+#endif
+#endif
+/* END c89str_simd.h */
+
+
+static C89STR_INLINE c89str_bool32 c89str_is_little_endian(void)
+{
+#if defined(C89STR_X86) || defined(C89STR_X64)
+    return C89STR_TRUE;
+#elif defined(__BYTE_ORDER) && defined(__LITTLE_ENDIAN) && __BYTE_ORDER == __LITTLE_ENDIAN
+    return C89STR_TRUE;
+#else
+    int n = 1;
+    return (*(char*)&n) == 1;
+#endif
+}
+
+static C89STR_INLINE c89str_bool32 c89str_is_big_endian(void)
+{
+    return !c89str_is_little_endian();
+}
+
+static C89STR_INLINE unsigned short c89str_swap_endian_uint16(unsigned short n)
+{
+#ifdef C89STR_HAS_BYTESWAP16_INTRINSIC
+    #if defined(_MSC_VER)
+        return _byteswap_ushort(n);
+    #elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap16(n);
+    #else
+        #error "This compiler does not support the byte swap intrinsic."
+    #endif
+#else
+    return ((n & 0xFF00) >> 8) |
+           ((n & 0x00FF) << 8);
+#endif
+}
+
+static C89STR_INLINE unsigned int c89str_swap_endian_uint32(unsigned int n)
+{
+#ifdef C89STR_HAS_BYTESWAP32_INTRINSIC
+    #if defined(_MSC_VER)
+        return _byteswap_ulong(n);
+    #elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap32(n);
+    #else
+        #error "This compiler does not support the byte swap intrinsic."
+    #endif
+#else
+    return ((n & 0xFF000000) >> 24) |
+           ((n & 0x00FF0000) >>  8) |
+           ((n & 0x0000FF00) <<  8) |
+           ((n & 0x000000FF) << 24);
+#endif
+}
+
+
+static C89STR_INLINE unsigned short c89str_be2host_16(unsigned short n)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_swap_endian_uint16(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned int c89str_be2host_32(unsigned int n)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_swap_endian_uint32(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned short c89str_le2host_16(unsigned short n)
+{
+    if (!c89str_is_little_endian()) {
+        return c89str_swap_endian_uint16(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned int c89str_le2host_32(unsigned int n)
+{
+    if (!c89str_is_little_endian()) {
+        return c89str_swap_endian_uint32(n);
+    }
+
+    return n;
+}
+
+
+static C89STR_INLINE unsigned short c89str_host2be_16(unsigned short n)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_swap_endian_uint16(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned int c89str_host2be_32(unsigned int n)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_swap_endian_uint32(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned short c89str_host2le_16(unsigned short n)
+{
+    if (!c89str_is_little_endian()) {
+        return c89str_swap_endian_uint16(n);
+    }
+
+    return n;
+}
+
+static C89STR_INLINE unsigned int c89str_host2le_32(unsigned int n)
+{
+    if (!c89str_is_little_endian()) {
+        return c89str_swap_endian_uint32(n);
+    }
+
+    return n;
 }
 
 
@@ -694,729 +1424,827 @@ C89STR_API void c89str_free(void* p, const c89str_allocation_callbacks* pAllocat
 
 
 
-/* BEG c89str_stdlib.c */
-C89STR_API size_t c89str_strlen(const char* src)
+/* BEG c89str_arena.c */
+#ifndef C89STR_ARENA_DEFAULT_BLOCK_SIZE
+#define C89STR_ARENA_DEFAULT_BLOCK_SIZE 65536
+#endif
+
+#ifndef C89STR_ARENA_ALIGNMENT
+#define C89STR_ARENA_ALIGNMENT          (sizeof(void*) * 2)     /* Must be a power of two. */
+#endif
+
+struct c89str_arena_block
 {
-    const char* end;
+    c89str_arena_block* pNext;
+    size_t cap;                         /* The size of the data which sits just after the header. */
+};
 
-    C89STR_ASSERT(src != NULL);
-    
-    end = src;
-    while (end[0] != '\0') {
-        end += 1;
-    }
+#define C89STR_ARENA_ALIGN(sz)          (((sz) + (C89STR_ARENA_ALIGNMENT - 1)) & ~(C89STR_ARENA_ALIGNMENT - 1))
+#define C89STR_ARENA_BLOCK_HEADER_SIZE  C89STR_ARENA_ALIGN(sizeof(c89str_arena_block))
 
-    return end - src;
+static C89STR_INLINE char* c89str_arena_block_data(c89str_arena_block* pBlock)
+{
+    return (char*)pBlock + C89STR_ARENA_BLOCK_HEADER_SIZE;
 }
 
-C89STR_API char* c89str_strcpy(char* dst, const char* src)
+C89STR_API errno_t c89str_arena_init(c89str_arena* pArena, size_t blockSize, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    char* dstorig;
+    if (pArena == NULL) {
+        return EINVAL;
+    }
 
-    C89STR_ASSERT(dst != NULL);
-    C89STR_ASSERT(src != NULL);
+    C89STR_ZERO_OBJECT(pArena);
 
-    dstorig = dst;
+    if (pAllocationCallbacks != NULL) {
+        pArena->allocationCallbacks = *pAllocationCallbacks;
+    } else {
+        pArena->allocationCallbacks.pUserData = NULL;
+        pArena->allocationCallbacks.onMalloc  = c89str_malloc_default;
+        pArena->allocationCallbacks.onRealloc = c89str_realloc_default;
+        pArena->allocationCallbacks.onFree    = c89str_free_default;
+    }
 
-    /* No, we're not using this garbage: while (*dst++ = *src++); */
-    for (;;) {
-        *dst = *src;
-        if (*src == '\0') {
-            break;
-        }
+    if (blockSize == 0) {
+        blockSize = C89STR_ARENA_DEFAULT_BLOCK_SIZE;
+    }
 
-        dst += 1;
-        src += 1;
+    if (blockSize > (size_t)-1 - C89STR_ARENA_BLOCK_HEADER_SIZE - C89STR_ARENA_ALIGNMENT) {
+        return EINVAL;
     }
 
-    return dstorig;
+    pArena->blockSize  = C89STR_ARENA_ALIGN(blockSize);
+    pArena->lastOffset = c89str_npos;
+
+    return C89STR_SUCCESS;
 }
 
-C89STR_API int c89str_strncpy(char* dst, const char* src, size_t count)
+C89STR_API errno_t c89str_arena_init_with_buffer(c89str_arena* pArena, void* pBuffer, size_t bufferSizeInBytes, size_t blockSize, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    size_t maxcount;
-    size_t i;
+    errno_t result;
+    size_t misalignment;
 
-    if (dst == 0) {
-        return EINVAL;
+    result = c89str_arena_init(pArena, blockSize, pAllocationCallbacks);
+    if (result != C89STR_SUCCESS) {
+        return result;
     }
-    if (src == 0) {
-        dst[0] = '\0';
+
+    if (pBuffer == NULL) {
         return EINVAL;
     }
 
-    maxcount = count;
-
-    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
-        dst[i] = src[i];
+    /* The block header needs to be aligned, which might mean skipping a few bytes at the start of the buffer. */
+    misalignment = (size_t)((c89str_uintptr)pBuffer & (C89STR_ARENA_ALIGNMENT - 1));
+    if (misalignment != 0) {
+        misalignment = C89STR_ARENA_ALIGNMENT - misalignment;
     }
 
-    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
-        dst[i] = '\0';
-        return 0;
+    if (bufferSizeInBytes < misalignment + C89STR_ARENA_BLOCK_HEADER_SIZE + C89STR_ARENA_ALIGNMENT) {
+        return EINVAL;  /* Too small to be useful. */
     }
 
-    dst[0] = '\0';
-    return ERANGE;
+    pArena->pUserBlock = (c89str_arena_block*)((char*)pBuffer + misalignment);
+    pArena->pUserBlock->pNext = NULL;
+    pArena->pUserBlock->cap   = (bufferSizeInBytes - misalignment - C89STR_ARENA_BLOCK_HEADER_SIZE) & ~(C89STR_ARENA_ALIGNMENT - 1);
+    pArena->pFirstBlock = pArena->pUserBlock;
+
+    return C89STR_SUCCESS;
 }
 
-C89STR_API int c89str_strcpy_s(char* dst, size_t dstCap, const char* src)
+C89STR_API void c89str_arena_uninit(c89str_arena* pArena)
 {
-    size_t i;
+    c89str_arena_block* pBlock;
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return ERANGE;
-    }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
+    if (pArena == NULL) {
+        return;
     }
 
-    for (i = 0; i < dstCap && src[i] != '\0'; ++i) {
-        dst[i] = src[i];
-    }
+    pBlock = pArena->pFirstBlock;
+    while (pBlock != NULL) {
+        c89str_arena_block* pNext = pBlock->pNext;
 
-    if (i < dstCap) {
-        dst[i] = '\0';
-        return 0;
+        if (pBlock != pArena->pUserBlock) {
+            c89str_free(pBlock, &pArena->allocationCallbacks);
+        }
+
+        pBlock = pNext;
     }
 
-    dst[0] = '\0';
-    return ERANGE;
+    C89STR_ZERO_OBJECT(pArena);
 }
 
-C89STR_API int c89str_strncpy_s(char* dst, size_t dstCap, const char* src, size_t count)
+C89STR_API void* c89str_arena_malloc(c89str_arena* pArena, size_t sz)
 {
-    size_t maxcount;
-    size_t i;
+    c89str_arena_block* pBlock;
+    char* p;
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return EINVAL;
-    }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
+    if (pArena == NULL || sz > (size_t)-1 - C89STR_ARENA_BLOCK_HEADER_SIZE - C89STR_ARENA_ALIGNMENT) {
+        return NULL;
     }
 
-    maxcount = count;
-    if (count == ((size_t)-1) || count >= dstCap) {        /* -1 = _TRUNCATE */
-        maxcount = dstCap - 1;
-    }
+    sz = C89STR_ARENA_ALIGN(sz);
 
-    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
-        dst[i] = src[i];
-    }
+    if (pArena->pCurrentBlock == NULL || pArena->pCurrentBlock->cap - pArena->offset < sz) {
+        /*
+        Not enough room in the current block. Blocks after the current one are left over from before a reset or rewind
+        and are free, so look for one that's big enough before going to the heap. Whichever block we end up with is put
+        straight after the current one so that everything after the current block is always unused.
+        */
+        c89str_arena_block** ppLink = (pArena->pCurrentBlock == NULL) ? &pArena->pFirstBlock : &pArena->pCurrentBlock->pNext;
+        c89str_arena_block** ppFound = ppLink;
 
-    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
-        dst[i] = '\0';
-        return 0;
+        while (*ppFound != NULL && (*ppFound)->cap < sz) {
+            ppFound = &(*ppFound)->pNext;
+        }
+
+        if (*ppFound != NULL) {
+            pBlock = *ppFound;
+            *ppFound = pBlock->pNext;
+        } else {
+            size_t cap = C89STR_MAX(pArena->blockSize, sz);
+
+            pBlock = (c89str_arena_block*)c89str_malloc(C89STR_ARENA_BLOCK_HEADER_SIZE + cap, &pArena->allocationCallbacks);
+            if (pBlock == NULL) {
+                return NULL;
+            }
+
+            pBlock->cap = cap;
+        }
+
+        pBlock->pNext = *ppLink;
+        *ppLink = pBlock;
+
+        pArena->pCurrentBlock = pBlock;
+        pArena->offset = 0;
     }
 
-    dst[0] = '\0';
-    return ERANGE;
+    p = c89str_arena_block_data(pArena->pCurrentBlock) + pArena->offset;
+    pArena->lastOffset = pArena->offset;
+    pArena->offset    += sz;
+
+    return p;
 }
 
-C89STR_API int c89str_strcat_s(char* dst, size_t dstCap, const char* src)
+C89STR_API void* c89str_arena_realloc(c89str_arena* pArena, void* p, size_t sz)
 {
-    char* dstorig;
+    c89str_arena_block* pBlock;
+    size_t oldSize;
+    void* pNew;
 
-    if (dst == 0) {
-        return EINVAL;
+    if (pArena == NULL) {
+        return NULL;
     }
-    if (dstCap == 0) {
-        return ERANGE;
+
+    if (p == NULL) {
+        return c89str_arena_malloc(pArena, sz);
     }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
+
+    if (sz > (size_t)-1 - C89STR_ARENA_BLOCK_HEADER_SIZE - C89STR_ARENA_ALIGNMENT) {
+        return NULL;
     }
 
-    dstorig = dst;
+    /* The most recent allocation can be resized in place so long as it still fits in the block. */
+    if (pArena->pCurrentBlock != NULL && pArena->lastOffset != c89str_npos && (char*)p == c89str_arena_block_data(pArena->pCurrentBlock) + pArena->lastOffset) {
+        if (pArena->pCurrentBlock->cap - pArena->lastOffset >= C89STR_ARENA_ALIGN(sz)) {
+            pArena->offset = pArena->lastOffset + C89STR_ARENA_ALIGN(sz);
+            return p;
+        }
 
-    while (dstCap > 0 && dst[0] != '\0') {
-        dst    += 1;
-        dstCap -= 1;
-    }
+        oldSize = pArena->offset - pArena->lastOffset;
+    } else {
+        /*
+        We don't track the size of each allocation, but we know it can't go past the used part of the block it's in.
+        Copying up to there might pick up some of the allocations after it, but that ends up in the part of the new
+        allocation past the old size which has undefined content anyway.
+        */
+        oldSize = 0;
+        for (pBlock = pArena->pFirstBlock; pBlock != NULL; pBlock = pBlock->pNext) {
+            c89str_uintptr data = (c89str_uintptr)c89str_arena_block_data(pBlock);
+            size_t used = (pBlock == pArena->pCurrentBlock) ? pArena->offset : pBlock->cap;
 
-    if (dstCap == 0) {
-        return EINVAL;  /* Unterminated. */
-    }
+            if ((c89str_uintptr)p >= data && (c89str_uintptr)p < data + used) {
+                oldSize = (size_t)(data + used - (c89str_uintptr)p);
+                break;
+            }
+        }
 
-    while (dstCap > 0 && src[0] != '\0') {
-        *dst++ = *src++;
-        dstCap -= 1;
+        C89STR_ASSERT(pBlock != NULL);  /* Not allocated from this arena. */
     }
 
-    if (dstCap > 0) {
-        dst[0] = '\0';
-    } else {
-        dstorig[0] = '\0';
-        return ERANGE;
+    pNew = c89str_arena_malloc(pArena, sz);
+    if (pNew == NULL) {
+        return NULL;
     }
 
-    return 0;
+    C89STR_COPY_MEMORY(pNew, p, C89STR_MIN(oldSize, sz));
+
+    return pNew;
 }
 
-C89STR_API int c89str_strncat_s(char* dst, size_t dstCap, const char* src, size_t count)
+C89STR_API void c89str_arena_free(c89str_arena* pArena, void* p)
 {
-    char* dstorig;
-
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return ERANGE;
-    }
-    if (src == 0) {
-        return EINVAL;
+    if (pArena == NULL || p == NULL) {
+        return;
     }
 
-    dstorig = dst;
-
-    while (dstCap > 0 && dst[0] != '\0') {
-        dst    += 1;
-        dstCap -= 1;
+    /* Only the most recent allocation can be given back. Everything else stays until the arena is reset. */
+    if (pArena->pCurrentBlock != NULL && pArena->lastOffset != c89str_npos && (char*)p == c89str_arena_block_data(pArena->pCurrentBlock) + pArena->lastOffset) {
+        pArena->offset     = pArena->lastOffset;
+        pArena->lastOffset = c89str_npos;
     }
+}
 
-    if (dstCap == 0) {
-        return EINVAL;  /* Unterminated. */
+C89STR_API void c89str_arena_reset(c89str_arena* pArena)
+{
+    if (pArena == NULL) {
+        return;
     }
 
-    if (count == ((size_t)-1)) {        /* _TRUNCATE */
-        count = dstCap - 1;
-    }
+    pArena->pCurrentBlock = NULL;
+    pArena->offset        = 0;
+    pArena->lastOffset    = c89str_npos;
+}
 
-    while (dstCap > 0 && src[0] != '\0' && count > 0) {
-        *dst++ = *src++;
-        dstCap -= 1;
-        count  -= 1;
-    }
+C89STR_API c89str_arena_mark c89str_arena_get_mark(const c89str_arena* pArena)
+{
+    c89str_arena_mark mark;
 
-    if (dstCap > 0) {
-        dst[0] = '\0';
-    } else {
-        dstorig[0] = '\0';
-        return ERANGE;
+    mark.pBlock = NULL;
+    mark.offset = 0;
+
+    if (pArena != NULL) {
+        mark.pBlock = pArena->pCurrentBlock;
+        mark.offset = pArena->offset;
     }
 
-    return 0;
+    return mark;
 }
 
-C89STR_API int c89str_itoa_s(int value, char* dst, size_t dstCap, int radix)
+C89STR_API void c89str_arena_rewind(c89str_arena* pArena, c89str_arena_mark mark)
 {
-    int sign;
-    unsigned int valueU;
-    char* dstEnd;
-
-    if (dst == NULL || dstCap == 0) {
-        return EINVAL;
-    }
-    if (radix < 2 || radix > 36) {
-        dst[0] = '\0';
-        return EINVAL;
+    if (pArena == NULL) {
+        return;
     }
 
-    sign = (value < 0 && radix == 10) ? -1 : 1;     /* The negative sign is only used when the base is 10. */
+    /* Blocks are only ever added after the current one so everything after the mark's block is newer than the mark. */
+    pArena->pCurrentBlock = mark.pBlock;
+    pArena->offset        = mark.offset;
+    pArena->lastOffset    = c89str_npos;
+}
 
-    if (value < 0) {
-        valueU = -value;
-    } else {
-        valueU = value;
-    }
+static void* c89str_arena_on_malloc(size_t sz, void* pUserData)
+{
+    return c89str_arena_malloc((c89str_arena*)pUserData, sz);
+}
 
-    dstEnd = dst;
-    do
-    {
-        int remainder = valueU % radix;
-        if (remainder > 9) {
-            *dstEnd = (char)((remainder - 10) + 'a');
-        } else {
-            *dstEnd = (char)(remainder + '0');
-        }
+static void* c89str_arena_on_realloc(void* p, size_t sz, void* pUserData)
+{
+    return c89str_arena_realloc((c89str_arena*)pUserData, p, sz);
+}
 
-        dstEnd += 1;
-        dstCap -= 1;
-        valueU /= radix;
-    } while (dstCap > 0 && valueU > 0);
+static void c89str_arena_on_free(void* p, void* pUserData)
+{
+    c89str_arena_free((c89str_arena*)pUserData, p);
+}
 
-    if (dstCap == 0) {
-        dst[0] = '\0';
-        return EINVAL;  /* Ran out of room in the output buffer. */
-    }
+C89STR_API c89str_allocation_callbacks c89str_arena_allocation_callbacks(c89str_arena* pArena)
+{
+    c89str_allocation_callbacks allocationCallbacks;
 
-    if (sign < 0) {
-        *dstEnd++ = '-';
-        dstCap -= 1;
-    }
+    allocationCallbacks.pUserData = pArena;
+    allocationCallbacks.onMalloc  = c89str_arena_on_malloc;
+    allocationCallbacks.onRealloc = c89str_arena_on_realloc;
+    allocationCallbacks.onFree    = c89str_arena_on_free;
 
-    if (dstCap == 0) {
-        dst[0] = '\0';
-        return EINVAL;  /* Ran out of room in the output buffer. */
-    }
+    return allocationCallbacks;
+}
+/* END c89str_arena.c */
 
-    *dstEnd = '\0';
 
 
-    /* At this point the string will be reversed. */
-    dstEnd -= 1;
-    while (dst < dstEnd) {
-        char temp = *dst;
-        *dst = *dstEnd;
-        *dstEnd = temp;
+/* BEG c89str_threading.c */
+#if !defined(C89STR_NO_THREADING)
+    #if defined(_WIN32)
+        #include <windows.h>
+        #define C89STR_THREADING_WIN32
+    #elif defined(__unix__) || defined(__unix) || defined(__APPLE__)
+        #include <pthread.h>
+        #include <unistd.h>
+        #define C89STR_THREADING_POSIX
+    #endif
+#endif
 
-        dst += 1;
-        dstEnd -= 1;
-    }
+typedef void (* c89str_job_proc)(void* pJob);
+
+typedef struct
+{
+    c89str_job_proc proc;
+    void* pJob;
+#if defined(C89STR_THREADING_WIN32)
+    HANDLE hThread;
+#elif defined(C89STR_THREADING_POSIX)
+    pthread_t thread;
+#endif
+    c89str_bool32 isRunning;
+} c89str_thread;
 
+#if defined(C89STR_THREADING_WIN32)
+static DWORD WINAPI c89str_thread_entry(LPVOID pData)
+{
+    c89str_thread* pThread = (c89str_thread*)pData;
+    pThread->proc(pThread->pJob);
     return 0;
 }
+#elif defined(C89STR_THREADING_POSIX)
+static void* c89str_thread_entry(void* pData)
+{
+    c89str_thread* pThread = (c89str_thread*)pData;
+    pThread->proc(pThread->pJob);
+    return NULL;
+}
+#endif
 
-C89STR_API int c89str_strcmp(const char* str1, const char* str2)
+static size_t c89str_get_processor_count(void)
 {
-    if (str1 == str2) return  0;
+#if defined(C89STR_THREADING_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (size_t)info.dwNumberOfProcessors : 1;
+#elif defined(C89STR_THREADING_POSIX) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (size_t)count : 1;
+#else
+    return 1;
+#endif
+}
 
-    /* These checks differ from the standard implementation. It's not important, but I prefer it just for sanity. */
-    if (str1 == NULL) return -1;
-    if (str2 == NULL) return  1;
+/*
+Runs each job on its own thread and waits for all of them to finish. The calling thread runs the first job itself. If
+a thread can't be created, or threading isn't available, the job is run on the calling thread instead which means this
+never fails. The allocation callbacks are only used from the calling thread.
+*/
+static void c89str_run_jobs(c89str_job_proc proc, void* pJobs, size_t jobSize, size_t jobCount, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t iJob;
+
+#if defined(C89STR_THREADING_WIN32) || defined(C89STR_THREADING_POSIX)
+    if (jobCount > 1) {
+        c89str_thread* pThreads;
+
+        /* The SIMD flags are cached in a plain global. Fill the cache before any threads start so they only ever read it. */
+        c89str_get_simd_flags();
+
+        pThreads = (c89str_thread*)c89str_malloc(sizeof(*pThreads) * jobCount, pAllocationCallbacks);
+        if (pThreads != NULL) {
+            for (iJob = 1; iJob < jobCount; iJob += 1) {
+                pThreads[iJob].proc = proc;
+                pThreads[iJob].pJob = (char*)pJobs + (iJob * jobSize);
+            #if defined(C89STR_THREADING_WIN32)
+                pThreads[iJob].hThread   = CreateThread(NULL, 0, c89str_thread_entry, &pThreads[iJob], 0, NULL);
+                pThreads[iJob].isRunning = (pThreads[iJob].hThread != NULL);
+            #else
+                pThreads[iJob].isRunning = (pthread_create(&pThreads[iJob].thread, NULL, c89str_thread_entry, &pThreads[iJob]) == 0);
+            #endif
+            }
 
-    for (;;) {
-        if (str1[0] == '\0') {
-            break;
+            proc(pJobs);
+
+            for (iJob = 1; iJob < jobCount; iJob += 1) {
+                if (pThreads[iJob].isRunning) {
+                #if defined(C89STR_THREADING_WIN32)
+                    WaitForSingleObject(pThreads[iJob].hThread, INFINITE);
+                    CloseHandle(pThreads[iJob].hThread);
+                #else
+                    pthread_join(pThreads[iJob].thread, NULL);
+                #endif
+                } else {
+                    proc(pThreads[iJob].pJob);
+                }
+            }
+
+            c89str_free(pThreads, pAllocationCallbacks);
+            return;
         }
+    }
+#else
+    C89STR_UNUSED(pAllocationCallbacks);
+#endif
 
-        if (str1[0] != str2[0]) {
-            break;
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        proc((char*)pJobs + (iJob * jobSize));
+    }
+}
+/* END c89str_threading.c */
+
+
+
+/* BEG c89str_stdlib.c */
+/*
+The strlen() implementations below read whole aligned blocks. An aligned block never straddles a page boundary so
+it's safe to read bytes beyond the null terminator (and before the start of the string) so long as they're within
+the same block. Bytes before the start of the string are masked out.
+*/
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_strlen__swar(const char* src)
+{
+    const char* end = src;
+
+    /* Head. Go byte-by-byte until we're aligned. */
+    while (((c89str_uintptr)end & (sizeof(size_t) - 1)) != 0) {
+        if (end[0] == '\0') {
+            return end - src;
         }
+        end += 1;
+    }
 
-        str1 += 1;
-        str2 += 1;
+    /* Body. A word at a time until we find one with a zero byte. */
+    while (!c89str_swar_has_zero(c89str_swar_load(end))) {
+        end += sizeof(size_t);
     }
 
-    return ((unsigned char*)str1)[0] - ((unsigned char*)str2)[0];
+    /* Tail. The null terminator is somewhere in this word. */
+    while (end[0] != '\0') {
+        end += 1;
+    }
+
+    return end - src;
 }
 
-C89STR_API int c89str_strncmp(const char* str1, const char* str2, size_t maxLen)
+#if defined(C89STR_SUPPORT_SSE2)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_strlen__sse2(const char* src)
 {
-    if (str1 == str2) return  0;
+    const __m128i zero = _mm_setzero_si128();
+    const char* pBlock;
+    unsigned int misalignment;
+    unsigned int mask;
 
-    /* These checks differ from the standard implementation. It's not important, but I prefer it just for sanity. */
-    if (str1 == NULL) return -1;
-    if (str2 == NULL) return  1;
+    misalignment = (unsigned int)((c89str_uintptr)src & 15);
+    pBlock = src - misalignment;
+
+    mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)pBlock), zero)) >> misalignment;
+    if (mask != 0) {
+        return c89str_ctz32(mask);
+    }
 
-    /* This function still needs to check for null terminators even though the length has been specified. */
     for (;;) {
-        if (maxLen == 0) {
-            break;
-        }
+        pBlock += 16;
 
-        if (str1[0] == '\0') {
-            break;
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)pBlock), zero));
+        if (mask != 0) {
+            return (pBlock - src) + c89str_ctz32(mask);
         }
+    }
+}
+#endif
 
-        if (str1[0] != str2[0]) {
-            break;
-        }
+#if defined(C89STR_SUPPORT_AVX2)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_strlen__avx2(const char* src)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const char* pBlock;
+    unsigned int misalignment;
+    c89str_uint32 mask;
 
-        str1 += 1;
-        str2 += 1;
-        maxLen -= 1;
-    }
+    misalignment = (unsigned int)((c89str_uintptr)src & 31);
+    pBlock = src - misalignment;
 
-    if (maxLen == 0) {
-        return 0;
+    mask = (c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)pBlock), zero)) >> misalignment;
+    if (mask != 0) {
+        return c89str_ctz32(mask);
     }
 
-    return ((unsigned char*)str1)[0] - ((unsigned char*)str2)[0];
+    for (;;) {
+        pBlock += 32;
+
+        mask = (c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)pBlock), zero));
+        if (mask != 0) {
+            return (pBlock - src) + c89str_ctz32(mask);
+        }
+    }
 }
+#endif
 
-C89STR_API int c89str_stricmp_ascii(const char* str1, const char* str2)
+#if defined(C89STR_SUPPORT_NEON)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_strlen__neon(const char* src)
 {
-    if (str1 == NULL || str2 == NULL) {
-        return 0;
-    }
+    const char* pBlock;
+    unsigned int misalignment;
+    c89str_uint64 mask;
 
-    while (*str1 != '\0' && *str2 != '\0') {
-        int c1 = (int)*str1;
-        int c2 = (int)*str2;
-    
-        if (c1 >= 'A' && c1 <= 'Z') {
-            c1 += 'a' - 'A';
-        }
-        if (c2 >= 'A' && c2 <= 'Z') {
-            c2 += 'a' - 'A';
-        }
-    
-        if (c1 != c2) {
-            return c1 - c2;
-        }
-    
-        str1 += 1;
-        str2 += 1;
-    }
+    misalignment = (unsigned int)((c89str_uintptr)src & 15);
+    pBlock = src - misalignment;
 
-    if (*str1 == '\0' && *str2 == '\0') {
-        return 0;
-    } else if (*str1 == '\0') {
-        return -1;
-    } else {
-        return 1;
+    mask = c89str_neon_movemask_u8x16(vceqq_u8(vld1q_u8((const c89str_uint8*)pBlock), vdupq_n_u8(0))) >> (misalignment * 4);
+    if (mask != 0) {
+        return c89str_ctz64(mask) / 4;
     }
-}
 
-C89STR_API int c89str_strnicmp_ascii(const char* str1, const char* str2, size_t count)
-{
-    if (str1 == NULL || str2 == NULL) {
-        return 0;
-    }
+    for (;;) {
+        pBlock += 16;
 
-    while (*str1 != '\0' && *str2 != '\0' && count > 0) {
-        int c1 = (int)*str1;
-        int c2 = (int)*str2;
-    
-        if (c1 >= 'A' && c1 <= 'Z') {
-            c1 += 'a' - 'A';
-        }
-        if (c2 >= 'A' && c2 <= 'Z') {
-            c2 += 'a' - 'A';
+        mask = c89str_neon_movemask_u8x16(vceqq_u8(vld1q_u8((const c89str_uint8*)pBlock), vdupq_n_u8(0)));
+        if (mask != 0) {
+            return (pBlock - src) + (c89str_ctz64(mask) / 4);
         }
-       
-        if (c1 != c2) {
-            return c1 - c2;
-        }
-       
-        str1  += 1;
-        str2  += 1;
-        count -= 1;
-    }
-
-    if (count == 0) {
-        return 0;
-    } else if (*str1 == '\0' && *str2 == '\0') {
-        return 0;
-    } else if (*str1 == '\0') {
-        return -1;
-    } else {
-        return 1;
     }
 }
-
-C89STR_API int c89str_stricmp(const char* str1, const char* str2)
-{
-    /* We will use the standard implementations of stricmp() and strcasecmp() if they are available. */
-#if defined(_MSC_VER) && _MSC_VER >= 1400
-    return _stricmp(str1, str2);
-#elif defined(__GNUC__) && defined(__USE_GNU)
-    return strcasecmp(str1, str2);
-#else
-    /* It would be good if we could use a custom implementation based on the Unicode standard here. Would require a lot of work to get that right, however. */
-    return c89str_stricmp_ascii(str1, str2);
 #endif
-}
 
-C89STR_API int c89str_strnicmp(const char* str1, const char* str2, size_t count)
+C89STR_API size_t c89str_strlen(const char* src)
 {
-    /* We will use the standard implementations of strnicmp() and strncasecmp() if they are available. */
-#if defined(_MSC_VER) && _MSC_VER >= 1400
-    return _strnicmp(str1, str2, count);
-#elif defined(__GNUC__) && defined(__USE_GNU)
-    return strncasecmp(str1, str2, count);
-#else
-    /* It would be good if we could use a custom implementation based on the Unicode standard here. Would require a lot of work to get that right, however. */
-    return c89str_strnicmp_ascii(str1, str2, count);
-#endif
-}
-/* END c89str_stdlib.c */
+    c89str_uint32 simdFlags;
 
+    C89STR_ASSERT(src != NULL);
 
-/* BEG c89str_helpers.c */
-static C89STR_INLINE size_t c89str_scan_leading_whitespace(const char* str, size_t len)
-{
-    size_t i;
+    simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);   /* Will be unused when no SIMD is supported. */
 
-    if (str == NULL || len == 0) {
-        return C89STR_FALSE;
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_strlen__avx2(src);
     }
-
-    i = 0;
-    while (str[i] != '\0' && i < len) {
-        unsigned char c0 = (unsigned char)str[i];
-
-        if ((c0 >= 0x09 && c0 <= 0x0D) || c0 == 0x20) {
-            i += 1;
-            break;
-        }
-
-        if (i + 1 < len) {
-            unsigned char c1 = (unsigned char)str[i + 1];
-
-            if (c0 == 0xC2) {
-                if (c1 == 0x85 || c1 == 0xA0) {
-                    i += 2;
-                    break;   /* 0x0085, 0x00A0 */
-                }
-            }
-
-            if (i + 2 < len) {
-                unsigned char c2 = (unsigned char)str[i + 2];
-
-                if (c0 == 0xE1) {
-                    if (c1 == 0x9A) {
-                        if (c2 == 0x80) {
-                            i += 3;
-                            break;   /* 0x1680 */
-                        }
-                    }
-                }
-
-                if (c0 == 0xE2) {
-                    if (c1 == 0x80) {
-                        if (c2 >= 0x80 && c2 <= 0x8A) {
-                            i += 3;
-                            break;   /* 0x2000 - 0x200A */
-                        }
-
-                        if (c2 == 0xA8 || c2 == 0xA9 || c2 == 0xAF) {
-                            i += 3;
-                            break;   /* 0x2028, 0x2029, 0x202F */
-                        }
-                    }
-
-                    if (c1 == 0x81) {
-                        if (c2 == 0x9F) {
-                            i += 3;
-                            break;   /* 0x205F */
-                        }
-                    }
-                }
-
-                if (c0 == 0xE3) {
-                    if (c1 == 0x80) {
-                        if (c2 == 0x80) {
-                            i += 3;
-                            break;   /* 0x3000 */
-                        }
-                    }
-                }
-            }
-        }
-
-        /* Getting here means we've encountered a non-whitespace character. */
-        break;
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_strlen__sse2(src);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_strlen__neon(src);
     }
+#endif
 
-    return i;
+    return c89str_strlen__swar(src);
 }
 
-static C89STR_INLINE size_t c89str_scan_leading_newline(const char* str, size_t len)
+C89STR_API char* c89str_strcpy(char* dst, const char* src)
 {
-    size_t i;
+    char* dstorig;
 
-    if (str == NULL || len == 0) {
-        return C89STR_FALSE;
-    }
+    C89STR_ASSERT(dst != NULL);
+    C89STR_ASSERT(src != NULL);
 
-    i = 0;
-    while (str[i] != '\0' && i < len) {
-        unsigned char c0 = (unsigned char)str[i];
+    dstorig = dst;
 
-        if (c0 >= 0x0A && c0 <= 0x0D) {
-            i += 1;
+    /* No, we're not using this garbage: while (*dst++ = *src++); */
+    for (;;) {
+        *dst = *src;
+        if (*src == '\0') {
             break;
         }
 
-        if (i + 1 < len) {
-            unsigned char c1 = (unsigned char)str[i + 1];
-
-            if (c0 == 0xC2) {
-                if (c1 == 0x85) {
-                    i += 2;
-                    break;   /* 0x0085 */
-                }
-            }
-
-            if (i + 2 < len) {
-                unsigned char c2 = (unsigned char)str[i + 2];
-
-                if (c0 == 0xE2) {
-                    if (c1 == 0x80) {
-                        if (c2 == 0xA8 || c2 == 0xA9 ) {
-                            i += 3;
-                            break;   /* 0x2028, 0x2029 */
-                        }
-                    }
-                }
-            }
-        }
-
-        /* Getting here means we've encountered a non-newline character. */
-        break;
+        dst += 1;
+        src += 1;
     }
 
-    return i;
+    return dstorig;
 }
 
-C89STR_API size_t c89str_ltrim(const char* str, size_t len)
+C89STR_API int c89str_strncpy(char* dst, const char* src, size_t count)
 {
+    size_t maxcount;
     size_t i;
 
-    if (str == NULL || len == 0) {
-        return c89str_npos;
+    if (dst == 0) {
+        return EINVAL;
     }
-
-    i = 0;
-    while (i < len && str[i] != '\0') {
-        size_t whitespaceLen = c89str_scan_leading_whitespace(str + i, len - i);
-        if (whitespaceLen > 0) {
-            /* Found a whitespace. Keep scanning. */
-            i += 1;
-        } else {
-            /* Not a whitespace. Stop scanning. */
-            break;
-        }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
     }
 
-    return i;
-}
-
-C89STR_API c89str_bool32 c89str_is_null_or_whitespace(const char* str, size_t len)
-{
-    size_t offset;
+    maxcount = count;
 
-    if (str == NULL) {
-        return C89STR_TRUE;
+    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
     }
 
-    offset = c89str_ltrim(str, len);
-    if (offset == len || str[offset] == '\0') {
-        return C89STR_TRUE;
+    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
+        dst[i] = '\0';
+        return 0;
     }
 
-    return C89STR_FALSE;
+    dst[0] = '\0';
+    return ERANGE;
 }
 
-
-
-C89STR_API size_t c89str_find_next_whitespace(const char* str, size_t len, size_t* pWhitespaceLen)
+C89STR_API int c89str_strcpy_s(char* dst, size_t dstCap, const char* src)
 {
     size_t i;
 
-    if (str == NULL || len == 0) {
-        return c89str_npos;
-    }
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
+    }
 
-    i = 0;
-    while (i < len && str[i] != '\0') {
-        size_t whitespaceLen = c89str_scan_leading_whitespace(str + i, len - i);
-        if (whitespaceLen > 0) {
-            /* Found a whitespace. We're done. */
-            if (pWhitespaceLen != NULL) {
-                *pWhitespaceLen = whitespaceLen;
-            }
+    for (i = 0; i < dstCap && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
+    }
 
-            return i;
-        } else {
-            i += 1; /* Not a whitespace. Keep scanning. */
-        }
+    if (i < dstCap) {
+        dst[i] = '\0';
+        return 0;
     }
 
-    /* Getting here means no whitespace was not found. */
-    return c89str_npos;
+    dst[0] = '\0';
+    return ERANGE;
 }
 
-C89STR_API size_t c89str_find_next_line(const char* str, size_t len, size_t* pThisLineLen)
+C89STR_API int c89str_strncpy_s(char* dst, size_t dstCap, const char* src, size_t count)
 {
+    size_t maxcount;
     size_t i;
-    size_t newlineCodepointLen = 0;
 
-    if (pThisLineLen != NULL) {
-        *pThisLineLen = 0;
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return EINVAL;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
     }
 
-    if (str == NULL || len == 0) {
-        return c89str_npos;
+    maxcount = count;
+    if (count == ((size_t)-1) || count >= dstCap) {        /* -1 = _TRUNCATE */
+        maxcount = dstCap - 1;
     }
 
-    i = 0;
-    while (i < len && str[i] != '\0') {
-        newlineCodepointLen = c89str_scan_leading_newline(str + i, len - i);
-        if (newlineCodepointLen > 0) {
-            /* Found a new-line codepoint. We're done. */
-            break;
-        } else {
-            /* Not a new-line codepoint. Keep scanning. */
-            i += 1;
-        }
+    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
     }
 
-    /* At this point, `i` should be pointing to the end of the last line. */
-    if (pThisLineLen != NULL) {
-        *pThisLineLen = i;
+    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
+        dst[i] = '\0';
+        return 0;
     }
 
-    return i + newlineCodepointLen; /* Add the length of the new-line codepoint so the return value points to the start of the next line. */
+    dst[0] = '\0';
+    return ERANGE;
 }
 
-C89STR_API errno_t c89str_findn(const char* str, size_t strLen, const char* other, size_t otherLen, size_t* pResult)
+C89STR_API int c89str_strcat_s(char* dst, size_t dstCap, const char* src)
 {
-    size_t strOff;
+    char* dstorig;
 
-    if (pResult == NULL) {
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
         return EINVAL;
     }
 
-    *pResult = c89str_npos;
+    dstorig = dst;
 
-    if (str == NULL || other == NULL) {
-        return EINVAL;
+    while (dstCap > 0 && dst[0] != '\0') {
+        dst    += 1;
+        dstCap -= 1;
     }
 
-    if (strLen == (size_t)-1) {
-        strLen = c89str_strlen(str);
+    if (dstCap == 0) {
+        return EINVAL;  /* Unterminated. */
     }
 
-    if (otherLen == (size_t)-1) {
-        otherLen = c89str_strlen(other);
+    while (dstCap > 0 && src[0] != '\0') {
+        *dst++ = *src++;
+        dstCap -= 1;
     }
 
-    if (strLen == 0 || otherLen == 0) {
+    if (dstCap > 0) {
+        dst[0] = '\0';
+    } else {
+        dstorig[0] = '\0';
+        return ERANGE;
+    }
+
+    return 0;
+}
+
+C89STR_API int c89str_strncat_s(char* dst, size_t dstCap, const char* src, size_t count)
+{
+    char* dstorig;
+
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
+    if (src == 0) {
         return EINVAL;
     }
 
-    strOff = 0;
-    while ((strLen - strOff) >= otherLen) {
-        c89str_bool32 found = C89STR_TRUE;
-        size_t i;
-        for (i = 0; i < otherLen; i += 1) {
-            if (str[strOff + i] != other[i]) {
-                found = C89STR_FALSE;
-                break;
-            }
-        }
+    dstorig = dst;
 
-        if (found) {
-            *pResult = strOff;
-            return C89STR_SUCCESS;
-        }
+    while (dstCap > 0 && dst[0] != '\0') {
+        dst    += 1;
+        dstCap -= 1;
+    }
+
+    if (dstCap == 0) {
+        return EINVAL;  /* Unterminated. */
+    }
+
+    if (count == ((size_t)-1)) {        /* _TRUNCATE */
+        count = dstCap - 1;
+    }
+
+    while (dstCap > 0 && src[0] != '\0' && count > 0) {
+        *dst++ = *src++;
+        dstCap -= 1;
+        count  -= 1;
+    }
 
-        strOff += 1;
+    if (dstCap > 0) {
+        dst[0] = '\0';
+    } else {
+        dstorig[0] = '\0';
+        return ERANGE;
     }
 
-    /* Getting here means we didn't find the other string at all. */
-    return ENOENT;
+    return 0;
 }
 
-C89STR_API errno_t c89str_find(const char* str, const char* other, size_t* pResult)
+C89STR_API int c89str_itoa_s(int value, char* dst, size_t dstCap, int radix)
 {
-    return c89str_findn(str, (size_t)-1, other, (size_t)-1, pResult);
+    int sign;
+    unsigned int valueU;
+    char* dstEnd;
+
+    if (dst == NULL || dstCap == 0) {
+        return EINVAL;
+    }
+    if (radix < 2 || radix > 36) {
+        dst[0] = '\0';
+        return EINVAL;
+    }
+
+    sign = (value < 0 && radix == 10) ? -1 : 1;     /* The negative sign is only used when the base is 10. */
+
+    if (value < 0) {
+        valueU = -value;
+    } else {
+        valueU = value;
+    }
+
+    dstEnd = dst;
+    do
+    {
+        int remainder = valueU % radix;
+        if (remainder > 9) {
+            *dstEnd = (char)((remainder - 10) + 'a');
+        } else {
+            *dstEnd = (char)(remainder + '0');
+        }
+
+        dstEnd += 1;
+        dstCap -= 1;
+        valueU /= radix;
+    } while (dstCap > 0 && valueU > 0);
+
+    if (dstCap == 0) {
+        dst[0] = '\0';
+        return EINVAL;  /* Ran out of room in the output buffer. */
+    }
+
+    if (sign < 0) {
+        *dstEnd++ = '-';
+        dstCap -= 1;
+    }
+
+    if (dstCap == 0) {
+        dst[0] = '\0';
+        return EINVAL;  /* Ran out of room in the output buffer. */
+    }
+
+    *dstEnd = '\0';
+
+
+    /* At this point the string will be reversed. */
+    dstEnd -= 1;
+    while (dst < dstEnd) {
+        char temp = *dst;
+        *dst = *dstEnd;
+        *dstEnd = temp;
+
+        dst += 1;
+        dstEnd -= 1;
+    }
+
+    return 0;
 }
 
-C89STR_API int c89str_strncmpn(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
+C89STR_API int c89str_strcmp(const char* str1, const char* str2)
 {
     if (str1 == str2) return  0;
 
@@ -1424,12 +2252,8 @@ C89STR_API int c89str_strncmpn(const char* str1, size_t str1Len, const char* str
     if (str1 == NULL) return -1;
     if (str2 == NULL) return  1;
 
-    /* This function still needs to check for null terminators even though the length has been specified. */
     for (;;) {
-        if (str1Len == 0 || str1[0] == '\0') {
-            break;
-        }
-        if (str2Len == 0 || str2[0] == '\0') {
+        if (str1[0] == '\0') {
             break;
         }
 
@@ -1439,4568 +2263,12322 @@ C89STR_API int c89str_strncmpn(const char* str1, size_t str1Len, const char* str
 
         str1 += 1;
         str2 += 1;
-        str1Len -= 1;
-        str2Len -= 1;
     }
 
-    /* If at this point we reached the end of both strings, they're equal. */
-    if (str1Len == 0 && str2Len == 0) return 0;
-    if (str1Len == 0) return -1;
-    if (str2Len == 0) return  1;
-
-    /* Getting here means we haven't reached the end according to the specified lengths, so just compare the last characters. */
     return ((unsigned char*)str1)[0] - ((unsigned char*)str2)[0];
 }
 
-C89STR_API c89str_bool32 c89str_begins_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
+C89STR_API int c89str_strncmp(const char* str1, const char* str2, size_t maxLen)
 {
-    if (str1 == str2) {
-        return C89STR_TRUE;
-    }
+    if (str1 == str2) return  0;
 
-    if (str1 == NULL || str2 == NULL) {
-        return C89STR_FALSE;
-    }
+    /* These checks differ from the standard implementation. It's not important, but I prefer it just for sanity. */
+    if (str1 == NULL) return -1;
+    if (str2 == NULL) return  1;
 
     /* This function still needs to check for null terminators even though the length has been specified. */
     for (;;) {
-        if (str1Len == 0 || str1[0] == '\0') {
+        if (maxLen == 0) {
             break;
         }
-        if (str2Len == 0 || str2[0] == '\0') {
+
+        if (str1[0] == '\0') {
             break;
         }
 
         if (str1[0] != str2[0]) {
-            return C89STR_FALSE;
+            break;
         }
 
         str1 += 1;
         str2 += 1;
-        str1Len -= 1;
-        str2Len -= 1;
+        maxLen -= 1;
     }
 
-    /* Getting here means we've reached the end of one or both strings. If we're at the end of the second string it must mean that the first string begins with it. */
-    if (str2Len == 0 || str2[0] == '\0') {
-        return C89STR_TRUE;
+    if (maxLen == 0) {
+        return 0;
     }
 
-    /* Getting here means we're not at the end of the second string so we must have reached the end of the first string. */
-    return C89STR_FALSE;
+    return ((unsigned char*)str1)[0] - ((unsigned char*)str2)[0];
 }
 
-C89STR_API c89str_bool32 c89str_ends_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
+C89STR_API int c89str_stricmp_ascii(const char* str1, const char* str2)
 {
     if (str1 == NULL || str2 == NULL) {
-        return C89STR_FALSE;
+        return 0;
     }
 
-    if (str1Len == (size_t)-1) {
-        str1Len = c89str_strlen(str1);
-    }
-    if (str2Len == (size_t)-1) {
-        str2Len = c89str_strlen(str2);
+    while (*str1 != '\0' && *str2 != '\0') {
+        int c1 = (int)*str1;
+        int c2 = (int)*str2;
+    
+        if (c1 >= 'A' && c1 <= 'Z') {
+            c1 += 'a' - 'A';
+        }
+        if (c2 >= 'A' && c2 <= 'Z') {
+            c2 += 'a' - 'A';
+        }
+    
+        if (c1 != c2) {
+            return c1 - c2;
+        }
+    
+        str1 += 1;
+        str2 += 1;
     }
 
-    if (str1Len < str2Len) {
-        return C89STR_FALSE;
+    if (*str1 == '\0' && *str2 == '\0') {
+        return 0;
+    } else if (*str1 == '\0') {
+        return -1;
+    } else {
+        return 1;
     }
-
-    return c89str_strncmp(str1 + str1Len - str2Len, str2, str2Len) == 0;
 }
 
-C89STR_API errno_t c89str_to_uint(const char* str, size_t len, unsigned int* pValue)
+C89STR_API int c89str_strnicmp_ascii(const char* str1, const char* str2, size_t count)
 {
-    unsigned int value = 0;
-
-    if (pValue == NULL || str == NULL) {
-        return EINVAL;
+    if (str1 == NULL || str2 == NULL) {
+        return 0;
     }
 
-    while (len > 0 && str[0] != '\0') {
-        if (str[0] >= '0' && str[0] <= '9') {
-            value *= 10;
-            value += str[0] - '0';
-        } else {
-            /* Not an integer. */
-            return EINVAL;
+    while (*str1 != '\0' && *str2 != '\0' && count > 0) {
+        int c1 = (int)*str1;
+        int c2 = (int)*str2;
+    
+        if (c1 >= 'A' && c1 <= 'Z') {
+            c1 += 'a' - 'A';
         }
-
-        len -= 1;
-        str += 1;
+        if (c2 >= 'A' && c2 <= 'Z') {
+            c2 += 'a' - 'A';
+        }
+       
+        if (c1 != c2) {
+            return c1 - c2;
+        }
+       
+        str1  += 1;
+        str2  += 1;
+        count -= 1;
     }
 
-    *pValue = value;
+    if (count == 0) {
+        return 0;
+    } else if (*str1 == '\0' && *str2 == '\0') {
+        return 0;
+    } else if (*str1 == '\0') {
+        return -1;
+    } else {
+        return 1;
+    }
+}
 
-    return C89STR_SUCCESS;
+C89STR_API int c89str_stricmp(const char* str1, const char* str2)
+{
+    /* We will use the standard implementations of stricmp() and strcasecmp() if they are available. */
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    return _stricmp(str1, str2);
+#elif defined(__GNUC__) && defined(__USE_GNU)
+    return strcasecmp(str1, str2);
+#else
+    /* It would be good if we could use a custom implementation based on the Unicode standard here. Would require a lot of work to get that right, however. */
+    return c89str_stricmp_ascii(str1, str2);
+#endif
 }
 
-C89STR_API errno_t c89str_to_int(const char* str, size_t len, int* pValue)
+C89STR_API int c89str_strnicmp(const char* str1, const char* str2, size_t count)
 {
-    int sign  = 1;
-    int value = 0;
+    /* We will use the standard implementations of strnicmp() and strncasecmp() if they are available. */
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    return _strnicmp(str1, str2, count);
+#elif defined(__GNUC__) && defined(__USE_GNU)
+    return strncasecmp(str1, str2, count);
+#else
+    /* It would be good if we could use a custom implementation based on the Unicode standard here. Would require a lot of work to get that right, however. */
+    return c89str_strnicmp_ascii(str1, str2, count);
+#endif
+}
+/* END c89str_stdlib.c */
 
-    if (pValue == NULL || str == NULL || len == 0) {
-        return EINVAL;
-    }
 
-    if (str[0] == '-') {
-        sign = -1;
-    } else {
-        sign = +1;
+/* BEG c89str_helpers.c */
+static C89STR_INLINE size_t c89str_scan_leading_whitespace(const char* str, size_t len)
+{
+    size_t i;
+
+    if (str == NULL || len == 0) {
+        return C89STR_FALSE;
     }
 
-    str += 1;
-    len -= 1;
+    i = 0;
+    while (str[i] != '\0' && i < len) {
+        unsigned char c0 = (unsigned char)str[i];
 
-    while (len > 0 && str[0] != '\0') {
-        if (str[0] >= '0' && str[0] <= '9') {
-            value *= 10;
-            value += str[0] - '0';
-        } else {
-            /* Not an integer. */
-            return EINVAL;
+        if ((c0 >= 0x09 && c0 <= 0x0D) || c0 == 0x20) {
+            i += 1;
+            break;
         }
 
-        str += 1;
-        len -= 1;
-    }
+        if (i + 1 < len) {
+            unsigned char c1 = (unsigned char)str[i + 1];
 
-    *pValue = value * sign;
+            if (c0 == 0xC2) {
+                if (c1 == 0x85 || c1 == 0xA0) {
+                    i += 2;
+                    break;   /* 0x0085, 0x00A0 */
+                }
+            }
 
-    return C89STR_SUCCESS;
-}
+            if (i + 2 < len) {
+                unsigned char c2 = (unsigned char)str[i + 2];
 
-C89STR_API errno_t c89str_ascii_tolower(char* dst, size_t dstCap, const char* src, size_t srcLen)
-{
-    if (dst == NULL || src == NULL) {
-        return EINVAL;
-    }
+                if (c0 == 0xE1) {
+                    if (c1 == 0x9A) {
+                        if (c2 == 0x80) {
+                            i += 3;
+                            break;   /* 0x1680 */
+                        }
+                    }
+                }
 
-    if (dstCap == 0) {
-        return ERANGE;
-    }
+                if (c0 == 0xE2) {
+                    if (c1 == 0x80) {
+                        if (c2 >= 0x80 && c2 <= 0x8A) {
+                            i += 3;
+                            break;   /* 0x2000 - 0x200A */
+                        }
 
-    while (srcLen > 0 && src[0] != '\0') {
-        if (dstCap == 1) {
-            return ERANGE;
-        }
+                        if (c2 == 0xA8 || c2 == 0xA9 || c2 == 0xAF) {
+                            i += 3;
+                            break;   /* 0x2028, 0x2029, 0x202F */
+                        }
+                    }
 
-        if (src[0] >= 'A' && src[0] <= 'Z') {
-            dst[0] = src[0] - 'A' + 'a';
-        } else {
-            dst[0] = src[0];
+                    if (c1 == 0x81) {
+                        if (c2 == 0x9F) {
+                            i += 3;
+                            break;   /* 0x205F */
+                        }
+                    }
+                }
+
+                if (c0 == 0xE3) {
+                    if (c1 == 0x80) {
+                        if (c2 == 0x80) {
+                            i += 3;
+                            break;   /* 0x3000 */
+                        }
+                    }
+                }
+            }
         }
 
-        dst += 1;
-        dstCap -= 1;
-        src += 1;
-        srcLen -= 1;
+        /* Getting here means we've encountered a non-whitespace character. */
+        break;
     }
 
-    dst[0] = '\0';
-    
-    return C89STR_SUCCESS;
+    return i;
 }
 
-C89STR_API errno_t c89str_ascii_toupper(char* dst, size_t dstCap, const char* src, size_t srcLen)
+static C89STR_INLINE size_t c89str_scan_leading_newline(const char* str, size_t len)
 {
-    if (dst == NULL || src == NULL) {
-        return EINVAL;
-    }
+    size_t i;
 
-    if (dstCap == 0) {
-        return ERANGE;
+    if (str == NULL || len == 0) {
+        return C89STR_FALSE;
     }
 
-    while (srcLen > 0 && src[0] != '\0') {
-        if (dstCap == 1) {
-            return ERANGE;
-        }
+    i = 0;
+    while (str[i] != '\0' && i < len) {
+        unsigned char c0 = (unsigned char)str[i];
 
-        if (src[0] >= 'a' && src[0] <= 'z') {
-            dst[0] = src[0] - 'a' + 'A';
-        } else {
-            dst[0] = src[0];
+        if (c0 >= 0x0A && c0 <= 0x0D) {
+            i += 1;
+            break;
         }
 
-        dst += 1;
-        dstCap -= 1;
-        src += 1;
-        srcLen -= 1;
-    }
+        if (i + 1 < len) {
+            unsigned char c1 = (unsigned char)str[i + 1];
 
-    dst[0] = '\0';
-    
-    return C89STR_SUCCESS;
-}
+            if (c0 == 0xC2) {
+                if (c1 == 0x85) {
+                    i += 2;
+                    break;   /* 0x0085 */
+                }
+            }
 
-C89STR_API c89str_bool32 c89str_is_all_digits(const char* str, size_t strLen)
-{
-    if (str == NULL) {
-        return C89STR_FALSE;
-    }
+            if (i + 2 < len) {
+                unsigned char c2 = (unsigned char)str[i + 2];
 
-    while (strLen > 0 && str[0] != '\0') {
-        if (str[0] < '0' || str[0] > '9') {
-            return C89STR_FALSE;
+                if (c0 == 0xE2) {
+                    if (c1 == 0x80) {
+                        if (c2 == 0xA8 || c2 == 0xA9 ) {
+                            i += 3;
+                            break;   /* 0x2028, 0x2029 */
+                        }
+                    }
+                }
+            }
         }
 
-        str += 1;
-        strLen -= 1;
+        /* Getting here means we've encountered a non-newline character. */
+        break;
     }
 
-    return C89STR_TRUE;
+    return i;
 }
-/* END c89str_helpers.c */
-
 
-
-#define C89STR_HEADER_SIZE_IN_BYTES     (sizeof(size_t) + sizeof(size_t) + sizeof(size_t)) /* cap, len, result. Result is typed as size_t here for alignment reasons. */
-
-static size_t c89str_allocation_size(size_t cap)
+/*
+Whitespace is almost always ASCII so the trimming routines below skip runs of ASCII whitespace a block at a time and
+only fall back to checking for multibyte Unicode whitespace when a byte with the high bit set is encountered. The
+null terminator is not whitespace so it stops a scan like any other character.
+*/
+static C89STR_INLINE c89str_bool32 c89str_is_ascii_whitespace(unsigned char c)
 {
-    return C89STR_HEADER_SIZE_IN_BYTES + cap + 1; /* +1 for null terminator. */
+    return (c >= 0x09 && c <= 0x0D) || c == 0x20;
 }
 
-static void* c89str_to_allocation_address(c89str str)
+/* Returns the length of the non-ASCII whitespace character at the start of the string, or 0 if there isn't one. */
+static C89STR_INLINE size_t c89str_scan_leading_multibyte_whitespace(const char* str, size_t len)
 {
-    return (void*)(str - C89STR_HEADER_SIZE_IN_BYTES);
-}
+    const unsigned char* p = (const unsigned char*)str;
 
-static c89str c89str_from_allocation_address(void* pAllocationAddress)
-{
-    return (char*)pAllocationAddress + C89STR_HEADER_SIZE_IN_BYTES;
-}
+    /* Trailing bytes are only read when the previous byte matched which means we never read past a null terminator. */
+    if (len < 2) {
+        return 0;
+    }
 
-static void c89str_set_cap(c89str str, size_t cap)
-{
-    ((size_t*)c89str_to_allocation_address(str))[0] = cap;
-}
+    switch (p[0])
+    {
+        case 0xC2:
+        {
+            return (p[1] == 0x85 || p[1] == 0xA0) ? 2 : 0;   /* 0x0085, 0x00A0 */
+        }
 
-static size_t c89str_get_cap(const c89str str)
-{
-    return ((size_t*)c89str_to_allocation_address(str))[0];
-}
+        case 0xE1:
+        {
+            return (len >= 3 && p[1] == 0x9A && p[2] == 0x80) ? 3 : 0;   /* 0x1680 */
+        }
 
-static size_t c89str_get_len(const c89str str)
-{
-    return ((size_t*)c89str_to_allocation_address(str))[1];
+        case 0xE2:
+        {
+            if (len >= 3 && p[1] == 0x80) {
+                return ((p[2] >= 0x80 && p[2] <= 0x8A) || p[2] == 0xA8 || p[2] == 0xA9 || p[2] == 0xAF) ? 3 : 0;   /* 0x2000 - 0x200A, 0x2028, 0x2029, 0x202F */
+            }
+            if (len >= 3 && p[1] == 0x81) {
+                return (p[2] == 0x9F) ? 3 : 0;   /* 0x205F */
+            }
+            return 0;
+        }
+
+        case 0xE3:
+        {
+            return (len >= 3 && p[1] == 0x80 && p[2] == 0x80) ? 3 : 0;   /* 0x3000 */
+        }
+
+        default: return 0;
+    }
 }
 
-static void c89str_set_res(c89str str, errno_t result)
+/* Returns the length of the non-ASCII whitespace character ending at str[len-1], or 0 if there isn't one. */
+static C89STR_INLINE size_t c89str_scan_trailing_multibyte_whitespace(const char* str, size_t len)
 {
-    if (str == NULL) {
-        return;
+    if (len >= 2 && c89str_scan_leading_multibyte_whitespace(str + len - 2, 2) == 2) {
+        return 2;
+    }
+    if (len >= 3 && c89str_scan_leading_multibyte_whitespace(str + len - 3, 3) == 3) {
+        return 3;
     }
 
-    ((size_t*)c89str_to_allocation_address(str))[2] = (size_t)result;
+    return 0;
 }
 
-static errno_t c89str_get_res(const c89str str)
+/*
+The kernels below return the number of leading ASCII whitespace bytes, or the end offset after stripping trailing
+ASCII whitespace, but only look at whole blocks. The caller finishes off the remainder one byte at a time. When the
+length is c89str_npos the string is null terminated and aligned loads are used in the same way as c89str_strlen().
+*/
+#if defined(C89STR_SUPPORT_SSE2)
+static C89STR_INLINE unsigned int c89str_non_whitespace_mask__sse2(__m128i block)
 {
-    /* If this is called with a null pointer, assume that NULL was returned from some function which should only happen in out-of-memory situations. */
-    if (str == NULL) {
-        return ENOMEM;
-    }
+    /* Bytes 0x09 - 0x0D are detected with an unsigned range check: (c - 0x09) <= 4. */
+    __m128i ctrl    = _mm_sub_epi8(block, _mm_set1_epi8(0x09));
+    __m128i isCtrl  = _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(0x04)), ctrl);
+    __m128i isSpace = _mm_cmpeq_epi8(block, _mm_set1_epi8(0x20));
 
-    return (errno_t)((size_t*)c89str_to_allocation_address(str))[2];
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(isCtrl, isSpace)) ^ 0xFFFF;
 }
 
-static c89str c89str_realloc_string(c89str str, size_t cap, const c89str_allocation_callbacks* pAllocationCallbacks)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_skip_leading_whitespace__sse2(const char* str, size_t len)
 {
-    void* pAllocation = c89str_realloc((str == NULL) ? NULL : c89str_to_allocation_address(str), c89str_allocation_size(cap), pAllocationCallbacks);
-    if (pAllocation == NULL) {
-        return NULL;    /* Failed */
+    size_t off;
+    unsigned int mask;
+
+    if (len == c89str_npos) {
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)str & 15);
+        const char* pBlock = str - misalignment;
+
+        mask = c89str_non_whitespace_mask__sse2(_mm_load_si128((const __m128i*)pBlock)) >> misalignment;
+        if (mask != 0) {
+            return c89str_ctz32(mask);
+        }
+
+        for (;;) {
+            pBlock += 16;
+
+            mask = c89str_non_whitespace_mask__sse2(_mm_load_si128((const __m128i*)pBlock));
+            if (mask != 0) {
+                return (pBlock - str) + c89str_ctz32(mask);
+            }
+        }
     }
 
-    c89str_set_cap(c89str_from_allocation_address(pAllocation), cap);
-    c89str_set_res(c89str_from_allocation_address(pAllocation), C89STR_SUCCESS);
+    for (off = 0; off + 16 <= len; off += 16) {
+        mask = c89str_non_whitespace_mask__sse2(_mm_loadu_si128((const __m128i*)(str + off)));
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
+        }
+    }
 
-    return c89str_from_allocation_address(pAllocation);
+    return off;
 }
 
-static c89str c89str_realloc_string_if_necessary(c89str str, size_t requiredCap, const c89str_allocation_callbacks* pAllocationCallbacks)
+static size_t c89str_skip_trailing_whitespace__sse2(const char* str, size_t len)
 {
-    if (str == NULL) {
-        /* Need to allocate a fresh string. */
-        str = c89str_realloc_string(str, requiredCap, pAllocationCallbacks);
-    } else {
-        /* Don't necessarily need to allocate a fresh string, but might need to expand memory to make it fit. */
-        size_t cap = c89str_get_cap(str);
+    unsigned int mask;
 
-        if (cap < requiredCap) {
-            cap = requiredCap;
-            str = c89str_realloc_string(str, cap, pAllocationCallbacks);
+    while (len >= 16) {
+        mask = c89str_non_whitespace_mask__sse2(_mm_loadu_si128((const __m128i*)(str + len - 16)));
+        if (mask != 0) {
+            return (len - 16) + c89str_bsr32(mask) + 1;
         }
+
+        len -= 16;
     }
 
-    return str;
+    return len;
 }
+#endif
 
-
-C89STR_API void c89str_delete(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks)
+#if defined(C89STR_SUPPORT_AVX2)
+static C89STR_INLINE c89str_uint32 c89str_non_whitespace_mask__avx2(__m256i block)
 {
-    if (str == NULL) {
-        return;
-    }
+    __m256i ctrl    = _mm256_sub_epi8(block, _mm256_set1_epi8(0x09));
+    __m256i isCtrl  = _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(0x04)), ctrl);
+    __m256i isSpace = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(0x20));
 
-    c89str_free(c89str_to_allocation_address(str), pAllocationCallbacks);
+    return ~(c89str_uint32)_mm256_movemask_epi8(_mm256_or_si256(isCtrl, isSpace));
 }
 
-C89STR_API c89str c89str_new_with_cap(const c89str_allocation_callbacks* pAllocationCallbacks, size_t capacityNotIncludingNullTerminator)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_skip_leading_whitespace__avx2(const char* str, size_t len)
 {
-    c89str str = c89str_realloc_string(NULL, capacityNotIncludingNullTerminator, pAllocationCallbacks);
-    if (str == NULL) {
-        return NULL;    /* Failed */
+    size_t off;
+    c89str_uint32 mask;
+
+    if (len == c89str_npos) {
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)str & 31);
+        const char* pBlock = str - misalignment;
+
+        mask = c89str_non_whitespace_mask__avx2(_mm256_load_si256((const __m256i*)pBlock)) >> misalignment;
+        if (mask != 0) {
+            return c89str_ctz32(mask);
+        }
+
+        for (;;) {
+            pBlock += 32;
+
+            mask = c89str_non_whitespace_mask__avx2(_mm256_load_si256((const __m256i*)pBlock));
+            if (mask != 0) {
+                return (pBlock - str) + c89str_ctz32(mask);
+            }
+        }
     }
 
-    c89str_set_len(str, 0);
-    str[0] = '\0';
+    for (off = 0; off + 32 <= len; off += 32) {
+        mask = c89str_non_whitespace_mask__avx2(_mm256_loadu_si256((const __m256i*)(str + off)));
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
+        }
+    }
 
-    return str;
+    return off;
 }
 
-C89STR_API c89str c89str_new(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
+static size_t c89str_skip_trailing_whitespace__avx2(const char* str, size_t len)
 {
-    return c89str_set(NULL, pAllocationCallbacks, pOther);
-}
+    c89str_uint32 mask;
 
-C89STR_API c89str c89str_newn(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
-{
-    return c89str_setn(NULL, pAllocationCallbacks, pOther, otherLen);
+    while (len >= 32) {
+        mask = c89str_non_whitespace_mask__avx2(_mm256_loadu_si256((const __m256i*)(str + len - 32)));
+        if (mask != 0) {
+            return (len - 32) + c89str_bsr32(mask) + 1;
+        }
+
+        len -= 32;
+    }
+
+    return len;
 }
+#endif
 
-C89STR_API c89str c89str_newv(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
+#if defined(C89STR_SUPPORT_NEON)
+static C89STR_INLINE c89str_uint64 c89str_non_whitespace_mask__neon(uint8x16_t block)
 {
-    return c89str_setv(NULL, pAllocationCallbacks, pFormat, args);
+    uint8x16_t isCtrl  = vcleq_u8(vsubq_u8(block, vdupq_n_u8(0x09)), vdupq_n_u8(0x04));
+    uint8x16_t isSpace = vceqq_u8(block, vdupq_n_u8(0x20));
+
+    return ~c89str_neon_movemask_u8x16(vorrq_u8(isCtrl, isSpace));
 }
 
-C89STR_API c89str c89str_newf(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_skip_leading_whitespace__neon(const char* str, size_t len)
 {
-    c89str str;
-    va_list args;
+    size_t off;
+    c89str_uint64 mask;
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+    if (len == c89str_npos) {
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)str & 15);
+        const char* pBlock = str - misalignment;
 
-    va_start(args, pFormat);
-    {
-        str = c89str_setv(NULL, pAllocationCallbacks, pFormat, args);
+        mask = c89str_non_whitespace_mask__neon(vld1q_u8((const c89str_uint8*)pBlock)) >> (misalignment * 4);
+        if (mask != 0) {
+            return c89str_ctz64(mask) / 4;
+        }
+
+        for (;;) {
+            pBlock += 16;
+
+            mask = c89str_non_whitespace_mask__neon(vld1q_u8((const c89str_uint8*)pBlock));
+            if (mask != 0) {
+                return (pBlock - str) + (c89str_ctz64(mask) / 4);
+            }
+        }
     }
-    va_end(args);
 
-    return str;
+    for (off = 0; off + 16 <= len; off += 16) {
+        mask = c89str_non_whitespace_mask__neon(vld1q_u8((const c89str_uint8*)(str + off)));
+        if (mask != 0) {
+            return off + (c89str_ctz64(mask) / 4);
+        }
+    }
+
+    return off;
 }
 
-C89STR_API c89str c89str_set(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
+static size_t c89str_skip_trailing_whitespace__neon(const char* str, size_t len)
 {
-    return c89str_setn(str, pAllocationCallbacks, pOther, (size_t)-1);
+    c89str_uint64 mask;
+
+    while (len >= 16) {
+        mask = c89str_non_whitespace_mask__neon(vld1q_u8((const c89str_uint8*)(str + len - 16)));
+        if (mask != 0) {
+            return (len - 16) + (c89str_bsr64(mask) / 4) + 1;
+        }
+
+        len -= 16;
+    }
+
+    return len;
 }
+#endif
 
-C89STR_API c89str c89str_setn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+static size_t c89str_skip_leading_whitespace(const char* str, size_t len)
 {
-    if (pOther == NULL) {
-        pOther = "";
+    size_t i = 0;
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        i = c89str_skip_leading_whitespace__avx2(str, len);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        i = c89str_skip_leading_whitespace__sse2(str, len);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        i = c89str_skip_leading_whitespace__neon(str, len);
+    } else
+#endif
+    {
+        /* No SIMD. Everything is done below. */
     }
 
-    if (otherLen == (size_t)-1) {
-        otherLen = c89str_strlen(pOther);
+    /* The remainder. When len is c89str_npos this stops at the null terminator. */
+    while (i < len && c89str_is_ascii_whitespace((unsigned char)str[i])) {
+        i += 1;
     }
 
-    if (str != pOther) {
-        c89str str2 = c89str_realloc_string_if_necessary(str, otherLen, pAllocationCallbacks);
-        if (str2 == NULL) {
-            if (str != NULL) {
-                c89str_set_res(str, ENOMEM);
-            }
+    return i;
+}
 
-            return str;
-        }
+static size_t c89str_skip_trailing_whitespace(const char* str, size_t len)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
 
-        str = str2;
-        C89STR_COPY_MEMORY(str, pOther, otherLen);   /* Will be explicitly null terminated later. */
-    } else {
-        /* str and pOther are the same string. No need for a data copy. */
-        C89STR_ASSERT(str != NULL);
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        len = c89str_skip_trailing_whitespace__avx2(str, len);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        len = c89str_skip_trailing_whitespace__sse2(str, len);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        len = c89str_skip_trailing_whitespace__neon(str, len);
+    } else
+#endif
+    {
+        /* No SIMD. Everything is done below. */
     }
 
-    /* Null terminate and set the length. */
-    str[otherLen] = '\0';
-    c89str_set_len(str, otherLen);
+    while (len > 0 && c89str_is_ascii_whitespace((unsigned char)str[len - 1])) {
+        len -= 1;
+    }
 
-    /* At this point we're done. */
-    return str;
+    return len;
 }
 
-C89STR_API c89str c89str_setv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
+C89STR_API size_t c89str_ltrim(const char* str, size_t len)
 {
-    va_list args2;
-    int len;
-    c89str str2;
+    size_t i;
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+    if (str == NULL) {
+        return c89str_npos;
+    }
 
-#if !defined(_MSC_VER) || _MSC_VER >= 1800
-    va_copy(args2, args);
-#else
-    args2 = args;
-#endif
-    {
-        len = c89str_vsnprintf(NULL, 0, pFormat, args2);
-        if (len < 0) {
-            if (str != NULL) {
-                c89str_set_res(str, errno);
-            }
+    i = 0;
+    for (;;) {
+        size_t whitespaceLen;
 
-            return str;
+        i += c89str_skip_leading_whitespace(str + i, (len == c89str_npos) ? c89str_npos : len - i);
+        if (i == len || (unsigned char)str[i] < 0x80) {
+            break;  /* End of the string, or a character that isn't whitespace (including the null terminator). */
+        }
+
+        /* A high byte. This is either multibyte whitespace, in which case we keep going, or the end of the run. */
+        whitespaceLen = c89str_scan_leading_multibyte_whitespace(str + i, (len == c89str_npos) ? c89str_npos : len - i);
+        if (whitespaceLen == 0) {
+            break;
         }
+
+        i += whitespaceLen;
     }
-    va_end(args2);
 
+    return i;
+}
 
-    /* Make sure there's enough room for the new string. */
-    str2 = c89str_realloc_string_if_necessary(str, len, pAllocationCallbacks);
-    if (str2 == NULL) {
-        if (str != NULL) {
-            c89str_set_res(str, ENOMEM);
-        }
+/*
+Returns the offset just past the last character that isn't whitespace. The string is scanned from the end so the
+cost is proportional to the amount of trailing whitespace rather than the length of the string.
+*/
+static size_t c89str_rtrim(const char* str, size_t len)
+{
+    if (str == NULL) {
+        return c89str_npos;
+    }
 
-        return str;
+    if (len == c89str_npos) {
+        len = c89str_strlen(str);
     }
 
-    /* Getting here means reallocation was successfull. */
-    str = str2;
-    str2 = NULL;    /* <-- Just to make sure we don't try using str2 again. The compiler will optimize this away. */
+    for (;;) {
+        size_t whitespaceLen;
 
-    /* We have enough room in the string so now we can just format straight into it. */
-    c89str_vsnprintf(str, len+1, pFormat, args);
+        len = c89str_skip_trailing_whitespace(str, len);
+        if (len == 0 || (unsigned char)str[len - 1] < 0x80) {
+            break;
+        }
 
-    /* The length needs to be set explicitly. The formatting will have written the null terminator. */
-    c89str_set_len(str, len);
+        whitespaceLen = c89str_scan_trailing_multibyte_whitespace(str, len);
+        if (whitespaceLen == 0) {
+            break;
+        }
 
-    /* We're done. */
-    return str;
+        len -= whitespaceLen;
+    }
+
+    return len;
 }
 
-C89STR_API c89str c89str_setf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+C89STR_API c89str_bool32 c89str_is_null_or_whitespace(const char* str, size_t len)
 {
-    va_list args;
+    size_t offset;
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+    if (str == NULL) {
+        return C89STR_TRUE;
+    }
 
-    va_start(args, pFormat);
-    {
-        str = c89str_setv(str, pAllocationCallbacks, pFormat, args);
+    offset = c89str_ltrim(str, len);
+    if (offset == len || str[offset] == '\0') {
+        return C89STR_TRUE;
     }
-    va_end(args);
 
-    return str;
+    return C89STR_FALSE;
 }
 
-C89STR_API c89str c89str_cat(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
-{
-    return c89str_catn(str, pAllocationCallbacks, pOther, (size_t)-1);
-}
 
-C89STR_API c89str c89str_catn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+
+C89STR_API size_t c89str_find_next_whitespace(const char* str, size_t len, size_t* pWhitespaceLen)
 {
-    c89str str2;
-    size_t len;
+    size_t i;
 
-    if (str != NULL) {
-        if (c89str_get_res(str) != C89STR_SUCCESS) {
-            return str; /* The string is in an error state. */
-        }
+    if (str == NULL || len == 0) {
+        return c89str_npos;
     }
 
-    if (pOther == NULL) {
-        pOther = "";
+    i = 0;
+    while (i < len && str[i] != '\0') {
+        size_t whitespaceLen = c89str_scan_leading_whitespace(str + i, len - i);
+        if (whitespaceLen > 0) {
+            /* Found a whitespace. We're done. */
+            if (pWhitespaceLen != NULL) {
+                *pWhitespaceLen = whitespaceLen;
+            }
+
+            return i;
+        } else {
+            i += 1; /* Not a whitespace. Keep scanning. */
+        }
     }
 
-    if (otherLen == (size_t)-1) {
-        otherLen = c89str_strlen(pOther);
+    /* Getting here means no whitespace was not found. */
+    return c89str_npos;
+}
+
+C89STR_API size_t c89str_find_next_line(const char* str, size_t len, size_t* pThisLineLen)
+{
+    size_t i;
+    size_t newlineCodepointLen = 0;
+
+    if (pThisLineLen != NULL) {
+        *pThisLineLen = 0;
     }
 
-    if (str == NULL) {
-        /* Input string is null. This is just an assignment. */
-        return c89str_setn(str, pAllocationCallbacks, pOther, otherLen);
+    if (str == NULL || len == 0) {
+        return c89str_npos;
     }
 
-    /* str should never be null at this point. */
-    C89STR_ASSERT(str != NULL);
+    i = 0;
+    while (i < len && str[i] != '\0') {
+        newlineCodepointLen = c89str_scan_leading_newline(str + i, len - i);
+        if (newlineCodepointLen > 0) {
+            /* Found a new-line codepoint. We're done. */
+            break;
+        } else {
+            /* Not a new-line codepoint. Keep scanning. */
+            i += 1;
+        }
+    }
 
-    len  = c89str_get_len(str);
-    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
-    if (str2 == NULL) {
-        c89str_set_res(str, ENOMEM);
-        return str;
+    /* At this point, `i` should be pointing to the end of the last line. */
+    if (pThisLineLen != NULL) {
+        *pThisLineLen = i;
     }
 
-    str = str2;
-    C89STR_COPY_MEMORY(str + len, pOther, otherLen);   /* Will be explicitly null terminated later. */
+    return i + newlineCodepointLen; /* Add the length of the new-line codepoint so the return value points to the start of the next line. */
+}
 
-    /* Null terminate and set the length. */
-    str[len + otherLen] = '\0';
-    c89str_set_len(str, len + otherLen);
+/*
+Line indexing. Only a handful of byte values can be part of a line break: 0x0A - 0x0D, and the last bytes of U+0085
+(0x85) and U+2028/U+2029 (0xA8/0xA9). These are found with SIMD and then each one is checked by looking at the bytes
+either side of it. Because a break is identified by its last byte, the string can be split anywhere, even in the
+middle of a \r\n pair, and each part indexed independently without needing to be stitched back together.
+*/
+#ifndef C89STR_LINE_INDEX_MIN_CHUNK_SIZE
+#define C89STR_LINE_INDEX_MIN_CHUNK_SIZE    (1024*1024)    /* c89str_line_index_parallel() won't give a thread less than this many bytes. */
+#endif
 
-    /* At this point we're done. */
-    return str;
+static C89STR_INLINE c89str_bool32 c89str_is_line_break_candidate(unsigned char c)
+{
+    return (c >= 0x0A && c <= 0x0D) || c == 0x85 || c == 0xA8 || c == 0xA9;
 }
 
-C89STR_API c89str c89str_catv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
+/* Returns the length of the line break ending at str[i], or 0 if str[i] is not the last byte of a line break. */
+static C89STR_INLINE size_t c89str_line_break_len_ending_at(const char* str, size_t len, size_t i)
 {
-    va_list args2;
-    size_t len;
-    int otherLen;
-    c89str str2;
+    switch ((unsigned char)str[i])
+    {
+        case 0x0A: return (i > 0 && str[i - 1] == '\r') ? 2 : 1;     /* \r\n counts as a single break. */
+        case 0x0B: return 1;
+        case 0x0C: return 1;
+        case 0x0D: return (i + 1 < len && str[i + 1] == '\n') ? 0 : 1;
+        case 0x85: return (i >= 1 && (unsigned char)str[i - 1] == 0xC2) ? 2 : 0;   /* 0x0085 */
+        case 0xA8:
+        case 0xA9: return (i >= 2 && (unsigned char)str[i - 2] == 0xE2 && (unsigned char)str[i - 1] == 0x80) ? 3 : 0;   /* 0x2028, 0x2029 */
+        default:   return 0;
+    }
+}
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+#if defined(C89STR_SUPPORT_SSE2)
+static size_t c89str_find_line_break_candidate__sse2(const char* str, size_t off, size_t end)
+{
+    unsigned int mask;
 
-    if (str != NULL) {
-        if (c89str_get_res(str) != C89STR_SUCCESS) {
-            return str; /* The string is in an error state. */
-        }
-    }
+    for (; off + 16 <= end; off += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(str + off));
+        __m128i ctrl  = _mm_sub_epi8(block, _mm_set1_epi8(0x0A));
+        __m128i isCandidate;
 
-#if !defined(_MSC_VER) || _MSC_VER >= 1800
-    va_copy(args2, args);
-#else
-    args2 = args;
-#endif
-    {
-        otherLen = c89str_vsnprintf(NULL, 0, pFormat, args2);
-        if (otherLen < 0) {
-            if (str != NULL) {
-                c89str_set_res(str, errno);
-            }
+        isCandidate = _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(0x03)), ctrl);                                      /* 0x0A - 0x0D */
+        isCandidate = _mm_or_si128(isCandidate, _mm_cmpeq_epi8(block, _mm_set1_epi8((char)0x85)));                        /* 0x85 */
+        isCandidate = _mm_or_si128(isCandidate, _mm_cmpeq_epi8(_mm_or_si128(block, _mm_set1_epi8(0x01)), _mm_set1_epi8((char)0xA9)));   /* 0xA8, 0xA9 */
 
-            return str;
+        mask = (unsigned int)_mm_movemask_epi8(isCandidate);
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
         }
     }
-    va_end(args2);
-
 
-    /* Make sure there's enough room for the new string. */
-    len = 0;
-    if (str != NULL) {
-        len = c89str_get_len(str);
+    while (off < end && !c89str_is_line_break_candidate((unsigned char)str[off])) {
+        off += 1;
     }
 
-    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
-    if (str2 == NULL) {
-        if (str != NULL) {
-            c89str_set_res(str, ENOMEM);
-        }
+    return off;
+}
+#endif
 
-        return str;
-    }
+#if defined(C89STR_SUPPORT_AVX2)
+static size_t c89str_find_line_break_candidate__avx2(const char* str, size_t off, size_t end)
+{
+    c89str_uint32 mask;
 
-    /* Getting here means reallocation was successfull. */
-    str = str2;
+    for (; off + 32 <= end; off += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(str + off));
+        __m256i ctrl  = _mm256_sub_epi8(block, _mm256_set1_epi8(0x0A));
+        __m256i isCandidate;
 
-    /* We have enough room in the string so now we can just format straight into it. */
-    c89str_vsnprintf(str + len, otherLen+1, pFormat, args);
+        isCandidate = _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(0x03)), ctrl);
+        isCandidate = _mm256_or_si256(isCandidate, _mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0x85)));
+        isCandidate = _mm256_or_si256(isCandidate, _mm256_cmpeq_epi8(_mm256_or_si256(block, _mm256_set1_epi8(0x01)), _mm256_set1_epi8((char)0xA9)));
 
-    /* The length needs to be set explicitly. The formatting will have written the null terminator. */
-    c89str_set_len(str, len + otherLen);
+        mask = (c89str_uint32)_mm256_movemask_epi8(isCandidate);
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
+        }
+    }
 
-    /* We're done. */
-    return str;
+    while (off < end && !c89str_is_line_break_candidate((unsigned char)str[off])) {
+        off += 1;
+    }
+
+    return off;
 }
+#endif
 
-C89STR_API c89str c89str_catf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+#if defined(C89STR_SUPPORT_NEON)
+static size_t c89str_find_line_break_candidate__neon(const char* str, size_t off, size_t end)
 {
-    va_list args;
+    c89str_uint64 mask;
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+    for (; off + 16 <= end; off += 16) {
+        uint8x16_t block = vld1q_u8((const c89str_uint8*)(str + off));
+        uint8x16_t isCandidate;
 
-    va_start(args, pFormat);
-    {
-        str = c89str_catv(str, pAllocationCallbacks, pFormat, args);
+        isCandidate = vcleq_u8(vsubq_u8(block, vdupq_n_u8(0x0A)), vdupq_n_u8(0x03));
+        isCandidate = vorrq_u8(isCandidate, vceqq_u8(block, vdupq_n_u8(0x85)));
+        isCandidate = vorrq_u8(isCandidate, vceqq_u8(vorrq_u8(block, vdupq_n_u8(0x01)), vdupq_n_u8(0xA9)));
+
+        mask = c89str_neon_movemask_u8x16(isCandidate);
+        if (mask != 0) {
+            return off + (c89str_ctz64(mask) / 4);
+        }
     }
-    va_end(args);
 
-    return str;
-}
+    while (off < end && !c89str_is_line_break_candidate((unsigned char)str[off])) {
+        off += 1;
+    }
 
-C89STR_API c89str c89str_prepend(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
-{
-    return c89str_prependn(str, pAllocationCallbacks, pOther, (size_t)-1);
+    return off;
 }
+#endif
 
-C89STR_API c89str c89str_prependn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+/* Returns the offset of the first byte in [off, end) that could be the last byte of a line break, or end if there isn't one. */
+static size_t c89str_find_line_break_candidate(const char* str, size_t off, size_t end)
 {
-    c89str str2;
-    size_t len;
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
 
-    if (str != NULL) {
-        if (c89str_get_res(str) != C89STR_SUCCESS) {
-            return str; /* The string is in an error state. */
-        }
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_find_line_break_candidate__avx2(str, off, end);
     }
-
-    if (pOther == NULL) {
-        pOther = "";
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_find_line_break_candidate__sse2(str, off, end);
     }
-
-    if (otherLen == (size_t)-1) {
-        otherLen = c89str_strlen(pOther);
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_find_line_break_candidate__neon(str, off, end);
     }
+#endif
 
-    if (str == NULL) {
-        /* Input string is null. This is just an assignment. */
-        return c89str_setn(str, pAllocationCallbacks, pOther, otherLen);
+    while (off < end && !c89str_is_line_break_candidate((unsigned char)str[off])) {
+        off += 1;
     }
 
-    C89STR_ASSERT(str != NULL);
+    return off;
+}
 
-    len  = c89str_get_len(str);
-    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
-    if (str2 == NULL) {
-        c89str_set_res(str, ENOMEM);
-        return str;
-    }
+/* Returns the offset of the last byte of the next line break ending in [off, end), or end if there isn't one. */
+static size_t c89str_find_next_line_break_end(const char* str, size_t len, size_t off, size_t end, size_t* pBreakLen)
+{
+    for (;;) {
+        size_t breakLen;
 
-    str = str2;
-    C89STR_MOVE_MEMORY(str + otherLen, str, len + 1);   /* Move the existing string to the right. +1 for the null terminator. */
-    C89STR_COPY_MEMORY(str, pOther, otherLen);          /* Copy the new string to the left. */
+        off = c89str_find_line_break_candidate(str, off, end);
+        if (off == end) {
+            return end;
+        }
 
-    /* Set the length (null terminator was already done. */
-    c89str_set_len(str, len + otherLen);
+        breakLen = c89str_line_break_len_ending_at(str, len, off);
+        if (breakLen > 0) {
+            *pBreakLen = breakLen;
+            return off;
+        }
 
-    /* At this point we're done. */
-    return str;
+        off += 1;
+    }
 }
 
-C89STR_API c89str c89str_prependv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
+/*
+Finds the start of each line that follows a break ending in [*pOff, end). Stops early if pOffsets fills up, in which
+case *pOff is where to resume. Set pOffsets to NULL to only count. Returns the number of lines found.
+*/
+static size_t c89str_find_line_starts(const char* str, size_t len, size_t* pOff, size_t end, size_t* pOffsets, size_t offsetsCap)
 {
-    va_list args2;
-    size_t len;
-    int otherLen;
-    c89str str2;
+    size_t off = *pOff;
+    size_t count = 0;
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+    while (off < end) {
+        size_t breakLen;
 
-    if (str != NULL) {
-        if (c89str_get_res(str) != C89STR_SUCCESS) {
-            return str; /* The string is in an error state. */
+        if (pOffsets != NULL && count == offsetsCap) {
+            break;
         }
-    }
-
-#if !defined(_MSC_VER) || _MSC_VER >= 1800
-    va_copy(args2, args);
-#else
-    args2 = args;
-#endif
-    {
-        otherLen = c89str_vsnprintf(NULL, 0, pFormat, args2);
-        if (otherLen < 0) {
-            if (str != NULL) {
-                c89str_set_res(str, errno);
-            }
 
-            return str;
+        off = c89str_find_next_line_break_end(str, len, off, end, &breakLen);
+        if (off == end) {
+            break;
         }
-    }
-    va_end(args2);
-
-
-    /* Make sure there's enough room for the new string. */
-    len = 0;
-    if (str != NULL) {
-        len = c89str_get_len(str);
-    }
 
-    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
-    if (str2 == NULL) {
-        if (str != NULL) {
-            c89str_set_res(str, ENOMEM);
+        off += 1;
+        if (off == len) {
+            break;  /* A break at the very end of the string doesn't start a new line. */
         }
 
-        return str;
-    }
-
-    str = str2;
-    str2 = NULL;    /* <-- Just to make sure we don't accidentally use str2 again. */
-
-    /*
-    Prepending is awkward here because we want to avoid as much data movement as possible which
-    means it makes sense to format straight into the string. We would need to move the existing
-    string down to make room for the new string, but the problem is that formatting straight into
-    the output buffer will result in the null terminator overwriting the first character of the
-    existing string.
-
-    What we're doing here is grabbing the first character of the existing string and storing it.
-    Then we move the existing string down to make room for the new string. We then format the new
-    string straight into the buffer which will result in the null terminator overwriting the first
-    character of the existing string. We then restore the first character of the existing string.
-    */
-
-    /* Grab the first character of the existing string. */
-    {
-        char firstChar = '\0';
-
-        if (len > 0) {
-            firstChar = str[0];
+        if (pOffsets != NULL) {
+            pOffsets[count] = off;
         }
+        count += 1;
+    }
 
-        /* Move the existing string down to make room for the new string. */
-        C89STR_MOVE_MEMORY(str + otherLen, str, len + 1);   /* +1 for the null terminator. */
+    *pOff = off;
+    return count;
+}
 
-        /* Format the new string straight into the buffer. */
-        c89str_vsnprintf(str, len+1, pFormat, args);
+C89STR_API errno_t c89str_for_each_line(const char* str, size_t strLen, c89str_line_proc onLine, void* pUserData)
+{
+    size_t lineOff;
 
-        /* Restore the first character of the existing string. */
-        if (len > 0) {
-            str[otherLen] = firstChar;
-        }
+    if (str == NULL || onLine == NULL) {
+        return EINVAL;
     }
 
-    /* The length needs to be set explicitly. The null terminator has already been dealt with. */
-    c89str_set_len(str, otherLen + len);
+    if (strLen == c89str_npos) {
+        strLen = c89str_strlen(str);
+    }
 
-    /* We're done. */
-    return str;
-}
+    lineOff = 0;
+    while (lineOff < strLen) {
+        errno_t result;
+        size_t breakLen = 0;
+        size_t breakEnd = c89str_find_next_line_break_end(str, strLen, lineOff, strLen, &breakLen);
 
-C89STR_API c89str c89str_prependf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
-{
-    va_list args;
+        if (breakEnd == strLen) {
+            /* The last line has no break. */
+            result = onLine(pUserData, lineOff, strLen - lineOff);
+            breakEnd = strLen - 1;
+        } else {
+            result = onLine(pUserData, lineOff, (breakEnd + 1 - breakLen) - lineOff);
+        }
 
-    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+        if (result != C89STR_SUCCESS) {
+            return result;
+        }
 
-    va_start(args, pFormat);
-    {
-        str = c89str_prependv(str, pAllocationCallbacks, pFormat, args);
+        lineOff = breakEnd + 1;
     }
-    va_end(args);
 
-    return str;
+    return C89STR_SUCCESS;
 }
 
-C89STR_API c89str c89str_remove(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t beg, size_t end)
+C89STR_API errno_t c89str_line_index(const char* str, size_t strLen, size_t** ppLineOffsets, size_t* pLineCount, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    size_t len;
-    size_t lenToRemove;
-
-    C89STR_UNUSED(pAllocationCallbacks);
+    size_t* pOffsets = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    size_t off = 0;
 
-    if (beg > end) {
-        return str;  /* The beginning must not be greater than the end. Nothing to remove. */
+    if (ppLineOffsets != NULL) {
+        *ppLineOffsets = NULL;
     }
 
-    if (str == NULL) {
-        return NULL; /* Nothing to remove from. */
+    if (pLineCount != NULL) {
+        *pLineCount = 0;
     }
 
-    if (c89str_get_res(str) != C89STR_SUCCESS) {
-        return str; /* The string is in an error state. */
+    if (str == NULL || pLineCount == NULL) {
+        return EINVAL;
     }
 
-    len = c89str_get_len(str);
-    if (beg > len) {
-        return str; /* Trying to remove beyond the end of the string. */
+    if (strLen == c89str_npos) {
+        strLen = c89str_strlen(str);
     }
-    if (end > len) {
-        end = len;  /* Trying to remove beyond the end of the string. Clamp the end. */
+
+    if (strLen == 0) {
+        return C89STR_SUCCESS;  /* An empty string has no lines. */
     }
 
-    lenToRemove = end - beg;
-    if (lenToRemove == 0) {
-        return str; /* Nothing to remove. */
+    if (ppLineOffsets == NULL) {
+        *pLineCount = 1 + c89str_find_line_starts(str, strLen, &off, strLen, NULL, 0);
+        return C89STR_SUCCESS;
     }
 
-    C89STR_MOVE_MEMORY(str + beg, str + end, len - end + 1); /* +1 to include the null terminator. */
-    c89str_set_len(str, len - lenToRemove);
+    do {
+        if (count == cap) {
+            size_t newCap = (cap == 0) ? (strLen / 64) + 16 : cap * 2;  /* The initial guess is based on lines of 64 bytes. */
+            size_t* pNewOffsets = (size_t*)c89str_realloc(pOffsets, sizeof(*pOffsets) * newCap, pAllocationCallbacks);
+            if (pNewOffsets == NULL) {
+                c89str_free(pOffsets, pAllocationCallbacks);
+                return ENOMEM;
+            }
 
-    /* We're done. */
-    return str;
+            pOffsets = pNewOffsets;
+            cap      = newCap;
+        }
+
+        if (count == 0) {
+            pOffsets[0] = 0;    /* The first line always starts at the beginning. */
+            count = 1;
+        }
+
+        count += c89str_find_line_starts(str, strLen, &off, strLen, pOffsets + count, cap - count);
+    } while (off < strLen);
+
+    *ppLineOffsets = pOffsets;
+    *pLineCount    = count;
+
+    return C89STR_SUCCESS;
 }
 
-static c89str c89str_replace_ex(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t replaceOffset, size_t replaceLen, const char* pOther, size_t otherLen, const char* pOtherPrepend, const char* pOtherAppend)
+typedef struct
 {
-    c89str newStr;
-    errno_t result;
+    const char* str;
+    size_t strLen;
+    size_t beg;
+    size_t end;
+    size_t* pOffsets;   /* NULL when counting. */
+    size_t count;
+} c89str_line_index_job;
+
+static void c89str_line_index_job_proc(void* pData)
+{
+    c89str_line_index_job* pJob = (c89str_line_index_job*)pData;
+    size_t off = pJob->beg;
 
-    if (str == NULL) {
-        return NULL; /* Nothing to replace. */
-    }
+    pJob->count = c89str_find_line_starts(pJob->str, pJob->strLen, &off, pJob->end, pJob->pOffsets, pJob->count);
+}
 
-    if (c89str_get_res(str) != C89STR_SUCCESS) {
-        return str; /* The string is in an error state. */
+C89STR_API errno_t c89str_line_index_parallel(const char* str, size_t strLen, size_t threadCount, size_t** ppLineOffsets, size_t* pLineCount, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_line_index_job* pJobs;
+    size_t jobCount;
+    size_t iJob;
+    size_t count;
+    size_t* pOffsets;
+
+    if (str == NULL || pLineCount == NULL) {
+        return c89str_line_index(str, strLen, ppLineOffsets, pLineCount, pAllocationCallbacks);    /* Let the single threaded version deal with invalid arguments. */
     }
 
-    if (replaceOffset + replaceLen > c89str_get_len(str)) {
-        return str;
+    if (strLen == c89str_npos) {
+        strLen = c89str_strlen(str);
     }
 
-    /* We can allow pOther to be NULL in which case it can be the same as a remove. */
-    if (pOther == NULL) {
-        pOther = "";
+    if (threadCount == 0) {
+        threadCount = c89str_get_processor_count();
     }
 
-    if (otherLen == (size_t)-1) {
-        otherLen = c89str_strlen(pOther);
+    jobCount = C89STR_MIN(threadCount, strLen / C89STR_LINE_INDEX_MIN_CHUNK_SIZE);
+    if (jobCount <= 1) {
+        return c89str_line_index(str, strLen, ppLineOffsets, pLineCount, pAllocationCallbacks);
     }
 
+    if (ppLineOffsets != NULL) {
+        *ppLineOffsets = NULL;
+    }
 
-    /* TODO: This can be made more efficient by doing the replacement in-place if the replacement string is the same or smaller in size. Can also optimize when there is no prepand nor append. */
+    pJobs = (c89str_line_index_job*)c89str_malloc(sizeof(*pJobs) * jobCount, pAllocationCallbacks);
+    if (pJobs == NULL) {
+        return ENOMEM;
+    }
 
-    
-    /* The string is split into 3 sections: the part before the replace, the replacement itself, and the part after the replacement. */
+    /*
+    Two passes. The first counts the lines in each chunk so the result can be allocated up front, and the second fills it
+    in with each chunk writing straight to its own part of the array. This way nothing is allocated from the other
+    threads and nothing needs to be copied.
+    */
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        pJobs[iJob].str      = str;
+        pJobs[iJob].strLen   = strLen;
+        pJobs[iJob].beg      = (strLen / jobCount) * iJob;
+        pJobs[iJob].end      = (iJob + 1 < jobCount) ? (strLen / jobCount) * (iJob + 1) : strLen;
+        pJobs[iJob].pOffsets = NULL;
+        pJobs[iJob].count    = 0;
+    }
 
-    /* Pre-replacement. */
-    newStr = c89str_newn(pAllocationCallbacks, str, replaceOffset);
+    c89str_run_jobs(c89str_line_index_job_proc, pJobs, sizeof(*pJobs), jobCount, pAllocationCallbacks);
 
-    /* Replacement. */
-    if (pOtherPrepend != NULL) { newStr = c89str_cat(newStr, pAllocationCallbacks, pOtherPrepend); }
-    {
-        newStr = c89str_catn(newStr, pAllocationCallbacks, pOther, otherLen);
+    count = 1;  /* The first line. */
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        count += pJobs[iJob].count;
     }
-    if (pOtherAppend  != NULL) { newStr = c89str_cat(newStr, pAllocationCallbacks, pOtherAppend);  }
 
-    /* Post-replacement. */
-    newStr = c89str_catn(newStr, pAllocationCallbacks, str + (replaceOffset + replaceLen), c89str_get_len(str) - (replaceOffset + replaceLen));
+    if (ppLineOffsets != NULL) {
+        pOffsets = (size_t*)c89str_malloc(sizeof(*pOffsets) * count, pAllocationCallbacks);
+        if (pOffsets == NULL) {
+            c89str_free(pJobs, pAllocationCallbacks);
+            return ENOMEM;
+        }
 
-    /* Now check the result of the operation. */
-    result = c89str_result(newStr);
-    if (result != C89STR_SUCCESS) {
-        c89str_delete(newStr, pAllocationCallbacks);
-        c89str_set_res(str, result);
-        return str;
+        pOffsets[0] = 0;
+        count = 1;
+        for (iJob = 0; iJob < jobCount; iJob += 1) {
+            pJobs[iJob].pOffsets = pOffsets + count;
+            count += pJobs[iJob].count;
+        }
+
+        c89str_run_jobs(c89str_line_index_job_proc, pJobs, sizeof(*pJobs), jobCount, pAllocationCallbacks);
+
+        *ppLineOffsets = pOffsets;
     }
 
-    /* We're done. */
-    c89str_delete(str, pAllocationCallbacks);
-    str = newStr;
+    c89str_free(pJobs, pAllocationCallbacks);
 
-    return str;
+    *pLineCount = count;
+    return C89STR_SUCCESS;
 }
 
-C89STR_API c89str c89str_replace(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t replaceOffset, size_t replaceLength, const char* pOther, size_t otherLength)
-{
-    return c89str_replace_ex(str, pAllocationCallbacks, replaceOffset, replaceLength, pOther, otherLength, NULL, NULL);
-}
+/*
+Substring searching. The algorithm is chosen based on the length of the needle:
 
-C89STR_API c89str c89str_replace_all(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen)
+  - Single byte needles are a plain memchr().
+  - Short needles use a filter that looks for two of the needle's rarest bytes at the same time, 16 or 32 positions
+    at a time with SIMD. The whole needle is only compared at positions where both bytes match. Without SIMD this is
+    a memchr() on the rarest byte.
+  - Long needles use the Two-Way algorithm with a Horspool-style shift table which allows us to skip ahead by up to
+    the length of the needle at a time.
+
+The filters are O(n*m) in the worst case (think "aaaa...a" against "aa...ab"). To keep things linear they keep track
+of how many bytes they've compared, and if that gets out of hand they hand over to Two-Way which is always linear.
+*/
+#ifndef C89STR_FIND_SHORT_NEEDLE_MAX
+#define C89STR_FIND_SHORT_NEEDLE_MAX    32  /* Needles longer than this go straight to Two-Way. */
+#endif
+#define C89STR_FIND_WORK_FACTOR         4   /* The filters give up when they've compared more than this many bytes per byte of haystack. */
+
+static const char* c89str_memchr__swar(const char* p, size_t len, char c)
 {
-    size_t offset = 0;
+    const char* end = p + len;
 
-    if (str == NULL) {
-        return NULL;
+    /* Head. Go byte-by-byte until we're aligned. */
+    while (p < end && ((c89str_uintptr)p & (sizeof(size_t) - 1)) != 0) {
+        if (p[0] == c) {
+            return p;
+        }
+        p += 1;
     }
 
-    if (pQuery == NULL) {
-        pQuery = "";
+    /* Body. A word at a time so long as the whole word is within range. */
+    while ((size_t)(end - p) >= sizeof(size_t)) {
+        if (c89str_swar_has_byte(c89str_swar_load(p), (unsigned char)c)) {
+            break;
+        }
+        p += sizeof(size_t);
     }
 
-    if (queryLen == (size_t)-1) {
-        queryLen = c89str_strlen(pQuery);
+    /* Tail. */
+    while (p < end) {
+        if (p[0] == c) {
+            return p;
+        }
+        p += 1;
     }
 
-    if (queryLen == 0) {
-        return str; /* Nothing to replace. */
-    }
+    return NULL;
+}
 
+#if defined(C89STR_SUPPORT_SSE2)
+static const char* c89str_memchr__sse2(const char* p, size_t len, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t off;
+    unsigned int mask;
 
-    if (pReplacement == NULL) {
-        pReplacement = "";
+    if (len < 16) {
+        return c89str_memchr__swar(p, len, c);
     }
 
-    if (replacementLen == (size_t)-1) {
-        replacementLen = c89str_strlen(pReplacement);
+    for (off = 0; off + 16 <= len; off += 16) {
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + c89str_ctz32(mask);
+        }
     }
 
-
-    /* We can do an optimized implementation if we're replacing a single character. */
-    if (queryLen == 1 && replacementLen == 1) {
-        size_t len = c89str_get_len(str);
-        size_t i;
-
-        for (i = 0; i < len; ++i) {
-            if ((str)[i] == pQuery[0]) {
-                (str)[i] = pReplacement[0];
-            }
+    /* Tail. The last block overlaps with bytes that have already been checked which is fine because they didn't match. */
+    if (off < len) {
+        off  = len - 16;
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + c89str_ctz32(mask);
         }
-    
-        return str;
     }
 
+    return NULL;
+}
+#endif
 
-    /* We keep looping until there's no more occurrances. */
-    for (;;) {
-        errno_t result;
-        size_t location;
+#if defined(C89STR_SUPPORT_AVX2)
+static const char* c89str_memchr__avx2(const char* p, size_t len, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t off;
+    c89str_uint32 mask;
 
-        result = c89str_findn(str + offset, c89str_get_len(str) - offset, pQuery, queryLen, &location);
-        if (result == ENOENT || location == c89str_npos) {
-            break;  /* We're done */
-        }
+    if (len < 32) {
+        return c89str_memchr__swar(p, len, c);
+    }
 
-        /* Getting here means we found one. We just need to replace a range. */
-        str = c89str_replace(str, pAllocationCallbacks, offset + location, queryLen, pReplacement, replacementLen);
-        if (c89str_result(str) != C89STR_SUCCESS) {
-            break;  /* We got an error. Probably out of memory. Get out of the loop. */
+    for (off = 0; off + 32 <= len; off += 32) {
+        mask = (c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + c89str_ctz32(mask);
         }
+    }
 
-        offset += location + replacementLen;   /* Progress past the replacement. */
+    if (off < len) {
+        off  = len - 32;
+        mask = (c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + c89str_ctz32(mask);
+        }
     }
 
-    return str;
+    return NULL;
 }
+#endif
 
-C89STR_API c89str c89str_trim(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks)
+#if defined(C89STR_SUPPORT_NEON)
+static const char* c89str_memchr__neon(const char* p, size_t len, char c)
 {
-    size_t loff;
-    size_t roff;
-
-    C89STR_UNUSED(pAllocationCallbacks);
+    const uint8x16_t needle = vdupq_n_u8((c89str_uint8)c);
+    size_t off;
+    c89str_uint64 mask;
 
-    if (str == NULL) {
-        return NULL;
+    if (len < 16) {
+        return c89str_memchr__swar(p, len, c);
     }
 
-    /* The length of the string will never expand which simplifies our memory management. */
-    loff = c89str_utf8_ltrim_offset(str, c89str_get_len(str));
-    roff = c89str_utf8_rtrim_offset(str, c89str_get_len(str));
+    for (off = 0; off + 16 <= len; off += 16) {
+        mask = c89str_neon_movemask_u8x16(vceqq_u8(vld1q_u8((const c89str_uint8*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + (c89str_ctz64(mask) / 4);
+        }
+    }
 
-    C89STR_MOVE_MEMORY(str, str + loff, (roff - loff));  /* Left trim by moving the string down. */
-    c89str_set_len(str, roff - loff);                    /* Set the length before the right trim. */
-    str[c89str_get_len(str)] = '\0';                     /* Right trim by setting the null terminator. */
+    if (off < len) {
+        off  = len - 16;
+        mask = c89str_neon_movemask_u8x16(vceqq_u8(vld1q_u8((const c89str_uint8*)(p + off)), needle));
+        if (mask != 0) {
+            return p + off + (c89str_ctz64(mask) / 4);
+        }
+    }
 
-    return str;
+    return NULL;
 }
+#endif
 
-
-C89STR_API void c89str_set_len(c89str str, size_t len)
+static const char* c89str_memchr(const char* p, size_t len, char c)
 {
-    if (str == NULL) {
-        return;
-    }
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
 
-    ((size_t*)c89str_to_allocation_address(str))[1] = len;
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_memchr__avx2(p, len, c);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_memchr__sse2(p, len, c);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_memchr__neon(p, len, c);
+    }
+#endif
+
+    return c89str_memchr__swar(p, len, c);
 }
 
-C89STR_API size_t c89str_len(const c89str str)
+
+/*
+The filters below look for two bytes of the needle at the same time and only compare the whole needle at positions
+where both match. Rather than always using the first and last bytes, the searcher picks the two bytes of the needle
+that are least likely to appear in the haystack according to this table. It ranks each byte by how often it appears
+in a mix of source code and prose, with 0 being the rarest and 255 the most common.
+*/
+static const unsigned char c89str_g_byteFrequencyRank[256] = {
+     66,  49,  32,  21,  44,  20,  43,  39,  42, 184, 245,  48,  63,  57,  19,  31,  /* 0x00 */
+     47,  11,  10,  30,  41,   9,   8,  29,  18,  28,  38,  17,  16,  27,   7,  15,  /* 0x10 */
+    255, 163, 197, 213, 156, 164, 165, 212, 236, 237, 223, 167, 235, 195, 215, 217,  /* 0x20 */
+    218, 214, 198, 193, 187, 201, 182, 181, 183, 196, 204, 199, 185, 192, 188, 162,  /* 0x30 */
+    177, 222, 200, 227, 209, 239, 206, 205, 190, 229, 169, 194, 228, 208, 233, 231,  /* 0x40 */
+    221, 166, 225, 243, 230, 202, 191, 173, 210, 189, 172, 179, 186, 178, 155, 253,  /* 0x50 */
+    168, 246, 216, 244, 241, 254, 238, 219, 232, 249, 170, 224, 242, 226, 250, 247,  /* 0x60 */
+    240, 174, 248, 251, 252, 234, 207, 203, 211, 220, 180, 176, 171, 175, 161,  46,  /* 0x70 */
+    147, 145, 136, 131, 119, 100, 111, 144, 142, 125,  84,  78, 113,  94,  88, 148,  /* 0x80 */
+    122, 137, 117, 118, 140, 127, 150,  96, 116, 139, 123,  93, 126, 103,  91, 158,  /* 0x90 */
+    128, 120,  90, 104, 133,  99, 102, 129, 108, 141,  82,  79,  80,  98, 107,  85,  /* 0xA0 */
+    105, 132, 106, 124, 112, 101, 130, 109, 154, 143,  86, 121, 135, 115, 114,  92,  /* 0xB0 */
+     14,  26, 138, 151,  77,  81,  56,  55,  59,  67,  64,  51,  62,  50, 152, 134,  /* 0xC0 */
+    160, 149,  60,  58,  54,  61, 110, 146,  97,  95,  53,  52,   6,   5,   4,  37,  /* 0xD0 */
+    153,  89, 159,  87,  68,  76,  75,  74,  73,  72,  71,  70,  69,  65,   3,  83,  /* 0xE0 */
+    157,  13,  36,  45,   2,   1,  12,  35,  34,   0,  33,  25,  24,  23,  40,  22   /* 0xF0 */
+};
+
+/*
+These return false if they gave up because too much time was being spent comparing candidates. In that case *pOffset
+will be set to the offset at which the search should be resumed with Two-Way. Otherwise *pOffset will be set to the
+offset of the needle, or c89str_npos if it wasn't found. The needle must be at least 2 bytes.
+*/
+static c89str_bool32 c89str_searcher_filter__scalar(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t off, size_t work, size_t* pOffset)
 {
-    if (str == NULL) {
-        return 0;
-    } else {
-        return c89str_get_len(str);
+    const char* pNeedle = pSearcher->pNeedle;
+    size_t needleLen    = pSearcher->needleLen;
+    size_t rareOffset1  = pSearcher->rareOffset1;
+    size_t rareOffset2  = pSearcher->rareOffset2;
+
+    C89STR_ASSERT(needleLen >= 2);
+
+    while (haystackLen - off >= needleLen) {
+        const char* pRare;
+        const char* pCandidate;
+
+        if (work > (off + needleLen) * C89STR_FIND_WORK_FACTOR) {
+            *pOffset = off;
+            return C89STR_FALSE;
+        }
+
+        pRare = c89str_memchr(pHaystack + off + rareOffset1, haystackLen - off - needleLen + 1, pNeedle[rareOffset1]);
+        if (pRare == NULL) {
+            break;
+        }
+
+        pCandidate = pRare - rareOffset1;
+        if (pCandidate[rareOffset2] == pNeedle[rareOffset2] && C89STR_COMPARE_MEMORY(pCandidate, pNeedle, needleLen) == 0) {
+            *pOffset = (size_t)(pCandidate - pHaystack);
+            return C89STR_TRUE;
+        }
+
+        work += needleLen;
+        off   = (size_t)(pCandidate - pHaystack) + 1;
     }
+
+    *pOffset = c89str_npos;
+    return C89STR_TRUE;
 }
 
-C89STR_API size_t c89str_cap(const c89str str)
+#if defined(C89STR_SUPPORT_SSE2)
+static c89str_bool32 c89str_searcher_filter__sse2(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pOffset)
 {
-    if (str == NULL) {
-        return 0;
-    } else {
-        return c89str_get_cap(str);
+    const char* pNeedle = pSearcher->pNeedle;
+    size_t needleLen    = pSearcher->needleLen;
+    size_t rareOffset1  = pSearcher->rareOffset1;
+    size_t rareOffset2  = pSearcher->rareOffset2;
+    const __m128i rare1 = _mm_set1_epi8(pNeedle[rareOffset1]);
+    const __m128i rare2 = _mm_set1_epi8(pNeedle[rareOffset2]);
+    size_t off  = 0;
+    size_t work = 0;
+
+    /* Both blocks are loaded from within (off + needleLen - 1 + 16) which must be inside the haystack. */
+    while (haystackLen - off >= needleLen - 1 + 16) {
+        unsigned int mask;
+
+        if (work > (off + needleLen) * C89STR_FIND_WORK_FACTOR) {
+            *pOffset = off;
+            return C89STR_FALSE;
+        }
+
+        mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(rare1, _mm_loadu_si128((const __m128i*)(pHaystack + off + rareOffset1))),
+            _mm_cmpeq_epi8(rare2, _mm_loadu_si128((const __m128i*)(pHaystack + off + rareOffset2)))));
+
+        while (mask != 0) {
+            size_t candidate = off + c89str_ctz32(mask);
+            if (C89STR_COMPARE_MEMORY(pHaystack + candidate, pNeedle, needleLen) == 0) {
+                *pOffset = candidate;
+                return C89STR_TRUE;
+            }
+
+            work += needleLen;
+            mask &= mask - 1;
+        }
+
+        off += 16;
     }
+
+    return c89str_searcher_filter__scalar(pSearcher, pHaystack, haystackLen, off, work, pOffset);
 }
+#endif
 
-C89STR_API errno_t c89str_result(const c89str str)
+#if defined(C89STR_SUPPORT_AVX2)
+static c89str_bool32 c89str_searcher_filter__avx2(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pOffset)
 {
-    return c89str_get_res(str);
-}
+    const char* pNeedle = pSearcher->pNeedle;
+    size_t needleLen    = pSearcher->needleLen;
+    size_t rareOffset1  = pSearcher->rareOffset1;
+    size_t rareOffset2  = pSearcher->rareOffset2;
+    const __m256i rare1 = _mm256_set1_epi8(pNeedle[rareOffset1]);
+    const __m256i rare2 = _mm256_set1_epi8(pNeedle[rareOffset2]);
+    size_t off  = 0;
+    size_t work = 0;
+
+    while (haystackLen - off >= needleLen - 1 + 32) {
+        c89str_uint32 mask;
+
+        if (work > (off + needleLen) * C89STR_FIND_WORK_FACTOR) {
+            *pOffset = off;
+            return C89STR_FALSE;
+        }
 
+        mask = (c89str_uint32)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(rare1, _mm256_loadu_si256((const __m256i*)(pHaystack + off + rareOffset1))),
+            _mm256_cmpeq_epi8(rare2, _mm256_loadu_si256((const __m256i*)(pHaystack + off + rareOffset2)))));
 
+        while (mask != 0) {
+            size_t candidate = off + c89str_ctz32(mask);
+            if (C89STR_COMPARE_MEMORY(pHaystack + candidate, pNeedle, needleLen) == 0) {
+                *pOffset = candidate;
+                return C89STR_TRUE;
+            }
 
+            work += needleLen;
+            mask &= mask - 1;
+        }
 
-/* Begin Unicode */
-static C89STR_INLINE c89str_bool32 c89str_is_invalid_utf8_octet(c89str_utf8 utf8)
-{
-    /* RFC 3629 - Section 1: The octet values C0, C1, F5 to FF never appear. */
-    return (unsigned char)utf8 == 0xC0 || (unsigned char)utf8 == 0xC1 || (unsigned char)utf8 >= 0xF5;
+        off += 32;
+    }
+
+    return c89str_searcher_filter__scalar(pSearcher, pHaystack, haystackLen, off, work, pOffset);
 }
+#endif
 
-static C89STR_INLINE void c89str_utf32_cp_to_utf16_pair(c89str_utf32 utf32cp, c89str_utf16* pUTF16)
+#if defined(C89STR_SUPPORT_NEON)
+static c89str_bool32 c89str_searcher_filter__neon(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pOffset)
 {
-    /* RFC 2781 - Section 2.1 */
-    c89str_utf32 u;
+    const char* pNeedle    = pSearcher->pNeedle;
+    size_t needleLen       = pSearcher->needleLen;
+    size_t rareOffset1     = pSearcher->rareOffset1;
+    size_t rareOffset2     = pSearcher->rareOffset2;
+    const uint8x16_t rare1 = vdupq_n_u8((c89str_uint8)pNeedle[rareOffset1]);
+    const uint8x16_t rare2 = vdupq_n_u8((c89str_uint8)pNeedle[rareOffset2]);
+    size_t off  = 0;
+    size_t work = 0;
+
+    while (haystackLen - off >= needleLen - 1 + 16) {
+        c89str_uint64 mask;
+
+        if (work > (off + needleLen) * C89STR_FIND_WORK_FACTOR) {
+            *pOffset = off;
+            return C89STR_FALSE;
+        }
 
-    C89STR_ASSERT(utf32cp >= 0x10000);
+        mask = c89str_neon_movemask_u8x16(vandq_u8(
+            vceqq_u8(rare1, vld1q_u8((const c89str_uint8*)(pHaystack + off + rareOffset1))),
+            vceqq_u8(rare2, vld1q_u8((const c89str_uint8*)(pHaystack + off + rareOffset2)))));
 
-    u = utf32cp - 0x10000;
-    pUTF16[0] = (c89str_utf16)(0xD800 | ((u & 0xFFC00) >> 10));
-    pUTF16[1] = (c89str_utf16)(0xDC00 | ((u & 0x003FF) >>  0));
-}
+        while (mask != 0) {
+            unsigned int bit = c89str_ctz64(mask);
+            size_t candidate = off + (bit / 4);
+            if (C89STR_COMPARE_MEMORY(pHaystack + candidate, pNeedle, needleLen) == 0) {
+                *pOffset = candidate;
+                return C89STR_TRUE;
+            }
 
-static C89STR_INLINE c89str_utf32 c89str_utf16_pair_to_utf32_cp(const c89str_utf16* pUTF16)
-{
-    /* RFC 2781 - Section 2.1 */
-    C89STR_ASSERT(pUTF16 != NULL);
+            work += needleLen;
+            mask &= ~((c89str_uint64)0xF << (bit & ~3U));
+        }
+
+        off += 16;
+    }
 
-    return (((c89str_utf32)(pUTF16[0] & 0x003FF) << 10) | ((c89str_utf32)(pUTF16[1] & 0x003FF) << 0)) + 0x10000;
+    return c89str_searcher_filter__scalar(pSearcher, pHaystack, haystackLen, off, work, pOffset);
 }
+#endif
 
-static C89STR_INLINE c89str_bool32 c89str_is_cp_in_surrogate_pair_range(c89str_utf32 utf32)
+static c89str_bool32 c89str_searcher_filter(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pOffset)
 {
-    return utf32 >= 0xD800 && utf32 <= 0xDFFF;
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_searcher_filter__avx2(pSearcher, pHaystack, haystackLen, pOffset);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_searcher_filter__sse2(pSearcher, pHaystack, haystackLen, pOffset);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_searcher_filter__neon(pSearcher, pHaystack, haystackLen, pOffset);
+    }
+#endif
+
+    return c89str_searcher_filter__scalar(pSearcher, pHaystack, haystackLen, 0, 0, pOffset);
 }
 
-static C89STR_INLINE c89str_bool32 c89str_is_valid_code_point(c89str_utf32 utf32)
+
+/*
+Two-Way string matching (Crochemore and Perrin) with a bad character shift table in the style of musl's memmem().
+The needle is split at its critical factorization. The right half is compared left-to-right and the left half
+right-to-left. For periodic needles we remember how much of the needle is already known to match after a shift which
+is what gives us the linear worst case.
+*/
+static size_t c89str_twoway_maximal_suffix(const unsigned char* pNeedle, size_t needleLen, c89str_bool32 reversed, size_t* pPeriod)
 {
-    return utf32 <= C89STR_UNICODE_MAX_CODE_POINT && !c89str_is_cp_in_surrogate_pair_range(utf32);
+    size_t ip = (size_t)-1;
+    size_t jp = 0;
+    size_t k  = 1;
+    size_t p  = 1;
+
+    while (jp + k < needleLen) {
+        unsigned char a = pNeedle[ip + k];
+        unsigned char b = pNeedle[jp + k];
+
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k   = 1;
+            } else {
+                k  += 1;
+            }
+        } else if ((a > b) != reversed) {
+            jp += k;
+            k   = 1;
+            p   = jp - ip;
+        } else {
+            ip  = jp;
+            jp += 1;
+            k   = 1;
+            p   = 1;
+        }
+    }
+
+    *pPeriod = p;
+    return ip;
 }
 
-static C89STR_INLINE size_t c89str_utf32_cp_to_utf8_len(c89str_utf32 utf32)
+static void c89str_searcher_init_twoway(c89str_searcher* pSearcher)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
-    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
+    const unsigned char* pNeedle;
+    size_t needleLen;
+    size_t i;
+    size_t critPos;
+    size_t critPosRev;
+    size_t period;
+    size_t periodRev;
 
-    if (utf32 <= 0x7F) {
-        return 1;
+    C89STR_ASSERT(pSearcher != NULL);
+
+    pNeedle   = (const unsigned char*)pSearcher->pNeedle;
+    needleLen = pSearcher->needleLen;
+
+    /*
+    The skip is the distance from the last occurrence of the byte to the end of the needle, or the whole length of the
+    needle if it's not there at all. Skipping less than that is always safe so it can be clamped.
+    */
+    for (i = 0; i < 256; i += 1) {
+        pSearcher->twoWaySkip[i] = (c89str_uint8)C89STR_MIN(needleLen, 255);
     }
-    if (utf32 <= 0x7FF) {
-        return 2;
+    for (i = 0; i < needleLen; i += 1) {
+        pSearcher->twoWaySkip[pNeedle[i]] = (c89str_uint8)C89STR_MIN(needleLen - i - 1, 255);
     }
-    if (utf32 <= 0xFFFF) {
-        return 3;
+
+    /* The critical factorization is the later of the two maximal suffixes. */
+    critPos    = c89str_twoway_maximal_suffix(pNeedle, needleLen, C89STR_FALSE, &period);
+    critPosRev = c89str_twoway_maximal_suffix(pNeedle, needleLen, C89STR_TRUE,  &periodRev);
+    if (critPosRev + 1 > critPos + 1) {
+        critPos = critPosRev;
+        period  = periodRev;
     }
-    if (utf32 <= 0x10FFFF) {
-        return 4;
+
+    /* If the left half is not repeated after a shift by the period, the needle is not periodic. */
+    if (C89STR_COMPARE_MEMORY(pNeedle, pNeedle + period, critPos + 1) != 0) {
+        pSearcher->twoWayMemory = 0;
+        pSearcher->twoWayPeriod = C89STR_MAX(critPos + 1, needleLen - critPos - 1) + 1;
+    } else {
+        pSearcher->twoWayMemory = needleLen - period;
+        pSearcher->twoWayPeriod = period;
     }
 
-    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
-    C89STR_ASSERT(C89STR_FALSE);
-    return 0; /* Invalid. */
+    pSearcher->twoWayCritPos = critPos;
 }
 
-static C89STR_INLINE size_t c89str_utf32_cp_to_utf8(c89str_utf32 utf32, c89str_utf8* pUTF8, size_t utf8Cap)
+static size_t c89str_searcher_find_twoway(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
-    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
-    C89STR_ASSERT(utf8Cap > 0);
+    const unsigned char* h = (const unsigned char*)pHaystack;
+    const unsigned char* n = (const unsigned char*)pSearcher->pNeedle;
+    size_t l   = pSearcher->needleLen;
+    size_t ms  = pSearcher->twoWayCritPos;
+    size_t off = 0;
+    size_t mem = 0;
+
+    while (haystackLen - off >= l) {
+        size_t k;
+
+        /* Check the last byte first. If it's not a match we can skip ahead based on where the byte is in the needle. */
+        k = pSearcher->twoWaySkip[h[off + l - 1]];
+        if (k != 0) {
+            if (k < mem) {
+                k = mem;
+            }
 
-    if (utf32 <= 0x7F) {
-        if (utf8Cap >= 1) {
-            pUTF8[0] = (utf32 & 0x7F);
-            return 1;
+            off += k;
+            mem  = 0;
+            continue;
         }
-    }
-    if (utf32 <= 0x7FF) {
-        if (utf8Cap >= 2) {
-            pUTF8[0] = 0xC0 | (c89str_utf8)((utf32 & 0x07C0) >> 6);
-            pUTF8[1] = 0x80 | (c89str_utf8) (utf32 & 0x003F);
-            return 2;
+
+        /* Compare the right half. */
+        for (k = C89STR_MAX(ms + 1, mem); k < l && n[k] == h[off + k]; k += 1) {
         }
-    }
-    if (utf32 <= 0xFFFF) {
-        if (utf8Cap >= 3) {
-            pUTF8[0] = 0xE0 | (c89str_utf8)((utf32 & 0xF000) >> 12);
-            pUTF8[1] = 0x80 | (c89str_utf8)((utf32 & 0x0FC0) >>  6);
-            pUTF8[2] = 0x80 | (c89str_utf8) (utf32 & 0x003F);
-            return 3;
+        if (k < l) {
+            off += k - ms;
+            mem  = 0;
+            continue;
         }
-    }
-    if (utf32 <= 0x10FFFF) {
-        if (utf8Cap >= 4) {
-            pUTF8[0] = 0xF0 | (c89str_utf8)((utf32 & 0x1C0000) >> 18);
-            pUTF8[1] = 0x80 | (c89str_utf8)((utf32 & 0x03F000) >> 12);
-            pUTF8[2] = 0x80 | (c89str_utf8)((utf32 & 0x000FC0) >>  6);
-            pUTF8[3] = 0x80 | (c89str_utf8) (utf32 & 0x00003F);
-            return 4;
+
+        /* Compare the left half. */
+        for (k = ms + 1; k > mem && n[k - 1] == h[off + k - 1]; k -= 1) {
         }
+        if (k <= mem) {
+            return off;
+        }
+
+        off += pSearcher->twoWayPeriod;
+        mem  = pSearcher->twoWayMemory;
     }
 
-    /* Getting here means there was not enough room in the output buffer. */
-    return 0;
+    return c89str_npos;
 }
 
-static C89STR_INLINE size_t c89str_utf32_cp_to_utf16_len(c89str_utf32 utf32)
+
+/* This does everything except initialize the Two-Way state which is more expensive, and only needed for long needles. */
+static void c89str_searcher_init_filter(c89str_searcher* pSearcher, const char* pNeedle, size_t needleLen)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
-    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
+    size_t i;
+    unsigned char rareByte1;
 
-    if (utf32 <= 0xFFFF) {
-        return 1;
-    } else {
-        return 2;
+    C89STR_ASSERT(pSearcher != NULL);
+    C89STR_ASSERT(needleLen > 0);
+
+    pSearcher->pNeedle   = pNeedle;
+    pSearcher->needleLen = needleLen;
+
+    /* The first filter byte is the rarest byte in the needle. */
+    pSearcher->rareOffset1 = 0;
+    for (i = 1; i < needleLen; i += 1) {
+        if (c89str_g_byteFrequencyRank[(unsigned char)pNeedle[i]] < c89str_g_byteFrequencyRank[(unsigned char)pNeedle[pSearcher->rareOffset1]]) {
+            pSearcher->rareOffset1 = i;
+        }
     }
 
-    /* Unreachable. */
-#if 0
-    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
-    C89STR_ASSERT(C89STR_FALSE);
-    return 0; /* Invalid. */
-#endif
+    /* The second filter byte is the rarest byte that's different to the first. If every byte is the same, just use the byte at the other end. */
+    rareByte1 = (unsigned char)pNeedle[pSearcher->rareOffset1];
+    pSearcher->rareOffset2 = (pSearcher->rareOffset1 == needleLen - 1) ? 0 : needleLen - 1;
+    for (i = 0; i < needleLen; i += 1) {
+        unsigned char b = (unsigned char)pNeedle[i];
+        if (b != rareByte1) {
+            if ((unsigned char)pNeedle[pSearcher->rareOffset2] == rareByte1 || c89str_g_byteFrequencyRank[b] < c89str_g_byteFrequencyRank[(unsigned char)pNeedle[pSearcher->rareOffset2]]) {
+                pSearcher->rareOffset2 = i;
+            }
+        }
+    }
 }
 
-static C89STR_INLINE size_t c89str_utf32_cp_to_utf16(c89str_utf32 utf32, c89str_utf16* pUTF16, size_t utf16Cap)
+C89STR_API errno_t c89str_searcher_init(c89str_searcher* pSearcher, const char* pNeedle, size_t needleLen)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
-    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
-    C89STR_ASSERT(utf16Cap > 0);
+    if (pSearcher == NULL) {
+        return EINVAL;
+    }
 
-    if (utf32 <= 0xFFFF) {
-        if (utf16Cap >= 1) {
-            pUTF16[0] = (c89str_utf16)utf32;
-            return 1;
-        }
-    } else {
-        if (utf16Cap >= 2) {
-            c89str_utf32_cp_to_utf16_pair(utf32, pUTF16);
-            return 2;
-        }
+    C89STR_ZERO_OBJECT(pSearcher);
+
+    if (pNeedle == NULL) {
+        return EINVAL;
     }
 
-    /* Getting here means there was not enough room in the output buffer. */
-    return 0;
-}
+    if (needleLen == (size_t)-1) {
+        needleLen = c89str_strlen(pNeedle);
+    }
 
+    if (needleLen == 0) {
+        return EINVAL;
+    }
 
+    c89str_searcher_init_filter(pSearcher, pNeedle, needleLen);
+    c89str_searcher_init_twoway(pSearcher);
 
-C89STR_API c89str_bool32 c89str_utf16_is_bom_le(const unsigned char bom[2])
-{
-    /* RFC 2781 - Section 3.2 */
-    return bom[0] == 0xFF && bom[1] == 0xFE;
+    return C89STR_SUCCESS;
 }
 
-C89STR_API c89str_bool32 c89str_utf16_is_bom_be(const unsigned char bom[2])
+/*
+Handles everything that doesn't need Two-Way. Returns false if Two-Way is required, in which case *pOffset is the
+offset from which it needs to start searching. Otherwise *pOffset is the offset of the needle, or c89str_npos.
+*/
+static c89str_bool32 c89str_searcher_find_fast(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pOffset)
 {
-    /* RFC 2781 - Section 3.2 */
-    return bom[0] == 0xFE && bom[1] == 0xFF;
-}
+    *pOffset = 0;
 
-C89STR_API c89str_bool32 c89str_utf32_is_bom_le(const unsigned char bom[4])
-{
-    return bom[0] == 0xFF && bom[1] == 0xFE && bom[2] == 0x00 && bom[3] == 0x00;
-}
+    if (pSearcher->needleLen > haystackLen) {
+        *pOffset = c89str_npos;
+        return C89STR_TRUE;
+    }
 
-C89STR_API c89str_bool32 c89str_utf32_is_bom_be(const unsigned char bom[4])
-{
-    return bom[0] == 0x00 && bom[1] == 0x00 && bom[2] == 0xFE && bom[3] == 0xFF;
-}
+    if (pSearcher->needleLen == 1) {
+        const char* pFound = c89str_memchr(pHaystack, haystackLen, pSearcher->pNeedle[0]);
+        if (pFound == NULL) {
+            *pOffset = c89str_npos;
+        } else {
+            *pOffset = (size_t)(pFound - pHaystack);
+        }
 
-C89STR_API c89str_bool32 c89str_utf8_has_bom(const unsigned char* pBytes, size_t len)
-{
-    if (pBytes == NULL) {
-        return C89STR_FALSE;
+        return C89STR_TRUE;
     }
 
-    if (len < 3) {
-        return C89STR_FALSE;
+    if (pSearcher->needleLen <= C89STR_FIND_SHORT_NEEDLE_MAX) {
+        return c89str_searcher_filter(pSearcher, pHaystack, haystackLen, pOffset);
     }
 
-    return (pBytes[0] == 0xEF && pBytes[1] == 0xBB && pBytes[2] == 0xBF);
+    return C89STR_FALSE;
 }
 
-C89STR_API c89str_bool32 c89str_utf16_has_bom(const unsigned char* pBytes, size_t len)
+static size_t c89str_searcher_find_offset(const c89str_searcher* pSearcher, const char* pHaystack, size_t haystackLen)
 {
-    if (pBytes == NULL) {
-        return C89STR_FALSE;
+    size_t offset;
+    size_t found;
+
+    if (c89str_searcher_find_fast(pSearcher, pHaystack, haystackLen, &offset)) {
+        return offset;
     }
 
-    if (len < 2) {
-        return C89STR_FALSE;
+    found = c89str_searcher_find_twoway(pSearcher, pHaystack + offset, haystackLen - offset);
+    if (found == c89str_npos) {
+        return c89str_npos;
     }
 
-    return c89str_utf16_is_bom_le(pBytes) || c89str_utf16_is_bom_be(pBytes);
+    return offset + found;
 }
 
-C89STR_API c89str_bool32 c89str_utf32_has_bom(const unsigned char* pBytes, size_t len)
+C89STR_API errno_t c89str_searcher_find(const c89str_searcher* pSearcher, const char* str, size_t strLen, size_t* pResult)
 {
-    if (pBytes == NULL) {
-        return C89STR_FALSE;
+    if (pResult == NULL) {
+        return EINVAL;
     }
 
-    if (len < 4) {
-        return C89STR_FALSE;
+    *pResult = c89str_npos;
+
+    if (pSearcher == NULL || pSearcher->pNeedle == NULL || str == NULL) {
+        return EINVAL;
     }
 
-    return c89str_utf32_is_bom_le(pBytes) || c89str_utf32_is_bom_be(pBytes);
-}
+    if (strLen == (size_t)-1) {
+        strLen = c89str_strlen(str);
+    }
 
+    if (strLen == 0) {
+        return EINVAL;
+    }
 
-C89STR_API void c89str_utf16_swap_endian(c89str_utf16* pUTF16, size_t count)
-{
-    if (count == (size_t)-1) {
-        size_t i;
-        for (i = 0; i < count; ++i) {
-            pUTF16[i] = c89str_swap_endian_uint16(pUTF16[i]);
-        }
-    } else {
-        while (pUTF16[0] != 0) {
-            pUTF16[0] = c89str_swap_endian_uint16(pUTF16[0]);
-            pUTF16 += 1;
-        }
+    *pResult = c89str_searcher_find_offset(pSearcher, str, strLen);
+    if (*pResult == c89str_npos) {
+        return ENOENT;
     }
+
+    return C89STR_SUCCESS;
 }
 
-C89STR_API void c89str_utf32_swap_endian(c89str_utf32* pUTF32, size_t count)
+C89STR_API errno_t c89str_searcher_find_all(const c89str_searcher* pSearcher, const char* str, size_t strLen, size_t* pOffsets, size_t offsetsCap, size_t* pCount)
 {
-    if (count == (size_t)-1) {
-        size_t i;
-        for (i = 0; i < count; ++i) {
-            pUTF32[i] = c89str_swap_endian_uint32(pUTF32[i]);
+    size_t offset;
+    size_t count;
+
+    if (pCount == NULL) {
+        return EINVAL;
+    }
+
+    *pCount = 0;
+
+    if (pSearcher == NULL || pSearcher->pNeedle == NULL || str == NULL) {
+        return EINVAL;
+    }
+
+    if (strLen == (size_t)-1) {
+        strLen = c89str_strlen(str);
+    }
+
+    if (strLen == 0) {
+        return EINVAL;
+    }
+
+    offset = 0;
+    count  = 0;
+    while (offset < strLen) {
+        size_t found = c89str_searcher_find_offset(pSearcher, str + offset, strLen - offset);
+        if (found == c89str_npos) {
+            break;
         }
-    } else {
-        while (pUTF32[0] != 0) {
-            pUTF32[0] = c89str_swap_endian_uint32(pUTF32[0]);
-            pUTF32 += 1;
+
+        if (pOffsets != NULL) {
+            if (count == offsetsCap) {
+                *pCount = count;
+                return ENOMEM;  /* Not enough room in the output buffer. */
+            }
+
+            pOffsets[count] = offset + found;
         }
+
+        count  += 1;
+        offset += found + pSearcher->needleLen;    /* Matches do not overlap. */
     }
-}
 
+    *pCount = count;
+    return C89STR_SUCCESS;
+}
 
-C89STR_API errno_t c89str_utf8_to_utf16_len(size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API errno_t c89str_findn(const char* str, size_t strLen, const char* other, size_t otherLen, size_t* pResult)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf16Len = 0;
+    c89str_searcher searcher;
+    size_t offset;
+    size_t found;
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    if (pResult == NULL) {
+        return EINVAL;
     }
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
+    *pResult = c89str_npos;
+
+    if (str == NULL || other == NULL) {
+        return EINVAL;
     }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;   /* Invalid input. */
+    if (strLen == (size_t)-1) {
+        strLen = c89str_strlen(str);
     }
 
-    if (utf8Len == 0 || pUTF8[0] == 0) {
-        return C89STR_SUCCESS;   /* Empty input string. Length is always 0. */
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(other);
     }
 
-    /* Check for BOM. */
-    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (strLen == 0 || otherLen == 0) {
+        return EINVAL;
+    }
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
+    /* This is a one-off search so the Two-Way state is only initialized if we actually need it. */
+    c89str_searcher_init_filter(&searcher, other, otherLen);
+
+    if (!c89str_searcher_find_fast(&searcher, str, strLen, &offset)) {
+        c89str_searcher_init_twoway(&searcher);
+
+        found = c89str_searcher_find_twoway(&searcher, str + offset, strLen - offset);
+        if (found == c89str_npos) {
+            offset = c89str_npos;
+        } else {
+            offset += found;
         }
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf8* pUTF8Original = pUTF8;
-        for (;;) {
-            if (pUTF8[0] == 0) {
-                break;  /* Reached the end of the null terminated string. */
-            }
+    if (offset == c89str_npos) {
+        return ENOENT;
+    }
 
-            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
-                utf16Len += 1;
-                pUTF8    += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        pUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    *pResult = offset;
+    return C89STR_SUCCESS;
+}
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16. */
-                        pUTF8    += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+C89STR_API errno_t c89str_find(const char* str, const char* other, size_t* pResult)
+{
+    return c89str_findn(str, (size_t)-1, other, (size_t)-1, pResult);
+}
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        pUTF8    += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        unsigned int cp;
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
 
-                        cp = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!c89str_is_valid_code_point(cp)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                pUTF8    += 4;
-                            }
-                        } else {
-                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
-                            pUTF8    += 4;
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            pUTF8    += 1;
-                        }
-                    }
-                }
-            }
+/*
+The multi searcher prefilter is based on Teddy from Hyperscan. Patterns are distributed among 8 buckets. For each of the
+first few bytes of the patterns there's a pair of 16 entry tables, indexed by the low and high nibble of a byte, with a
+bit set for each bucket that has a pattern with a matching nibble at that position. A byte shuffle does the lookups for
+a whole vector at a time, and a position can only be the start of a match if some bucket's bit survives the AND of every
+lookup. This needs a byte shuffle instruction which means it's only available with AVX2 and AArch64.
+
+With too many patterns the buckets fill up and every position looks like a candidate, at which point it's faster to
+just run the automaton.
+*/
+#define C89STR_MULTI_SEARCHER_PREFILTER_MAX_PATTERNS    32
+#define C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN         3
+#define C89STR_MULTI_SEARCHER_PREFILTER_BUCKETS         8
+#define C89STR_MULTI_SEARCHER_ROW_EXTRA                 2   /* The match and depth that follow the transitions in each row. */
+
+/*
+The prefilter tables in the form each implementation wants them. These are built once at the start of a search rather
+than on every call to the prefilter since the prefilter is called again each time the automaton drops back to the root.
+*/
+typedef struct
+{
+    c89str_uint32 simdFlags;
+#if defined(C89STR_SUPPORT_AVX2)
+    __m256i lo256[C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN];
+    __m256i hi256[C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN];
+#endif
+#if defined(C89STR_SUPPORT_NEON_TBL)
+    uint8x16_t lo128[C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN];
+    uint8x16_t hi128[C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN];
+#endif
+} c89str_multi_searcher_prefilter_tables;
+
+#if defined(C89STR_SUPPORT_AVX2)
+static size_t c89str_multi_searcher_prefilter__avx2(const c89str_multi_searcher* pSearcher, const c89str_multi_searcher_prefilter_tables* pTables, const char* pHaystack, size_t haystackLen, size_t off)
+{
+    __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    __m256i zero = _mm256_setzero_si256();
+    size_t len = pSearcher->prefilterLen;
+    size_t k;
+
+    while (haystackLen - off >= 32 + len - 1) {
+        __m256i candidates = _mm256_set1_epi8((char)0xFF);
+        c89str_uint32 mask;
+
+        for (k = 0; k < len; k += 1) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)(pHaystack + off + k));
+            __m256i loNibbles = _mm256_and_si256(bytes, nibbleMask);
+            __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask);
+
+            candidates = _mm256_and_si256(candidates, _mm256_and_si256(_mm256_shuffle_epi8(pTables->lo256[k], loNibbles), _mm256_shuffle_epi8(pTables->hi256[k], hiNibbles)));
         }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        mask = ~(c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(candidates, zero));
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                utf16Len += 1;
-                iUTF8    += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        iUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        iUTF8    += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+        off += 32;
+    }
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        iUTF8    += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        unsigned int cp;
-                        if (iUTF8+3 > utf8Len) {
-                            return EINVAL;
-                        }
+    return off;
+}
+#endif
 
-                        cp = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!c89str_is_valid_code_point(cp)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                iUTF8    += 4;
-                            }
-                        } else {
-                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
-                            iUTF8    += 4;
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            iUTF8    += 1;
-                        }
-                    }
-                }
-            }
+#if defined(C89STR_SUPPORT_NEON_TBL)
+static size_t c89str_multi_searcher_prefilter__neon(const c89str_multi_searcher* pSearcher, const c89str_multi_searcher_prefilter_tables* pTables, const char* pHaystack, size_t haystackLen, size_t off)
+{
+    uint8x16_t nibbleMask = vdupq_n_u8(0x0F);
+    size_t len = pSearcher->prefilterLen;
+    size_t k;
+
+    while (haystackLen - off >= 16 + len - 1) {
+        uint8x16_t candidates = vdupq_n_u8(0xFF);
+        c89str_uint64 mask;
+
+        for (k = 0; k < len; k += 1) {
+            uint8x16_t bytes = vld1q_u8((const c89str_uint8*)(pHaystack + off + k));
+            candidates = vandq_u8(candidates, vandq_u8(vqtbl1q_u8(pTables->lo128[k], vandq_u8(bytes, nibbleMask)), vqtbl1q_u8(pTables->hi128[k], vshrq_n_u8(bytes, 4))));
         }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
+        mask = ~c89str_neon_movemask_u8x16(vceqq_u8(candidates, vdupq_n_u8(0)));
+        if (mask != 0) {
+            return off + (c89str_ctz64(mask) >> 2);
         }
-    }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+        off += 16;
     }
 
-    return result;
+    return off;
 }
+#endif
 
-C89STR_API errno_t c89str_utf8_to_utf16ne(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+static c89str_bool32 c89str_multi_searcher_has_prefilter(void)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf16CapOriginal = utf16Cap;
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
 
-    if (pUTF16 == NULL) {
-        return c89str_utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-    }
+    C89STR_UNUSED(simdFlags);
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return C89STR_TRUE;
     }
-
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
+#endif
+#if defined(C89STR_SUPPORT_NEON_TBL)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return C89STR_TRUE;
     }
+#endif
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
-    }
+    return C89STR_FALSE;
+}
 
-    /* Check for BOM. */
-    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;   /* Found a BOM, but it's forbidden. */
-        }
+static void c89str_multi_searcher_load_prefilter_tables(const c89str_multi_searcher* pSearcher, c89str_multi_searcher_prefilter_tables* pTables)
+{
+    size_t k;
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
+    C89STR_ZERO_OBJECT(pTables);
+    pTables->simdFlags = c89str_get_simd_flags();
+
+    for (k = 0; k < pSearcher->prefilterLen; k += 1) {
+    #if defined(C89STR_SUPPORT_AVX2)
+        if ((pTables->simdFlags & C89STR_SIMD_AVX2) != 0) {
+            __m128i t;
+
+            /* The shuffle works within each 128-bit lane so the tables need to be in both halves. */
+            t = _mm_loadu_si128((const __m128i*)pSearcher->prefilterMasks[k][0]);
+            pTables->lo256[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(t), t, 1);
+
+            t = _mm_loadu_si128((const __m128i*)pSearcher->prefilterMasks[k][1]);
+            pTables->hi256[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(t), t, 1);
         }
+    #endif
+    #if defined(C89STR_SUPPORT_NEON_TBL)
+        if ((pTables->simdFlags & C89STR_SIMD_NEON) != 0) {
+            pTables->lo128[k] = vld1q_u8((const c89str_uint8*)pSearcher->prefilterMasks[k][0]);
+            pTables->hi128[k] = vld1q_u8((const c89str_uint8*)pSearcher->prefilterMasks[k][1]);
+        }
+    #endif
     }
+}
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            if (utf16Cap == 1) {
-                result = ENOMEM;
-                break;
-            }
+/* Returns the offset of the first position at or after off which could be the start of a match. Positions near the end that can't be checked are treated as candidates. */
+static size_t c89str_multi_searcher_prefilter(const c89str_multi_searcher* pSearcher, const c89str_multi_searcher_prefilter_tables* pTables, const char* pHaystack, size_t haystackLen, size_t off)
+{
+    C89STR_UNUSED(pSearcher);
+    C89STR_UNUSED(pTables);
+    C89STR_UNUSED(pHaystack);
+    C89STR_UNUSED(haystackLen);
 
-            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF16[0] = pUTF8[0];
-                pUTF16   += 1;
-                utf16Cap -= 1;
-                pUTF8    += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        pUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((pTables->simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_multi_searcher_prefilter__avx2(pSearcher, pTables, pHaystack, haystackLen, off);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON_TBL)
+    if ((pTables->simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_multi_searcher_prefilter__neon(pSearcher, pTables, pHaystack, haystackLen, off);
+    }
+#endif
 
-                        pUTF16[0] = ((c89str_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        pUTF8    += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    return off;
+}
 
-                        pUTF16[0] = ((c89str_utf16)(pUTF8[0] & 0x0F) << 12) | ((c89str_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        pUTF8    += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        if (utf16Cap < 2) {
-                            break;  /* No enough room. */
-                        } else {
-                            unsigned int cp;
-                            if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                                result = EINVAL; /* Input string is too short. */
-                                break;
-                            }
+static void c89str_multi_searcher_init_prefilter(c89str_multi_searcher* pSearcher, const char* const* ppPatterns, size_t minPatternLen)
+{
+    size_t iPattern;
+    size_t k;
 
-                            cp = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                            if (!c89str_is_valid_code_point(cp)) {
-                                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                    result = C89STR_ECODEPOINT;
-                                    break;
-                                } else {
-                                    /* Replacement. */
-                                    pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                                    pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    pUTF8    += 4;
-                                }
-                            } else {
-                                c89str_utf32_cp_to_utf16_pair(cp, pUTF16);
-                                pUTF16   += 2;
-                                utf16Cap -= 2;
-                                pUTF8    += 4;
-                            }
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            pUTF8    += 1;
-                        }
-                    }
-                }
-            }
+    if (pSearcher->patternCount > C89STR_MULTI_SEARCHER_PREFILTER_MAX_PATTERNS || !c89str_multi_searcher_has_prefilter()) {
+        return; /* The prefilter will not be used. */
+    }
+
+    pSearcher->prefilterLen = (c89str_uint32)C89STR_MIN(minPatternLen, C89STR_MULTI_SEARCHER_PREFILTER_MAX_LEN);
+
+    for (iPattern = 0; iPattern < pSearcher->patternCount; iPattern += 1) {
+        unsigned char bucketBit = (unsigned char)(1 << (iPattern % C89STR_MULTI_SEARCHER_PREFILTER_BUCKETS));
+
+        for (k = 0; k < pSearcher->prefilterLen; k += 1) {
+            unsigned char b = (unsigned char)ppPatterns[iPattern][k];
+
+            pSearcher->prefilterMasks[k][0][b & 0x0F] |= bucketBit;
+            pSearcher->prefilterMasks[k][1][b >> 4]   |= bucketBit;
         }
+    }
+}
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+C89STR_API errno_t c89str_multi_searcher_init(c89str_multi_searcher* pSearcher, const char* const* ppPatterns, const size_t* pPatternLens, size_t patternCount, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t iPattern;
+    size_t iByte;
+    size_t iClass;
+    size_t totalLen;
+    size_t minPatternLen;
+    size_t maxStateCount;
+    size_t classCount;
+    size_t stateCount;
+    size_t rowSize;
+    c89str_uint32* pTable;
+    c89str_uint32* pFailures;
+    c89str_uint32* pQueue;
+    size_t queueHead;
+    size_t queueTail;
+    size_t classes[256];
+    void* pShrunk;
+
+    if (pSearcher == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pSearcher);
+
+    if (ppPatterns == NULL || patternCount == 0) {
+        return EINVAL;
+    }
+
+    pSearcher->pPatternLens = (size_t*)c89str_malloc(sizeof(*pSearcher->pPatternLens) * patternCount, pAllocationCallbacks);
+    if (pSearcher->pPatternLens == NULL) {
+        return ENOMEM;
+    }
+
+    pSearcher->patternCount = patternCount;
+
+    /* Lengths first so we know how big the automaton can get. */
+    totalLen      = 0;
+    minPatternLen = (size_t)-1;
+    for (iPattern = 0; iPattern < patternCount; iPattern += 1) {
+        size_t patternLen;
+
+        if (ppPatterns[iPattern] == NULL) {
+            c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+            return EINVAL;
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if (utf16Cap == 1) {
-                result = ENOMEM;
-                break;
-            }
 
-            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                pUTF16[0] = pUTF8[iUTF8+0];
-                pUTF16   += 1;
-                utf16Cap -= 1;
-                iUTF8    += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        iUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+        patternLen = (pPatternLens == NULL) ? (size_t)-1 : pPatternLens[iPattern];
+        if (patternLen == (size_t)-1) {
+            patternLen = c89str_strlen(ppPatterns[iPattern]);
+        }
 
-                        pUTF16[0] = ((c89str_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        iUTF8    += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+        if (patternLen == 0) {
+            c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+            return EINVAL;  /* Empty patterns would match everywhere. */
+        }
 
-                        pUTF16[0] = ((c89str_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((c89str_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        iUTF8    += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        if (utf16Cap < 2) {
-                            break;  /* No enough room. */
-                        } else {
-                            unsigned int cp;
-                            if (iUTF8+3 > utf8Len) {
-                                result = EINVAL;
-                                break;
-                            }
+        if (patternLen > (size_t)-1 - 1 - totalLen) {
+            c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+            return ENOMEM;
+        }
 
-                            cp = ((c89str_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
-                            if (!c89str_is_valid_code_point(cp)) {
-                                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                    result = C89STR_ECODEPOINT;
-                                    break;
-                                } else {
-                                    /* Replacement. */
-                                    pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                                    pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    iUTF8    += 4;
-                                }
-                            } else {
-                                c89str_utf32_cp_to_utf16_pair(cp, pUTF16);
-                                pUTF16   += 2;
-                                utf16Cap -= 2;
-                                iUTF8    += 4;
-                            }
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            iUTF8    += 1;
-                        }
-                    }
-                }
+        pSearcher->pPatternLens[iPattern] = patternLen;
+        totalLen += patternLen;
+        minPatternLen = C89STR_MIN(minPatternLen, patternLen);
+    }
+
+    /*
+    Each byte that appears in a pattern gets its own class, and every other byte shares class 0. This keeps the
+    transition table small since it only needs a column for each class rather than every byte.
+    */
+    C89STR_ZERO_MEMORY(classes, sizeof(classes));
+    classCount = 1;
+    for (iPattern = 0; iPattern < patternCount; iPattern += 1) {
+        for (iByte = 0; iByte < pSearcher->pPatternLens[iPattern]; iByte += 1) {
+            unsigned char b = (unsigned char)ppPatterns[iPattern][iByte];
+            if (classes[b] == 0) {
+                classes[b] = classCount;
+                classCount += 1;
             }
         }
+    }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
-        }
+    /* If every byte is used, class 0 is empty and the classes need to be shifted down to fit in a byte. */
+    iClass = (classCount > 256) ? 1 : 0;
+    classCount -= iClass;
+    for (iByte = 0; iByte < 256; iByte += 1) {
+        pSearcher->byteClasses[iByte] = (unsigned char)(classes[iByte] - iClass);
     }
 
-    /* Null terminate. */
-    if (utf16Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF16[0] = 0;
+    /*
+    The trie can't have more states than there are pattern bytes, plus the root. Each state is a row with a transition for
+    each class followed by the state's match and depth. Transitions are the offset of the target row rather than the
+    index of the state which saves a multiply on every byte. These offsets are 32-bit.
+    */
+    maxStateCount = totalLen + 1;
+    rowSize = classCount + C89STR_MULTI_SEARCHER_ROW_EXTRA;
+    if (maxStateCount > (size_t)0xFFFFFFFF / rowSize || maxStateCount > ((size_t)-1 / sizeof(c89str_uint32)) / rowSize) {
+        c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+        return ENOMEM;
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    pSearcher->classCount = classCount;
+
+    pTable = (c89str_uint32*)c89str_malloc(sizeof(c89str_uint32) * maxStateCount * rowSize, pAllocationCallbacks);
+    if (pTable == NULL) {
+        c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+        return ENOMEM;
     }
 
-    return result;
-}
+    pSearcher->pTable = pTable;
+    C89STR_ZERO_MEMORY(pTable, sizeof(c89str_uint32) * maxStateCount * rowSize);
 
-C89STR_API errno_t c89str_utf8_to_utf16le(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
-{
-    errno_t result;
-    size_t utf16Len;
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = c89str_utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    /* Build the trie. The root is row 0 which is never the child of any state so 0 can be used to mean "no child" while building. */
+    stateCount = 1;
+    for (iPattern = 0; iPattern < patternCount; iPattern += 1) {
+        size_t row = 0;
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+        for (iByte = 0; iByte < pSearcher->pPatternLens[iPattern]; iByte += 1) {
+            size_t iTransition = row + pSearcher->byteClasses[(unsigned char)ppPatterns[iPattern][iByte]];
+
+            if (pTable[iTransition] == 0) {
+                pTable[iTransition] = (c89str_uint32)(stateCount * rowSize);
+                pTable[pTable[iTransition] + classCount + 1] = pTable[row + classCount + 1] + 1;   /* Depth. */
+                stateCount += 1;
+            }
+
+            row = pTable[iTransition];
+        }
+
+        if (pTable[row + classCount] == 0) {
+            pTable[row + classCount] = (c89str_uint32)(iPattern + 1);
+        }
     }
 
-    if (result != C89STR_SUCCESS) {
-        return result;
+    pSearcher->stateCount = stateCount;
+
+
+    /*
+    Now compute the failure links in breadth first order and fold them into the transition table so that every state
+    has a transition for every class. When a state is dequeued its own row contains only its children, and the row of
+    its failure state has already been completed since it's shallower. Each state also inherits the match of its
+    failure state if it doesn't have one of its own, which will be the longest pattern that's a suffix of the state.
+    */
+    pFailures = (c89str_uint32*)c89str_malloc(sizeof(c89str_uint32) * stateCount * 2, pAllocationCallbacks);
+    if (pFailures == NULL) {
+        c89str_multi_searcher_uninit(pSearcher, pAllocationCallbacks);
+        return ENOMEM;
     }
 
-    if (pUTF16 != NULL && !c89str_is_little_endian()) {
-        c89str_utf16_swap_endian(pUTF16, utf16Len);
+    pQueue = pFailures + stateCount;
+    queueHead = 0;
+    queueTail = 0;
+
+    for (iClass = 0; iClass < classCount; iClass += 1) {
+        c89str_uint32 child = pTable[iClass];
+        if (child != 0) {
+            pFailures[child / rowSize] = 0;
+            pQueue[queueTail++] = child;
+        }
     }
 
-    return C89STR_SUCCESS;
-}
+    while (queueHead < queueTail) {
+        c89str_uint32 row = pQueue[queueHead++];
+        c89str_uint32 failureRow = pFailures[row / rowSize];
 
-C89STR_API errno_t c89str_utf8_to_utf16be(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
-{
-    errno_t result;
-    size_t utf16Len;
+        for (iClass = 0; iClass < classCount; iClass += 1) {
+            c89str_uint32 child = pTable[row + iClass];
+            if (child != 0) {
+                c89str_uint32 childFailureRow = pTable[failureRow + iClass];
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = c89str_utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+                pFailures[child / rowSize] = childFailureRow;
+                if (pTable[child + classCount] == 0) {
+                    pTable[child + classCount] = pTable[childFailureRow + classCount];
+                }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+                pQueue[queueTail++] = child;
+            } else {
+                pTable[row + iClass] = pTable[failureRow + iClass];
+            }
+        }
     }
 
-    if (result != C89STR_SUCCESS) {
-        return result;
-    }
+    c89str_free(pFailures, pAllocationCallbacks);
 
-    if (pUTF16 != NULL && !c89str_is_big_endian()) {
-        c89str_utf16_swap_endian(pUTF16, utf16Len);
+    /* Patterns that share prefixes will have left some of the table unused. */
+    if (stateCount < maxStateCount) {
+        pShrunk = c89str_realloc(pTable, sizeof(c89str_uint32) * stateCount * rowSize, pAllocationCallbacks);
+        if (pShrunk != NULL) {
+            pSearcher->pTable = (c89str_uint32*)pShrunk;
+        }
     }
 
+    c89str_multi_searcher_init_prefilter(pSearcher, ppPatterns, minPatternLen);
+
     return C89STR_SUCCESS;
 }
 
-C89STR_API errno_t c89str_utf8_to_utf32_len(size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API void c89str_multi_searcher_uninit(c89str_multi_searcher* pSearcher, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf32Len = 0;
-
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    if (pSearcher == NULL) {
+        return;
     }
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
+    if (pSearcher->pTable != NULL) {
+        c89str_free(pSearcher->pTable, pAllocationCallbacks);
     }
-
-    if (pUTF8 == NULL) {
-        return EINVAL;   /* Invalid input. */
+    if (pSearcher->pPatternLens != NULL) {
+        c89str_free(pSearcher->pPatternLens, pAllocationCallbacks);
     }
 
-    if (utf8Len == 0 || pUTF8[0] == 0) {
-        return C89STR_SUCCESS;   /* Empty input string. Length is always 0. */
+    C89STR_ZERO_OBJECT(pSearcher);
+}
+
+/*
+Finds the leftmost-longest match. A plain Aho-Corasick scan reports matches in order of where they end, so once we've got
+a match we need to keep going until it's impossible for anything to start at or before it. The depth of the current state
+is the length of the longest suffix of the text that could still become a match, so that happens as soon as that suffix
+starts after the match we've got.
+*/
+static size_t c89str_multi_searcher_find_offset(const c89str_multi_searcher* pSearcher, const char* pHaystack, size_t haystackLen, size_t* pPatternIndex)
+{
+    const c89str_uint32* pTable = pSearcher->pTable;
+    const unsigned char* pByteClasses = pSearcher->byteClasses;
+    size_t classCount = pSearcher->classCount;
+    size_t matchOffset;
+    size_t matchLen;
+    size_t matchIndex;
+    c89str_uint32 row = 0;
+    size_t i = 0;
+
+    if (pPatternIndex != NULL) {
+        *pPatternIndex = c89str_npos;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+    /* Run the automaton until the first match. This is where almost all of the time is spent so keep it tight. */
+    if (pSearcher->prefilterLen > 0) {
+        c89str_multi_searcher_prefilter_tables prefilterTables;
+        c89str_multi_searcher_load_prefilter_tables(pSearcher, &prefilterTables);
+
+        for (;;) {
+            /* The prefilter can only be used from the root. Anywhere else we're in the middle of a potential match. */
+            if (row == 0) {
+                i = c89str_multi_searcher_prefilter(pSearcher, &prefilterTables, pHaystack, haystackLen, i);
+            }
+
+            if (i == haystackLen) {
+                return c89str_npos;
+            }
+
+            row = pTable[row + pByteClasses[(unsigned char)pHaystack[i]]];
+            i += 1;
+
+            if (pTable[row + classCount] != 0) {
+                break;
+            }
         }
+    } else {
+        for (;;) {
+            if (i == haystackLen) {
+                return c89str_npos;
+            }
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
+            row = pTable[row + pByteClasses[(unsigned char)pHaystack[i]]];
+            i += 1;
+
+            if (pTable[row + classCount] != 0) {
+                break;
+            }
         }
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            utf32Len += 1;
-            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF8 += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        pUTF8 += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        pUTF8 += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        unsigned int cp;
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        cp = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!c89str_is_valid_code_point(cp)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                            }
-                        }
-                        pUTF8 += 4;
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF8 += 1;
-                        }
-                    }
-                }
+    matchIndex  = pTable[row + classCount] - 1;
+    matchLen    = pSearcher->pPatternLens[matchIndex];
+    matchOffset = i - matchLen;
+
+    /* Now keep going until nothing can start at or before the match we've got. */
+    while (i < haystackLen && i - pTable[row + classCount + 1] <= matchOffset) {
+        c89str_uint32 match;
+
+        row = pTable[row + pByteClasses[(unsigned char)pHaystack[i]]];
+        i += 1;
+
+        match = pTable[row + classCount];
+        if (match != 0) {
+            size_t len   = pSearcher->pPatternLens[match - 1];
+            size_t start = i - len;
+
+            if (start < matchOffset || (start == matchOffset && len > matchLen)) {
+                matchOffset = start;
+                matchLen    = len;
+                matchIndex  = match - 1;
             }
         }
+    }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            utf32Len += 1;
-            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                iUTF8 += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        iUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        iUTF8 += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        iUTF8 += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        unsigned int cp;
-                        if (iUTF8+3 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        cp = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!c89str_is_valid_code_point(cp)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                            }
-                        }
-
-                        iUTF8 += 4;
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            iUTF8 += 1;
-                        }
-                    }
-                }
-            }
-        }
-
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
-        }
+    if (pPatternIndex != NULL) {
+        *pPatternIndex = matchIndex;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
-
-    return result;
+    return matchOffset;
 }
 
-
-C89STR_API errno_t c89str_utf8_to_utf32ne(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API errno_t c89str_multi_searcher_find(const c89str_multi_searcher* pSearcher, const char* str, size_t strLen, size_t* pResult, size_t* pPatternIndex)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf32CapOriginal = utf32Cap;
-
-    if (pUTF32 == NULL) {
-        return c89str_utf8_to_utf32_len(pUTF32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    if (pPatternIndex != NULL) {
+        *pPatternIndex = c89str_npos;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    if (pResult == NULL) {
+        return EINVAL;
     }
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
-    }
+    *pResult = c89str_npos;
 
-    if (pUTF8 == NULL) {
+    if (pSearcher == NULL || pSearcher->pTable == NULL || str == NULL) {
         return EINVAL;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
-
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
-        }
+    if (strLen == (size_t)-1) {
+        strLen = c89str_strlen(str);
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF32[0] = pUTF8[0];
-                pUTF8 += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    if (strLen == 0) {
+        return EINVAL;
+    }
 
-                        pUTF32[0] = ((c89str_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
-                        pUTF8 += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    *pResult = c89str_multi_searcher_find_offset(pSearcher, str, strLen, pPatternIndex);
+    if (*pResult == c89str_npos) {
+        return ENOENT;
+    }
 
-                        pUTF32[0] = ((c89str_utf16)(pUTF8[0] & 0x0F) << 12) | ((c89str_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
-                        pUTF8 += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    return C89STR_SUCCESS;
+}
 
-                        pUTF32[0] = ((c89str_utf32)(pUTF8[0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        pUTF8 += 4;
+C89STR_API int c89str_strncmpn(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
+{
+    if (str1 == str2) return  0;
 
-                        if (!c89str_is_valid_code_point(pUTF32[0])) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;   /* No characters should be in the UTF-16 surrogate pair range. */
-                                break;
-                            } else {
-                                /* Replacement. */
-                                pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF8 += 1;
-                        }
-                    }
-                }
-            }
+    /* These checks differ from the standard implementation. It's not important, but I prefer it just for sanity. */
+    if (str1 == NULL) return -1;
+    if (str2 == NULL) return  1;
 
-            pUTF32   += 1;
-            utf32Cap -= 1;
+    /* This function still needs to check for null terminators even though the length has been specified. */
+    for (;;) {
+        if (str1Len == 0 || str1[0] == '\0') {
+            break;
+        }
+        if (str2Len == 0 || str2[0] == '\0') {
+            break;
         }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        if (str1[0] != str2[0]) {
+            break;
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
 
-            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                pUTF32[0] = pUTF8[iUTF8+0];
-                iUTF8 += 1;
-            } else {
-                if (c89str_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                        iUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+        str1 += 1;
+        str2 += 1;
+        str1Len -= 1;
+        str2Len -= 1;
+    }
 
-                        pUTF32[0] = ((c89str_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
-                        iUTF8 += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+    /* If at this point we reached the end of both strings, they're equal. */
+    if (str1Len == 0 && str2Len == 0) return 0;
+    if (str1Len == 0) return -1;
+    if (str2Len == 0) return  1;
 
-                        pUTF32[0] = ((c89str_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((c89str_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
-                        iUTF8 += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        if (iUTF8+3 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+    /* Getting here means we haven't reached the end according to the specified lengths, so just compare the last characters. */
+    return ((unsigned char*)str1)[0] - ((unsigned char*)str2)[0];
+}
 
-                        pUTF32[0] = ((c89str_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((c89str_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((c89str_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
-                        iUTF8 += 4;
+C89STR_API c89str_bool32 c89str_begins_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
+{
+    if (str1 == str2) {
+        return C89STR_TRUE;
+    }
 
-                        if (!c89str_is_valid_code_point(pUTF32[0])) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-                    } else {
-                        if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = C89STR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF32[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            iUTF8 += 1;
-                        }
-                    }
-                }
-            }
+    if (str1 == NULL || str2 == NULL) {
+        return C89STR_FALSE;
+    }
 
-            pUTF32   += 1;
-            utf32Cap -= 1;
+    /* This function still needs to check for null terminators even though the length has been specified. */
+    for (;;) {
+        if (str1Len == 0 || str1[0] == '\0') {
+            break;
+        }
+        if (str2Len == 0 || str2[0] == '\0') {
+            break;
         }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
+        if (str1[0] != str2[0]) {
+            return C89STR_FALSE;
         }
-    }
 
-    /* Null terminate. */
-    if (utf32Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF32[0] = 0;
+        str1 += 1;
+        str2 += 1;
+        str1Len -= 1;
+        str2Len -= 1;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    /* Getting here means we've reached the end of one or both strings. If we're at the end of the second string it must mean that the first string begins with it. */
+    if (str2Len == 0 || str2[0] == '\0') {
+        return C89STR_TRUE;
     }
 
-    return result;
+    /* Getting here means we're not at the end of the second string so we must have reached the end of the first string. */
+    return C89STR_FALSE;
 }
 
-C89STR_API errno_t c89str_utf8_to_utf32le(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API c89str_bool32 c89str_ends_with(const char* str1, size_t str1Len, const char* str2, size_t str2Len)
 {
-    errno_t result;
-    size_t utf32Len;
-
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = c89str_utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
+    if (str1 == NULL || str2 == NULL) {
+        return C89STR_FALSE;
     }
 
-    if (result != C89STR_SUCCESS) {
-        return result;
+    if (str1Len == (size_t)-1) {
+        str1Len = c89str_strlen(str1);
+    }
+    if (str2Len == (size_t)-1) {
+        str2Len = c89str_strlen(str2);
     }
 
-    if (pUTF32 != NULL && !c89str_is_little_endian()) {
-        c89str_utf32_swap_endian(pUTF32, utf32Len);
+    if (str1Len < str2Len) {
+        return C89STR_FALSE;
     }
 
-    return C89STR_SUCCESS;
+    return c89str_strncmp(str1 + str1Len - str2Len, str2, str2Len) == 0;
 }
 
-C89STR_API errno_t c89str_utf8_to_utf32be(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API errno_t c89str_to_uint(const char* str, size_t len, unsigned int* pValue)
 {
-    errno_t result;
-    size_t utf32Len;
+    unsigned int value = 0;
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = c89str_utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
+    if (pValue == NULL || str == NULL) {
+        return EINVAL;
     }
 
-    if (result != C89STR_SUCCESS) {
-        return result;
-    }
+    while (len > 0 && str[0] != '\0') {
+        if (str[0] >= '0' && str[0] <= '9') {
+            value *= 10;
+            value += str[0] - '0';
+        } else {
+            /* Not an integer. */
+            return EINVAL;
+        }
 
-    if (pUTF32 != NULL && !c89str_is_big_endian()) {
-        c89str_utf32_swap_endian(pUTF32, utf32Len);
+        len -= 1;
+        str += 1;
     }
 
+    *pValue = value;
+
     return C89STR_SUCCESS;
 }
 
-C89STR_API errno_t c89str_utf8_to_wchar_len(size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+C89STR_API errno_t c89str_to_int(const char* str, size_t len, int* pValue)
 {
-#if C89STR_SIZEOF_WCHAR_T == 2
-    return c89str_utf8_to_utf16_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-#else
-    return c89str_utf8_to_utf32_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-#endif
-}
+    int sign  = 1;
+    int value = 0;
 
-C89STR_API errno_t c89str_utf8_to_wchar(wchar_t* pWCHAR, size_t wcharCap, size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
-{
-#if C89STR_SIZEOF_WCHAR_T == 2
-    return c89str_utf8_to_utf16((c89str_utf16*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-#else
-    return c89str_utf8_to_utf32((c89str_utf32*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-#endif
-}
+    if (pValue == NULL || str == NULL || len == 0) {
+        return EINVAL;
+    }
 
+    if (str[0] == '-') {
+        sign = -1;
+    } else {
+        sign = +1;
+    }
 
+    str += 1;
+    len -= 1;
 
-C89STR_API errno_t c89str_utf16_to_utf8_len_internal(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
-{
-    errno_t result = C89STR_SUCCESS;
-    size_t utf8Len = 0;
-    c89str_utf16 w1;
-    c89str_utf16 w2;
-    c89str_utf32 utf32;
+    while (len > 0 && str[0] != '\0') {
+        if (str[0] >= '0' && str[0] <= '9') {
+            value *= 10;
+            value += str[0] - '0';
+        } else {
+            /* Not an integer. */
+            return EINVAL;
+        }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+        str += 1;
+        len -= 1;
     }
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
+    *pValue = value * sign;
 
-    if (pUTF16 == NULL) {
-        return EINVAL; /* Invalid input. */
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_ascii_tolower(char* dst, size_t dstCap, const char* src, size_t srcLen)
+{
+    if (dst == NULL || src == NULL) {
+        return EINVAL;
     }
 
-    if (utf16Len == 0 || pUTF16[0] == 0) {
-        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    if (dstCap == 0) {
+        return ERANGE;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+    while (srcLen > 0 && src[0] != '\0') {
+        if (dstCap == 1) {
+            return ERANGE;
         }
 
-        pUTF16 += 1; /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
+        if (src[0] >= 'A' && src[0] <= 'Z') {
+            dst[0] = src[0] - 'A' + 'a';
+        } else {
+            dst[0] = src[0];
         }
+
+        dst += 1;
+        dstCap -= 1;
+        src += 1;
+        srcLen -= 1;
     }
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+    dst[0] = '\0';
+    
+    return C89STR_SUCCESS;
+}
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+C89STR_API errno_t c89str_ascii_toupper(char* dst, size_t dstCap, const char* src, size_t srcLen)
+{
+    if (dst == NULL || src == NULL) {
+        return EINVAL;
+    }
 
-                    pUTF16 += 1;
-                }
-            }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
 
-            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
+    while (srcLen > 0 && src[0] != '\0') {
+        if (dstCap == 1) {
+            return ERANGE;
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        if (src[0] >= 'a' && src[0] <= 'z') {
+            dst[0] = src[0] - 'a' + 'A';
+        } else {
+            dst[0] = src[0];
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
-            }
-
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+        dst += 1;
+        dstCap -= 1;
+        src += 1;
+        srcLen -= 1;
+    }
 
-                    iUTF16 += 1;
-                }
-            }
+    dst[0] = '\0';
+    
+    return C89STR_SUCCESS;
+}
 
-            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
-        }
+C89STR_API c89str_bool32 c89str_is_all_digits(const char* str, size_t strLen)
+{
+    if (str == NULL) {
+        return C89STR_FALSE;
+    }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
+    while (strLen > 0 && str[0] != '\0') {
+        if (str[0] < '0' || str[0] > '9') {
+            return C89STR_FALSE;
         }
-    }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = utf8Len;
+        str += 1;
+        strLen -= 1;
     }
 
-    return result;
+    return C89STR_TRUE;
 }
+/* END c89str_helpers.c */
 
-C89STR_API errno_t c89str_utf16ne_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+
+
+#ifndef C89STR_CAPACITY_GROWTH_NUMERATOR
+#define C89STR_CAPACITY_GROWTH_NUMERATOR    3
+#endif
+#ifndef C89STR_CAPACITY_GROWTH_DENOMINATOR
+#define C89STR_CAPACITY_GROWTH_DENOMINATOR  2
+#endif
+#ifndef C89STR_MIN_CAPACITY_GROWTH
+#define C89STR_MIN_CAPACITY_GROWTH          16
+#endif
+
+#if !defined(C89STR_COMPACT_HEADER)
+#define C89STR_HEADER_SIZE_IN_BYTES     (sizeof(size_t) + sizeof(size_t) + sizeof(size_t)) /* cap, len, result. Result is typed as size_t here for alignment reasons. */
+#define C89STR_MAX_HEADER_SIZE_IN_BYTES C89STR_HEADER_SIZE_IN_BYTES
+
+/* The top bit of the result is used to mark strings that live in a buffer owned by the application. */
+#define C89STR_RESULT_FLAG_EXTERNAL     ((size_t)1 << (sizeof(size_t)*8 - 1))
+
+static size_t c89str_allocation_size(size_t cap)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf16le_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return c89str_utf16be_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    }
+    return C89STR_HEADER_SIZE_IN_BYTES + cap + 1; /* +1 for null terminator. */
 }
 
-C89STR_API errno_t c89str_utf16le_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static void* c89str_to_allocation_address(c89str str)
 {
-    return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+    return (void*)(str - C89STR_HEADER_SIZE_IN_BYTES);
 }
 
-C89STR_API errno_t c89str_utf16be_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static c89str c89str_from_allocation_address(void* pAllocationAddress)
 {
-    return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+    return (char*)pAllocationAddress + C89STR_HEADER_SIZE_IN_BYTES;
 }
 
-C89STR_API errno_t c89str_utf16_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static void c89str_set_cap(c89str str, size_t cap)
 {
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    ((size_t*)c89str_to_allocation_address(str))[0] = cap;
+}
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+static size_t c89str_get_cap(const c89str str)
+{
+    return ((size_t*)c89str_to_allocation_address(str))[0];
+}
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+static size_t c89str_get_len(const c89str str)
+{
+    return ((size_t*)c89str_to_allocation_address(str))[1];
+}
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+static void c89str_store_len(c89str str, size_t len)
+{
+    ((size_t*)c89str_to_allocation_address(str))[1] = len;
+}
 
-        if (isLE) {
-            result = c89str_utf16le_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf16be_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+static c89str_bool32 c89str_is_external(const c89str str)
+{
+    return (((size_t*)c89str_to_allocation_address(str))[2] & C89STR_RESULT_FLAG_EXTERNAL) != 0;
+}
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
-        }
+static void c89str_set_res(c89str str, errno_t result)
+{
+    size_t* pHeader;
 
-        return result;
+    if (str == NULL) {
+        return;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf16ne_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    pHeader = (size_t*)c89str_to_allocation_address(str);
+    pHeader[2] = (pHeader[2] & C89STR_RESULT_FLAG_EXTERNAL) | (size_t)result;
 }
 
-
-C89STR_API errno_t c89str_utf16_to_utf8_internal(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+static errno_t c89str_get_res(const c89str str)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf8CapOriginal = utf8Cap;
-    c89str_utf16 w1;
-    c89str_utf16 w2;
-    c89str_utf32 utf32;
-    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
-
-    if (pUTF8 == NULL) {
-        return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+    /* If this is called with a null pointer, assume that NULL was returned from some function which should only happen in out-of-memory situations. */
+    if (str == NULL) {
+        return ENOMEM;
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    return (errno_t)(((size_t*)c89str_to_allocation_address(str))[2] & ~C89STR_RESULT_FLAG_EXTERNAL);
+}
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
+static c89str c89str_realloc_string(c89str str, size_t cap, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    void* pAllocation;
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
-    }
+    if (str != NULL && c89str_is_external(str)) {
+        /* We don't own the memory of external strings so they need to be moved into a new heap allocation. */
+        size_t len = C89STR_MIN(c89str_get_len(str), cap);
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        pAllocation = c89str_malloc(c89str_allocation_size(cap), pAllocationCallbacks);
+        if (pAllocation == NULL) {
+            return NULL;    /* Failed */
         }
 
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
+        C89STR_COPY_MEMORY(c89str_from_allocation_address(pAllocation), str, len);
+        c89str_store_len(c89str_from_allocation_address(pAllocation), len);
+        c89str_from_allocation_address(pAllocation)[len] = '\0';
+    } else {
+        pAllocation = c89str_realloc((str == NULL) ? NULL : c89str_to_allocation_address(str), c89str_allocation_size(cap), pAllocationCallbacks);
+        if (pAllocation == NULL) {
+            return NULL;    /* Failed */
         }
     }
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+    c89str_set_cap(c89str_from_allocation_address(pAllocation), cap);
+    ((size_t*)pAllocation)[2] = C89STR_SUCCESS; /* Also clears the external flag. */
 
-                    pUTF16 += 1;
-                }
-            }
+    return c89str_from_allocation_address(pAllocation);
+}
 
-            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+static c89str c89str_init_external(void* pBuffer, size_t bufferSizeInBytes)
+{
+    char* pHeader = (char*)pBuffer;
+    size_t misalignment = (size_t)((c89str_uintptr)pHeader & (sizeof(size_t) - 1));
+    c89str str;
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
+    /* The header is accessed as an array of size_t so it needs to be aligned. */
+    if (misalignment != 0) {
+        if (bufferSizeInBytes < sizeof(size_t) - misalignment) {
+            return NULL;
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+        pHeader           += sizeof(size_t) - misalignment;
+        bufferSizeInBytes -= sizeof(size_t) - misalignment;
+    }
 
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
-            }
+    if (bufferSizeInBytes < C89STR_HEADER_SIZE_IN_BYTES + 1) {
+        return NULL;    /* Not enough room for the header and null terminator. */
+    }
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+    str = c89str_from_allocation_address(pHeader);
+    c89str_set_cap(str, bufferSizeInBytes - C89STR_HEADER_SIZE_IN_BYTES - 1);
+    c89str_store_len(str, 0);
+    ((size_t*)pHeader)[2] = C89STR_SUCCESS | C89STR_RESULT_FLAG_EXTERNAL;
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+    return str;
+}
+#else
+/*
+The compact header is laid out like this, immediately before the string data:
 
-                    iUTF16 += 1;
-                }
-            }
+    [cap][len][tag]
 
-            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+The tag is a single byte. The low 2 bits select the width of the cap and len fields which will be 1, 2, 4 or
+sizeof(size_t) bytes, whichever is the smallest that can hold the capacity. A short string therefore only has 3 bytes
+of overhead. The fields are not aligned.
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-        }
+The result is not stored separately because it's almost always a success. Instead, when a string is put into an error
+state the error flag is set in the tag and the result code is stored in the cap field. None of the mutating functions
+will touch the capacity of a string in an error state except to reallocate it which clears the error, so while in
+an error state the capacity is reported as the length which is always safe.
+*/
+#define C89STR_HEADER_TAG_CLASS_MASK    0x03
+#define C89STR_HEADER_TAG_ERROR         0x04
+#define C89STR_HEADER_TAG_EXTERNAL      0x08   /* The string lives in a buffer owned by the application. */
+#define C89STR_MAX_HEADER_SIZE_IN_BYTES (sizeof(size_t) + sizeof(size_t) + 1)
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
-    }
-    
-    /* Null terminate. */
-    if (utf8Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF8[0] = 0;
+static size_t c89str_header_field_size(unsigned char tag)
+{
+    switch (tag & C89STR_HEADER_TAG_CLASS_MASK) {
+        case 0:  return 1;
+        case 1:  return 2;
+        case 2:  return 4;
+        default: return sizeof(size_t);
     }
+}
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+static size_t c89str_header_size(unsigned char tag)
+{
+    return c89str_header_field_size(tag)*2 + 1;
+}
+
+/* Returns the smallest class that can store the given capacity. */
+static unsigned char c89str_header_class(size_t cap)
+{
+    if (cap <= 0xFF) {
+        return 0;
+    }
+    if (cap <= 0xFFFF) {
+        return 1;
+    }
+    if (((cap >> 16) >> 16) == 0) {     /* Split shift so it's valid when size_t is 32-bit. */
+        return 2;
     }
 
-    return result;
+    return 3;
 }
 
-C89STR_API errno_t c89str_utf16ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static size_t c89str_read_header_field(const char* pField, size_t fieldSize)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return c89str_utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    switch (fieldSize) {
+        case 1:
+        {
+            return *(const unsigned char*)pField;
+        }
+        case 2:
+        {
+            c89str_uint16 value;
+            C89STR_COPY_MEMORY(&value, pField, sizeof(value));
+            return value;
+        }
+        case 4:
+        {
+            c89str_uint32 value;
+            C89STR_COPY_MEMORY(&value, pField, sizeof(value));
+            return value;
+        }
+        default:
+        {
+            size_t value;
+            C89STR_COPY_MEMORY(&value, pField, sizeof(value));
+            return value;
+        }
     }
 }
 
-C89STR_API errno_t c89str_utf16le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static void c89str_write_header_field(char* pField, size_t fieldSize, size_t value)
 {
-    return c89str_utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+    switch (fieldSize) {
+        case 1:
+        {
+            *(unsigned char*)pField = (unsigned char)value;
+        } break;
+        case 2:
+        {
+            c89str_uint16 value16 = (c89str_uint16)value;
+            C89STR_COPY_MEMORY(pField, &value16, sizeof(value16));
+        } break;
+        case 4:
+        {
+            c89str_uint32 value32 = (c89str_uint32)value;
+            C89STR_COPY_MEMORY(pField, &value32, sizeof(value32));
+        } break;
+        default:
+        {
+            C89STR_COPY_MEMORY(pField, &value, sizeof(value));
+        } break;
+    }
 }
 
-C89STR_API errno_t c89str_utf16be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static unsigned char c89str_get_tag(const c89str str)
 {
-    return c89str_utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+    return (unsigned char)str[-1];
 }
 
-C89STR_API errno_t c89str_utf16_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+/* Writes an entire header. The class is derived from the capacity. */
+static c89str c89str_write_header(char* pHeader, size_t cap, size_t len, unsigned char flags)
 {
-    if (pUTF8 == NULL) {
-        return c89str_utf16_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    }
+    unsigned char tag = (unsigned char)(c89str_header_class(cap) | flags);
+    size_t fieldSize = c89str_header_field_size(tag);
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    c89str_write_header_field(pHeader,             fieldSize, cap);
+    c89str_write_header_field(pHeader + fieldSize, fieldSize, len);
+    pHeader[fieldSize*2] = (char)tag;
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
-    }
+    return pHeader + fieldSize*2 + 1;
+}
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+static size_t c89str_allocation_size(size_t cap)
+{
+    return c89str_header_size(c89str_header_class(cap)) + cap + 1; /* +1 for null terminator. */
+}
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+static void* c89str_to_allocation_address(c89str str)
+{
+    return (void*)(str - c89str_header_size(c89str_get_tag(str)));
+}
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+static size_t c89str_get_len(const c89str str)
+{
+    size_t fieldSize = c89str_header_field_size(c89str_get_tag(str));
+    return c89str_read_header_field(str - 1 - fieldSize, fieldSize);
+}
 
-        if (isLE) {
-            result = c89str_utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+static void c89str_store_len(c89str str, size_t len)
+{
+    size_t fieldSize = c89str_header_field_size(c89str_get_tag(str));
+    c89str_write_header_field(str - 1 - fieldSize, fieldSize, len);
+}
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
-        }
+static size_t c89str_get_cap(const c89str str)
+{
+    unsigned char tag = c89str_get_tag(str);
+    size_t fieldSize;
 
-        return result;
+    if ((tag & C89STR_HEADER_TAG_ERROR) != 0) {
+        return c89str_get_len(str);
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf16ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    fieldSize = c89str_header_field_size(tag);
+    return c89str_read_header_field(str - 1 - fieldSize*2, fieldSize);
 }
 
+static c89str_bool32 c89str_is_external(const c89str str)
+{
+    return (c89str_get_tag(str) & C89STR_HEADER_TAG_EXTERNAL) != 0;
+}
 
-C89STR_API errno_t c89str_utf16_to_utf32_len_internal(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+static void c89str_set_res(c89str str, errno_t result)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf32Len = 0;
-    c89str_utf16 w1;
-    c89str_utf16 w2;
+    unsigned char tag;
+    size_t fieldSize;
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    if (str == NULL) {
+        return;
     }
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
+    tag = c89str_get_tag(str);
+    fieldSize = c89str_header_field_size(tag);
+
+    if (result == C89STR_SUCCESS) {
+        if ((tag & C89STR_HEADER_TAG_ERROR) != 0) {
+            /* The real capacity was lost when the error was stored. The length is a safe lower bound. */
+            c89str_write_header_field(str - 1 - fieldSize*2, fieldSize, c89str_get_len(str));
+            str[-1] = (char)(tag & ~C89STR_HEADER_TAG_ERROR);
+        }
+    } else {
+        /* Error codes are small, but clamp just in case the field is a single byte and the code isn't. */
+        size_t code = (size_t)result;
+        if (fieldSize == 1 && code > 0xFF) {
+            code = 0xFF;
+        }
+
+        c89str_write_header_field(str - 1 - fieldSize*2, fieldSize, code);
+        str[-1] = (char)(tag | C89STR_HEADER_TAG_ERROR);
     }
+}
 
-    if (pUTF16 == NULL) {
-        return EINVAL; /* Invalid input. */
+static errno_t c89str_get_res(const c89str str)
+{
+    unsigned char tag;
+    size_t fieldSize;
+
+    /* If this is called with a null pointer, assume that NULL was returned from some function which should only happen in out-of-memory situations. */
+    if (str == NULL) {
+        return ENOMEM;
     }
 
-    if (utf16Len == 0 || pUTF16[0] == 0) {
-        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    tag = c89str_get_tag(str);
+    if ((tag & C89STR_HEADER_TAG_ERROR) == 0) {
+        return C89STR_SUCCESS;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    fieldSize = c89str_header_field_size(tag);
+    return (errno_t)c89str_read_header_field(str - 1 - fieldSize*2, fieldSize);
+}
 
-        pUTF16 += 1; /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
+static c89str c89str_realloc_string(c89str str, size_t cap, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t newHeaderSize = c89str_header_size(c89str_header_class(cap));
+    size_t oldHeaderSize;
+    size_t len;
+    char* pOldAllocation;
+    char* pAllocation;
+
+    if (str == NULL) {
+        pAllocation = (char*)c89str_realloc(NULL, c89str_allocation_size(cap), pAllocationCallbacks);
+        if (pAllocation == NULL) {
+            return NULL;    /* Failed */
         }
-    }
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[1]);
-                        }
-                    
-                        /* Check for invalid code point. */
-                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            }
-                        }
+        str = c89str_write_header(pAllocation, cap, 0, 0);
+        str[0] = '\0';
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    }
+        return str;
+    }
 
-                    pUTF16 += 1;
-                }
-            }
+    len = C89STR_MIN(c89str_get_len(str), cap);
 
-            utf32Len += 1;
+    if (c89str_is_external(str)) {
+        /* We don't own the memory of external strings so they need to be moved into a new heap allocation. */
+        pAllocation = (char*)c89str_malloc(c89str_allocation_size(cap), pAllocationCallbacks);
+        if (pAllocation == NULL) {
+            return NULL;    /* Failed */
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
+        C89STR_COPY_MEMORY(pAllocation + newHeaderSize, str, len);
     } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
-            }
-
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        /* Check for invalid code point. */
-                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            }
-                        }
+        /*
+        The size of the header depends on the capacity so the content might need to be moved. When the header is
+        getting smaller it needs to be moved before the allocation shrinks, and when it's getting bigger it needs to be
+        moved after the allocation grows.
+        */
+        oldHeaderSize  = c89str_header_size(c89str_get_tag(str));
+        pOldAllocation = str - oldHeaderSize;
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    }
+        if (newHeaderSize < oldHeaderSize) {
+            C89STR_MOVE_MEMORY(pOldAllocation + newHeaderSize, str, len);
 
-                    iUTF16 += 1;
-                }
+            pAllocation = (char*)c89str_realloc(pOldAllocation, c89str_allocation_size(cap), pAllocationCallbacks);
+            if (pAllocation == NULL) {
+                pAllocation = pOldAllocation;   /* The old allocation is big enough. It'll just waste a bit of memory. */
+            }
+        } else {
+            pAllocation = (char*)c89str_realloc(pOldAllocation, c89str_allocation_size(cap), pAllocationCallbacks);
+            if (pAllocation == NULL) {
+                return NULL;    /* Failed */
             }
 
-            utf32Len += 1;
-        }
-
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
+            if (newHeaderSize > oldHeaderSize) {
+                C89STR_MOVE_MEMORY(pAllocation + newHeaderSize, pAllocation + oldHeaderSize, len);
+            }
         }
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
+    str = c89str_write_header(pAllocation, cap, len, 0);
+    str[len] = '\0';
 
-    return result;
+    return str;
 }
 
-C89STR_API errno_t c89str_utf16ne_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+static c89str c89str_init_external(void* pBuffer, size_t bufferSizeInBytes)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf16le_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return c89str_utf16be_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    unsigned char headerClass;
+
+    /* Use the smallest header that can describe the rest of the buffer. */
+    for (headerClass = 0; headerClass <= C89STR_HEADER_TAG_CLASS_MASK; headerClass += 1) {
+        size_t headerSize = c89str_header_size(headerClass);
+        size_t cap;
+
+        if (bufferSizeInBytes < headerSize + 1) {
+            return NULL;    /* Not enough room for the header and null terminator. */
+        }
+
+        cap = bufferSizeInBytes - headerSize - 1;
+        if (c89str_header_class(cap) <= headerClass) {
+            /* The capacity might fit in a smaller class than this one, in which case the header just starts a bit later in the buffer. */
+            return c89str_write_header((char*)pBuffer + headerSize - c89str_header_size(c89str_header_class(cap)), cap, 0, C89STR_HEADER_TAG_EXTERNAL);
+        }
     }
-}
 
-C89STR_API errno_t c89str_utf16le_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
-{
-    return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+    return NULL;    /* Should never get here. */
 }
+#endif
 
-C89STR_API errno_t c89str_utf16be_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+/* Returns the capacity to grow to when a string with the given capacity needs to fit requiredCap. */
+static size_t c89str_calculate_grown_cap(size_t cap, size_t requiredCap)
 {
-    return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
-}
+    size_t maxCap = (size_t)-1 - C89STR_MAX_HEADER_SIZE_IN_BYTES - 1;
+    size_t growth = 0;
 
-C89STR_API errno_t c89str_utf16_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
-{
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    if (C89STR_CAPACITY_GROWTH_NUMERATOR > C89STR_CAPACITY_GROWTH_DENOMINATOR) {
+        /* Split the multiplication so it can't overflow. */
+        growth = (cap / C89STR_CAPACITY_GROWTH_DENOMINATOR) * (C89STR_CAPACITY_GROWTH_NUMERATOR - C89STR_CAPACITY_GROWTH_DENOMINATOR)
+               + (cap % C89STR_CAPACITY_GROWTH_DENOMINATOR) * (C89STR_CAPACITY_GROWTH_NUMERATOR - C89STR_CAPACITY_GROWTH_DENOMINATOR) / C89STR_CAPACITY_GROWTH_DENOMINATOR;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
-
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
-
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
-
-        if (isLE) {
-            result = c89str_utf16le_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf16be_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
-
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;
-        }
+#if C89STR_MIN_CAPACITY_GROWTH > 0
+    if (growth < C89STR_MIN_CAPACITY_GROWTH) {
+        growth = C89STR_MIN_CAPACITY_GROWTH;
+    }
+#endif
 
-        return result;
+    if (cap > maxCap || growth > maxCap - cap) {
+        return requiredCap;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf16ne_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    return C89STR_MAX(cap + growth, requiredCap);
 }
 
-
-C89STR_API errno_t c89str_utf16_to_utf32_internal(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+static c89str c89str_realloc_string_if_necessary(c89str str, size_t requiredCap, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf32CapOriginal = utf32Cap;
-    c89str_utf16 w1;
-    c89str_utf16 w2;
-    c89str_utf32 utf32;
-
-    if (pUTF32 == NULL) {
-        return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
-    }
-
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
-    }
-
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
-
-    if (pUTF32 == NULL) {
-        return EINVAL;
-    }
+    if (str == NULL) {
+        /* Need to allocate a fresh string. Fresh strings are sized exactly. */
+        str = c89str_realloc_string(str, requiredCap, pAllocationCallbacks);
+    } else {
+        /* Don't necessarily need to allocate a fresh string, but might need to expand memory to make it fit. */
+        size_t cap = c89str_get_cap(str);
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+        if (cap < requiredCap) {
+            /* Grow geometrically so repeated appends are amortized O(1). If that much memory isn't available, try again with just what's needed. */
+            c89str newStr = c89str_realloc_string(str, c89str_calculate_grown_cap(cap, requiredCap), pAllocationCallbacks);
+            if (newStr == NULL) {
+                newStr = c89str_realloc_string(str, requiredCap, pAllocationCallbacks);
+            }
 
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
+            str = newStr;
         }
     }
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
-
-                    pUTF16 += 1;
-                }
-            }
+    return str;
+}
 
-            if (isLE) {
-                pUTF32[0] = c89str_host2le_32(utf32);
-            } else {
-                pUTF32[0] = c89str_host2be_32(utf32);
-            }
-            
-            pUTF32   += 1;
-            utf32Cap -= 1;
-        }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+C89STR_API void c89str_delete(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (str == NULL) {
+        return;
+    }
 
-            if (isLE) {
-                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
-            }
+    if (c89str_is_external(str)) {
+        return; /* The application owns the memory. */
+    }
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = C89STR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+    c89str_free(c89str_to_allocation_address(str), pAllocationCallbacks);
+}
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = C89STR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+C89STR_API c89str c89str_new_with_cap(const c89str_allocation_callbacks* pAllocationCallbacks, size_t capacityNotIncludingNullTerminator)
+{
+    c89str str = c89str_realloc_string(NULL, capacityNotIncludingNullTerminator, pAllocationCallbacks);
+    if (str == NULL) {
+        return NULL;    /* Failed */
+    }
 
-                    iUTF16 += 1;
-                }
-            }
+    c89str_set_len(str, 0);
+    str[0] = '\0';
 
-            if (isLE) {
-                pUTF32[0] = c89str_host2le_32(utf32);
-            } else {
-                pUTF32[0] = c89str_host2be_32(utf32);
-            }
+    return str;
+}
 
-            pUTF32   += 1;
-            utf32Cap -= 1;
-        }
+C89STR_API c89str c89str_new_with_buffer(void* pBuffer, size_t bufferSizeInBytes)
+{
+    c89str str;
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
-    }
-    
-    /* Null terminate. */
-    if (utf32Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF32[0] = 0;
+    if (pBuffer == NULL) {
+        return NULL;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    str = c89str_init_external(pBuffer, bufferSizeInBytes);
+    if (str == NULL) {
+        return NULL;    /* The buffer is too small. */
     }
 
-    return result;
+    str[0] = '\0';
+
+    return str;
 }
 
-C89STR_API errno_t c89str_utf16ne_to_utf32ne(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_new(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return c89str_utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    }
+    return c89str_set(NULL, pAllocationCallbacks, pOther);
 }
 
-C89STR_API errno_t c89str_utf16le_to_utf32le(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_newn(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
 {
-    return c89str_utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+    return c89str_setn(NULL, pAllocationCallbacks, pOther, otherLen);
 }
 
-C89STR_API errno_t c89str_utf16be_to_utf32be(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_newv(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
 {
-    return c89str_utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+    return c89str_setv(NULL, pAllocationCallbacks, pFormat, args);
 }
 
-C89STR_API errno_t c89str_utf16_to_utf32(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_newf(const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
 {
-    if (pUTF32 == NULL) {
-        return c89str_utf16_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    }
+    c89str str;
+    va_list args;
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
-    }
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-    if (pUTF32 == NULL) {
-        return EINVAL;
+    va_start(args, pFormat);
+    {
+        str = c89str_setv(NULL, pAllocationCallbacks, pFormat, args);
     }
+    va_end(args);
 
-    /* Check for BOM. */
-    if (c89str_utf16_has_bom((const unsigned char*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+    return str;
+}
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+C89STR_API c89str c89str_set(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
+{
+    return c89str_setn(str, pAllocationCallbacks, pOther, (size_t)-1);
+}
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+C89STR_API c89str c89str_setn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+{
+    if (pOther == NULL) {
+        pOther = "";
+    }
 
-        if (isLE) {
-            result = c89str_utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(pOther);
+    }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+    if (str != pOther) {
+        c89str str2 = c89str_realloc_string_if_necessary(str, otherLen, pAllocationCallbacks);
+        if (str2 == NULL) {
+            if (str != NULL) {
+                c89str_set_res(str, ENOMEM);
+            }
+
+            return str;
         }
 
-        return result;
+        str = str2;
+        C89STR_COPY_MEMORY(str, pOther, otherLen);   /* Will be explicitly null terminated later. */
+    } else {
+        /* str and pOther are the same string. No need for a data copy. */
+        C89STR_ASSERT(str != NULL);
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf16ne_to_utf32ne(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-}
+    /* Null terminate and set the length. */
+    str[otherLen] = '\0';
+    c89str_set_len(str, otherLen);
 
+    /* At this point we're done. */
+    return str;
+}
 
-C89STR_API errno_t c89str_utf32_to_utf8_len_internal(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+C89STR_API c89str c89str_setv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf8Len = 0;
-    c89str_utf32 utf32;
+    va_list args2;
+    int len;
+    c89str str2;
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
-    }
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+    va_copy(args2, args);
+#else
+    args2 = args;
+#endif
+    {
+        len = c89str_vsnprintf(NULL, 0, pFormat, args2);
+        if (len < 0) {
+            if (str != NULL) {
+                c89str_set_res(str, errno);
+            }
 
-    if (pUTF32 == NULL) {
-        return EINVAL; /* Invalid input. */
+            return str;
+        }
     }
+    va_end(args2);
 
-    if (utf32Len == 0 || pUTF32[0] == 0) {
-        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
-    }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+    /* Make sure there's enough room for the new string. */
+    str2 = c89str_realloc_string_if_necessary(str, len, pAllocationCallbacks);
+    if (str2 == NULL) {
+        if (str != NULL) {
+            c89str_set_res(str, ENOMEM);
         }
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+        return str;
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[0]);
-            }
-
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    /* Getting here means reallocation was successfull. */
+    str = str2;
+    str2 = NULL;    /* <-- Just to make sure we don't try using str2 again. The compiler will optimize this away. */
 
-            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
-            pUTF32  += 1;
-        }
+    /* We have enough room in the string so now we can just format straight into it. */
+    c89str_vsnprintf(str, len+1, pFormat, args);
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
-            }
+    /* The length needs to be set explicitly. The formatting will have written the null terminator. */
+    c89str_set_len(str, len);
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    /* We're done. */
+    return str;
+}
 
-            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
-        }
+C89STR_API c89str c89str_setf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+{
+    va_list args;
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
-        }
-    }
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = utf8Len;
+    va_start(args, pFormat);
+    {
+        str = c89str_setv(str, pAllocationCallbacks, pFormat, args);
     }
+    va_end(args);
 
-    return result;
+    return str;
 }
 
-C89STR_API errno_t c89str_utf32ne_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_cat(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf32le_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return c89str_utf32be_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    }
+    return c89str_catn(str, pAllocationCallbacks, pOther, (size_t)-1);
 }
 
-C89STR_API errno_t c89str_utf32le_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_catn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
 {
-    return c89str_utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
-}
+    c89str str2;
+    size_t len;
 
-C89STR_API errno_t c89str_utf32be_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
-}
+    if (str != NULL) {
+        if (c89str_get_res(str) != C89STR_SUCCESS) {
+            return str; /* The string is in an error state. */
+        }
+    }
 
-C89STR_API errno_t c89str_utf32_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (pOther == NULL) {
+        pOther = "";
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(pOther);
+    }
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (str == NULL) {
+        /* Input string is null. This is just an assignment. */
+        return c89str_setn(str, pAllocationCallbacks, pOther, otherLen);
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    /* str should never be null at this point. */
+    C89STR_ASSERT(str != NULL);
 
-        if (isLE) {
-            result = c89str_utf32le_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf32be_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+    len  = c89str_get_len(str);
+    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
+    if (str2 == NULL) {
+        c89str_set_res(str, ENOMEM);
+        return str;
+    }
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
-        }
+    str = str2;
+    C89STR_COPY_MEMORY(str + len, pOther, otherLen);   /* Will be explicitly null terminated later. */
 
-        return result;
-    }
+    /* Null terminate and set the length. */
+    str[len + otherLen] = '\0';
+    c89str_set_len(str, len + otherLen);
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf32ne_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    /* At this point we're done. */
+    return str;
 }
 
-
-C89STR_API errno_t c89str_utf32_to_utf8_internal(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+C89STR_API c89str c89str_catv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf8CapOriginal = utf8Cap;
-    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
-    c89str_utf32 utf32;
+    va_list args2;
+    size_t len;
+    int otherLen;
+    c89str str2;
 
-    if (pUTF8 == NULL) {
-        return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
-    }
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (str != NULL) {
+        if (c89str_get_res(str) != C89STR_SUCCESS) {
+            return str; /* The string is in an error state. */
+        }
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+    va_copy(args2, args);
+#else
+    args2 = args;
+#endif
+    {
+        otherLen = c89str_vsnprintf(NULL, 0, pFormat, args2);
+        if (otherLen < 0) {
+            if (str != NULL) {
+                c89str_set_res(str, errno);
+            }
+
+            return str;
+        }
     }
+    va_end(args2);
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
+
+    /* Make sure there's enough room for the new string. */
+    len = 0;
+    if (str != NULL) {
+        len = c89str_get_len(str);
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
+    if (str2 == NULL) {
+        if (str != NULL) {
+            c89str_set_res(str, ENOMEM);
         }
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+        return str;
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+    /* Getting here means reallocation was successfull. */
+    str = str2;
 
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[0]);
-            }
+    /* We have enough room in the string so now we can just format straight into it. */
+    c89str_vsnprintf(str + len, otherLen+1, pFormat, args);
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    /* The length needs to be set explicitly. The formatting will have written the null terminator. */
+    c89str_set_len(str, len + otherLen);
 
-            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    /* We're done. */
+    return str;
+}
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-            pUTF32  += 1;
-        }
+C89STR_API c89str c89str_catf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+{
+    va_list args;
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
-            }
+    va_start(args, pFormat);
+    {
+        str = c89str_catv(str, pAllocationCallbacks, pFormat, args);
+    }
+    va_end(args);
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    return str;
+}
 
-            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+C89STR_API c89str c89str_prepend(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther)
+{
+    return c89str_prependn(str, pAllocationCallbacks, pOther, (size_t)-1);
+}
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-        }
+C89STR_API c89str c89str_prependn(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+{
+    c89str str2;
+    size_t len;
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+    if (str != NULL) {
+        if (c89str_get_res(str) != C89STR_SUCCESS) {
+            return str; /* The string is in an error state. */
         }
     }
 
-    /* Null terminate. */
-    if (utf8Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF8[0] = 0;
+    if (pOther == NULL) {
+        pOther = "";
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(pOther);
     }
 
-    return result;
-}
+    if (str == NULL) {
+        /* Input string is null. This is just an assignment. */
+        return c89str_setn(str, pAllocationCallbacks, pOther, otherLen);
+    }
 
-C89STR_API errno_t c89str_utf32ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    if (c89str_is_little_endian()) {
-        return c89str_utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return c89str_utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    C89STR_ASSERT(str != NULL);
+
+    len  = c89str_get_len(str);
+    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
+    if (str2 == NULL) {
+        c89str_set_res(str, ENOMEM);
+        return str;
     }
-}
 
-C89STR_API errno_t c89str_utf32le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
-}
+    str = str2;
+    C89STR_MOVE_MEMORY(str + otherLen, str, len + 1);   /* Move the existing string to the right. +1 for the null terminator. */
+    C89STR_COPY_MEMORY(str, pOther, otherLen);          /* Copy the new string to the left. */
 
-C89STR_API errno_t c89str_utf32be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
+    /* Set the length (null terminator was already done. */
+    c89str_set_len(str, len + otherLen);
+
+    /* At this point we're done. */
+    return str;
 }
 
-C89STR_API errno_t c89str_utf32_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_prependv(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
 {
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    va_list args2;
+    size_t len;
+    int otherLen;
+    c89str str2;
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+    if (str != NULL) {
+        if (c89str_get_res(str) != C89STR_SUCCESS) {
+            return str; /* The string is in an error state. */
         }
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+    va_copy(args2, args);
+#else
+    args2 = args;
+#endif
+    {
+        otherLen = c89str_vsnprintf(NULL, 0, pFormat, args2);
+        if (otherLen < 0) {
+            if (str != NULL) {
+                c89str_set_res(str, errno);
+            }
 
-        if (isLE) {
-            result = c89str_utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+            return str;
         }
+    }
+    va_end(args2);
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+
+    /* Make sure there's enough room for the new string. */
+    len = 0;
+    if (str != NULL) {
+        len = c89str_get_len(str);
+    }
+
+    str2 = c89str_realloc_string_if_necessary(str, len + otherLen, pAllocationCallbacks);
+    if (str2 == NULL) {
+        if (str != NULL) {
+            c89str_set_res(str, ENOMEM);
         }
 
-        return result;
+        return str;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf32ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-}
+    str = str2;
+    str2 = NULL;    /* <-- Just to make sure we don't accidentally use str2 again. */
 
+    /*
+    Prepending is awkward here because we want to avoid as much data movement as possible which
+    means it makes sense to format straight into the string. We would need to move the existing
+    string down to make room for the new string, but the problem is that formatting straight into
+    the output buffer will result in the null terminator overwriting the first character of the
+    existing string.
 
+    What we're doing here is grabbing the first character of the existing string and storing it.
+    Then we move the existing string down to make room for the new string. We then format the new
+    string straight into the buffer which will result in the null terminator overwriting the first
+    character of the existing string. We then restore the first character of the existing string.
+    */
 
-C89STR_API errno_t c89str_utf32_to_utf16_len_internal(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
-{
-    errno_t result = C89STR_SUCCESS;
-    size_t utf16Len = 0;
-    c89str_utf32 utf32;
+    /* Grab the first character of the existing string. */
+    {
+        char firstChar = '\0';
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
-    }
+        if (len > 0) {
+            firstChar = str[0];
+        }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
-    }
+        /* Move the existing string down to make room for the new string. */
+        C89STR_MOVE_MEMORY(str + otherLen, str, len + 1);   /* +1 for the null terminator. */
 
-    if (pUTF32 == NULL) {
-        return EINVAL; /* Invalid input. */
-    }
+        /* Format the new string straight into the buffer. */
+        c89str_vsnprintf(str, len+1, pFormat, args);
 
-    if (utf32Len == 0 || pUTF32[0] == 0) {
-        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+        /* Restore the first character of the existing string. */
+        if (len > 0) {
+            str[otherLen] = firstChar;
+        }
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    /* The length needs to be set explicitly. The null terminator has already been dealt with. */
+    c89str_set_len(str, otherLen + len);
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    /* We're done. */
+    return str;
+}
+
+C89STR_API c89str c89str_prependf(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+{
+    va_list args;
+
+    C89STR_ASSERT(pFormat != NULL); /* Format cannot be null. */
+
+    va_start(args, pFormat);
+    {
+        str = c89str_prependv(str, pAllocationCallbacks, pFormat, args);
     }
+    va_end(args);
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[0]);
-            }
+    return str;
+}
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+C89STR_API c89str c89str_remove(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t beg, size_t end)
+{
+    size_t len;
+    size_t lenToRemove;
 
-            utf16Len += c89str_utf32_cp_to_utf16_len(utf32);
-            pUTF32   += 1;
-        }
+    C89STR_UNUSED(pAllocationCallbacks);
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
-            }
+    if (beg > end) {
+        return str;  /* The beginning must not be greater than the end. Nothing to remove. */
+    }
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    if (str == NULL) {
+        return NULL; /* Nothing to remove from. */
+    }
 
-            utf16Len += c89str_utf32_cp_to_utf16_len(utf32);
-        }
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
+    }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
-        }
+    len = c89str_get_len(str);
+    if (beg > len) {
+        return str; /* Trying to remove beyond the end of the string. */
+    }
+    if (end > len) {
+        end = len;  /* Trying to remove beyond the end of the string. Clamp the end. */
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+    lenToRemove = end - beg;
+    if (lenToRemove == 0) {
+        return str; /* Nothing to remove. */
     }
 
-    return result;
+    C89STR_MOVE_MEMORY(str + beg, str + end, len - end + 1); /* +1 to include the null terminator. */
+    c89str_set_len(str, len - lenToRemove);
+
+    /* We're done. */
+    return str;
 }
 
-errno_t c89str_utf32ne_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+static c89str c89str_replace_ex(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t replaceOffset, size_t replaceLen, const char* pOther, size_t otherLen, const char* pOtherPrepend, const char* pOtherAppend)
 {
-    if (c89str_is_little_endian()) {
-        return c89str_utf32le_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return c89str_utf32be_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    c89str newStr;
+    errno_t result;
+
+    if (str == NULL) {
+        return NULL; /* Nothing to replace. */
     }
-}
 
-C89STR_API errno_t c89str_utf32le_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
-}
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
+    }
 
-C89STR_API errno_t c89str_utf32be_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
-}
+    if (replaceOffset + replaceLen > c89str_get_len(str)) {
+        return str;
+    }
 
-C89STR_API errno_t c89str_utf32_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    /* We can allow pOther to be NULL in which case it can be the same as a remove. */
+    if (pOther == NULL) {
+        pOther = "";
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(pOther);
+    }
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    /* TODO: This can be made more efficient by doing the replacement in-place if the replacement string is the same or smaller in size. Can also optimize when there is no prepand nor append. */
 
-        if (isLE) {
-            result = c89str_utf32le_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = c89str_utf32be_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+    
+    /* The string is split into 3 sections: the part before the replace, the replacement itself, and the part after the replacement. */
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
-        }
+    /* Pre-replacement. */
+    newStr = c89str_newn(pAllocationCallbacks, str, replaceOffset);
 
-        return result;
+    /* Replacement. */
+    if (pOtherPrepend != NULL) { newStr = c89str_cat(newStr, pAllocationCallbacks, pOtherPrepend); }
+    {
+        newStr = c89str_catn(newStr, pAllocationCallbacks, pOther, otherLen);
     }
+    if (pOtherAppend  != NULL) { newStr = c89str_cat(newStr, pAllocationCallbacks, pOtherAppend);  }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf32ne_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    /* Post-replacement. */
+    newStr = c89str_catn(newStr, pAllocationCallbacks, str + (replaceOffset + replaceLen), c89str_get_len(str) - (replaceOffset + replaceLen));
+
+    /* Now check the result of the operation. */
+    result = c89str_result(newStr);
+    if (result != C89STR_SUCCESS) {
+        c89str_delete(newStr, pAllocationCallbacks);
+        c89str_set_res(str, result);
+        return str;
+    }
+
+    /* We're done. */
+    c89str_delete(str, pAllocationCallbacks);
+    str = newStr;
+
+    return str;
 }
 
+C89STR_API c89str c89str_replace(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t replaceOffset, size_t replaceLength, const char* pOther, size_t otherLength)
+{
+    return c89str_replace_ex(str, pAllocationCallbacks, replaceOffset, replaceLength, pOther, otherLength, NULL, NULL);
+}
 
-C89STR_API errno_t c89str_utf32_to_utf16_internal(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+C89STR_API c89str c89str_replace_all(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen)
 {
-    errno_t result = C89STR_SUCCESS;
-    size_t utf16CapOriginal = utf16Cap;
-    size_t utf16cpLen;  /* Code point length in UTF-8 code units. */
-    c89str_utf32 utf32;
+    return c89str_replace_all_ex(str, pAllocationCallbacks, pQuery, queryLen, pReplacement, replacementLen, (size_t)-1);
+}
 
-    if (pUTF16 == NULL) {
-        return c89str_utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+C89STR_API c89str c89str_replace_all_ex(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen, size_t maxReplacements)
+{
+    c89str_searcher searcher;
+    const char* pSrc;
+    size_t len;
+    size_t newLen;
+    size_t offset;
+    size_t count;
+    size_t replacementCount;
+
+    if (str == NULL) {
+        return NULL;
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+    if (pQuery == NULL) {
+        pQuery = "";
     }
 
-    if (pUTF16 == NULL) {
-        return EINVAL;
+    if (queryLen == (size_t)-1) {
+        queryLen = c89str_strlen(pQuery);
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (queryLen == 0) {
+        return str; /* Nothing to replace. */
+    }
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
+
+    if (pReplacement == NULL) {
+        pReplacement = "";
+    }
+
+    if (replacementLen == (size_t)-1) {
+        replacementLen = c89str_strlen(pReplacement);
+    }
+
+    len = c89str_get_len(str);
+    if (queryLen > len || maxReplacements == 0) {
+        return str; /* Nothing to replace. */
+    }
+
+
+    /* We can do an optimized implementation if we're replacing a single character. */
+    if (queryLen == 1 && replacementLen == 1) {
+        char* pFound;
+
+        offset = 0;
+        count  = 0;
+        while (count < maxReplacements && (pFound = (char*)c89str_memchr(str + offset, len - offset, pQuery[0])) != NULL) {
+            *pFound = pReplacement[0];
+            offset  = (size_t)(pFound - str) + 1;
+            count  += 1;
         }
+
+        return str;
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const c89str_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (utf16Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
 
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[0]);
-            }
+    /* The query is the same for every iteration so only preprocess it once. */
+    if (c89str_searcher_init(&searcher, pQuery, queryLen) != C89STR_SUCCESS) {
+        return str;
+    }
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    /*
+    The string is rewritten left to right with the unprocessed part of the string always at or ahead of the output. When
+    the replacement is no longer than the query this is naturally the case. Otherwise we count the matches so we know the
+    final length, resize once, and then move the original content to the end of the new buffer before rewriting. The
+    output can only grow by the total growth of the string so it never catches up to the part that's still to be read.
+    */
+    if (replacementLen <= queryLen) {
+        pSrc = str;
+        replacementCount = maxReplacements;
+    } else {
+        c89str newStr;
 
-            utf16cpLen = c89str_utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
-            if (utf16cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+        offset = 0;
+        count  = 0;
+        while (count < maxReplacements && offset < len) {
+            size_t location = c89str_searcher_find_offset(&searcher, str + offset, len - offset);
+            if (location == c89str_npos) {
                 break;
             }
 
-            if (isLE) {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
-                    pUTF16[1] = c89str_host2le_16(pUTF16[1]);
-                }
-            } else {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
-                    pUTF16[1] = c89str_host2be_16(pUTF16[1]);
-                }
-            }
+            offset += location + queryLen;
+            count  += 1;
+        }
 
-            pUTF16   += utf16cpLen;
-            utf16Cap -= utf16cpLen;
-            pUTF32   += 1;
+        if (count == 0) {
+            return str; /* Nothing to replace. */
         }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        if ((replacementLen - queryLen) > ((size_t)-1 - C89STR_MAX_HEADER_SIZE_IN_BYTES - 1 - len) / count) {
+            c89str_set_res(str, ENOMEM);
+            return str; /* Too big. */
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (utf16Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
 
-            if (isLE) {
-                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
-            }
+        newLen = len + (replacementLen - queryLen) * count;
 
-            if (!c89str_is_valid_code_point(utf32)) {
-                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = C89STR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
+        /* The final length is known so there's no point growing any further than that. */
+        if (c89str_get_cap(str) < newLen) {
+            newStr = c89str_realloc_string(str, newLen, pAllocationCallbacks);
+            if (newStr == NULL) {
+                c89str_set_res(str, ENOMEM);
+                return str;
             }
 
-            utf16cpLen = c89str_utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
-            if (utf16cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+            str = newStr;
+        }
 
-            if (isLE) {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
-                    pUTF16[1] = c89str_host2le_16(pUTF16[1]);
-                }
-            } else {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
-                    pUTF16[1] = c89str_host2be_16(pUTF16[1]);
-                }
-            }
 
-            pUTF16   += utf16cpLen;
-            utf16Cap -= utf16cpLen;
+        pSrc = str + (newLen - len);
+        C89STR_MOVE_MEMORY(str + (newLen - len), str, len);
+
+        replacementCount = count;
+    }
+
+    newLen = 0;
+    offset = 0;
+    count  = 0;
+    while (count < replacementCount && offset < len) {
+        size_t location = c89str_searcher_find_offset(&searcher, pSrc + offset, len - offset);
+        if (location == c89str_npos) {
+            break;
         }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+        if (str + newLen != pSrc + offset) {
+            C89STR_MOVE_MEMORY(str + newLen, pSrc + offset, location);
         }
-    }
+        newLen += location;
 
-    /* Null terminate. */
-    if (utf16Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF16[0] = 0;
+        C89STR_COPY_MEMORY(str + newLen, pReplacement, replacementLen);
+        newLen += replacementLen;
+
+        offset += location + queryLen;
+        count  += 1;
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    if (str + newLen != pSrc + offset) {
+        C89STR_MOVE_MEMORY(str + newLen, pSrc + offset, len - offset);
     }
+    newLen += len - offset;
 
-    return result;
-}
+    str[newLen] = '\0';
+    c89str_set_len(str, newLen);
 
-C89STR_API errno_t c89str_utf32ne_to_utf16ne(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    if (c89str_is_little_endian()) {
-        return c89str_utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return c89str_utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    }
+    return str;
 }
 
-C89STR_API errno_t c89str_utf32le_to_utf16le(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    return c89str_utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
-}
+#define C89STR_REPLACE_ALL_MULTI_STACK_LENS    32  /* Replacement lengths are resolved into a stack buffer up to this many patterns. */
 
-C89STR_API errno_t c89str_utf32be_to_utf16be(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+C89STR_API c89str c89str_replace_all_multi(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_multi_searcher* pSearcher, const char* const* ppReplacements, const size_t* pReplacementLens)
 {
-    return c89str_utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
-}
+    size_t  replacementLensStack[C89STR_REPLACE_ALL_MULTI_STACK_LENS];
+    size_t* pLens;
+    size_t  maxCap = (size_t)-1 - C89STR_MAX_HEADER_SIZE_IN_BYTES - 1;
+    c89str  newStr;
+    c89str  grownStr;
+    size_t  len;
+    size_t  newLen;
+    size_t  offset;
+    size_t  iPattern;
+    c89str_bool32 isInPlace;
 
-C89STR_API errno_t c89str_utf32_to_utf16(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
-{
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    if (str == NULL) {
+        return NULL;
     }
 
-    /* Check for BOM. */
-    if (c89str_utf32_has_bom((const unsigned char*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
+    }
 
-        c89str_bool32 isLE;
-        if ((flags & C89STR_FORBID_BOM) != 0) {
-            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (pSearcher == NULL || pSearcher->pTable == NULL || ppReplacements == NULL) {
+        return str; /* Nothing to replace. */
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
+    /* Resolve the length of each replacement once up front so we're not running strlen() on every match. */
+    if (pSearcher->patternCount <= C89STR_REPLACE_ALL_MULTI_STACK_LENS) {
+        pLens = replacementLensStack;
+    } else {
+        pLens = (size_t*)c89str_malloc(pSearcher->patternCount * sizeof(*pLens), pAllocationCallbacks);
+        if (pLens == NULL) {
+            c89str_set_res(str, ENOMEM);
+            return str;
         }
+    }
 
-        if (isLE) {
-            result = c89str_utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+    /*
+    If no replacement is longer than its pattern the string can never grow and the whole thing can be done in place. The
+    output never catches up with the part of the string that's still being searched.
+    */
+    isInPlace = C89STR_TRUE;
+    for (iPattern = 0; iPattern < pSearcher->patternCount; iPattern += 1) {
+        if (ppReplacements[iPattern] == NULL) {
+            pLens[iPattern] = 0;
+        } else if (pReplacementLens == NULL || pReplacementLens[iPattern] == (size_t)-1) {
+            pLens[iPattern] = c89str_strlen(ppReplacements[iPattern]);
         } else {
-            result = c89str_utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+            pLens[iPattern] = pReplacementLens[iPattern];
         }
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        if (pLens[iPattern] > pSearcher->pPatternLens[iPattern]) {
+            isInPlace = C89STR_FALSE;
         }
-
-        return result;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return c89str_utf32ne_to_utf16ne(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, pUTF32LenProcessed, flags);
-}
+    len = c89str_get_len(str);
 
+    /*
+    The string is rebuilt left to right in a single pass. Text between matches is copied as is. When the string can grow
+    the output goes into a new string which is grown geometrically as we go. It's not allocated until the first match so
+    there's no allocation at all if nothing matches.
+    */
+    newStr = (isInPlace) ? str : NULL;
+    newLen = 0;
+    offset = 0;
+    while (offset < len) {
+        size_t patternIndex;
+        size_t replacementLen;
+        size_t location = c89str_multi_searcher_find_offset(pSearcher, str + offset, len - offset, &patternIndex);
+        if (location == c89str_npos) {
+            break;
+        }
 
+        replacementLen = pLens[patternIndex];
 
-C89STR_API c89str_bool32 c89str_utf32_is_null_or_whitespace(const c89str_utf32* pUTF32, size_t utf32Len)
-{
-    if (pUTF32 == NULL) {
-        return C89STR_TRUE;
-    }
+        if (!isInPlace) {
+            if (location > maxCap - newLen || replacementLen > maxCap - newLen - location) {
+                goto error;  /* Too big. */
+            }
 
-    while (pUTF32[0] != 0 && utf32Len > 0) {
-        c89str_utf32 cp = pUTF32[0];
+            /* Growing can move the content when the size of the header changes and only the length stored in the header is kept. */
+            c89str_set_len(newStr, newLen);
 
-        pUTF32   += 1;
-        utf32Len -= 1;
-        
-        if (cp >= 0x09 && cp <= 0x0D) {
-            continue;
-        }
+            grownStr = c89str_realloc_string_if_necessary(newStr, C89STR_MAX(newLen + location + replacementLen, len), pAllocationCallbacks);
+            if (grownStr == NULL) {
+                goto error;
+            }
 
-        if (cp >= 0x2000 && cp <= 0x200A) {
-            continue;
+            newStr = grownStr;
         }
 
-        switch (cp) {
-            case 0x0020:
-            case 0x0085:
-            case 0x00A0:
-            case 0x1680:
-            case 0x2028:
-            case 0x2029:
-            case 0x202F:
-            case 0x205F:
-            case 0x3000:
-                continue;
+        if (newStr + newLen != str + offset) {
+            C89STR_MOVE_MEMORY(newStr + newLen, str + offset, location);
+        }
+        newLen += location;
 
-            default:
-                return C89STR_FALSE;
+        if (replacementLen > 0) {
+            C89STR_COPY_MEMORY(newStr + newLen, ppReplacements[patternIndex], replacementLen);
+            newLen += replacementLen;
         }
+
+        offset += location + pSearcher->pPatternLens[patternIndex];
     }
 
-    /* Getting here means we reached the end of the string without finding anything other than whitespace which means the string is entire whitespace. */
-    return C89STR_TRUE;
-}
+    if (pLens != replacementLensStack) {
+        c89str_free(pLens, pAllocationCallbacks);
+    }
+    pLens = NULL;
 
-C89STR_API c89str_bool32 c89str_utf32_is_newline(c89str_utf32 utf32)
-{
-    if (utf32 >= 0x0A && utf32 <= 0x0D) {
-        return C89STR_TRUE;
+    if (newStr == NULL) {
+        return str; /* Nothing to replace. */
     }
 
-    if (utf32 == 0x85) {
-        return C89STR_TRUE;
+    if (newStr != str) {
+        if (len - offset > maxCap - newLen) {
+            goto error;
+        }
+
+        c89str_set_len(newStr, newLen);
+
+        grownStr = c89str_realloc_string_if_necessary(newStr, newLen + (len - offset), pAllocationCallbacks);
+        if (grownStr == NULL) {
+            goto error;
+        }
+
+        newStr = grownStr;
     }
 
-    if (utf32 >= 0x2028 && utf32 <= 0x2029) {
-        return C89STR_TRUE;
+    if (newStr + newLen != str + offset) {
+        C89STR_MOVE_MEMORY(newStr + newLen, str + offset, len - offset);
     }
+    newLen += len - offset;
 
-    return C89STR_FALSE;
-}
+    newStr[newLen] = '\0';
+    c89str_set_len(newStr, newLen);
 
-C89STR_API c89str_bool32 c89str_utf8_is_null_or_whitespace(const c89str_utf8* pUTF8, size_t utf8Len)
-{
-    return c89str_is_null_or_whitespace((const char*)pUTF8, utf8Len);
-}
+    if (newStr != str) {
+        c89str_delete(str, pAllocationCallbacks);
+    }
 
-C89STR_API size_t c89str_utf8_find_next_whitespace(const c89str_utf8* pUTF8, size_t utf8Len)
-{
-    return c89str_find_next_whitespace((const char*)pUTF8, utf8Len, NULL);
-}
+    return newStr;
 
+error:
+    if (pLens != NULL && pLens != replacementLensStack) {
+        c89str_free(pLens, pAllocationCallbacks);
+    }
 
-C89STR_API size_t c89str_utf8_ltrim_offset(const c89str_utf8* pUTF8, size_t utf8Len)
-{
-    return c89str_ltrim((const char*)pUTF8, utf8Len);
+    if (newStr != NULL && newStr != str) {
+        c89str_delete(newStr, pAllocationCallbacks);
+    }
+
+    c89str_set_res(str, ENOMEM);
+    return str;
 }
 
-C89STR_API size_t c89str_utf8_rtrim_offset(const c89str_utf8* pUTF8, size_t utf8Len)
+C89STR_API c89str c89str_trim(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks)
 {
-    size_t utf8RunningOffset = 0;
-    size_t utf8LastNonWhitespaceOffset = utf8Len;
+    size_t loff;
+    size_t roff;
 
-    if (pUTF8 == NULL) {
-        return c89str_npos;
+    C89STR_UNUSED(pAllocationCallbacks);
+
+    if (str == NULL) {
+        return NULL;
     }
 
-    for (;;) {
-        c89str_utf32 utf32;
-        size_t utf8Processed;
-        int err;
+    /* The length of the string will never expand which simplifies our memory management. */
+    loff = c89str_utf8_ltrim_offset(str, c89str_get_len(str));
+    roff = c89str_utf8_rtrim_offset(str, c89str_get_len(str));
+    if (roff < loff) {
+        roff = loff;    /* The string is entirely whitespace. */
+    }
 
-        err = c89str_utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
+    C89STR_MOVE_MEMORY(str, str + loff, (roff - loff));  /* Left trim by moving the string down. */
+    c89str_set_len(str, roff - loff);                    /* Set the length before the right trim. */
+    str[c89str_get_len(str)] = '\0';                     /* Right trim by setting the null terminator. */
 
-        if (utf8Processed == 0) {
-            break;
-        }
+    return str;
+}
 
-        utf8RunningOffset += utf8Processed;
+C89STR_API c89str c89str_reserve(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks, size_t capacityNotIncludingNullTerminator)
+{
+    c89str newStr;
 
-        if (c89str_utf32_is_null_or_whitespace(&utf32, 1) == C89STR_FALSE) {
-            utf8LastNonWhitespaceOffset = utf8RunningOffset;
-        }
+    if (str == NULL) {
+        return c89str_new_with_cap(pAllocationCallbacks, capacityNotIncludingNullTerminator);
+    }
 
-        pUTF8   += utf8Processed;
-        utf8Len -= utf8Processed;
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
     }
 
-    return utf8LastNonWhitespaceOffset;
-}
+    if (c89str_get_cap(str) >= capacityNotIncludingNullTerminator) {
+        return str; /* Already big enough. */
+    }
 
-C89STR_API size_t c89str_utf8_find_next_line(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pThisLineLen)
-{
-    return c89str_find_next_line((const char*)pUTF8, utf8Len, pThisLineLen);
+    /* This is an explicit request so allocate exactly what was asked for rather than growing geometrically. */
+    newStr = c89str_realloc_string(str, capacityNotIncludingNullTerminator, pAllocationCallbacks);
+    if (newStr == NULL) {
+        c89str_set_res(str, ENOMEM);
+        return str;
+    }
+
+    return newStr;
 }
-/* End Unicode */
 
+C89STR_API c89str c89str_shrink_to_fit(c89str str, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str newStr;
 
+    if (str == NULL) {
+        return NULL;
+    }
 
+    if (c89str_get_res(str) != C89STR_SUCCESS) {
+        return str; /* The string is in an error state. */
+    }
 
+    if (c89str_get_cap(str) == c89str_get_len(str) || c89str_is_external(str)) {
+        return str; /* Already as small as it can be, or it's in a buffer we don't own. */
+    }
 
+    /* If the reallocation fails the string is still perfectly usable so it's not treated as an error. */
+    newStr = c89str_realloc_string(str, c89str_get_len(str), pAllocationCallbacks);
+    if (newStr == NULL) {
+        return str;
+    }
 
+    return newStr;
+}
 
 
-/* BEG c89str_lexer.c */
-C89STR_API errno_t c89str_lexer_init(c89str_lexer* pLexer, const char* pText, size_t textLen)
+C89STR_API void c89str_set_len(c89str str, size_t len)
 {
-    if (pLexer == NULL) {
-        return EINVAL;  /* Invalid arguments. */
+    if (str == NULL) {
+        return;
     }
 
-    C89STR_ZERO_OBJECT(pLexer);
+    c89str_store_len(str, len);
+}
 
-    if (pText == NULL) {
-        return EINVAL;  
+C89STR_API size_t c89str_len(const c89str str)
+{
+    if (str == NULL) {
+        return 0;
+    } else {
+        return c89str_get_len(str);
     }
+}
 
-    pLexer->pText      = pText;
-    pLexer->textLen    = textLen;
-    pLexer->textOff    = 0;
-    pLexer->lineNumber = 1;
-
-    /* We do not use the null terminator to know the end of the string so we need to calculate it now. */
-    if (pLexer->textLen == (size_t)-1) {
-        pLexer->textLen = c89str_strlen(pText);
+C89STR_API size_t c89str_cap(const c89str str)
+{
+    if (str == NULL) {
+        return 0;
+    } else {
+        return c89str_get_cap(str);
     }
+}
 
-    pLexer->options.pLineCommentOpeningToken  = "//";
-    pLexer->options.pBlockCommentOpeningToken = "/*";
-    pLexer->options.pBlockCommentClosingToken = "*/";
-
-    return 0;
+C89STR_API errno_t c89str_result(const c89str str)
+{
+    return c89str_get_res(str);
 }
 
 
-static errno_t c89str_lexer_set_token(c89str_lexer* pLexer, c89str_utf32 token, size_t tokenLen)
+
+
+/* Begin Unicode */
+static C89STR_INLINE c89str_bool32 c89str_is_invalid_utf8_octet(c89str_utf8 utf8)
 {
-    C89STR_ASSERT(pLexer != NULL);
+    /* RFC 3629 - Section 1: The octet values C0, C1, F5 to FF never appear. */
+    return (unsigned char)utf8 == 0xC0 || (unsigned char)utf8 == 0xC1 || (unsigned char)utf8 >= 0xF5;
+}
 
-    pLexer->token     = token;
-    pLexer->pTokenStr = pLexer->pText + pLexer->textOff;
-    pLexer->tokenLen  = tokenLen;
-    pLexer->textOff  += tokenLen;
+static C89STR_INLINE void c89str_utf32_cp_to_utf16_pair(c89str_utf32 utf32cp, c89str_utf16* pUTF16)
+{
+    /* RFC 2781 - Section 2.1 */
+    c89str_utf32 u;
 
-    if (token == c89str_token_type_newline) {
-        pLexer->lineNumber += 1;
-    }
+    C89STR_ASSERT(utf32cp >= 0x10000);
 
-    /* We need to parse comments and strings to find line numbers. */
-    if (token == c89str_token_type_comment || token == c89str_token_type_string_double || token == c89str_token_type_string_single) {
-        const char* pRunningStr = pLexer->pTokenStr;
-        for (;;) {
-            size_t thisLineLen;
-            size_t nextLineOff = c89str_find_next_line(pRunningStr, pLexer->tokenLen - (pRunningStr - pLexer->pTokenStr), &thisLineLen);
-            if (nextLineOff == thisLineLen || nextLineOff == c89str_npos) {
-                break;  /* Reached the end. */
-            }
+    u = utf32cp - 0x10000;
+    pUTF16[0] = (c89str_utf16)(0xD800 | ((u & 0xFFC00) >> 10));
+    pUTF16[1] = (c89str_utf16)(0xDC00 | ((u & 0x003FF) >>  0));
+}
 
-            pRunningStr += nextLineOff;
-            pLexer->lineNumber += 1;
-        }
-    }
+static C89STR_INLINE c89str_utf32 c89str_utf16_units_to_utf32_cp(c89str_utf16 w1, c89str_utf16 w2)
+{
+    /* RFC 2781 - Section 2.1 */
+    return (((c89str_utf32)(w1 & 0x003FF) << 10) | ((c89str_utf32)(w2 & 0x003FF) << 0)) + 0x10000;
+}
 
-    return 0;
+static C89STR_INLINE c89str_utf32 c89str_utf16_pair_to_utf32_cp(const c89str_utf16* pUTF16)
+{
+    C89STR_ASSERT(pUTF16 != NULL);
+    return c89str_utf16_units_to_utf32_cp(pUTF16[0], pUTF16[1]);
 }
 
-static errno_t c89str_lexer_set_single_char(c89str_lexer* pLexer, c89str_utf32 c)
+static C89STR_INLINE c89str_bool32 c89str_is_cp_in_surrogate_pair_range(c89str_utf32 utf32)
 {
-    return c89str_lexer_set_token(pLexer, c, 1);
+    return utf32 >= 0xD800 && utf32 <= 0xDFFF;
 }
 
-static errno_t c89str_lexer_set_error(c89str_lexer* pLexer, size_t tokenLen)
+static C89STR_INLINE c89str_bool32 c89str_is_valid_code_point(c89str_utf32 utf32)
 {
-    c89str_lexer_set_token(pLexer, c89str_token_type_error, tokenLen);
-    return EINVAL;
+    return utf32 <= C89STR_UNICODE_MAX_CODE_POINT && !c89str_is_cp_in_surrogate_pair_range(utf32);
 }
 
-static size_t c89str_lexer_parse_integer_suffix(c89str_lexer* pLexer, size_t off) /* Returns the new offset. */
+/*
+Decodes the sequence at the start of the input and returns its length. Returns 0 if the input ends part way through
+the sequence. Set utf8Len to (size_t)-1 for null terminated strings in which case a
+null terminator anywhere inside the sequence counts as the end.
+
+This is deliberately lenient. Continuation bytes are not checked and 2 and 3 byte sequences are not checked for
+overlong encodings or surrogates. Only 4 byte sequences have their code point checked. An invalid lead byte is a 1
+byte sequence, and it and invalid 4 byte sequences output C89STR_UTF8_INVALID_CP. Use c89str_utf8_validate() for
+strict checking.
+*/
+#define C89STR_UTF8_INVALID_CP  0xFFFFFFFF
+
+#if !defined(C89STR_NO_UTF8_DECODE_TABLE)
+/*
+The table version gets the sequence length from the lead byte and then decodes every sequence as if it was 4 bytes
+long, with the lead byte masked according to the length, before shifting out the excess. When there's fewer than 4
+bytes left, or the length of the string isn't known, it goes a byte at a time so we don't read past the end.
+*/
+static const c89str_uint8 c89str_g_utf8SequenceLength[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 00..0F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 10..1F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 20..2F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 30..3F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 40..4F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 50..5F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 60..6F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 70..7F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     /* 80..8F Continuation bytes. */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     /* 90..9F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     /* A0..AF */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     /* B0..BF */
+    0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,     /* C0..CF C0 and C1 never appear. */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,     /* D0..DF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,     /* E0..EF */
+    4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0      /* F0..FF F5 and above never appear. */
+};
+
+/* Indexed by the sequence length. Invalid lead bytes are masked to nothing. */
+static const c89str_uint8 c89str_g_utf8LeadMask[5]  = { 0x00, 0x7F, 0x1F, 0x0F, 0x07 };
+static const c89str_uint8 c89str_g_utf8LeadShift[5] = { 18, 18, 12, 6, 0 };
+
+static C89STR_INLINE size_t c89str_utf8_decode_cp(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf32* pCP)
 {
-    const char* txt;
-    size_t len;
+    const c89str_uint8* p = (const c89str_uint8*)pUTF8;
+    size_t len = c89str_g_utf8SequenceLength[p[0]];
+    size_t i;
+    c89str_utf32 cp;
 
-    C89STR_ASSERT(pLexer != NULL);
+    if (len == 0) {
+        *pCP = C89STR_UTF8_INVALID_CP;
+        return 1;
+    }
 
-    txt = pLexer->pText;
-    len = pLexer->textLen;
+    if (utf8Len >= 4 && utf8Len != (size_t)-1) {
+        cp = ((c89str_utf32)(p[0] & c89str_g_utf8LeadMask[len]) << 18) | ((c89str_utf32)(p[1] & 0x3F) << 12) | ((c89str_utf32)(p[2] & 0x3F) << 6) | (c89str_utf32)(p[3] & 0x3F);
+        cp >>= c89str_g_utf8LeadShift[len];
+    } else {
+        if (utf8Len != (size_t)-1 && len > utf8Len) {
+            return 0;
+        }
 
-    if (off < len) {
-        if (txt[off] == 'u' || txt[off] == 'U') {
-            off += 1;
-            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                off += 1;
-                if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                    off += 1;   /* Suffix is ull/ULL. */
-                } else {
-                    /* Suffix is ul/UL. */
-                }
-            } else {
-                /* Suffix is u/U. */
-            }
-        } else if (txt[off] == 'l' || txt[off] == 'L') {
-            off += 1;
-            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                off += 1;
-                if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
-                    off += 1;   /* Suffix is llu/LLU. */
-                } else {
-                    /* Suffix is ll/LL. */
-                }
-            } else if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
-                off += 1;   /* Suffix is lu/LU. */
-            } else {
-                /* Suffix is l/L. */
+        cp = p[0] & c89str_g_utf8LeadMask[len];
+        for (i = 1; i < len; i += 1) {
+            if (p[i] == 0 && utf8Len == (size_t)-1) {
+                return 0;
             }
-        } else {
-            /* No suffix. */
+
+            cp = (cp << 6) | (p[i] & 0x3F);
         }
-    } else {
-        /* No suffix (EOF). */
     }
 
-    return off;
-}
+    if (len == 4 && !c89str_is_valid_code_point(cp)) {
+        cp = C89STR_UTF8_INVALID_CP;
+    }
 
-static size_t c89str_lexer_parse_float_suffix(c89str_lexer* pLexer, size_t off) /* Returns the new offset. */
+    *pCP = cp;
+    return len;
+}
+#else
+static C89STR_INLINE size_t c89str_utf8_decode_cp(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf32* pCP)
 {
-    const char* txt;
+    const c89str_uint8* p = (const c89str_uint8*)pUTF8;
     size_t len;
 
-    C89STR_ASSERT(pLexer != NULL);
+    if (c89str_is_invalid_utf8_octet(pUTF8[0])) {
+        *pCP = C89STR_UTF8_INVALID_CP;
+        return 1;
+    }
 
-    txt = pLexer->pText;
-    len = pLexer->textLen;
+    if ((p[0] & 0xE0) == 0xC0) {
+        len = 2;
+    } else if ((p[0] & 0xF0) == 0xE0) {
+        len = 3;
+    } else if ((p[0] & 0xF8) == 0xF0) {
+        len = 4;
+    } else if (p[0] < 0x80) {
+        len = 1;
+    } else {
+        *pCP = C89STR_UTF8_INVALID_CP;   /* Continuation byte. */
+        return 1;
+    }
 
-    /* Supported suffixes: 'f'/'F' (float), 'd'/'D' (double) and 'l'/'L' (long double). */
-    if (off < len) {
-        if (txt[off] == 'f' || txt[off] == 'F' || txt[off] == 'd' || txt[off] == 'D' || txt[off] == 'l' || txt[off] == 'L') {
-            off += 1;
+    if (utf8Len == (size_t)-1) {
+        if ((len > 1 && p[1] == 0) || (len > 2 && p[2] == 0) || (len > 3 && p[3] == 0)) {
+            return 0;
         }
     } else {
-        /* No suffix (EOF). */
+        if (len > utf8Len) {
+            return 0;
+        }
     }
 
-    return off;
-}
-
-static errno_t c89str_lexer_parse_suffix_and_set_token(c89str_lexer* pLexer, c89str_utf32 token, size_t off)
-{
-    /* Get past the suffix first. */
-    if (token == c89str_token_type_float_literal_dec || token == c89str_token_type_float_literal_hex) {
-        /* Floating point suffix. */
-        off = c89str_lexer_parse_float_suffix(pLexer, off);
+    if (len == 1) {
+        *pCP = p[0];
+    } else if (len == 2) {
+        *pCP = ((c89str_utf32)(p[0] & 0x1F) <<  6) | (p[1] & 0x3F);
+    } else if (len == 3) {
+        *pCP = ((c89str_utf32)(p[0] & 0x0F) << 12) | ((c89str_utf32)(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
     } else {
-        /* Assume an integer suffix. */
-        off = c89str_lexer_parse_integer_suffix(pLexer, off);
+        *pCP = ((c89str_utf32)(p[0] & 0x07) << 18) | ((c89str_utf32)(p[1] & 0x3F) << 12) | ((c89str_utf32)(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+        if (!c89str_is_valid_code_point(*pCP)) {
+            *pCP = C89STR_UTF8_INVALID_CP;
+        }
     }
 
-    return c89str_lexer_set_token(pLexer, token, (off - pLexer->textOff));
+    return len;
 }
+#endif
 
-C89STR_API errno_t c89str_lexer_next(c89str_lexer* pLexer)
+static C89STR_INLINE size_t c89str_utf32_cp_to_utf8_len(c89str_utf32 utf32)
 {
-    int result;
-    const char* txt;
-    size_t off;
-    size_t len;
+    /* This API assumes the the UTF-32 code point is valid. */
+    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
+    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
 
-    if (pLexer == NULL) {
-        return EINVAL;  /* Invalid arguments. */
+    if (utf32 <= 0x7F) {
+        return 1;
     }
-
+    if (utf32 <= 0x7FF) {
+        return 2;
+    }
+    if (utf32 <= 0xFFFF) {
+        return 3;
+    }
+    if (utf32 <= 0x10FFFF) {
+        return 4;
+    }
+
+    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
+    C89STR_ASSERT(C89STR_FALSE);
+    return 0; /* Invalid. */
+}
+
+static C89STR_INLINE size_t c89str_utf32_cp_to_utf8(c89str_utf32 utf32, c89str_utf8* pUTF8, size_t utf8Cap)
+{
+    /* This API assumes the the UTF-32 code point is valid. */
+    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
+    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
+    C89STR_ASSERT(utf8Cap > 0);
+
+    if (utf32 <= 0x7F) {
+        if (utf8Cap >= 1) {
+            pUTF8[0] = (utf32 & 0x7F);
+            return 1;
+        }
+    }
+    if (utf32 <= 0x7FF) {
+        if (utf8Cap >= 2) {
+            pUTF8[0] = 0xC0 | (c89str_utf8)((utf32 & 0x07C0) >> 6);
+            pUTF8[1] = 0x80 | (c89str_utf8) (utf32 & 0x003F);
+            return 2;
+        }
+    }
+    if (utf32 <= 0xFFFF) {
+        if (utf8Cap >= 3) {
+            pUTF8[0] = 0xE0 | (c89str_utf8)((utf32 & 0xF000) >> 12);
+            pUTF8[1] = 0x80 | (c89str_utf8)((utf32 & 0x0FC0) >>  6);
+            pUTF8[2] = 0x80 | (c89str_utf8) (utf32 & 0x003F);
+            return 3;
+        }
+    }
+    if (utf32 <= 0x10FFFF) {
+        if (utf8Cap >= 4) {
+            pUTF8[0] = 0xF0 | (c89str_utf8)((utf32 & 0x1C0000) >> 18);
+            pUTF8[1] = 0x80 | (c89str_utf8)((utf32 & 0x03F000) >> 12);
+            pUTF8[2] = 0x80 | (c89str_utf8)((utf32 & 0x000FC0) >>  6);
+            pUTF8[3] = 0x80 | (c89str_utf8) (utf32 & 0x00003F);
+            return 4;
+        }
+    }
+
+    /* Getting here means there was not enough room in the output buffer. */
+    return 0;
+}
+
+static C89STR_INLINE size_t c89str_utf32_cp_to_utf16_len(c89str_utf32 utf32)
+{
+    /* This API assumes the the UTF-32 code point is valid. */
+    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
+    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
+
+    if (utf32 <= 0xFFFF) {
+        return 1;
+    } else {
+        return 2;
+    }
+
+    /* Unreachable. */
+#if 0
+    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
+    C89STR_ASSERT(C89STR_FALSE);
+    return 0; /* Invalid. */
+#endif
+}
+
+static C89STR_INLINE size_t c89str_utf32_cp_to_utf16(c89str_utf32 utf32, c89str_utf16* pUTF16, size_t utf16Cap)
+{
+    /* This API assumes the the UTF-32 code point is valid. */
+    C89STR_ASSERT(utf32 <= C89STR_UNICODE_MAX_CODE_POINT);
+    C89STR_ASSERT(c89str_is_cp_in_surrogate_pair_range(utf32) == C89STR_FALSE);
+    C89STR_ASSERT(utf16Cap > 0);
+
+    if (utf32 <= 0xFFFF) {
+        if (utf16Cap >= 1) {
+            pUTF16[0] = (c89str_utf16)utf32;
+            return 1;
+        }
+    } else {
+        if (utf16Cap >= 2) {
+            c89str_utf32_cp_to_utf16_pair(utf32, pUTF16);
+            return 2;
+        }
+    }
+
+    /* Getting here means there was not enough room in the output buffer. */
+    return 0;
+}
+
+
+
+C89STR_API c89str_bool32 c89str_utf16_is_bom_le(const unsigned char bom[2])
+{
+    /* RFC 2781 - Section 3.2 */
+    return bom[0] == 0xFF && bom[1] == 0xFE;
+}
+
+C89STR_API c89str_bool32 c89str_utf16_is_bom_be(const unsigned char bom[2])
+{
+    /* RFC 2781 - Section 3.2 */
+    return bom[0] == 0xFE && bom[1] == 0xFF;
+}
+
+C89STR_API c89str_bool32 c89str_utf32_is_bom_le(const unsigned char bom[4])
+{
+    return bom[0] == 0xFF && bom[1] == 0xFE && bom[2] == 0x00 && bom[3] == 0x00;
+}
+
+C89STR_API c89str_bool32 c89str_utf32_is_bom_be(const unsigned char bom[4])
+{
+    return bom[0] == 0x00 && bom[1] == 0x00 && bom[2] == 0xFE && bom[3] == 0xFF;
+}
+
+C89STR_API c89str_bool32 c89str_utf8_has_bom(const unsigned char* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return C89STR_FALSE;
+    }
+
+    if (len < 3) {
+        return C89STR_FALSE;
+    }
+
+    return (pBytes[0] == 0xEF && pBytes[1] == 0xBB && pBytes[2] == 0xBF);
+}
+
+C89STR_API c89str_bool32 c89str_utf16_has_bom(const unsigned char* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return C89STR_FALSE;
+    }
+
+    if (len < 2) {
+        return C89STR_FALSE;
+    }
+
+    return c89str_utf16_is_bom_le(pBytes) || c89str_utf16_is_bom_be(pBytes);
+}
+
+C89STR_API c89str_bool32 c89str_utf32_has_bom(const unsigned char* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return C89STR_FALSE;
+    }
+
+    if (len < 4) {
+        return C89STR_FALSE;
+    }
+
+    return c89str_utf32_is_bom_le(pBytes) || c89str_utf32_is_bom_be(pBytes);
+}
+
+/* The has_bom() functions take a length in bytes, but the converters have a length in code units. */
+static c89str_bool32 c89str_utf16_has_bom_in_units(const c89str_utf16* pUTF16, size_t utf16Len)
+{
+    return utf16Len > 0 && c89str_utf16_has_bom((const unsigned char*)pUTF16, sizeof(*pUTF16));
+}
+
+static c89str_bool32 c89str_utf32_has_bom_in_units(const c89str_utf32* pUTF32, size_t utf32Len)
+{
+    return utf32Len > 0 && c89str_utf32_has_bom((const unsigned char*)pUTF32, sizeof(*pUTF32));
+}
+
+
+/*
+Bulk Byte Swapping
+
+The swap_endian() functions use these, as do the conversions between UTF-16 and UTF-32 in the non-native byte order.
+Those swap the input a block at a time into a local buffer, convert it in native byte order, and then swap the output
+in place, rather than checking the byte order for every code unit. The source and destination can be the same.
+*/
+#define C89STR_SWAP_BLOCK_SIZE  256 /* In code units. */
+
+#if defined(C89STR_SUPPORT_SSE2)
+static C89STR_INLINE __m128i c89str_utf16_swap__sse2(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static C89STR_INLINE __m128i c89str_utf32_swap__sse2(__m128i v)
+{
+    /* Swap the 16-bit halves, then the bytes within each half. */
+    return c89str_utf16_swap__sse2(_mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1));
+}
+
+static size_t c89str_utf16_swap_endian_copy__sse2(c89str_utf16* pDst, const c89str_utf16* pSrc, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i*)(pDst + i), c89str_utf16_swap__sse2(_mm_loadu_si128((const __m128i*)(pSrc + i))));
+    }
+
+    return i;
+}
+
+static size_t c89str_utf32_swap_endian_copy__sse2(c89str_utf32* pDst, const c89str_utf32* pSrc, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(pDst + i), c89str_utf32_swap__sse2(_mm_loadu_si128((const __m128i*)(pSrc + i))));
+    }
+
+    return i;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_AVX2)
+static size_t c89str_utf16_swap_endian_copy__avx2(c89str_utf16* pDst, const c89str_utf16* pSrc, size_t count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(pSrc + i)), shuffle));
+    }
+
+    return i;
+}
+
+static size_t c89str_utf32_swap_endian_copy__avx2(c89str_utf32* pDst, const c89str_utf32* pSrc, size_t count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(pSrc + i)), shuffle));
+    }
+
+    return i;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON)
+static C89STR_INLINE uint16x8_t c89str_utf16_swap__neon(uint16x8_t v)
+{
+    return vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+}
+
+static size_t c89str_utf16_swap_endian_copy__neon(c89str_utf16* pDst, const c89str_utf16* pSrc, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        vst1q_u16(pDst + i, c89str_utf16_swap__neon(vld1q_u16(pSrc + i)));
+    }
+
+    return i;
+}
+
+static size_t c89str_utf32_swap_endian_copy__neon(c89str_utf32* pDst, const c89str_utf32* pSrc, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        vst1q_u32(pDst + i, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(vld1q_u32(pSrc + i)))));
+    }
+
+    return i;
+}
+#endif
+
+static void c89str_utf16_swap_endian_copy(c89str_utf16* pDst, const c89str_utf16* pSrc, size_t count)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    size_t i = 0;
+    C89STR_UNUSED(simdFlags);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        i = c89str_utf16_swap_endian_copy__avx2(pDst, pSrc, count);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        i = c89str_utf16_swap_endian_copy__sse2(pDst, pSrc, count);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        i = c89str_utf16_swap_endian_copy__neon(pDst, pSrc, count);
+    } else
+#endif
+    {
+        /* No SIMD. */
+    }
+
+    for (; i < count; i += 1) {
+        pDst[i] = c89str_swap_endian_uint16(pSrc[i]);
+    }
+}
+
+static void c89str_utf32_swap_endian_copy(c89str_utf32* pDst, const c89str_utf32* pSrc, size_t count)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    size_t i = 0;
+    C89STR_UNUSED(simdFlags);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        i = c89str_utf32_swap_endian_copy__avx2(pDst, pSrc, count);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        i = c89str_utf32_swap_endian_copy__sse2(pDst, pSrc, count);
+    } else
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        i = c89str_utf32_swap_endian_copy__neon(pDst, pSrc, count);
+    } else
+#endif
+    {
+        /* No SIMD. */
+    }
+
+    for (; i < count; i += 1) {
+        pDst[i] = c89str_swap_endian_uint32(pSrc[i]);
+    }
+}
+
+C89STR_API void c89str_utf16_swap_endian(c89str_utf16* pUTF16, size_t count)
+{
+    if (count == (size_t)-1) {
+        while (pUTF16[0] != 0) {
+            pUTF16[0] = c89str_swap_endian_uint16(pUTF16[0]);
+            pUTF16 += 1;
+        }
+    } else {
+        c89str_utf16_swap_endian_copy(pUTF16, pUTF16, count);
+    }
+}
+
+C89STR_API void c89str_utf32_swap_endian(c89str_utf32* pUTF32, size_t count)
+{
+    if (count == (size_t)-1) {
+        while (pUTF32[0] != 0) {
+            pUTF32[0] = c89str_swap_endian_uint32(pUTF32[0]);
+            pUTF32 += 1;
+        }
+    } else {
+        c89str_utf32_swap_endian_copy(pUTF32, pUTF32, count);
+    }
+}
+
+
+/*
+SIMD UTF-8 to UTF-16
+
+The vectorized paths only ever decode sequences that the scalar code would decode without any special handling: ASCII,
+and 2- and 3-byte sequences with a valid lead byte followed by exactly the right number of continuation bytes. These
+are decoded with the same formulas as the scalar code so the output is identical. Anything else (4-byte sequences,
+invalid octets, stray or missing continuation bytes) stops the SIMD path and is left to the scalar loop which takes care
+of replacement characters and C89STR_ERROR_ON_INVALID_CODE_POINT.
+
+The input is looked at in 32 byte windows. Blocks that are not pure ASCII are handled like simdutf: a 12-bit mask of
+the bytes that end a code point is used to look up a shuffle and the number of bytes it consumes. The shuffle moves
+either up to six 1- or 2-byte code points into 16-bit lanes, or up to four 1-, 2- or 3-byte code points into 32-bit
+lanes, after which the bits are put together with a few shifts and masks. The first 16 bytes of each shuffle are the
+shuffle itself, followed by the number of UTF-16 code units it outputs. Shuffles below
+C89STR_UTF8_TO_UTF16_SHUFFLE_COUNT_16 use 16-bit lanes. Index 0 is used when the block does not start with a code
+point we can handle.
+
+The kernels may write up to 32 code units past the current output position so they are only used when there is that
+much room left in the output buffer. The contents of the output buffer past the null terminator are undefined.
+*/
+#if defined(C89STR_SUPPORT_AVX2) || defined(C89STR_SUPPORT_NEON_TBL)
+static const c89str_uint8 c89str_g_utf8ToUTF16ShuffleIndex[4096][2] = {
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {137,  7}, {139,  7}, {153,  7}, {145,  7}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {141,  7}, {155,  7}, {147,  7}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {149,  7}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {142,  8}, {156,  8}, {148,  8}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {150,  8}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 30,  8}, { 38,  8}, {194,  8}, { 42,  8}, { 50,  8}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 44,  8}, { 52,  8}, { 68,  8}, {  0,  0}, {162,  6}, { 56,  8}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 45,  8}, { 53,  8}, { 69,  8}, {  0,  0}, {163,  7}, { 57,  8}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 59,  8}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {151,  9}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 46,  9}, { 54,  9}, { 70,  9}, {  0,  0}, {163,  7}, { 58,  9}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 60,  9}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 61,  9}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {170, 10}, {180, 10}, {153,  7}, {198, 10}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {186, 10}, {155,  7}, {204, 10}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {210, 10}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {188, 10}, {156,  8}, {206, 10}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {212, 10}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 62, 10}, { 78, 10}, {194,  8}, { 86, 10}, {102, 10}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 90, 10}, {106, 10}, { 68,  8}, {  0,  0}, {162,  6}, {114, 10}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 92, 10}, {108, 10}, { 69,  8}, {  0,  0}, {163,  7}, {116, 10}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {120, 10}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {214, 10}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 93, 10}, {109, 10}, { 70,  9}, {  0,  0}, {163,  7}, {117, 10}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {121, 10}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {123, 10}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {137,  7}, {139,  7}, {153,  7}, {145,  7}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {141,  7}, {155,  7}, {147,  7}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {149,  7}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {189, 11}, {156,  8}, {207, 11}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {213, 11}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 30,  8}, { 38,  8}, {194,  8}, { 42,  8}, { 50,  8}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 44,  8}, { 52,  8}, { 68,  8}, {  0,  0}, {162,  6}, { 56,  8}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 45,  8}, { 53,  8}, { 69,  8}, {  0,  0}, {163,  7}, { 57,  8}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 59,  8}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {215, 11}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 94, 11}, {110, 11}, { 70,  9}, {  0,  0}, {163,  7}, {118, 11}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {122, 11}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {124, 11}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {170, 10}, {180, 10}, {153,  7}, {198, 10}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {186, 10}, {155,  7}, {204, 10}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {210, 10}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {188, 10}, {156,  8}, {206, 10}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {212, 10}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {125, 11}, { 78, 10}, {194,  8}, { 86, 10}, {102, 10}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 90, 10}, {106, 10}, { 68,  8}, {  0,  0}, {162,  6}, {114, 10}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 92, 10}, {108, 10}, { 69,  8}, {  0,  0}, {163,  7}, {116, 10}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {120, 10}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {214, 10}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 93, 10}, {109, 10}, { 70,  9}, {  0,  0}, {163,  7}, {117, 10}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {121, 10}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {123, 10}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {137,  7}, {139,  7}, {153,  7}, {145,  7}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {141,  7}, {155,  7}, {147,  7}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {149,  7}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {142,  8}, {156,  8}, {148,  8}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {150,  8}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 30,  8}, { 38,  8}, {194,  8}, { 42,  8}, { 50,  8}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 44,  8}, { 52,  8}, { 68,  8}, {  0,  0}, {162,  6}, { 56,  8}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 45,  8}, { 53,  8}, { 69,  8}, {  0,  0}, {163,  7}, { 57,  8}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 59,  8}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {216, 12}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 46,  9}, { 54,  9}, { 70,  9}, {  0,  0}, {163,  7}, { 58,  9}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 60,  9}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 61,  9}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {170, 10}, {180, 10}, {153,  7}, {198, 10}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {186, 10}, {155,  7}, {204, 10}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {210, 10}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {188, 10}, {156,  8}, {206, 10}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {212, 10}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {126, 12}, { 78, 10}, {194,  8}, { 86, 10}, {102, 10}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 90, 10}, {106, 10}, { 68,  8}, {  0,  0}, {162,  6}, {114, 10}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 92, 10}, {108, 10}, { 69,  8}, {  0,  0}, {163,  7}, {116, 10}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {120, 10}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {214, 10}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 93, 10}, {109, 10}, { 70,  9}, {  0,  0}, {163,  7}, {117, 10}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {121, 10}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {123, 10}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {137,  7}, {139,  7}, {153,  7}, {145,  7}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {141,  7}, {155,  7}, {147,  7}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {149,  7}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {189, 11}, {156,  8}, {207, 11}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {213, 11}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, { 30,  8}, { 38,  8}, {194,  8}, { 42,  8}, { 50,  8}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 44,  8}, { 52,  8}, { 68,  8}, {  0,  0}, {162,  6}, { 56,  8}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 45,  8}, { 53,  8}, { 69,  8}, {  0,  0}, {163,  7}, { 57,  8}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 59,  8}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {215, 11}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 94, 11}, {110, 11}, { 70,  9}, {  0,  0}, {163,  7}, {118, 11}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {122, 11}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {124, 11}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {132,  6}, {134,  6}, {138,  6}, {152,  6}, {  0,  0}, {136,  6}, { 14,  6}, { 18,  6}, {144,  6}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {140,  6}, {154,  6}, {146,  6}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {170, 10}, {180, 10}, {153,  7}, {198, 10}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {186, 10}, {155,  7}, {204, 10}, { 22,  7}, { 26,  7}, { 34,  7}, {  0,  0}, {163,  7}, { 28,  7}, { 36,  7}, {191,  7}, { 40,  7}, { 48,  7}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {210, 10}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, { 29,  7}, { 37,  7}, {193,  7}, { 41,  7}, { 49,  7}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 43,  7}, { 51,  7}, { 67,  7}, {  0,  0}, {162,  6}, { 55,  7}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {188, 10}, {156,  8}, {206, 10}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {212, 10}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {125, 11}, { 78, 10}, {194,  8}, { 86, 10}, {102, 10}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 90, 10}, {106, 10}, { 68,  8}, {  0,  0}, {162,  6}, {114, 10}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 92, 10}, {108, 10}, { 69,  8}, {  0,  0}, {163,  7}, {116, 10}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {120, 10}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {129,  5}, {133,  5}, {131,  5}, { 10,  5}, { 12,  5}, { 16,  5}, {  0,  0}, {135,  5}, { 13,  5}, { 17,  5}, {143,  5}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {214, 10}, {161,  9}, {175,  9}, {152,  6}, {  0,  0}, {167,  9}, {177,  9}, { 18,  6}, {195,  9}, { 20,  6}, { 24,  6}, { 32,  6},
+    {  0,  0}, {  1,  1}, {183,  9}, {154,  6}, {201,  9}, { 21,  6}, { 25,  6}, { 33,  6}, {  0,  0}, {162,  6}, { 27,  6}, { 35,  6}, {190,  6}, { 39,  6}, { 47,  6}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {169,  9}, {179,  9}, {153,  7}, {197,  9}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {185,  9}, {155,  7}, {203,  9}, { 93, 10}, {109, 10}, { 70,  9}, {  0,  0}, {163,  7}, {117, 10}, { 74,  9}, {191,  7}, { 82,  9}, { 98,  9}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {209,  9}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {121, 10}, { 76,  9}, {193,  7}, { 84,  9}, {100,  9}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 88,  9}, {104,  9}, { 67,  7}, {  0,  0}, {162,  6}, {112,  9}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {128,  4}, {  6,  4}, {  8,  4}, {130,  4}, {  9,  4}, { 11,  4}, { 15,  4},
+    {  0,  0}, {  1,  1}, {187,  9}, {156,  8}, {205,  9}, {158,  8}, {172,  8}, { 16,  5}, {  0,  0}, {164,  8}, {176,  8}, { 17,  5}, {192,  8}, { 19,  5}, { 23,  5}, { 31,  5},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {211,  9}, {160,  8}, {174,  8}, {152,  6}, {  0,  0}, {166,  8}, {123, 10}, { 77,  9}, {194,  8}, { 85,  9}, {101,  9}, { 66,  8},
+    {  0,  0}, {  1,  1}, {182,  8}, {154,  6}, {200,  8}, { 89,  9}, {105,  9}, { 68,  8}, {  0,  0}, {162,  6}, {113,  9}, { 72,  8}, {190,  6}, { 80,  8}, { 96,  8}, { 63,  6},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {127,  3}, {  4,  3}, {  5,  3}, {  7,  3}, {  0,  0}, {168,  8}, {178,  8}, {153,  7}, {196,  8}, {157,  7}, {171,  7}, { 15,  4},
+    {  0,  0}, {  1,  1}, {184,  8}, {155,  7}, {202,  8}, { 91,  9}, {107,  9}, { 69,  8}, {  0,  0}, {163,  7}, {115,  9}, { 73,  8}, {191,  7}, { 81,  8}, { 97,  8}, { 64,  7},
+    {  0,  0}, {  1,  1}, {  2,  2}, {  3,  2}, {208,  8}, {159,  7}, {173,  7}, {152,  6}, {  0,  0}, {165,  7}, {119,  9}, { 75,  8}, {193,  7}, { 83,  8}, { 99,  8}, { 65,  7},
+    {  0,  0}, {  1,  1}, {181,  7}, {154,  6}, {199,  7}, { 87,  8}, {103,  8}, { 67,  7}, {  0,  0}, {162,  6}, {111,  8}, { 71,  7}, {190,  6}, { 79,  7}, { 95,  7}, { 63,  6}
+};
+
+#define C89STR_UTF8_TO_UTF16_SHUFFLE_COUNT_16 127
+
+static const c89str_uint8 c89str_g_utf8ToUTF16Shuffles[217][17] = {
+    {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0},
+    {  0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 1},
+    {  1,   0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 1},
+    {  0, 255,   1, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  0, 255,   2,   1, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  1,   0,   2, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  1,   0,   3,   2, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  0, 255,   1, 255,   2, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255,   1, 255,   3,   2, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255,   2,   1,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255,   2,   1,   4,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0,   2, 255,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0,   2, 255,   4,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0,   3,   2,   4, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0,   3,   2,   5,   4, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255,   1, 255,   2, 255,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   1, 255,   2, 255,   4,   3, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   1, 255,   3,   2,   4, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   1, 255,   3,   2,   5,   4, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   2,   1,   3, 255,   4, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   2,   1,   3, 255,   5,   4, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   2,   1,   4,   3,   5, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   2,   1,   4,   3,   6,   5, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   2, 255,   3, 255,   4, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   2, 255,   3, 255,   5,   4, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   2, 255,   4,   3,   5, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   2, 255,   4,   3,   6,   5, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   3,   2,   4, 255,   5, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   3,   2,   4, 255,   6,   5, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   3,   2,   5,   4,   6, 255, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  1,   0,   3,   2,   5,   4,   7,   6, 255, 255, 255, 255, 255, 255, 255, 255, 4},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   4, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   5,   4, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   5, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   6,   5, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   5, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   6,   5, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   5, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   6,   5, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   7, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   8,   7, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   5, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   6,   5, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   7, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   8,   7, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   6, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   7,   6, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   7, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   8,   7, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   7, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   8,   7, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   8, 255, 255, 255, 255, 255, 255, 255, 5},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   9,   8, 255, 255, 255, 255, 255, 255, 5},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   4, 255,   5, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   4, 255,   6,   5, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   5,   4,   6, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   3, 255,   5,   4,   7,   6, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   5, 255,   6, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   5, 255,   7,   6, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   6,   5,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   2, 255,   4,   3,   6,   5,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   5, 255,   6, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   5, 255,   7,   6, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   6,   5,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   4, 255,   6,   5,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   1, 255,   3,   2,   5,   4,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   5, 255,   6, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   5, 255,   7,   6, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   6,   5,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   4, 255,   6,   5,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   3, 255,   5,   4,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   5, 255,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   7, 255,   8, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   7, 255,   9,   8, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   8,   7,   9, 255, 255, 255, 255, 255, 6},
+    {  0, 255,   2,   1,   4,   3,   6,   5,   8,   7,  10,   9, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   5, 255,   6, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   5, 255,   7,   6, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   6,   5,   7, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   4, 255,   6,   5,   8,   7, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   3, 255,   5,   4,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   5, 255,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   7, 255,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   7, 255,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   8,   7,   9, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   2, 255,   4,   3,   6,   5,   8,   7,  10,   9, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   6, 255,   7, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   6, 255,   8,   7, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   7,   6,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   5, 255,   7,   6,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   7, 255,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   7, 255,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   8,   7,   9, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   4, 255,   6,   5,   8,   7,  10,   9, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   7, 255,   8, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   7, 255,   9,   8, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   8,   7,   9, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   6, 255,   8,   7,  10,   9, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   8, 255,   9, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   8, 255,  10,   9, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   9,   8,  10, 255, 255, 255, 255, 255, 6},
+    {  1,   0,   3,   2,   5,   4,   7,   6,   9,   8,  11,  10, 255, 255, 255, 255, 6},
+    {  2,   1,   0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 1},
+    {  0, 255, 255, 255,   3,   2,   1, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  1,   0, 255, 255,   4,   3,   2, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  2,   1,   0, 255,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  2,   1,   0, 255,   4,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  2,   1,   0, 255,   5,   4,   3, 255, 255, 255, 255, 255, 255, 255, 255, 255, 2},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   4,   3,   2, 255, 255, 255, 255, 255, 3},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   5,   4,   3, 255, 255, 255, 255, 255, 3},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   4, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   5,   4, 255, 255, 255, 255, 255, 255, 3},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   6,   5,   4, 255, 255, 255, 255, 255, 3},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   5,   4,   3, 255, 255, 255, 255, 255, 3},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   6,   5,   4, 255, 255, 255, 255, 255, 3},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   5, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   6,   5, 255, 255, 255, 255, 255, 255, 3},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   7,   6,   5, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   4, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   5,   4, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   6,   5,   4, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   5, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   6,   5, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   7,   6,   5, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   6, 255, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   7,   6, 255, 255, 255, 255, 255, 255, 3},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   8,   7,   6, 255, 255, 255, 255, 255, 3},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   2, 255, 255, 255,   5,   4,   3, 255, 4},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   3,   2, 255, 255,   6,   5,   4, 255, 4},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   4,   3,   2, 255,   5, 255, 255, 255, 4},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   4,   3,   2, 255,   6,   5, 255, 255, 4},
+    {  0, 255, 255, 255,   1, 255, 255, 255,   4,   3,   2, 255,   7,   6,   5, 255, 4},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   3, 255, 255, 255,   6,   5,   4, 255, 4},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   4,   3, 255, 255,   7,   6,   5, 255, 4},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   5,   4,   3, 255,   6, 255, 255, 255, 4},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   5,   4,   3, 255,   7,   6, 255, 255, 4},
+    {  0, 255, 255, 255,   2,   1, 255, 255,   5,   4,   3, 255,   8,   7,   6, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   4, 255, 255, 255,   5, 255, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   4, 255, 255, 255,   6,   5, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   4, 255, 255, 255,   7,   6,   5, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   5,   4, 255, 255,   6, 255, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   5,   4, 255, 255,   7,   6, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   5,   4, 255, 255,   8,   7,   6, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   6,   5,   4, 255,   7, 255, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   6,   5,   4, 255,   8,   7, 255, 255, 4},
+    {  0, 255, 255, 255,   3,   2,   1, 255,   6,   5,   4, 255,   9,   8,   7, 255, 4},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   3, 255, 255, 255,   6,   5,   4, 255, 4},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   4,   3, 255, 255,   7,   6,   5, 255, 4},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   5,   4,   3, 255,   6, 255, 255, 255, 4},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   5,   4,   3, 255,   7,   6, 255, 255, 4},
+    {  1,   0, 255, 255,   2, 255, 255, 255,   5,   4,   3, 255,   8,   7,   6, 255, 4},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   4, 255, 255, 255,   7,   6,   5, 255, 4},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   5,   4, 255, 255,   8,   7,   6, 255, 4},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   6,   5,   4, 255,   7, 255, 255, 255, 4},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   6,   5,   4, 255,   8,   7, 255, 255, 4},
+    {  1,   0, 255, 255,   3,   2, 255, 255,   6,   5,   4, 255,   9,   8,   7, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   5, 255, 255, 255,   6, 255, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   5, 255, 255, 255,   7,   6, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   5, 255, 255, 255,   8,   7,   6, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   6,   5, 255, 255,   7, 255, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   6,   5, 255, 255,   8,   7, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   6,   5, 255, 255,   9,   8,   7, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   7,   6,   5, 255,   8, 255, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   7,   6,   5, 255,   9,   8, 255, 255, 4},
+    {  1,   0, 255, 255,   4,   3,   2, 255,   7,   6,   5, 255,  10,   9,   8, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   4, 255, 255, 255,   5, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   4, 255, 255, 255,   6,   5, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   4, 255, 255, 255,   7,   6,   5, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   5,   4, 255, 255,   6, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   5,   4, 255, 255,   7,   6, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   5,   4, 255, 255,   8,   7,   6, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   6,   5,   4, 255,   7, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   6,   5,   4, 255,   8,   7, 255, 255, 4},
+    {  2,   1,   0, 255,   3, 255, 255, 255,   6,   5,   4, 255,   9,   8,   7, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   5, 255, 255, 255,   6, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   5, 255, 255, 255,   7,   6, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   5, 255, 255, 255,   8,   7,   6, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   6,   5, 255, 255,   7, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   6,   5, 255, 255,   8,   7, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   6,   5, 255, 255,   9,   8,   7, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   7,   6,   5, 255,   8, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   7,   6,   5, 255,   9,   8, 255, 255, 4},
+    {  2,   1,   0, 255,   4,   3, 255, 255,   7,   6,   5, 255,  10,   9,   8, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   6, 255, 255, 255,   7, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   6, 255, 255, 255,   8,   7, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   6, 255, 255, 255,   9,   8,   7, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   7,   6, 255, 255,   8, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   7,   6, 255, 255,   9,   8, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   7,   6, 255, 255,  10,   9,   8, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   8,   7,   6, 255,   9, 255, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   8,   7,   6, 255,  10,   9, 255, 255, 4},
+    {  2,   1,   0, 255,   5,   4,   3, 255,   8,   7,   6, 255,  11,  10,   9, 255, 4}
+};
+#endif
+
+/*
+Takes masks of the top four bits of each byte in a 32 byte window, and a mask of the C0 and C1 bytes, and returns a
+mask of the bytes that end a code point which is safe to decode with the SIMD paths. A code point is only safe if every
+byte up to and including the one following it has been checked. The window must start on a code point boundary.
+*/
+static C89STR_INLINE c89str_uint32 c89str_utf8_simd_end_mask(c89str_uint32 b7, c89str_uint32 b6, c89str_uint32 b5, c89str_uint32 b4, c89str_uint32 c0c1)
+{
+    c89str_uint32 cont  = b7 & ~b6;
+    c89str_uint32 lead2 = b7 &  b6 & ~b5;
+    c89str_uint32 lead3 = b7 &  b6 &  b5 & ~b4;
+    c89str_uint32 bad   = (b7 & b6 & b5 & b4) | c0c1;   /* 4-byte sequences are left to the scalar path. */
+    c89str_uint32 mismatch;
+    unsigned int limit;
+
+    /* A byte must be a continuation byte if, and only if, one of the previous two bytes expects it to be. */
+    mismatch = (((lead2 | lead3) << 1) | (lead3 << 2)) ^ cont;
+
+    limit = (mismatch != 0) ? c89str_ctz32(mismatch) : 32;
+    if (limit == 0) {
+        return 0;
+    }
+
+    limit = limit - 1;
+    if (bad != 0) {
+        limit = C89STR_MIN(limit, c89str_ctz32(bad));
+    }
+
+    return (~cont >> 1) & (((c89str_uint32)1 << limit) - 1);
+}
+
+/*
+Checks that an entire 32 byte window is safe for the SIMD paths. Code points are allowed to cross into the next
+window. pCarry is a mask of the continuation bytes expected at the start of the window. On output it is set to those
+expected at the start of the next window, and pCarryLen to the number of bytes of the code point that crosses over.
+*/
+static C89STR_INLINE c89str_bool32 c89str_utf8_simd_check_window(c89str_uint32 b7, c89str_uint32 b6, c89str_uint32 b5, c89str_uint32 b4, c89str_uint32 c0c1, c89str_uint32* pCarry, unsigned int* pCarryLen)
+{
+    c89str_uint32 cont  = b7 & ~b6;
+    c89str_uint32 lead2 = b7 &  b6 & ~b5;
+    c89str_uint32 lead3 = b7 &  b6 &  b5 & ~b4;
+    c89str_uint32 bad   = (b7 & b6 & b5 & b4) | c0c1;
+
+    if (bad != 0 || ((((lead2 | lead3) << 1) | (lead3 << 2) | *pCarry) ^ cont) != 0) {
+        return C89STR_FALSE;
+    }
+
+    *pCarry    = ((lead2 | lead3) >> 31) | (lead3 >> 30);
+    *pCarryLen = ((lead3 >> 30) & 1) ? 2 : (*pCarry != 0);
+    return C89STR_TRUE;
+}
+
+/*
+Counts the UTF-16 length of a 32 byte window and returns the number of bytes counted. This is called in a loop with
+fixed 32 byte steps so that the loads don't depend on the previous window. When a window can't be counted in full the
+return value is less than 32 and the caller must stop there. It'll be 0 when a code point from the previous window
+crosses into this one, in which case that code point must be taken back.
+*/
+static C89STR_INLINE size_t c89str_utf8_to_utf16_len_window(c89str_uint32 b7, c89str_uint32 b6, c89str_uint32 b5, c89str_uint32 b4, c89str_uint32 c0c1, c89str_uint32* pCarry, unsigned int* pCarryLen, size_t* pUTF16Len)
+{
+    c89str_uint32 ends;
+
+    if (c89str_utf8_simd_check_window(b7, b6, b5, b4, c0c1, pCarry, pCarryLen)) {
+        *pUTF16Len += c89str_popcount32(~(b7 & ~b6));   /* One code unit for each code point that starts in this window. */
+        return 32;
+    }
+
+    if (*pCarry != 0) {
+        return 0;
+    }
+
+    ends = c89str_utf8_simd_end_mask(b7, b6, b5, b4, c0c1);
+    if (ends == 0) {
+        return 0;
+    }
+
+    *pUTF16Len += c89str_popcount32(ends);
+    return c89str_bsr32(ends) + 1;
+}
+
+/*
+Decodes the code points at the start of a window with the shuffle tables, given the mask from
+c89str_utf8_simd_end_mask(). Each step loads 16 bytes so nothing past the first 16 bytes of the window is started.
+Returns the number of bytes consumed.
+*/
+#if defined(C89STR_SUPPORT_AVX2)
+/* Uses SSSE3 and SSE4.1 instructions which are always available when AVX2 is. */
+static C89STR_INLINE size_t c89str_utf8_to_utf16ne_window__avx2(const c89str_utf8* pUTF8, c89str_uint32 ends, c89str_utf16* pUTF16, size_t* pUTF16Len)
+{
+    size_t iUTF8  = 0;
+    size_t iUTF16 = 0;
+
+    while (iUTF8 <= 16) {
+        const c89str_uint8* pIndex = c89str_g_utf8ToUTF16ShuffleIndex[(ends >> iUTF8) & 0xFFF];
+        const c89str_uint8* pShuffle;
+        __m128i perm;
+        __m128i out;
+
+        if (pIndex[1] == 0) {
+            break;
+        }
+
+        pShuffle = c89str_g_utf8ToUTF16Shuffles[pIndex[0]];
+        perm = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8)), _mm_loadu_si128((const __m128i*)pShuffle));
+
+        if (pIndex[0] < C89STR_UTF8_TO_UTF16_SHUFFLE_COUNT_16) {
+            /* [cont, lead] in each 16-bit lane. */
+            out = _mm_or_si128(_mm_and_si128(perm, _mm_set1_epi16(0x7F)), _mm_srli_epi16(_mm_and_si128(perm, _mm_set1_epi16(0x1F00)), 2));
+        } else {
+            /* [cont, cont, lead, 0] in each 32-bit lane. */
+            out = _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(perm, _mm_set1_epi32(0x7F)), _mm_srli_epi32(_mm_and_si128(perm, _mm_set1_epi32(0x3F00)), 2)),
+                _mm_srli_epi32(_mm_and_si128(perm, _mm_set1_epi32(0x0F0000)), 4));
+            out = _mm_packus_epi32(out, out);
+        }
+
+        _mm_storeu_si128((__m128i*)(pUTF16 + iUTF16), out);
+        iUTF8  += pIndex[1];
+        iUTF16 += pShuffle[16];
+    }
+
+    *pUTF16Len = iUTF16;
+    return iUTF8;
+}
+
+static C89STR_INLINE void c89str_utf8_simd_masks__avx2(__m256i v, c89str_uint32 masks[5])
+{
+    masks[0] = (c89str_uint32)_mm256_movemask_epi8(v);
+    masks[1] = (c89str_uint32)_mm256_movemask_epi8(_mm256_slli_epi16(v, 1));
+    masks[2] = (c89str_uint32)_mm256_movemask_epi8(_mm256_slli_epi16(v, 2));
+    masks[3] = (c89str_uint32)_mm256_movemask_epi8(_mm256_slli_epi16(v, 3));
+    masks[4] = (c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8((char)0xFE)), _mm256_set1_epi8((char)0xC0)));
+}
+
+static size_t c89str_utf8_to_utf16ne__avx2(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len)
+{
+    size_t iUTF8  = 0;
+    size_t iUTF16 = 0;
+
+    while (utf8Len - iUTF8 >= 32 && utf16Cap - iUTF16 >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pUTF8 + iUTF8));
+        c89str_uint32 masks[5];
+
+        masks[0] = (c89str_uint32)_mm256_movemask_epi8(v);
+        if (masks[0] == 0) {
+            _mm256_storeu_si256((__m256i*)(pUTF16 + iUTF16 +  0), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+            _mm256_storeu_si256((__m256i*)(pUTF16 + iUTF16 + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+            iUTF8  += 32;
+            iUTF16 += 32;
+        } else if ((masks[0] & 0xFF) == 0) {
+            /* Long enough ASCII run that widening beats the shuffles which only do 6 at a time. */
+            size_t asciiLen = C89STR_MIN(c89str_ctz32(masks[0]), 16);
+            _mm256_storeu_si256((__m256i*)(pUTF16 + iUTF16), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+            iUTF8  += asciiLen;
+            iUTF16 += asciiLen;
+        } else {
+            size_t utf16Len;
+            size_t utf8Processed;
+
+            c89str_utf8_simd_masks__avx2(v, masks);
+            utf8Processed = c89str_utf8_to_utf16ne_window__avx2(pUTF8 + iUTF8, c89str_utf8_simd_end_mask(masks[0], masks[1], masks[2], masks[3], masks[4]), pUTF16 + iUTF16, &utf16Len);
+            if (utf8Processed == 0) {
+                break;
+            }
+
+            iUTF8  += utf8Processed;
+            iUTF16 += utf16Len;
+        }
+    }
+
+    *pUTF16Len = iUTF16;
+    return iUTF8;
+}
+
+static size_t c89str_utf8_to_utf16_len__avx2(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF16Len)
+{
+    size_t iUTF8 = 0;
+    c89str_uint32 carry = 0;
+    unsigned int carryLen = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pUTF8 + iUTF8));
+        c89str_uint32 masks[5];
+        size_t utf8Processed;
+
+        masks[0] = (c89str_uint32)_mm256_movemask_epi8(v);
+        if ((masks[0] | carry) == 0) {
+            *pUTF16Len += 32;
+            iUTF8      += 32;
+            continue;
+        }
+
+        c89str_utf8_simd_masks__avx2(v, masks);
+        utf8Processed = c89str_utf8_to_utf16_len_window(masks[0], masks[1], masks[2], masks[3], masks[4], &carry, &carryLen, pUTF16Len);
+        iUTF8 += utf8Processed;
+
+        if (utf8Processed != 32) {
+            break;
+        }
+    }
+
+    /* Don't stop in the middle of a code point. */
+    if (carry != 0) {
+        *pUTF16Len -= 1;
+        iUTF8      -= carryLen;
+    }
+
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_SSE2)
+static C89STR_INLINE void c89str_utf8_simd_masks__sse2(__m128i lo, __m128i hi, c89str_uint32 masks[5])
+{
+    const __m128i maskFE = _mm_set1_epi8((char)0xFE);
+    const __m128i maskC0 = _mm_set1_epi8((char)0xC0);
+
+    masks[0] = (c89str_uint32)_mm_movemask_epi8(lo)                                     | ((c89str_uint32)_mm_movemask_epi8(hi)                                     << 16);
+    masks[1] = (c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(lo, 1))                  | ((c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(hi, 1))                  << 16);
+    masks[2] = (c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(lo, 2))                  | ((c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(hi, 2))                  << 16);
+    masks[3] = (c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(lo, 3))                  | ((c89str_uint32)_mm_movemask_epi8(_mm_slli_epi16(hi, 3))                  << 16);
+    masks[4] = (c89str_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, maskFE), maskC0)) | ((c89str_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(hi, maskFE), maskC0)) << 16);
+}
+
+/* SSE2 has no byte shuffle so only runs of ASCII are widened. Counting only needs masks so the len path does everything. */
+static size_t c89str_utf8_to_utf16ne__sse2(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t iUTF8  = 0;
+    size_t iUTF16 = 0;
+
+    while (utf8Len - iUTF8 >= 16 && utf16Cap - iUTF16 >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8));
+        c89str_uint32 nonASCII = (c89str_uint32)_mm_movemask_epi8(v);
+        size_t asciiLen = (nonASCII == 0) ? 16 : c89str_ctz32(nonASCII);
+
+        if (asciiLen == 0) {
+            break;
+        }
+
+        _mm_storeu_si128((__m128i*)(pUTF16 + iUTF16 + 0), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(pUTF16 + iUTF16 + 8), _mm_unpackhi_epi8(v, zero));
+        iUTF8  += asciiLen;
+        iUTF16 += asciiLen;
+    }
+
+    *pUTF16Len = iUTF16;
+    return iUTF8;
+}
+
+static size_t c89str_utf8_to_utf16_len__sse2(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF16Len)
+{
+    size_t iUTF8 = 0;
+    c89str_uint32 carry = 0;
+    unsigned int carryLen = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8 + 16));
+        c89str_uint32 masks[5];
+        size_t utf8Processed;
+
+        if ((_mm_movemask_epi8(_mm_or_si128(lo, hi)) | carry) == 0) {
+            *pUTF16Len += 32;
+            iUTF8      += 32;
+            continue;
+        }
+
+        c89str_utf8_simd_masks__sse2(lo, hi, masks);
+        utf8Processed = c89str_utf8_to_utf16_len_window(masks[0], masks[1], masks[2], masks[3], masks[4], &carry, &carryLen, pUTF16Len);
+        iUTF8 += utf8Processed;
+
+        if (utf8Processed != 32) {
+            break;
+        }
+    }
+
+    /* Don't stop in the middle of a code point. */
+    if (carry != 0) {
+        *pUTF16Len -= 1;
+        iUTF8      -= carryLen;
+    }
+
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON)
+#if defined(C89STR_SUPPORT_NEON_TBL)
+static C89STR_INLINE size_t c89str_utf8_to_utf16ne_window__neon(const c89str_utf8* pUTF8, c89str_uint32 ends, c89str_utf16* pUTF16, size_t* pUTF16Len)
+{
+    size_t iUTF8  = 0;
+    size_t iUTF16 = 0;
+
+    while (iUTF8 <= 16) {
+        const c89str_uint8* pIndex = c89str_g_utf8ToUTF16ShuffleIndex[(ends >> iUTF8) & 0xFFF];
+        const c89str_uint8* pShuffle;
+        uint8x16_t perm;
+
+        if (pIndex[1] == 0) {
+            break;
+        }
+
+        pShuffle = c89str_g_utf8ToUTF16Shuffles[pIndex[0]];
+        perm = vqtbl1q_u8(vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8)), vld1q_u8(pShuffle));
+
+        if (pIndex[0] < C89STR_UTF8_TO_UTF16_SHUFFLE_COUNT_16) {
+            /* [cont, lead] in each 16-bit lane. */
+            uint16x8_t perm16 = vreinterpretq_u16_u8(perm);
+            vst1q_u16((c89str_uint16*)(pUTF16 + iUTF16), vorrq_u16(vandq_u16(perm16, vdupq_n_u16(0x7F)), vshrq_n_u16(vandq_u16(perm16, vdupq_n_u16(0x1F00)), 2)));
+        } else {
+            /* [cont, cont, lead, 0] in each 32-bit lane. */
+            uint32x4_t perm32 = vreinterpretq_u32_u8(perm);
+            uint32x4_t out = vorrq_u32(
+                vorrq_u32(vandq_u32(perm32, vdupq_n_u32(0x7F)), vshrq_n_u32(vandq_u32(perm32, vdupq_n_u32(0x3F00)), 2)),
+                vshrq_n_u32(vandq_u32(perm32, vdupq_n_u32(0x0F0000)), 4));
+            vst1_u16((c89str_uint16*)(pUTF16 + iUTF16), vmovn_u32(out));
+        }
+
+        iUTF8  += pIndex[1];
+        iUTF16 += pShuffle[16];
+    }
+
+    *pUTF16Len = iUTF16;
+    return iUTF8;
+}
+
+static C89STR_INLINE void c89str_utf8_simd_masks__neon(uint8x16_t lo, uint8x16_t hi, c89str_uint32 masks[5])
+{
+    const uint8x16_t maskFE = vdupq_n_u8(0xFE);
+    const uint8x16_t maskC0 = vdupq_n_u8(0xC0);
+
+    masks[0] = c89str_neon_bitmask_u8x16(vtstq_u8(lo, vdupq_n_u8(0x80))) | (c89str_neon_bitmask_u8x16(vtstq_u8(hi, vdupq_n_u8(0x80))) << 16);
+    masks[1] = c89str_neon_bitmask_u8x16(vtstq_u8(lo, vdupq_n_u8(0x40))) | (c89str_neon_bitmask_u8x16(vtstq_u8(hi, vdupq_n_u8(0x40))) << 16);
+    masks[2] = c89str_neon_bitmask_u8x16(vtstq_u8(lo, vdupq_n_u8(0x20))) | (c89str_neon_bitmask_u8x16(vtstq_u8(hi, vdupq_n_u8(0x20))) << 16);
+    masks[3] = c89str_neon_bitmask_u8x16(vtstq_u8(lo, vdupq_n_u8(0x10))) | (c89str_neon_bitmask_u8x16(vtstq_u8(hi, vdupq_n_u8(0x10))) << 16);
+    masks[4] = c89str_neon_bitmask_u8x16(vceqq_u8(vandq_u8(lo, maskFE), maskC0)) | (c89str_neon_bitmask_u8x16(vceqq_u8(vandq_u8(hi, maskFE), maskC0)) << 16);
+}
+#endif
+
+static size_t c89str_utf8_to_utf16ne__neon(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len)
+{
+    size_t iUTF8  = 0;
+    size_t iUTF16 = 0;
+
+    while (utf8Len - iUTF8 >= 32 && utf16Cap - iUTF16 >= 32) {
+        uint8x16_t lo = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8));
+        uint8x16_t hi = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 + 16));
+        c89str_uint64 nonASCII = c89str_neon_movemask_u8x16(vcgeq_u8(lo, vdupq_n_u8(0x80)));
+        size_t asciiLen = (nonASCII == 0) ? 16 : (c89str_ctz64(nonASCII) / 4);
+
+        if (asciiLen >= 8) {
+            vst1q_u16((c89str_uint16*)(pUTF16 + iUTF16 + 0), vmovl_u8(vget_low_u8(lo)));
+            vst1q_u16((c89str_uint16*)(pUTF16 + iUTF16 + 8), vmovl_u8(vget_high_u8(lo)));
+            iUTF8  += asciiLen;
+            iUTF16 += asciiLen;
+        } else {
+        #if defined(C89STR_SUPPORT_NEON_TBL)
+            c89str_uint32 masks[5];
+            size_t utf16Len;
+            size_t utf8Processed;
+
+            c89str_utf8_simd_masks__neon(lo, hi, masks);
+            utf8Processed = c89str_utf8_to_utf16ne_window__neon(pUTF8 + iUTF8, c89str_utf8_simd_end_mask(masks[0], masks[1], masks[2], masks[3], masks[4]), pUTF16 + iUTF16, &utf16Len);
+            if (utf8Processed == 0) {
+                break;
+            }
+
+            iUTF8  += utf8Processed;
+            iUTF16 += utf16Len;
+        #else
+            C89STR_UNUSED(hi);
+
+            if (asciiLen == 0) {
+                break;
+            }
+
+            vst1q_u16((c89str_uint16*)(pUTF16 + iUTF16), vmovl_u8(vget_low_u8(lo)));
+            iUTF8  += asciiLen;
+            iUTF16 += asciiLen;
+        #endif
+        }
+    }
+
+    *pUTF16Len = iUTF16;
+    return iUTF8;
+}
+
+static size_t c89str_utf8_to_utf16_len__neon(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF16Len)
+{
+    size_t iUTF8 = 0;
+    c89str_uint32 carry = 0;
+    unsigned int carryLen = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        uint8x16_t lo = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8));
+        uint8x16_t hi = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 + 16));
+        c89str_uint64 nonASCII = c89str_neon_movemask_u8x16(vcgeq_u8(vorrq_u8(lo, hi), vdupq_n_u8(0x80)));
+
+        if ((nonASCII | carry) == 0) {
+            *pUTF16Len += 32;
+            iUTF8      += 32;
+        } else {
+        #if defined(C89STR_SUPPORT_NEON_TBL)
+            c89str_uint32 masks[5];
+            size_t utf8Processed;
+
+            c89str_utf8_simd_masks__neon(lo, hi, masks);
+            utf8Processed = c89str_utf8_to_utf16_len_window(masks[0], masks[1], masks[2], masks[3], masks[4], &carry, &carryLen, pUTF16Len);
+            iUTF8 += utf8Processed;
+
+            if (utf8Processed != 32) {
+                break;
+            }
+        #else
+            break;
+        #endif
+        }
+    }
+
+    /* Don't stop in the middle of a code point. */
+    if (carry != 0) {
+        *pUTF16Len -= 1;
+        iUTF8      -= carryLen;
+    }
+
+    return iUTF8;
+}
+#endif
+
+/*
+Converts as much of the input as the SIMD paths can handle and returns the number of bytes consumed. Returns 0 when
+there's nothing the SIMD paths can do at the start of the input, in which case the caller should fall back to the
+scalar path for a while.
+*/
+static size_t c89str_utf8_to_utf16ne_simd(const c89str_utf8* pUTF8, size_t utf8Len, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+    C89STR_UNUSED(pUTF8);
+    C89STR_UNUSED(utf8Len);
+    C89STR_UNUSED(pUTF16);
+    C89STR_UNUSED(utf16Cap);
+
+    *pUTF16Len = 0;
+
+    /* The lanes are built in little-endian order. */
+    if (!c89str_is_little_endian()) {
+        return 0;
+    }
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf8_to_utf16ne__avx2(pUTF8, utf8Len, pUTF16, utf16Cap, pUTF16Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf8_to_utf16ne__sse2(pUTF8, utf8Len, pUTF16, utf16Cap, pUTF16Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf8_to_utf16ne__neon(pUTF8, utf8Len, pUTF16, utf16Cap, pUTF16Len);
+    }
+#endif
+
+    return 0;
+}
+
+/* Same as above, but only counts. The count is added to pUTF16Len. */
+static size_t c89str_utf8_to_utf16_len_simd(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF16Len)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+    C89STR_UNUSED(pUTF8);
+    C89STR_UNUSED(utf8Len);
+    C89STR_UNUSED(pUTF16Len);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf8_to_utf16_len__avx2(pUTF8, utf8Len, pUTF16Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf8_to_utf16_len__sse2(pUTF8, utf8Len, pUTF16Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf8_to_utf16_len__neon(pUTF8, utf8Len, pUTF16Len);
+    }
+#endif
+
+    return 0;
+}
+
+/* When the SIMD paths can't make progress the scalar path is used for at least this many bytes before trying again. */
+#define C89STR_UTF_SIMD_BACKOFF 16
+
+
+/*
+UTF-8 Validation
+
+The SIMD paths use the lookup algorithm by Keiser and Lemire. Every byte is classified by the high nibble of the byte
+before it, the low nibble of the byte before it, and its own high nibble. Each of the three tables maps a nibble to a
+set of error bits. A bit set in all three means the pair of bytes is invalid. A separate check makes sure the bytes
+that must be the second continuation byte of a 3-byte sequence or the third of a 4-byte sequence are continuation
+bytes. Blocks of ASCII skip all of this unless the previous block ended in the middle of a sequence.
+
+The SIMD paths only tell us that there's an error somewhere in a block. When they stop, the scalar path takes over
+from the start of the sequence containing the first unchecked byte. It either finds the error and reports its exact
+offset, or goes on for C89STR_UTF_SIMD_BACKOFF bytes before handing back to the SIMD paths.
+*/
+#define C89STR_UTF8_TOO_SHORT       0x01    /* A lead byte that isn't followed by a continuation byte. */
+#define C89STR_UTF8_TOO_LONG        0x02    /* A continuation byte following an ASCII byte. */
+#define C89STR_UTF8_OVERLONG_3      0x04    /* E0 80..9F */
+#define C89STR_UTF8_TOO_LARGE       0x08    /* F4 90..BF, or F5..FF */
+#define C89STR_UTF8_SURROGATE       0x10    /* ED A0..BF */
+#define C89STR_UTF8_OVERLONG_2      0x20    /* C0..C1 */
+#define C89STR_UTF8_TOO_LARGE_1000  0x40    /* F5..FF 80..8F. Shares a bit with C89STR_UTF8_OVERLONG_4. */
+#define C89STR_UTF8_OVERLONG_4      0x40    /* F0 80..8F */
+#define C89STR_UTF8_TWO_CONTS       0x80    /* A continuation byte following another one. Might be valid. */
+#define C89STR_UTF8_CARRY           (C89STR_UTF8_TOO_SHORT | C89STR_UTF8_TOO_LONG | C89STR_UTF8_TWO_CONTS)
+
+#if defined(C89STR_SUPPORT_AVX2) || defined(C89STR_SUPPORT_NEON_TBL)
+/* Indexed by the high nibble of the previous byte. */
+static const c89str_uint8 c89str_g_utf8ValidateByte1High[16] = {
+    C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG,
+    C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG, C89STR_UTF8_TOO_LONG,
+    C89STR_UTF8_TWO_CONTS, C89STR_UTF8_TWO_CONTS, C89STR_UTF8_TWO_CONTS, C89STR_UTF8_TWO_CONTS,
+    C89STR_UTF8_TOO_SHORT | C89STR_UTF8_OVERLONG_2,
+    C89STR_UTF8_TOO_SHORT,
+    C89STR_UTF8_TOO_SHORT | C89STR_UTF8_OVERLONG_3 | C89STR_UTF8_SURROGATE,
+    C89STR_UTF8_TOO_SHORT | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000 | C89STR_UTF8_OVERLONG_4
+};
+
+/* Indexed by the low nibble of the previous byte. */
+static const c89str_uint8 c89str_g_utf8ValidateByte1Low[16] = {
+    C89STR_UTF8_CARRY | C89STR_UTF8_OVERLONG_3 | C89STR_UTF8_OVERLONG_2 | C89STR_UTF8_OVERLONG_4,
+    C89STR_UTF8_CARRY | C89STR_UTF8_OVERLONG_2,
+    C89STR_UTF8_CARRY,
+    C89STR_UTF8_CARRY,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000 | C89STR_UTF8_SURROGATE,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000,
+    C89STR_UTF8_CARRY | C89STR_UTF8_TOO_LARGE | C89STR_UTF8_TOO_LARGE_1000
+};
+
+/* Indexed by the high nibble of the current byte. */
+static const c89str_uint8 c89str_g_utf8ValidateByte2High[16] = {
+    C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT,
+    C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT,
+    C89STR_UTF8_TOO_LONG | C89STR_UTF8_OVERLONG_2 | C89STR_UTF8_TWO_CONTS | C89STR_UTF8_OVERLONG_3 | C89STR_UTF8_TOO_LARGE_1000 | C89STR_UTF8_OVERLONG_4,
+    C89STR_UTF8_TOO_LONG | C89STR_UTF8_OVERLONG_2 | C89STR_UTF8_TWO_CONTS | C89STR_UTF8_OVERLONG_3 | C89STR_UTF8_TOO_LARGE,
+    C89STR_UTF8_TOO_LONG | C89STR_UTF8_OVERLONG_2 | C89STR_UTF8_TWO_CONTS | C89STR_UTF8_SURROGATE  | C89STR_UTF8_TOO_LARGE,
+    C89STR_UTF8_TOO_LONG | C89STR_UTF8_OVERLONG_2 | C89STR_UTF8_TWO_CONTS | C89STR_UTF8_SURROGATE  | C89STR_UTF8_TOO_LARGE,
+    C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT, C89STR_UTF8_TOO_SHORT
+};
+#endif
+
+/*
+Checks the sequences starting from *pOffset, which must be on a code point boundary, up to the first one that starts at
+or after endOffset. Returns false if an invalid sequence was found, in which case *pOffset is the offset of it.
+*/
+static c89str_bool32 c89str_utf8_validate_scalar(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pOffset, size_t endOffset)
+{
+    const c89str_uint8* pBytes = (const c89str_uint8*)pUTF8;
+    size_t iUTF8 = *pOffset;
+    c89str_bool32 isValid = C89STR_TRUE;
+
+    while (iUTF8 < endOffset) {
+        c89str_uint8 lead = pBytes[iUTF8];
+        c89str_uint8 next;
+
+        if (lead < 0x80) {
+            if (utf8Len - iUTF8 >= sizeof(size_t) && (c89str_swar_load(pUTF8 + iUTF8) & C89STR_SWAR_HIGHS) == 0) {
+                iUTF8 += sizeof(size_t);
+            } else {
+                iUTF8 += 1;
+            }
+        } else if (lead < 0xC2) {
+            isValid = C89STR_FALSE;     /* Stray continuation byte or overlong 2-byte sequence. */
+            break;
+        } else if (lead < 0xE0) {
+            if (utf8Len - iUTF8 < 2 || (pBytes[iUTF8 + 1] & 0xC0) != 0x80) {
+                isValid = C89STR_FALSE;
+                break;
+            }
+
+            iUTF8 += 2;
+        } else if (lead < 0xF0) {
+            if (utf8Len - iUTF8 < 3) {
+                isValid = C89STR_FALSE;
+                break;
+            }
+
+            next = pBytes[iUTF8 + 1];
+            if ((next & 0xC0) != 0x80 || (pBytes[iUTF8 + 2] & 0xC0) != 0x80) {
+                isValid = C89STR_FALSE;
+                break;
+            }
+
+            if ((lead == 0xE0 && next < 0xA0) || (lead == 0xED && next > 0x9F)) {
+                isValid = C89STR_FALSE;     /* Overlong or surrogate. */
+                break;
+            }
+
+            iUTF8 += 3;
+        } else if (lead < 0xF5) {
+            if (utf8Len - iUTF8 < 4) {
+                isValid = C89STR_FALSE;
+                break;
+            }
+
+            next = pBytes[iUTF8 + 1];
+            if ((next & 0xC0) != 0x80 || (pBytes[iUTF8 + 2] & 0xC0) != 0x80 || (pBytes[iUTF8 + 3] & 0xC0) != 0x80) {
+                isValid = C89STR_FALSE;
+                break;
+            }
+
+            if ((lead == 0xF0 && next < 0x90) || (lead == 0xF4 && next > 0x8F)) {
+                isValid = C89STR_FALSE;     /* Overlong or above U+10FFFF. */
+                break;
+            }
+
+            iUTF8 += 4;
+        } else {
+            isValid = C89STR_FALSE;
+            break;
+        }
+    }
+
+    *pOffset = iUTF8;
+    return isValid;
+}
+
+#if defined(C89STR_SUPPORT_SSE2)
+/*
+SSE2 has no byte shuffle for the lookups. Instead this uses the same structural check as the UTF-8 to UTF-16 length
+path, which only accepts 1- to 3-byte sequences. E0 and ED are left to the scalar path since they need their second
+byte to be range checked.
+*/
+static size_t c89str_utf8_validate__sse2(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    const __m128i lead0E0 = _mm_set1_epi8((char)0xE0);
+    const __m128i lead0ED = _mm_set1_epi8((char)0xED);
+    size_t iUTF8 = 0;
+    c89str_uint32 carry = 0;
+    unsigned int carryLen = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8 +  0));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8 + 16));
+        c89str_uint32 masks[5];
+
+        if ((_mm_movemask_epi8(_mm_or_si128(lo, hi)) | carry) == 0) {
+            iUTF8 += 32;
+            continue;
+        }
+
+        c89str_utf8_simd_masks__sse2(lo, hi, masks);
+        masks[4] |= (c89str_uint32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(lo, lead0E0), _mm_cmpeq_epi8(lo, lead0ED)));
+        masks[4] |= (c89str_uint32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(hi, lead0E0), _mm_cmpeq_epi8(hi, lead0ED))) << 16;
+
+        if (!c89str_utf8_simd_check_window(masks[0], masks[1], masks[2], masks[3], masks[4], &carry, &carryLen)) {
+            break;
+        }
+
+        iUTF8 += 32;
+    }
+
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_AVX2)
+/* Returns a vector with a non-zero byte wherever there's an error, given this block and the previous one. */
+static C89STR_INLINE __m256i c89str_utf8_validate_block__avx2(__m256i input, __m256i prevInput, __m256i byte1HighTable, __m256i byte1LowTable, __m256i byte2HighTable)
+{
+    const __m256i mask0F = _mm256_set1_epi8(0x0F);
+    __m256i prevShifted = _mm256_permute2x128_si256(prevInput, input, 0x21);   /* [prevInput.hi, input.lo] */
+    __m256i prev1 = _mm256_alignr_epi8(input, prevShifted, 16 - 1);
+    __m256i prev2 = _mm256_alignr_epi8(input, prevShifted, 16 - 2);
+    __m256i prev3 = _mm256_alignr_epi8(input, prevShifted, 16 - 3);
+    __m256i special;
+    __m256i must23;
+
+    special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(byte1HighTable, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), mask0F)),
+            _mm256_shuffle_epi8(byte1LowTable,  _mm256_and_si256(prev1, mask0F))),
+        _mm256_shuffle_epi8(byte2HighTable, _mm256_and_si256(_mm256_srli_epi16(input, 4), mask0F)));
+
+    /* The high bit is set when this byte is the third byte of a 3- or 4-byte sequence, or the fourth of a 4-byte one. */
+    must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))), _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), special);
+}
+
+static size_t c89str_utf8_validate__avx2(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    const __m256i byte1HighTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c89str_g_utf8ValidateByte1High));
+    const __m256i byte1LowTable  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c89str_g_utf8ValidateByte1Low));
+    const __m256i byte2HighTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c89str_g_utf8ValidateByte2High));
+    const __m256i incompleteMax  = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m256i prevInput = _mm256_setzero_si256();
+    __m256i prevIncomplete = _mm256_setzero_si256();
+    size_t iUTF8 = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i*)(pUTF8 + iUTF8));
+
+        if (_mm256_movemask_epi8(input) != 0 || !_mm256_testz_si256(prevIncomplete, prevIncomplete)) {
+            __m256i error = c89str_utf8_validate_block__avx2(input, prevInput, byte1HighTable, byte1LowTable, byte2HighTable);
+            if (!_mm256_testz_si256(error, error)) {
+                break;
+            }
+
+            /* Non-zero if the block ends in the middle of a sequence. The next block checks that it's finished properly. */
+            prevIncomplete = _mm256_subs_epu8(input, incompleteMax);
+        } else {
+            prevIncomplete = _mm256_setzero_si256();
+        }
+
+        prevInput = input;
+        iUTF8 += 32;
+    }
+
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON_TBL)
+/* See c89str_utf8_validate_block__avx2(). */
+static C89STR_INLINE uint8x16_t c89str_utf8_validate_block__neon(uint8x16_t input, uint8x16_t prevInput, uint8x16_t byte1HighTable, uint8x16_t byte1LowTable, uint8x16_t byte2HighTable)
+{
+    uint8x16_t prev1 = vextq_u8(prevInput, input, 16 - 1);
+    uint8x16_t prev2 = vextq_u8(prevInput, input, 16 - 2);
+    uint8x16_t prev3 = vextq_u8(prevInput, input, 16 - 3);
+    uint8x16_t special;
+    uint8x16_t must23;
+
+    special = vandq_u8(
+        vandq_u8(
+            vqtbl1q_u8(byte1HighTable, vshrq_n_u8(prev1, 4)),
+            vqtbl1q_u8(byte1LowTable,  vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+        vqtbl1q_u8(byte2HighTable, vshrq_n_u8(input, 4)));
+
+    must23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)), vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+
+    return veorq_u8(vandq_u8(must23, vdupq_n_u8(0x80)), special);
+}
+
+static size_t c89str_utf8_validate__neon(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    static const c89str_uint8 incompleteMax[16] = {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+    const uint8x16_t byte1HighTable = vld1q_u8(c89str_g_utf8ValidateByte1High);
+    const uint8x16_t byte1LowTable  = vld1q_u8(c89str_g_utf8ValidateByte1Low);
+    const uint8x16_t byte2HighTable = vld1q_u8(c89str_g_utf8ValidateByte2High);
+    const uint8x16_t incompleteMaxV = vld1q_u8(incompleteMax);
+    uint8x16_t prevInput = vdupq_n_u8(0);
+    uint8x16_t prevIncomplete = vdupq_n_u8(0);
+    size_t iUTF8 = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        uint8x16_t lo = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 +  0));
+        uint8x16_t hi = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 + 16));
+
+        if (vmaxvq_u8(vorrq_u8(lo, hi)) >= 0x80 || vmaxvq_u8(prevIncomplete) != 0) {
+            uint8x16_t error = vorrq_u8(
+                c89str_utf8_validate_block__neon(lo, prevInput, byte1HighTable, byte1LowTable, byte2HighTable),
+                c89str_utf8_validate_block__neon(hi, lo,        byte1HighTable, byte1LowTable, byte2HighTable));
+            if (vmaxvq_u8(error) != 0) {
+                break;
+            }
+
+            prevIncomplete = vqsubq_u8(hi, incompleteMaxV);
+        } else {
+            prevIncomplete = vdupq_n_u8(0);
+        }
+
+        prevInput = hi;
+        iUTF8 += 32;
+    }
+
+    return iUTF8;
+}
+#elif defined(C89STR_SUPPORT_NEON)
+/* Without vqtbl1q_u8() only ASCII is skipped. */
+static size_t c89str_utf8_validate__neon(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    size_t iUTF8 = 0;
+
+    while (utf8Len - iUTF8 >= 32) {
+        uint8x16_t lo = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 +  0));
+        uint8x16_t hi = vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8 + 16));
+        if (c89str_neon_movemask_u8x16(vcgeq_u8(vorrq_u8(lo, hi), vdupq_n_u8(0x80))) != 0) {
+            break;
+        }
+
+        iUTF8 += 32;
+    }
+
+    return iUTF8;
+}
+#endif
+
+/*
+Returns the number of bytes at the start of the input that were checked by the SIMD paths. This can be in the middle
+of a sequence that crosses over, in which case that sequence has not been fully checked.
+*/
+static size_t c89str_utf8_validate_simd(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+    C89STR_UNUSED(pUTF8);
+    C89STR_UNUSED(utf8Len);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf8_validate__avx2(pUTF8, utf8Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf8_validate__sse2(pUTF8, utf8Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf8_validate__neon(pUTF8, utf8Len);
+    }
+#endif
+
+    return 0;
+}
+
+C89STR_API errno_t c89str_utf8_validate(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pErrorOffset)
+{
+    size_t iUTF8 = 0;
+
+    if (pErrorOffset != NULL) {
+        *pErrorOffset = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    if (utf8Len == (size_t)-1) {
+        utf8Len = c89str_strlen(pUTF8);
+    }
+
+    while (iUTF8 < utf8Len) {
+        size_t iUTF8End = utf8Len;
+
+        if (utf8Len - iUTF8 >= 32) {
+            size_t iUTF8Start   = iUTF8;
+            size_t iUTF8Checked = iUTF8 + c89str_utf8_validate_simd(pUTF8 + iUTF8, utf8Len - iUTF8);
+            size_t i;
+
+            /* The SIMD paths can stop in the middle of a sequence. Go back to the start of it. */
+            iUTF8 = iUTF8Checked;
+            for (i = 1; i <= 3 && i <= iUTF8Checked - iUTF8Start; i += 1) {
+                c89str_uint8 c = (c89str_uint8)pUTF8[iUTF8Checked - i];
+                if (c >= 0xC0) {
+                    iUTF8 = iUTF8Checked - i;
+                    break;
+                }
+
+                if (c < 0x80) {
+                    break;
+                }
+            }
+
+            iUTF8End = C89STR_MIN(iUTF8 + C89STR_UTF_SIMD_BACKOFF, utf8Len);
+        }
+
+        if (!c89str_utf8_validate_scalar(pUTF8, utf8Len, &iUTF8, iUTF8End)) {
+            if (pErrorOffset != NULL) {
+                *pErrorOffset = iUTF8;
+            }
+
+            return C89STR_ECODEPOINT;
+        }
+    }
+
+    if (pErrorOffset != NULL) {
+        *pErrorOffset = utf8Len;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+
+
+/*
+UTF-8 Code Point Counting
+
+Every code point starts with exactly one byte that isn't a continuation byte. Continuation bytes are 0x80..0xBF which
+is -128..-65 as a signed byte, so a signed compare against -65 picks out the start of each code point.
+
+The counting paths accumulate the compare masks into per-byte counters, which can go for 255 blocks before they
+overflow, and only then sum them horizontally. Finding the offset of a code point needs to know where to stop so the
+scanning paths count each block on its own instead. Both leave any partial block at the end to the scalar
+path. Null terminated strings are scanned with aligned loads the same way as c89str_strlen() so there's no need for
+a separate pass to find the length.
+*/
+static C89STR_INLINE c89str_bool32 c89str_utf8_is_lead_byte(c89str_utf8 c)
+{
+    return ((c89str_uint8)c & 0xC0) != 0x80;
+}
+
+/* Counts the bytes in a word that have only their high bit set. */
+static C89STR_INLINE size_t c89str_swar_count_highs(size_t word)
+{
+    return ((word >> 7) * C89STR_SWAR_ONES) >> ((sizeof(size_t) - 1) * 8);
+}
+
+static size_t c89str_utf8_count_code_points__swar(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    size_t count = 0;
+    size_t iUTF8 = 0;
+
+    for (; utf8Len - iUTF8 >= sizeof(size_t); iUTF8 += sizeof(size_t)) {
+        size_t word = c89str_swar_load(pUTF8 + iUTF8);
+        count += sizeof(size_t) - c89str_swar_count_highs(word & ~(word << 1) & C89STR_SWAR_HIGHS);
+    }
+
+    for (; iUTF8 < utf8Len; iUTF8 += 1) {
+        count += c89str_utf8_is_lead_byte(pUTF8[iUTF8]);
+    }
+
+    return count;
+}
+
+static size_t c89str_utf8_scan_code_points__swar(const c89str_utf8* pUTF8, size_t utf8Len, size_t maxCount, size_t* pCount)
+{
+    size_t count = 0;
+    size_t iUTF8 = 0;
+
+    /* Null terminated strings are left to the scalar path. */
+    if (utf8Len != (size_t)-1) {
+        for (; utf8Len - iUTF8 >= sizeof(size_t); iUTF8 += sizeof(size_t)) {
+            size_t word = c89str_swar_load(pUTF8 + iUTF8);
+            size_t n = sizeof(size_t) - c89str_swar_count_highs(word & ~(word << 1) & C89STR_SWAR_HIGHS);
+            if (count + n > maxCount) {
+                break;
+            }
+
+            count += n;
+        }
+    }
+
+    *pCount = count;
+    return iUTF8;
+}
+
+#if defined(C89STR_SUPPORT_SSE2)
+static size_t c89str_utf8_count_code_points__sse2(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    const __m128i threshold = _mm_set1_epi8(-65);
+    size_t blockCount = utf8Len / 16;
+    size_t count = 0;
+
+    while (blockCount > 0) {
+        size_t iterations = C89STR_MIN(blockCount, 255);
+        size_t i;
+        __m128i acc = _mm_setzero_si128();
+
+        for (i = 0; i < iterations; i += 1) {
+            acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(_mm_loadu_si128((const __m128i*)pUTF8), threshold));
+            pUTF8 += 16;
+        }
+
+        acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+        blockCount -= iterations;
+    }
+
+    return count + c89str_utf8_count_code_points__swar(pUTF8, utf8Len & 15);
+}
+
+/* SSE2 has no popcount instruction so sum the bytes of the compare mask instead. */
+static C89STR_INLINE size_t c89str_count_lead_bytes__sse2(__m128i block, __m128i threshold)
+{
+    __m128i sum = _mm_sad_epu8(_mm_sub_epi8(_mm_setzero_si128(), _mm_cmpgt_epi8(block, threshold)), _mm_setzero_si128());
+    return (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_utf8_scan_code_points__sse2(const c89str_utf8* pUTF8, size_t utf8Len, size_t maxCount, size_t* pCount)
+{
+    const __m128i threshold = _mm_set1_epi8(-65);
+    size_t count = 0;
+    size_t iUTF8 = 0;
+    size_t n;
+
+    if (utf8Len == (size_t)-1) {
+        const __m128i zero = _mm_setzero_si128();
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)pUTF8 & 15);
+        const c89str_utf8* pBlock = pUTF8 - misalignment;
+        __m128i block;
+
+        block = _mm_load_si128((const __m128i*)pBlock);
+        if (((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) >> misalignment) == 0) {
+            n = c89str_popcount32((unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(block, threshold)) >> misalignment);
+            if (n <= maxCount) {
+                count = n;
+
+                for (;;) {
+                    pBlock += 16;
+
+                    block = _mm_load_si128((const __m128i*)pBlock);
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) != 0) {
+                        break;
+                    }
+
+                    n = c89str_count_lead_bytes__sse2(block, threshold);
+                    if (count + n > maxCount) {
+                        break;
+                    }
+
+                    count += n;
+                }
+
+                iUTF8 = pBlock - pUTF8;
+            }
+        }
+    } else {
+        for (; utf8Len - iUTF8 >= 16; iUTF8 += 16) {
+            n = c89str_count_lead_bytes__sse2(_mm_loadu_si128((const __m128i*)(pUTF8 + iUTF8)), threshold);
+            if (count + n > maxCount) {
+                break;
+            }
+
+            count += n;
+        }
+    }
+
+    *pCount = count;
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_AVX2)
+static size_t c89str_utf8_count_code_points__avx2(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    const __m256i threshold = _mm256_set1_epi8(-65);
+    size_t blockCount = utf8Len / 32;
+    size_t count = 0;
+
+    while (blockCount > 0) {
+        size_t iterations = C89STR_MIN(blockCount, 255);
+        size_t i;
+        __m256i acc = _mm256_setzero_si256();
+        __m128i sum;
+
+        for (i = 0; i < iterations; i += 1) {
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(_mm256_loadu_si256((const __m256i*)pUTF8), threshold));
+            pUTF8 += 32;
+        }
+
+        acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        count += (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        blockCount -= iterations;
+    }
+
+    return count + c89str_utf8_count_code_points__swar(pUTF8, utf8Len & 31);
+}
+
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_utf8_scan_code_points__avx2(const c89str_utf8* pUTF8, size_t utf8Len, size_t maxCount, size_t* pCount)
+{
+    const __m256i threshold = _mm256_set1_epi8(-65);
+    size_t count = 0;
+    size_t iUTF8 = 0;
+    size_t n;
+
+    if (utf8Len == (size_t)-1) {
+        const __m256i zero = _mm256_setzero_si256();
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)pUTF8 & 31);
+        const c89str_utf8* pBlock = pUTF8 - misalignment;
+        __m256i block;
+
+        block = _mm256_load_si256((const __m256i*)pBlock);
+        if (((c89str_uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero)) >> misalignment) == 0) {
+            n = c89str_popcount32((c89str_uint32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(block, threshold)) >> misalignment);
+            if (n <= maxCount) {
+                count = n;
+
+                for (;;) {
+                    pBlock += 32;
+
+                    block = _mm256_load_si256((const __m256i*)pBlock);
+                    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero)) != 0) {
+                        break;
+                    }
+
+                    n = c89str_popcount32((c89str_uint32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(block, threshold)));
+                    if (count + n > maxCount) {
+                        break;
+                    }
+
+                    count += n;
+                }
+
+                iUTF8 = pBlock - pUTF8;
+            }
+        }
+    } else {
+        for (; utf8Len - iUTF8 >= 32; iUTF8 += 32) {
+            n = c89str_popcount32((c89str_uint32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_loadu_si256((const __m256i*)(pUTF8 + iUTF8)), threshold)));
+            if (count + n > maxCount) {
+                break;
+            }
+
+            count += n;
+        }
+    }
+
+    *pCount = count;
+    return iUTF8;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON)
+static C89STR_INLINE unsigned int c89str_neon_count_lead_bytes(uint8x16_t block, unsigned int misalignment)
+{
+    c89str_uint64 mask = c89str_neon_movemask_u8x16(vcgtq_s8(vreinterpretq_s8_u8(block), vdupq_n_s8(-65))) >> (misalignment * 4);
+    return (c89str_popcount32((c89str_uint32)(mask & 0xFFFFFFFF)) + c89str_popcount32((c89str_uint32)(mask >> 32))) / 4;
+}
+
+static size_t c89str_utf8_count_code_points__neon(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    const int8x16_t threshold = vdupq_n_s8(-65);
+    size_t blockCount = utf8Len / 16;
+    size_t count = 0;
+
+    while (blockCount > 0) {
+        size_t iterations = C89STR_MIN(blockCount, 255);
+        size_t i;
+        uint8x16_t acc = vdupq_n_u8(0);
+        uint64x2_t sum;
+
+        for (i = 0; i < iterations; i += 1) {
+            acc = vsubq_u8(acc, vcgtq_s8(vld1q_s8((const signed char*)pUTF8), threshold));
+            pUTF8 += 16;
+        }
+
+        sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+        count += (size_t)vgetq_lane_u64(sum, 0) + (size_t)vgetq_lane_u64(sum, 1);
+        blockCount -= iterations;
+    }
+
+    return count + c89str_utf8_count_code_points__swar(pUTF8, utf8Len & 15);
+}
+
+static C89STR_NO_SANITIZE_ADDRESS size_t c89str_utf8_scan_code_points__neon(const c89str_utf8* pUTF8, size_t utf8Len, size_t maxCount, size_t* pCount)
+{
+    size_t count = 0;
+    size_t iUTF8 = 0;
+    size_t n;
+
+    if (utf8Len == (size_t)-1) {
+        unsigned int misalignment = (unsigned int)((c89str_uintptr)pUTF8 & 15);
+        const c89str_utf8* pBlock = pUTF8 - misalignment;
+        uint8x16_t block;
+
+        block = vld1q_u8((const c89str_uint8*)pBlock);
+        if ((c89str_neon_movemask_u8x16(vceqq_u8(block, vdupq_n_u8(0))) >> (misalignment * 4)) == 0) {
+            n = c89str_neon_count_lead_bytes(block, misalignment);
+            if (n <= maxCount) {
+                count = n;
+
+                for (;;) {
+                    pBlock += 16;
+
+                    block = vld1q_u8((const c89str_uint8*)pBlock);
+                    if (c89str_neon_movemask_u8x16(vceqq_u8(block, vdupq_n_u8(0))) != 0) {
+                        break;
+                    }
+
+                    n = c89str_neon_count_lead_bytes(block, 0);
+                    if (count + n > maxCount) {
+                        break;
+                    }
+
+                    count += n;
+                }
+
+                iUTF8 = pBlock - pUTF8;
+            }
+        }
+    } else {
+        for (; utf8Len - iUTF8 >= 16; iUTF8 += 16) {
+            n = c89str_neon_count_lead_bytes(vld1q_u8((const c89str_uint8*)(pUTF8 + iUTF8)), 0);
+            if (count + n > maxCount) {
+                break;
+            }
+
+            count += n;
+        }
+    }
+
+    *pCount = count;
+    return iUTF8;
+}
+#endif
+
+static size_t c89str_utf8_count_code_points_simd(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);   /* Will be unused when no SIMD is supported. */
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf8_count_code_points__avx2(pUTF8, utf8Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf8_count_code_points__sse2(pUTF8, utf8Len);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf8_count_code_points__neon(pUTF8, utf8Len);
+    }
+#endif
+
+    return c89str_utf8_count_code_points__swar(pUTF8, utf8Len);
+}
+
+/*
+Counts the code points in whole blocks, stopping before the first block that would take the count beyond maxCount.
+When utf8Len is (size_t)-1 it also stops at the block containing the null terminator. Returns the number of bytes
+scanned and outputs the number of code points starting within them. The caller finishes off byte by byte.
+*/
+static size_t c89str_utf8_scan_code_points_simd(const c89str_utf8* pUTF8, size_t utf8Len, size_t maxCount, size_t* pCount)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);   /* Will be unused when no SIMD is supported. */
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf8_scan_code_points__avx2(pUTF8, utf8Len, maxCount, pCount);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf8_scan_code_points__sse2(pUTF8, utf8Len, maxCount, pCount);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf8_scan_code_points__neon(pUTF8, utf8Len, maxCount, pCount);
+    }
+#endif
+
+    return c89str_utf8_scan_code_points__swar(pUTF8, utf8Len, maxCount, pCount);
+}
+
+C89STR_API size_t c89str_utf8_count_code_points(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    size_t count;
+    size_t iUTF8;
+
+    if (pUTF8 == NULL) {
+        return 0;
+    }
+
+    if (utf8Len != (size_t)-1) {
+        return c89str_utf8_count_code_points_simd(pUTF8, utf8Len);
+    }
+
+    /* Null terminated. The scan stops at the block containing the terminator which leaves at most one block. */
+    iUTF8 = c89str_utf8_scan_code_points_simd(pUTF8, utf8Len, (size_t)-1, &count);
+    return count + c89str_utf8_count_code_points__swar(pUTF8 + iUTF8, c89str_strlen(pUTF8 + iUTF8));
+}
+
+C89STR_API size_t c89str_utf8_offset_of_code_point(const c89str_utf8* pUTF8, size_t utf8Len, size_t codePointIndex)
+{
+    size_t count;
+    size_t iUTF8;
+
+    if (pUTF8 == NULL) {
+        return c89str_npos;
+    }
+
+    iUTF8 = c89str_utf8_scan_code_points_simd(pUTF8, utf8Len, codePointIndex, &count);
+
+    for (;;) {
+        if (utf8Len == (size_t)-1) {
+            if (pUTF8[iUTF8] == '\0') {
+                break;
+            }
+        } else {
+            if (iUTF8 == utf8Len) {
+                break;
+            }
+        }
+
+        if (c89str_utf8_is_lead_byte(pUTF8[iUTF8])) {
+            if (count == codePointIndex) {
+                return iUTF8;
+            }
+
+            count += 1;
+        }
+
+        iUTF8 += 1;
+    }
+
+    return (count == codePointIndex) ? iUTF8 : c89str_npos;
+}
+
+
+C89STR_API errno_t c89str_utf8_to_utf16_len(size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf16Len = 0;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;   /* Invalid input. */
+    }
+
+    if (utf8Len == 0 || pUTF8[0] == 0) {
+        return C89STR_SUCCESS;   /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf8* pUTF8Original = pUTF8;
+        for (;;) {
+            if (pUTF8[0] == 0) {
+                break;  /* Reached the end of the null terminated string. */
+            }
+
+            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
+                utf16Len += 1;
+                pUTF8    += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8, (size_t)-1, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL; /* Input string is too short. */
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                    }
+                } else {
+                    utf16Len += (cpLen == 4) ? 2 : 1;  /* Only 4 byte sequences need a surrogate pair. */
+                }
+
+                pUTF8    += cpLen;
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        size_t iUTF8SIMD = 0;   /* The position at which the SIMD path will be tried again. */
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if (iUTF8 >= iUTF8SIMD && utf8Len - iUTF8 >= 32) {
+                size_t utf8Processed = c89str_utf8_to_utf16_len_simd(pUTF8 + iUTF8, utf8Len - iUTF8, &utf16Len);
+                iUTF8    += utf8Processed;
+                iUTF8SIMD = iUTF8 + ((utf8Processed == 0) ? C89STR_UTF_SIMD_BACKOFF : 1);
+                continue;
+            }
+
+            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                utf16Len += 1;
+                iUTF8    += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8 + iUTF8, utf8Len - iUTF8, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL;
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf16Len += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                    }
+                } else {
+                    utf16Len += (cpLen == 4) ? 2 : 1;  /* Only 4 byte sequences need a surrogate pair. */
+                }
+
+                iUTF8    += cpLen;
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf16ne(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf16CapOriginal = utf16Cap;
+
+    if (pUTF16 == NULL) {
+        return c89str_utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;   /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            if (utf16Cap <= 1) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF16[0] = pUTF8[0];
+                pUTF16   += 1;
+                utf16Cap -= 1;
+                pUTF8    += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8, (size_t)-1, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL; /* Input string is too short. */
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                        pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                    }
+                } else if (cpLen == 4) {
+                    c89str_utf32_cp_to_utf16_pair(cp, pUTF16);
+                    pUTF16   += 2;
+                    utf16Cap -= 2;
+                } else {
+                    pUTF16[0] = (c89str_utf16)cp;
+                    pUTF16   += 1;
+                    utf16Cap -= 1;
+                }
+
+                pUTF8    += cpLen;
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        size_t iUTF8SIMD = 0;   /* The position at which the SIMD path will be tried again. */
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if (utf16Cap <= 1) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (iUTF8 >= iUTF8SIMD && utf8Len - iUTF8 >= 32 && utf16Cap > 32) {
+                size_t utf16Len;
+                size_t utf8Processed = c89str_utf8_to_utf16ne_simd(pUTF8 + iUTF8, utf8Len - iUTF8, pUTF16, utf16Cap - 1, &utf16Len);  /* -1 for the null terminator. */
+                pUTF16   += utf16Len;
+                utf16Cap -= utf16Len;
+                iUTF8    += utf8Processed;
+                iUTF8SIMD = iUTF8 + ((utf8Processed == 0) ? C89STR_UTF_SIMD_BACKOFF : 1);
+                continue;
+            }
+
+            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                pUTF16[0] = pUTF8[iUTF8+0];
+                pUTF16   += 1;
+                utf16Cap -= 1;
+                iUTF8    += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8 + iUTF8, utf8Len - iUTF8, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL;
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF16[0] = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                        pUTF16   += C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        utf16Cap -= C89STR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                    }
+                } else if (cpLen == 4) {
+                    c89str_utf32_cp_to_utf16_pair(cp, pUTF16);
+                    pUTF16   += 2;
+                    utf16Cap -= 2;
+                } else {
+                    pUTF16[0] = (c89str_utf16)cp;
+                    pUTF16   += 1;
+                    utf16Cap -= 1;
+                }
+
+                iUTF8    += cpLen;
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+    }
+
+    /* Null terminate. */
+    if (utf16Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF16[0] = 0;
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf16le(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result;
+    size_t utf16Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = c89str_utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF16 != NULL && !c89str_is_little_endian()) {
+        c89str_utf16_swap_endian(pUTF16, utf16Len);
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf16be(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result;
+    size_t utf16Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = c89str_utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF16 != NULL && !c89str_is_big_endian()) {
+        c89str_utf16_swap_endian(pUTF16, utf16Len);
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf32_len(size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf32Len = 0;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;   /* Invalid input. */
+    }
+
+    if (utf8Len == 0 || pUTF8[0] == 0) {
+        return C89STR_SUCCESS;   /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            utf32Len += 1;
+            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF8 += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8, (size_t)-1, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL; /* Input string is too short. */
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP && (flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                }
+
+                pUTF8 += cpLen;   /* Invalid sequences are replaced. */
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            utf32Len += 1;
+            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                iUTF8 += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8 + iUTF8, utf8Len - iUTF8, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL;
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP && (flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                }
+
+                iUTF8 += cpLen;   /* Invalid sequences are replaced. */
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    return result;
+}
+
+
+C89STR_API errno_t c89str_utf8_to_utf32ne(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf32CapOriginal = utf32Cap;
+
+    if (pUTF32 == NULL) {
+        return c89str_utf8_to_utf32_len(pUTF32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, utf8Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((unsigned char)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF32[0] = pUTF8[0];
+                pUTF8 += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8, (size_t)-1, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL; /* Input string is too short. */
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        if (cpLen == 4) {
+                            pUTF8 += cpLen;  /* An invalid 4 byte sequence is reported as processed. */
+                        }
+
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        cp = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+                }
+
+                pUTF32[0] = cp;
+                pUTF8 += cpLen;
+            }
+
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((unsigned char)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                pUTF32[0] = pUTF8[iUTF8+0];
+                iUTF8 += 1;
+            } else {
+                c89str_utf32 cp;
+                size_t cpLen = c89str_utf8_decode_cp(pUTF8 + iUTF8, utf8Len - iUTF8, &cp);
+                if (cpLen == 0) {
+                    result = EINVAL;
+                    break;
+                }
+
+                if (cp == C89STR_UTF8_INVALID_CP) {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        if (cpLen == 4) {
+                            iUTF8 += cpLen;  /* An invalid 4 byte sequence is reported as processed. */
+                        }
+
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        cp = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+                }
+
+                pUTF32[0] = cp;
+                iUTF8 += cpLen;
+            }
+
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+    }
+
+    /* Null terminate. */
+    if (utf32Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF32[0] = 0;
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf32le(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result;
+    size_t utf32Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = c89str_utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF32 != NULL && !c89str_is_little_endian()) {
+        c89str_utf32_swap_endian(pUTF32, utf32Len);
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf32be(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+    errno_t result;
+    size_t utf32Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = c89str_utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF32 != NULL && !c89str_is_big_endian()) {
+        c89str_utf32_swap_endian(pUTF32, utf32Len);
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf8_to_wchar_len(size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+#if C89STR_SIZEOF_WCHAR_T == 2
+    return c89str_utf8_to_utf16_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#else
+    return c89str_utf8_to_utf32_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#endif
+}
+
+C89STR_API errno_t c89str_utf8_to_wchar(wchar_t* pWCHAR, size_t wcharCap, size_t* pWCHARLen, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags)
+{
+#if C89STR_SIZEOF_WCHAR_T == 2
+    return c89str_utf8_to_utf16((c89str_utf16*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#else
+    return c89str_utf8_to_utf32((c89str_utf32*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#endif
+}
+
+
+/*
+The _alloc() conversions size the output for the worst case so the input only needs to be read once. Every code unit of
+input produces at most maxOutPerIn code units of output, plus one for the null terminator.
+*/
+static void* c89str_transcode_alloc(size_t inputLen, size_t maxOutPerIn, size_t outUnitSize, size_t* pOutCap, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t outCap;
+
+    if (inputLen > (((size_t)-1 / outUnitSize) - 1) / maxOutPerIn) {
+        return NULL;    /* Too big. */
+    }
+
+    outCap = (inputLen * maxOutPerIn) + 1;
+    *pOutCap = outCap;
+
+    return c89str_malloc(outCap * outUnitSize, pAllocationCallbacks);
+}
+
+/*
+Frees the output on error, and otherwise null terminates it and optionally shrinks it. If the allocation callbacks can't
+reallocate the original buffer is kept.
+*/
+static void* c89str_transcode_alloc_finish(void* pOut, size_t outLen, size_t outUnitSize, errno_t result, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (result != C89STR_SUCCESS) {
+        c89str_free(pOut, pAllocationCallbacks);
+        return NULL;
+    }
+
+    C89STR_ZERO_MEMORY((char*)pOut + (outLen * outUnitSize), outUnitSize);
+
+    if ((flags & C89STR_SHRINK_TO_FIT) != 0) {
+        void* pShrunk = c89str_realloc(pOut, (outLen + 1) * outUnitSize, pAllocationCallbacks);
+        if (pShrunk != NULL) {
+            pOut = pShrunk;
+        }
+    }
+
+    return pOut;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf16_alloc(c89str_utf16** ppUTF16, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    errno_t result;
+    c89str_utf16* pUTF16;
+    size_t utf16Cap;
+    size_t utf16Len = 0;
+
+    if (ppUTF16 == NULL) {
+        return EINVAL;
+    }
+
+    *ppUTF16 = NULL;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* A UTF-8 code unit never produces more than one UTF-16 code unit. Four bytes become a surrogate pair. */
+    pUTF16 = (c89str_utf16*)c89str_transcode_alloc((utf8Len == (size_t)-1) ? c89str_strlen(pUTF8) : utf8Len, 1, sizeof(*pUTF16), &utf16Cap, pAllocationCallbacks);
+    if (pUTF16 == NULL) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags & ~C89STR_SHRINK_TO_FIT);
+
+    pUTF16 = (c89str_utf16*)c89str_transcode_alloc_finish(pUTF16, utf16Len, sizeof(*pUTF16), result, flags, pAllocationCallbacks);
+    if (pUTF16 == NULL) {
+        return result;
+    }
+
+    *ppUTF16 = pUTF16;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf32_alloc(c89str_utf32** ppUTF32, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    errno_t result;
+    c89str_utf32* pUTF32;
+    size_t utf32Cap;
+    size_t utf32Len = 0;
+
+    if (ppUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    *ppUTF32 = NULL;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    pUTF32 = (c89str_utf32*)c89str_transcode_alloc((utf8Len == (size_t)-1) ? c89str_strlen(pUTF8) : utf8Len, 1, sizeof(*pUTF32), &utf32Cap, pAllocationCallbacks);
+    if (pUTF32 == NULL) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags & ~C89STR_SHRINK_TO_FIT);
+
+    pUTF32 = (c89str_utf32*)c89str_transcode_alloc_finish(pUTF32, utf32Len, sizeof(*pUTF32), result, flags, pAllocationCallbacks);
+    if (pUTF32 == NULL) {
+        return result;
+    }
+
+    *ppUTF32 = pUTF32;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+
+
+/*
+SIMD UTF-16 to UTF-8
+
+The kernels load blocks of 8 or 16 code units and byte swap them in-register when the input is not in native byte order.
+Blocks of 16 ASCII code units are narrowed directly. Otherwise each code unit is expanded into a 32-bit lane holding
+every byte it could be encoded as, and a shuffle selected by the UTF-8 length of each of 4 code units packs the bytes
+that are needed together. The shuffle is indexed by a base-3 number with one digit per code unit, the digit being the
+UTF-8 length of the code unit minus one. Each entry is 16 bytes of shuffle followed by the number of bytes it outputs.
+
+Surrogates stop the block and are left to the scalar path which takes care of pairing, replacement characters and
+C89STR_ERROR_ON_INVALID_CODE_POINT. Everything else is encoded with the same formulas as the scalar path. The kernels
+write whole blocks at a time and so only run while there's at least 64 bytes of room left in the output buffer (16 for
+the ASCII-only kernels).
+*/
+#if defined(C89STR_SUPPORT_AVX2) || defined(C89STR_SUPPORT_NEON_TBL)
+static const c89str_uint8 c89str_g_utf16ToUTF8Pow3[16] = {0, 1, 3, 4, 9, 10, 12, 13, 27, 28, 30, 31, 36, 37, 39, 40};
+
+static const c89str_uint8 c89str_g_utf16ToUTF8Shuffles[81][17] = {
+    {  0,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  4},
+    {  3,   0,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  5},
+    {  2,   1,   0,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  0,   7,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  5},
+    {  3,   0,   7,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  2,   1,   0,   7,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  0,   6,   5,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   6,   5,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   6,   5,   4,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  5},
+    {  3,   0,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  2,   1,   0,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  0,   7,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   7,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   7,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   6,   5,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   6,   5,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   6,   5,   4,  11,   8,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   7,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   7,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   7,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   6,   5,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   6,   5,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   6,   5,   4,  10,   9,   8,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  5},
+    {  3,   0,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  2,   1,   0,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  0,   7,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   7,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   7,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   6,   5,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   6,   5,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   6,   5,   4,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   7,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   7,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   7,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   6,   5,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   6,   5,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   6,   5,   4,  11,   8,  15,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   7,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   7,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   7,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   6,   5,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  3,   0,   6,   5,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  2,   1,   0,   6,   5,   4,  10,   9,   8,  15,  12, 255, 255, 255, 255, 255, 11},
+    {  0,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  6},
+    {  3,   0,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  2,   1,   0,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  0,   7,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   7,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   7,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   6,   5,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   6,   5,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   6,   5,   4,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255, 255,  7},
+    {  3,   0,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  2,   1,   0,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  0,   7,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   7,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   7,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   6,   5,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  3,   0,   6,   5,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  2,   1,   0,   6,   5,   4,  11,   8,  14,  13,  12, 255, 255, 255, 255, 255, 11},
+    {  0,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255, 255,  8},
+    {  3,   0,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  2,   1,   0,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  0,   7,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 255,  9},
+    {  3,   0,   7,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  2,   1,   0,   7,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 11},
+    {  0,   6,   5,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 255, 10},
+    {  3,   0,   6,   5,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 255, 11},
+    {  2,   1,   0,   6,   5,   4,  10,   9,   8,  14,  13,  12, 255, 255, 255, 255, 12}
+};
+#endif
+
+/*
+Takes masks of the code units in a block that need more than 1 byte, those that need 3 bytes, and surrogates, and
+returns the number of code units before the first surrogate. pUTF8Len receives the length of their UTF-8 encoding.
+*/
+static C89STR_INLINE unsigned int c89str_utf16_simd_block_len(c89str_uint32 multiByte, c89str_uint32 threeByte, c89str_uint32 surrogate, unsigned int blockSize, size_t* pUTF8Len)
+{
+    unsigned int count = (surrogate != 0) ? c89str_ctz32(surrogate) : blockSize;
+    c89str_uint32 mask = ((c89str_uint32)1 << count) - 1;
+
+    *pUTF8Len = count + c89str_popcount32(multiByte & mask) + c89str_popcount32(threeByte & mask);
+    return count;
+}
+
+#if defined(C89STR_SUPPORT_SSE2)
+/* Masks of the code units that are not ASCII, that need 3 bytes, and surrogates, for up to 16 code units. */
+static C89STR_INLINE void c89str_utf16_simd_masks__sse2(__m128i lo, __m128i hi, c89str_uint32* pMultiByte, c89str_uint32* pThreeByte, c89str_uint32* pSurrogate)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maskF800 = _mm_set1_epi16((short)0xF800);
+    const __m128i maskFF80 = _mm_set1_epi16((short)0xFF80);
+    const __m128i maskD800 = _mm_set1_epi16((short)0xD800);
+
+    *pMultiByte = (c89str_uint32)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, maskFF80), zero), _mm_cmpeq_epi16(_mm_and_si128(hi, maskFF80), zero))) ^ 0xFFFF;
+    *pThreeByte = (c89str_uint32)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, maskF800), zero), _mm_cmpeq_epi16(_mm_and_si128(hi, maskF800), zero))) ^ 0xFFFF;
+    *pSurrogate = (c89str_uint32)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, maskF800), maskD800), _mm_cmpeq_epi16(_mm_and_si128(hi, maskF800), maskD800)));
+}
+
+/* SSE2 has no byte shuffle so only runs of ASCII are narrowed. Counting only needs masks so the len path does everything. */
+static size_t c89str_utf16_to_utf8__sse2(const c89str_utf16* pUTF16, size_t utf16Len, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    const __m128i maskFF80 = _mm_set1_epi16((short)0xFF80);
+    size_t iUTF16 = 0;
+    size_t iUTF8  = 0;
+
+    while (utf16Len - iUTF16 >= 16 && utf8Cap - iUTF8 >= 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 0));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 8));
+        c89str_uint32 ascii;
+        size_t asciiLen;
+
+        if (swap) {
+            lo = c89str_utf16_swap__sse2(lo);
+            hi = c89str_utf16_swap__sse2(hi);
+        }
+
+        ascii = (c89str_uint32)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, maskFF80), _mm_setzero_si128()), _mm_cmpeq_epi16(_mm_and_si128(hi, maskFF80), _mm_setzero_si128())));
+        asciiLen = (ascii == 0xFFFF) ? 16 : c89str_ctz32(~ascii);
+        if (asciiLen == 0) {
+            break;
+        }
+
+        _mm_storeu_si128((__m128i*)(pUTF8 + iUTF8), _mm_packus_epi16(lo, hi));
+        iUTF16 += asciiLen;
+        iUTF8  += asciiLen;
+    }
+
+    *pUTF8Len = iUTF8;
+    return iUTF16;
+}
+
+static size_t c89str_utf16_to_utf8_len__sse2(const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    size_t iUTF16 = 0;
+
+    while (utf16Len - iUTF16 >= 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 0));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 8));
+        c89str_uint32 multiByte;
+        c89str_uint32 threeByte;
+        c89str_uint32 surrogate;
+        size_t utf8Len;
+        unsigned int count;
+
+        if (swap) {
+            lo = c89str_utf16_swap__sse2(lo);
+            hi = c89str_utf16_swap__sse2(hi);
+        }
+
+        c89str_utf16_simd_masks__sse2(lo, hi, &multiByte, &threeByte, &surrogate);
+        count = c89str_utf16_simd_block_len(multiByte, threeByte, surrogate, 16, &utf8Len);
+
+        *pUTF8Len += utf8Len;
+        iUTF16    += count;
+
+        if (count != 16) {
+            break;
+        }
+    }
+
+    return iUTF16;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_AVX2)
+/*
+Encodes all 8 code units in v, which must not contain surrogates, and returns the number of bytes output. This writes
+up to 28 bytes. Each code unit is expanded into a 32-bit lane of [last, middle, 3-byte lead, 2-byte lead], with ASCII
+code units going in the first byte as-is, and then the shuffles pick out the bytes that are needed. The lanes are built
+as two 16-bit halves so that all 8 code units are done at once. Uses SSSE3 instructions which are always available
+when AVX2 is.
+*/
+static C89STR_INLINE size_t c89str_utf16_to_utf8_block__avx2(__m128i v, c89str_uint32 multiByte, c89str_uint32 threeByte, c89str_utf8* pUTF8)
+{
+    __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128());
+    __m128i last  = _mm_or_si128(_mm_and_si128(ascii, v), _mm_andnot_si128(ascii, _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80))));
+    __m128i lo16  = _mm_or_si128(last, _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 2), _mm_set1_epi16(0x3F00)), _mm_set1_epi16((short)0x8000)));
+    __m128i hi16  = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(v, 12), _mm_set1_epi16(0xE0)), _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 2), _mm_set1_epi16((short)0xFF00)), _mm_set1_epi16((short)0xC000)));
+    const c89str_uint8* pShuffleLo = c89str_g_utf16ToUTF8Shuffles[c89str_g_utf16ToUTF8Pow3[(multiByte >> 0) & 0x0F] + c89str_g_utf16ToUTF8Pow3[(threeByte >> 0) & 0x0F]];
+    const c89str_uint8* pShuffleHi = c89str_g_utf16ToUTF8Shuffles[c89str_g_utf16ToUTF8Pow3[(multiByte >> 4) & 0x0F] + c89str_g_utf16ToUTF8Pow3[(threeByte >> 4) & 0x0F]];
+
+    _mm_storeu_si128((__m128i*)(pUTF8),                  _mm_shuffle_epi8(_mm_unpacklo_epi16(lo16, hi16), _mm_loadu_si128((const __m128i*)pShuffleLo)));
+    _mm_storeu_si128((__m128i*)(pUTF8 + pShuffleLo[16]), _mm_shuffle_epi8(_mm_unpackhi_epi16(lo16, hi16), _mm_loadu_si128((const __m128i*)pShuffleHi)));
+
+    return pShuffleLo[16] + pShuffleHi[16];
+}
+
+static size_t c89str_utf16_to_utf8__avx2(const c89str_utf16* pUTF16, size_t utf16Len, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    size_t iUTF16 = 0;
+    size_t iUTF8  = 0;
+
+    while (utf16Len - iUTF16 >= 16 && utf8Cap - iUTF8 >= 64) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 0));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(pUTF16 + iUTF16 + 8));
+        c89str_uint32 multiByte;
+        c89str_uint32 threeByte;
+        c89str_uint32 surrogate;
+        size_t utf8Len;
+        size_t loLen;
+        unsigned int count;
+
+        if (swap) {
+            lo = c89str_utf16_swap__sse2(lo);
+            hi = c89str_utf16_swap__sse2(hi);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(lo, hi), _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(pUTF8 + iUTF8), _mm_packus_epi16(lo, hi));
+            iUTF16 += 16;
+            iUTF8  += 16;
+            continue;
+        }
+
+        c89str_utf16_simd_masks__sse2(lo, hi, &multiByte, &threeByte, &surrogate);
+
+        if (surrogate == 0) {
+            iUTF8  += c89str_utf16_to_utf8_block__avx2(lo, multiByte >> 0, threeByte >> 0, pUTF8 + iUTF8);
+            iUTF8  += c89str_utf16_to_utf8_block__avx2(hi, multiByte >> 8, threeByte >> 8, pUTF8 + iUTF8);
+            iUTF16 += 16;
+            continue;
+        }
+
+        /* There's a surrogate somewhere. Encode the code units before it and leave the rest to the scalar path. */
+        count = c89str_utf16_simd_block_len(multiByte, threeByte, surrogate, 16, &utf8Len);
+        if (count == 0) {
+            break;
+        }
+
+        loLen = c89str_utf16_to_utf8_block__avx2(lo, multiByte >> 0, threeByte >> 0, pUTF8 + iUTF8);
+        if (count > 8) {
+            c89str_utf16_to_utf8_block__avx2(hi, multiByte >> 8, threeByte >> 8, pUTF8 + iUTF8 + loLen);
+        }
+
+        iUTF16 += count;
+        iUTF8  += utf8Len;
+        break;
+    }
+
+    *pUTF8Len = iUTF8;
+    return iUTF16;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON)
+/* Returns the number of ASCII code units at the start of lo and hi. */
+static C89STR_INLINE size_t c89str_utf16_ascii_prefix__neon(uint16x8_t lo, uint16x8_t hi)
+{
+    const uint16x8_t maskFF80 = vdupq_n_u16(0xFF80);
+    c89str_uint64 nonASCII = c89str_neon_movemask_u8x16(vcombine_u8(vmovn_u16(vtstq_u16(lo, maskFF80)), vmovn_u16(vtstq_u16(hi, maskFF80))));
+
+    return (nonASCII == 0) ? 16 : (c89str_ctz64(nonASCII) / 4);
+}
+
+#if defined(C89STR_SUPPORT_NEON_TBL)
+static C89STR_INLINE void c89str_utf16_simd_masks__neon(uint16x8_t lo, uint16x8_t hi, c89str_uint32* pMultiByte, c89str_uint32* pThreeByte, c89str_uint32* pSurrogate)
+{
+    const uint16x8_t maskFF80 = vdupq_n_u16(0xFF80);
+    const uint16x8_t maskF800 = vdupq_n_u16(0xF800);
+    const uint16x8_t maskD800 = vdupq_n_u16(0xD800);
+
+    *pMultiByte = c89str_neon_bitmask_u8x16(vcombine_u8(vmovn_u16(vtstq_u16(lo, maskFF80)), vmovn_u16(vtstq_u16(hi, maskFF80))));
+    *pThreeByte = c89str_neon_bitmask_u8x16(vcombine_u8(vmovn_u16(vtstq_u16(lo, maskF800)), vmovn_u16(vtstq_u16(hi, maskF800))));
+    *pSurrogate = c89str_neon_bitmask_u8x16(vcombine_u8(vmovn_u16(vceqq_u16(vandq_u16(lo, maskF800), maskD800)), vmovn_u16(vceqq_u16(vandq_u16(hi, maskF800), maskD800))));
+}
+
+/* See c89str_utf16_to_utf8_block__avx2(). */
+static C89STR_INLINE size_t c89str_utf16_to_utf8_block__neon(uint16x8_t v, c89str_uint32 multiByte, c89str_uint32 threeByte, c89str_utf8* pUTF8)
+{
+    uint16x8_t ascii = vceqq_u16(vandq_u16(v, vdupq_n_u16(0xFF80)), vdupq_n_u16(0));
+    uint16x8_t last  = vbslq_u16(ascii, v, vorrq_u16(vandq_u16(v, vdupq_n_u16(0x3F)), vdupq_n_u16(0x80)));
+    uint16x8_t lo16  = vorrq_u16(last, vorrq_u16(vandq_u16(vshlq_n_u16(v, 2), vdupq_n_u16(0x3F00)), vdupq_n_u16(0x8000)));
+    uint16x8_t hi16  = vorrq_u16(vorrq_u16(vshrq_n_u16(v, 12), vdupq_n_u16(0xE0)), vorrq_u16(vandq_u16(vshlq_n_u16(v, 2), vdupq_n_u16(0xFF00)), vdupq_n_u16(0xC000)));
+    uint16x8x2_t lanes = vzipq_u16(lo16, hi16);
+    const c89str_uint8* pShuffleLo = c89str_g_utf16ToUTF8Shuffles[c89str_g_utf16ToUTF8Pow3[(multiByte >> 0) & 0x0F] + c89str_g_utf16ToUTF8Pow3[(threeByte >> 0) & 0x0F]];
+    const c89str_uint8* pShuffleHi = c89str_g_utf16ToUTF8Shuffles[c89str_g_utf16ToUTF8Pow3[(multiByte >> 4) & 0x0F] + c89str_g_utf16ToUTF8Pow3[(threeByte >> 4) & 0x0F]];
+
+    vst1q_u8((c89str_uint8*)(pUTF8),                  vqtbl1q_u8(vreinterpretq_u8_u16(lanes.val[0]), vld1q_u8(pShuffleLo)));
+    vst1q_u8((c89str_uint8*)(pUTF8 + pShuffleLo[16]), vqtbl1q_u8(vreinterpretq_u8_u16(lanes.val[1]), vld1q_u8(pShuffleHi)));
+
+    return pShuffleLo[16] + pShuffleHi[16];
+}
+
+/* See c89str_utf16_to_utf8__avx2(). */
+static size_t c89str_utf16_to_utf8__neon(const c89str_utf16* pUTF16, size_t utf16Len, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    size_t iUTF16 = 0;
+    size_t iUTF8  = 0;
+
+    while (utf16Len - iUTF16 >= 16 && utf8Cap - iUTF8 >= 64) {
+        uint16x8_t lo = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 0));
+        uint16x8_t hi = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 8));
+        c89str_uint32 multiByte;
+        c89str_uint32 threeByte;
+        c89str_uint32 surrogate;
+        size_t utf8Len;
+        size_t loLen;
+        unsigned int count;
+
+        if (swap) {
+            lo = c89str_utf16_swap__neon(lo);
+            hi = c89str_utf16_swap__neon(hi);
+        }
+
+        c89str_utf16_simd_masks__neon(lo, hi, &multiByte, &threeByte, &surrogate);
+
+        if (multiByte == 0) {
+            vst1q_u8((c89str_uint8*)(pUTF8 + iUTF8), vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+            iUTF16 += 16;
+            iUTF8  += 16;
+            continue;
+        }
+
+        if (surrogate == 0) {
+            iUTF8  += c89str_utf16_to_utf8_block__neon(lo, multiByte >> 0, threeByte >> 0, pUTF8 + iUTF8);
+            iUTF8  += c89str_utf16_to_utf8_block__neon(hi, multiByte >> 8, threeByte >> 8, pUTF8 + iUTF8);
+            iUTF16 += 16;
+            continue;
+        }
+
+        count = c89str_utf16_simd_block_len(multiByte, threeByte, surrogate, 16, &utf8Len);
+        if (count == 0) {
+            break;
+        }
+
+        loLen = c89str_utf16_to_utf8_block__neon(lo, multiByte >> 0, threeByte >> 0, pUTF8 + iUTF8);
+        if (count > 8) {
+            c89str_utf16_to_utf8_block__neon(hi, multiByte >> 8, threeByte >> 8, pUTF8 + iUTF8 + loLen);
+        }
+
+        iUTF16 += count;
+        iUTF8  += utf8Len;
+        break;
+    }
+
+    *pUTF8Len = iUTF8;
+    return iUTF16;
+}
+#else
+/* Without vqtbl1q_u8() only runs of ASCII are narrowed. */
+static size_t c89str_utf16_to_utf8__neon(const c89str_utf16* pUTF16, size_t utf16Len, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    size_t iUTF16 = 0;
+    size_t iUTF8  = 0;
+
+    while (utf16Len - iUTF16 >= 16 && utf8Cap - iUTF8 >= 16) {
+        uint16x8_t lo = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 0));
+        uint16x8_t hi = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 8));
+        size_t asciiLen;
+
+        if (swap) {
+            lo = c89str_utf16_swap__neon(lo);
+            hi = c89str_utf16_swap__neon(hi);
+        }
+
+        asciiLen = c89str_utf16_ascii_prefix__neon(lo, hi);
+        if (asciiLen == 0) {
+            break;
+        }
+
+        vst1q_u8((c89str_uint8*)(pUTF8 + iUTF8), vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+        iUTF16 += asciiLen;
+        iUTF8  += asciiLen;
+    }
+
+    *pUTF8Len = iUTF8;
+    return iUTF16;
+}
+#endif
+
+static size_t c89str_utf16_to_utf8_len__neon(const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    size_t iUTF16 = 0;
+
+    while (utf16Len - iUTF16 >= 16) {
+        uint16x8_t lo = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 0));
+        uint16x8_t hi = vld1q_u16((const c89str_uint16*)(pUTF16 + iUTF16 + 8));
+    #if defined(C89STR_SUPPORT_NEON_TBL)
+        c89str_uint32 multiByte;
+        c89str_uint32 threeByte;
+        c89str_uint32 surrogate;
+        size_t utf8Len;
+    #endif
+        unsigned int count;
+
+        if (swap) {
+            lo = c89str_utf16_swap__neon(lo);
+            hi = c89str_utf16_swap__neon(hi);
+        }
+
+    #if defined(C89STR_SUPPORT_NEON_TBL)
+        c89str_utf16_simd_masks__neon(lo, hi, &multiByte, &threeByte, &surrogate);
+        count = c89str_utf16_simd_block_len(multiByte, threeByte, surrogate, 16, &utf8Len);
+        *pUTF8Len += utf8Len;
+    #else
+        count = (unsigned int)c89str_utf16_ascii_prefix__neon(lo, hi);
+        *pUTF8Len += count;
+    #endif
+
+        iUTF16 += count;
+
+        if (count != 16) {
+            break;
+        }
+    }
+
+    return iUTF16;
+}
+#endif
+
+/*
+Converts as much of the input as the SIMD paths can handle and returns the number of code units consumed. The input is
+byte swapped when swap is true. Returns 0 when there's nothing the SIMD paths can do at the start of the input.
+*/
+static size_t c89str_utf16_to_utf8_simd(const c89str_utf16* pUTF16, size_t utf16Len, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+    C89STR_UNUSED(pUTF16);
+    C89STR_UNUSED(utf16Len);
+    C89STR_UNUSED(pUTF8);
+    C89STR_UNUSED(utf8Cap);
+    C89STR_UNUSED(swap);
+
+    *pUTF8Len = 0;
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_utf16_to_utf8__avx2(pUTF16, utf16Len, pUTF8, utf8Cap, pUTF8Len, swap);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf16_to_utf8__sse2(pUTF16, utf16Len, pUTF8, utf8Cap, pUTF8Len, swap);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf16_to_utf8__neon(pUTF16, utf16Len, pUTF8, utf8Cap, pUTF8Len, swap);
+    }
+#endif
+
+    return 0;
+}
+
+/* Same as above, but only counts. The count is added to pUTF8Len. */
+static size_t c89str_utf16_to_utf8_len_simd(const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF8Len, c89str_bool32 swap)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+    C89STR_UNUSED(pUTF16);
+    C89STR_UNUSED(utf16Len);
+    C89STR_UNUSED(pUTF8Len);
+    C89STR_UNUSED(swap);
+
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_utf16_to_utf8_len__sse2(pUTF16, utf16Len, pUTF8Len, swap);   /* Only uses masks so there's no need for an AVX2 version. */
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_utf16_to_utf8_len__neon(pUTF16, utf16Len, pUTF8Len, swap);
+    }
+#endif
+
+    return 0;
+}
+
+C89STR_API errno_t c89str_utf16_to_utf8_len_internal(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf8Len = 0;
+    c89str_utf16 w1;
+    c89str_utf16 w2;
+    c89str_utf32 utf32;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf16Len == 0 || pUTF16[0] == 0) {
+        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1; /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        size_t iUTF16SIMD = 0;   /* The position at which the SIMD path will be tried again. */
+        c89str_bool32 swap = (isLE != c89str_is_little_endian());
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (iUTF16 >= iUTF16SIMD && utf16Len - iUTF16 >= 16) {
+                size_t utf16Processed = c89str_utf16_to_utf8_len_simd(pUTF16 + iUTF16, utf16Len - iUTF16, &utf8Len, swap);
+                iUTF16    += utf16Processed;
+                iUTF16SIMD = iUTF16 + ((utf16Processed == 0) ? C89STR_UTF_SIMD_BACKOFF : 1);
+                continue;
+            }
+
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+2 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf16ne_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf16le_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return c89str_utf16be_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf16le_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf16be_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf8_len(size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf16le_to_utf8_len(pUTF8Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf16be_to_utf8_len(pUTF8Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf16ne_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+C89STR_API errno_t c89str_utf16_to_utf8_internal(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf8CapOriginal = utf8Cap;
+    c89str_utf16 w1;
+    c89str_utf16 w2;
+    c89str_utf32 utf32;
+    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
+    size_t utf16cpLen;  /* Code point length in UTF-16 code units. Only consumed once the output has been written. */
+
+    if (pUTF8 == NULL) {
+        return c89str_utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                utf16cpLen = 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        utf16cpLen = 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    utf16cpLen = 1;
+                }
+            }
+
+            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+            pUTF16  += utf16cpLen;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        size_t iUTF16SIMD = 0;   /* The position at which the SIMD path will be tried again. */
+        c89str_bool32 swap = (isLE != c89str_is_little_endian());
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (iUTF16 >= iUTF16SIMD && utf16Len - iUTF16 >= 16 && utf8Cap > 32) {
+                size_t utf8SIMDLen;
+                size_t utf16Processed = c89str_utf16_to_utf8_simd(pUTF16 + iUTF16, utf16Len - iUTF16, pUTF8, utf8Cap - 1, &utf8SIMDLen, swap);  /* -1 to keep room for the null terminator. */
+                iUTF16    += utf16Processed;
+                pUTF8     += utf8SIMDLen;
+                utf8Cap   -= utf8SIMDLen;
+                iUTF16SIMD = iUTF16 + ((utf16Processed == 0) ? C89STR_UTF_SIMD_BACKOFF : 1);
+                continue;
+            }
+
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                utf16cpLen = 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+2 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        utf16cpLen = 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    utf16cpLen = 1;
+                }
+            }
+
+            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+            iUTF16  += utf16cpLen;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+    
+    /* Null terminate. */
+    if (utf8Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF8[0] = 0;
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf16ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return c89str_utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf16le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf16be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (pUTF8 == NULL) {
+        return c89str_utf16_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf16ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf8_alloc(c89str_utf8** ppUTF8, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    errno_t result;
+    c89str_utf8* pUTF8;
+    size_t utf8Cap;
+    size_t utf8Len = 0;
+    size_t utf16LenForSizing;
+
+    if (ppUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    *ppUTF8 = NULL;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL;
+    }
+
+    utf16LenForSizing = utf16Len;
+    if (utf16LenForSizing == (size_t)-1) {
+        utf16LenForSizing = 0;
+        while (pUTF16[utf16LenForSizing] != 0) {
+            utf16LenForSizing += 1;
+        }
+    }
+
+    /* A UTF-16 code unit never produces more than 3 bytes. A surrogate pair is two code units producing 4 bytes. */
+    pUTF8 = (c89str_utf8*)c89str_transcode_alloc(utf16LenForSizing, 3, sizeof(*pUTF8), &utf8Cap, pAllocationCallbacks);
+    if (pUTF8 == NULL) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf16_to_utf8(pUTF8, utf8Cap, &utf8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags & ~C89STR_SHRINK_TO_FIT);
+
+    pUTF8 = (c89str_utf8*)c89str_transcode_alloc_finish(pUTF8, utf8Len, sizeof(*pUTF8), result, flags, pAllocationCallbacks);
+    if (pUTF8 == NULL) {
+        return result;
+    }
+
+    *ppUTF8 = pUTF8;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+
+C89STR_API errno_t c89str_utf16_to_utf32_len_internal(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf32Len = 0;
+    c89str_utf16 w1;
+    c89str_utf16 w2;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf16Len == 0 || pUTF16[0] == 0) {
+        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1; /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[1]);
+                        }
+                    
+                        /* Check for invalid code point. */
+                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            utf32Len += 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+2 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        /* Check for invalid code point. */
+                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            utf32Len += 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf16ne_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf16le_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return c89str_utf16be_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf16le_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf16be_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf32_len(size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf16le_to_utf32_len(pUTF32Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf16be_to_utf32_len(pUTF32Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf16ne_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+C89STR_API errno_t c89str_utf16_to_utf32_internal(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf32CapOriginal = utf32Cap;
+    c89str_utf16 w1;
+    c89str_utf16 w2;
+    c89str_utf32 utf32;
+
+    if (pUTF32 == NULL) {
+        return c89str_utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = c89str_le2host_16(pUTF16[0]);
+            } else {
+                w1 = c89str_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = c89str_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = c89str_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            if (isLE) {
+                pUTF32[0] = c89str_host2le_32(utf32);
+            } else {
+                pUTF32[0] = c89str_host2be_32(utf32);
+            }
+            
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. In the non-native byte order the input is swapped a block at a time. See above. */
+        size_t iUTF16;
+        c89str_bool32 swap = (isLE != c89str_is_little_endian());
+        c89str_utf16 swapped[C89STR_SWAP_BLOCK_SIZE];
+        const c89str_utf16* pBlock = pUTF16;    /* The input in native byte order, starting at iBlock. */
+        size_t iBlock = 0;
+        size_t iRefill = (swap) ? 0 : utf16Len; /* Where the next block starts. The last unit of a block is left for the next one so a surrogate pair is never split. */
+        c89str_utf32* pUTF32Block = pUTF32;     /* The output of the current block, swapped when the block is done. */
+
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (iUTF16 >= iRefill) {
+                size_t blockLen;
+
+                c89str_utf32_swap_endian_copy(pUTF32Block, pUTF32Block, (size_t)(pUTF32 - pUTF32Block));
+                pUTF32Block = pUTF32;
+
+                iBlock   = iUTF16;
+                blockLen = utf16Len - iUTF16;
+                if (blockLen > C89STR_SWAP_BLOCK_SIZE) {
+                    blockLen = C89STR_SWAP_BLOCK_SIZE;
+                    iRefill  = iBlock + blockLen - 1;
+                } else {
+                    iRefill  = utf16Len;
+                }
+
+                c89str_utf16_swap_endian_copy(swapped, pUTF16 + iUTF16, blockLen);
+                pBlock = swapped;
+            }
+
+            w1 = pBlock[iUTF16 - iBlock];
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+2 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        w2 = pBlock[iUTF16+1 - iBlock];
+
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = c89str_utf16_units_to_utf32_cp(w1, w2);
+                        } else {
+                            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = C89STR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = C89STR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            pUTF32[0] = utf32;
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (swap) {
+            c89str_utf32_swap_endian_copy(pUTF32Block, pUTF32Block, (size_t)(pUTF32 - pUTF32Block));
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+    
+    /* Null terminate. */
+    if (utf32Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF32[0] = 0;
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf16ne_to_utf32ne(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return c89str_utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf16le_to_utf32le(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf16be_to_utf32be(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    return c89str_utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf32(c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, unsigned int flags)
+{
+    if (pUTF32 == NULL) {
+        return c89str_utf16_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, &utf16LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf16ne_to_utf32ne(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+C89STR_API errno_t c89str_utf32_to_utf8_len_internal(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf8Len = 0;
+    c89str_utf32 utf32;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf32Len == 0 || pUTF32[0] == 0) {
+        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[0]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
+            pUTF32  += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8Len += c89str_utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf32ne_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf32le_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return c89str_utf32be_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf32le_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf32be_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf32_to_utf8_len(size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf32le_to_utf8_len(pUTF8Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf32be_to_utf8_len(pUTF8Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf32ne_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+
+C89STR_API errno_t c89str_utf32_to_utf8_internal(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf8CapOriginal = utf8Cap;
+    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
+    c89str_utf32 utf32;
+
+    if (pUTF8 == NULL) {
+        return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[0]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+            pUTF32  += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. In the non-native byte order the input is swapped a block at a time. */
+        size_t iUTF32;
+        c89str_bool32 swap = (isLE != c89str_is_little_endian());
+        c89str_utf32 swapped[C89STR_SWAP_BLOCK_SIZE];
+        const c89str_utf32* pBlock = pUTF32;    /* The input in native byte order, starting at iBlock. */
+        size_t iBlock = 0;
+        size_t iRefill = (swap) ? 0 : utf32Len;    /* Where the next block starts. */
+
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (iUTF32 == iRefill) {
+                size_t blockLen;
+
+                iBlock   = iUTF32;
+                blockLen = utf32Len - iUTF32;
+                if (blockLen > C89STR_SWAP_BLOCK_SIZE) {
+                    blockLen = C89STR_SWAP_BLOCK_SIZE;
+                }
+
+                iRefill = iBlock + blockLen;
+
+                c89str_utf32_swap_endian_copy(swapped, pUTF32 + iUTF32, blockLen);
+                pBlock = swapped;
+            }
+
+            utf32 = pBlock[iUTF32 - iBlock];
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    /* Null terminate. */
+    if (utf8Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF8[0] = 0;
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf32ne_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return c89str_utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf32le_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf32be_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf32_to_utf8(c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf32ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+C89STR_API errno_t c89str_utf32_to_utf8_alloc(c89str_utf8** ppUTF8, size_t* pUTF8Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    errno_t result;
+    c89str_utf8* pUTF8;
+    size_t utf8Cap;
+    size_t utf8Len = 0;
+    size_t utf32LenForSizing;
+
+    if (ppUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    *ppUTF8 = NULL;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    utf32LenForSizing = utf32Len;
+    if (utf32LenForSizing == (size_t)-1) {
+        utf32LenForSizing = 0;
+        while (pUTF32[utf32LenForSizing] != 0) {
+            utf32LenForSizing += 1;
+        }
+    }
+
+    /* A UTF-32 code unit never produces more than 4 bytes. Invalid code points are replaced with U+FFFD which is 3. */
+    pUTF8 = (c89str_utf8*)c89str_transcode_alloc(utf32LenForSizing, 4, sizeof(*pUTF8), &utf8Cap, pAllocationCallbacks);
+    if (pUTF8 == NULL) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf32_to_utf8(pUTF8, utf8Cap, &utf8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags & ~C89STR_SHRINK_TO_FIT);
+
+    pUTF8 = (c89str_utf8*)c89str_transcode_alloc_finish(pUTF8, utf8Len, sizeof(*pUTF8), result, flags, pAllocationCallbacks);
+    if (pUTF8 == NULL) {
+        return result;
+    }
+
+    *ppUTF8 = pUTF8;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+
+
+C89STR_API errno_t c89str_utf32_to_utf16_len_internal(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf16Len = 0;
+    c89str_utf32 utf32;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf32Len == 0 || pUTF32[0] == 0) {
+        return C89STR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[0]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16Len += c89str_utf32_cp_to_utf16_len(utf32);
+            pUTF32   += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16Len += c89str_utf32_cp_to_utf16_len(utf32);
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    return result;
+}
+
+errno_t c89str_utf32ne_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf32le_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return c89str_utf32be_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf32le_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf32be_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf32_to_utf16_len(size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf32le_to_utf16_len(pUTF16Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf32be_to_utf16_len(pUTF16Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf32ne_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+
+C89STR_API errno_t c89str_utf32_to_utf16_internal(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags, c89str_bool32 isLE)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t utf16CapOriginal = utf16Cap;
+    size_t utf16cpLen;  /* Code point length in UTF-8 code units. */
+    c89str_utf32 utf32;
+
+    if (pUTF16 == NULL) {
+        return c89str_utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const c89str_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (utf16Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = c89str_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = c89str_be2host_32(pUTF32[0]);
+            }
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16cpLen = c89str_utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
+            if (utf16cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            if (isLE) {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = c89str_host2le_16(pUTF16[0]);
+                    pUTF16[1] = c89str_host2le_16(pUTF16[1]);
+                }
+            } else {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = c89str_host2be_16(pUTF16[0]);
+                    pUTF16[1] = c89str_host2be_16(pUTF16[1]);
+                }
+            }
+
+            pUTF16   += utf16cpLen;
+            utf16Cap -= utf16cpLen;
+            pUTF32   += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. In the non-native byte order the input is swapped a block at a time. */
+        size_t iUTF32;
+        c89str_bool32 swap = (isLE != c89str_is_little_endian());
+        c89str_utf32 swapped[C89STR_SWAP_BLOCK_SIZE];
+        const c89str_utf32* pBlock = pUTF32;    /* The input in native byte order, starting at iBlock. */
+        size_t iBlock = 0;
+        size_t iRefill = (swap) ? 0 : utf32Len;    /* Where the next block starts. */
+        c89str_utf16* pUTF16Block = pUTF16;     /* The output of the current block, swapped when the block is done. */
+
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (utf16Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (iUTF32 == iRefill) {
+                size_t blockLen;
+
+                c89str_utf16_swap_endian_copy(pUTF16Block, pUTF16Block, (size_t)(pUTF16 - pUTF16Block));
+                pUTF16Block = pUTF16;
+
+                iBlock   = iUTF32;
+                blockLen = utf32Len - iUTF32;
+                if (blockLen > C89STR_SWAP_BLOCK_SIZE) {
+                    blockLen = C89STR_SWAP_BLOCK_SIZE;
+                }
+
+                iRefill = iBlock + blockLen;
+
+                c89str_utf32_swap_endian_copy(swapped, pUTF32 + iUTF32, blockLen);
+                pBlock = swapped;
+            }
+
+            utf32 = pBlock[iUTF32 - iBlock];
+
+            if (!c89str_is_valid_code_point(utf32)) {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = C89STR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16cpLen = c89str_utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
+            if (utf16cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF16   += utf16cpLen;
+            utf16Cap -= utf16cpLen;
+        }
+
+        if (swap) {
+            c89str_utf16_swap_endian_copy(pUTF16Block, pUTF16Block, (size_t)(pUTF16 - pUTF16Block));
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    /* Null terminate. */
+    if (utf16Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF16[0] = 0;
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf32ne_to_utf16ne(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (c89str_is_little_endian()) {
+        return c89str_utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return c89str_utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+C89STR_API errno_t c89str_utf32le_to_utf16le(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_TRUE);
+}
+
+C89STR_API errno_t c89str_utf32be_to_utf16be(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    return c89str_utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, C89STR_FALSE);
+}
+
+C89STR_API errno_t c89str_utf32_to_utf16(c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, unsigned int flags)
+{
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        c89str_bool32 isLE;
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = c89str_utf32_is_bom_le((const unsigned char*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = c89str_utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = c89str_utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, &utf32LenProcessed, flags | C89STR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return c89str_utf32ne_to_utf16ne(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+
+
+/*
+Streaming
+
+Each chunk is converted with the regular conversion functions. They return EINVAL with the number of units processed
+pointing at the start of the sequence when the input ends part way through a code point, so that's where the chunk
+is cut. On the next call the kept units are topped up from the new chunk and converted in a small buffer of their own,
+and then the rest of the new chunk is converted in place. This gives the same output as converting the whole input in
+one go, including for malformed input.
+
+The regular conversion functions skip a BOM at the start of their input, which is only correct at the start of the
+stream. A BOM anywhere else is converted here instead, by itself, so the conversion functions never see it.
+*/
+/*
+The output capacity given to the convert callbacks does not include the null terminator. The conversion functions can
+fill their output buffer completely, in which case they return ENOMEM because there's no room left for the terminator,
+so the stream leaves room for it and writes it itself.
+*/
+typedef errno_t (* c89str_utf_stream_convert_proc)(c89str_utf_stream* pStream, void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen, size_t* pInLenProcessed);
+
+C89STR_API errno_t c89str_utf_stream_init(c89str_utf_stream* pStream, unsigned int flags)
+{
+    if (pStream == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pStream);
+    pStream->flags = flags;
+    pStream->isLE  = c89str_is_little_endian();
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_utf_stream_finish(c89str_utf_stream* pStream)
+{
+    errno_t result = C89STR_SUCCESS;
+
+    if (pStream == NULL) {
+        return EINVAL;
+    }
+
+    if (pStream->partialLen > 0) {
+        result = EINVAL;    /* The input ended part way through a code point. */
+    }
+
+    c89str_utf_stream_init(pStream, pStream->flags);
+
+    return result;
+}
+
+static errno_t c89str_utf_stream_feed(c89str_utf_stream* pStream, c89str_utf_stream_convert_proc onConvert, size_t inUnitSize, size_t maxSequenceLen, size_t outUnitSize, void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen, size_t* pInLenProcessed)
+{
+    errno_t result = C89STR_SUCCESS;
+    size_t outLen = 0;
+    size_t inLenProcessed = 0;
+    size_t outLenThisCall;
+    size_t inLenThisCall;
+
+    if (pOutLen != NULL) {
+        *pOutLen = 0;
+    }
+
+    if (pInLenProcessed != NULL) {
+        *pInLenProcessed = 0;
+    }
+
+    if (pStream == NULL || pOut == NULL || (pIn == NULL && inLen > 0)) {
+        return EINVAL;
+    }
+
+    if (outCap == 0) {
+        return ENOMEM;  /* Need room for the null terminator. */
+    }
+
+    /* Finish off the code point from the previous chunk first. */
+    if (pStream->partialLen > 0) {
+        size_t partialLen = pStream->partialLen;
+        size_t topUpLen = maxSequenceLen - partialLen;
+        union
+        {
+            c89str_utf8  utf8[8];
+            c89str_utf16 utf16[4];
+        } temp;
+
+        if (topUpLen > inLen) {
+            topUpLen = inLen;
+        }
+
+        C89STR_COPY_MEMORY(temp.utf8, pStream->partial.utf8, partialLen * inUnitSize);
+        C89STR_COPY_MEMORY(temp.utf8 + (partialLen * inUnitSize), pIn, topUpLen * inUnitSize);
+
+        result = onConvert(pStream, pOut, outCap - 1, &outLenThisCall, temp.utf8, partialLen + topUpLen, &inLenThisCall);
+        if (result == ENOMEM && inLenThisCall == partialLen + topUpLen) {
+            result = C89STR_SUCCESS;    /* Only the null terminator didn't fit. */
+        }
+
+        if (inLenThisCall < partialLen) {
+            /* Nothing was converted. Either the code point is still incomplete, or there's no room for it. */
+            if (result == EINVAL && topUpLen == inLen) {
+                C89STR_ZERO_MEMORY(pOut, outUnitSize);
+                C89STR_COPY_MEMORY(pStream->partial.utf8 + (partialLen * inUnitSize), pIn, topUpLen * inUnitSize);
+                pStream->partialLen += topUpLen;
+
+                if (pInLenProcessed != NULL) {
+                    *pInLenProcessed = inLen;
+                }
+
+                return C89STR_SUCCESS;
+            }
+
+            if (result == C89STR_SUCCESS) {
+                result = ENOMEM;
+            }
+
+            C89STR_ZERO_MEMORY(pOut, outUnitSize);
+            return result;
+        }
+
+        pStream->partialLen = 0;
+        outLen         = outLenThisCall;
+        inLenProcessed = inLenThisCall - partialLen;
+
+        if (result != C89STR_SUCCESS && result != EINVAL) {
+            goto done;  /* EINVAL means a later code point in the temp buffer was cut off. It'll be converted below. */
+        }
+
+        result = C89STR_SUCCESS;
+    }
+
+    while (inLenProcessed < inLen) {
+        result = onConvert(pStream, (unsigned char*)pOut + (outLen * outUnitSize), outCap - outLen - 1, &outLenThisCall, (const unsigned char*)pIn + (inLenProcessed * inUnitSize), inLen - inLenProcessed, &inLenThisCall);
+        outLen         += outLenThisCall;
+        inLenProcessed += inLenThisCall;
+
+        if (result == ENOMEM && inLenProcessed == inLen) {
+            result = C89STR_SUCCESS;    /* Only the null terminator didn't fit. */
+        }
+
+        if (result != C89STR_SUCCESS) {
+            break;
+        }
+
+        if (inLenThisCall == 0) {
+            result = ENOMEM;    /* The output buffer is full. */
+            break;
+        }
+    }
+
+    /* Keep the start of a code point that was cut off by the end of the chunk for next time. */
+    if (result == EINVAL && inLen - inLenProcessed < maxSequenceLen) {
+        pStream->partialLen = inLen - inLenProcessed;
+        C89STR_COPY_MEMORY(pStream->partial.utf8, (const unsigned char*)pIn + (inLenProcessed * inUnitSize), pStream->partialLen * inUnitSize);
+        inLenProcessed = inLen;
+        result = C89STR_SUCCESS;
+    }
+
+done:
+    C89STR_ZERO_MEMORY((unsigned char*)pOut + (outLen * outUnitSize), outUnitSize);
+
+    if (pOutLen != NULL) {
+        *pOutLen = outLen;
+    }
+
+    if (pInLenProcessed != NULL) {
+        *pInLenProcessed = inLenProcessed;
+    }
+
+    return result;
+}
+
+static errno_t c89str_utf8_to_utf16_stream_convert(c89str_utf_stream* pStream, void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen, size_t* pInLenProcessed)
+{
+    c89str_utf16* pUTF16 = (c89str_utf16*)pOut;
+    const c89str_utf8* pUTF8 = (const c89str_utf8*)pIn;
+    errno_t result;
+
+    *pOutLen = 0;
+    *pInLenProcessed = 0;
+
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, inLen)) {
+        if (pStream->isStarted) {
+            if (outCap == 0) {
+                return ENOMEM;
+            }
+
+            pUTF16[0] = 0xFEFF;
+            *pOutLen = 1;
+        } else if ((pStream->flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;
+        }
+
+        pStream->isStarted = C89STR_TRUE;
+        *pInLenProcessed = 3;
+        return C89STR_SUCCESS;
+    }
+
+    if (outCap == 0) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf8_to_utf16ne(pUTF16, outCap, pOutLen, pUTF8, inLen, pInLenProcessed, pStream->flags);
+    if (*pInLenProcessed > 0) {
+        pStream->isStarted = C89STR_TRUE;
+    }
+
+    return result;
+}
+
+static errno_t c89str_utf8_to_utf32_stream_convert(c89str_utf_stream* pStream, void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen, size_t* pInLenProcessed)
+{
+    c89str_utf32* pUTF32 = (c89str_utf32*)pOut;
+    const c89str_utf8* pUTF8 = (const c89str_utf8*)pIn;
+    errno_t result;
+
+    *pOutLen = 0;
+    *pInLenProcessed = 0;
+
+    if (c89str_utf8_has_bom((const unsigned char*)pUTF8, inLen)) {
+        if (pStream->isStarted) {
+            if (outCap == 0) {
+                return ENOMEM;
+            }
+
+            pUTF32[0] = 0xFEFF;
+            *pOutLen = 1;
+        } else if ((pStream->flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;
+        }
+
+        pStream->isStarted = C89STR_TRUE;
+        *pInLenProcessed = 3;
+        return C89STR_SUCCESS;
+    }
+
+    if (outCap == 0) {
+        return ENOMEM;
+    }
+
+    result = c89str_utf8_to_utf32ne(pUTF32, outCap, pOutLen, pUTF8, inLen, pInLenProcessed, pStream->flags);
+    if (*pInLenProcessed > 0) {
+        pStream->isStarted = C89STR_TRUE;
+    }
+
+    return result;
+}
+
+static errno_t c89str_utf16_to_utf8_stream_convert(c89str_utf_stream* pStream, void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen, size_t* pInLenProcessed)
+{
+    c89str_utf8* pUTF8 = (c89str_utf8*)pOut;
+    const c89str_utf16* pUTF16 = (const c89str_utf16*)pIn;
+    errno_t result;
+
+    *pOutLen = 0;
+    *pInLenProcessed = 0;
+
+    if (c89str_utf16_has_bom_in_units(pUTF16, inLen)) {
+        if (pStream->isStarted) {
+            /* Not a BOM this far into the stream. Convert it as a regular code point. */
+            c89str_utf32 utf32 = (pStream->isLE) ? c89str_le2host_16(pUTF16[0]) : c89str_be2host_16(pUTF16[0]);
+            size_t utf8cpLen = c89str_utf32_cp_to_utf8(utf32, pUTF8, outCap);
+            if (utf8cpLen == 0) {
+                return ENOMEM;
+            }
+
+            *pOutLen = utf8cpLen;
+        } else {
+            if ((pStream->flags & C89STR_FORBID_BOM) != 0) {
+                return C89STR_EBOM;
+            }
+
+            pStream->isLE = c89str_utf16_is_bom_le((const unsigned char*)pUTF16);
+        }
+
+        pStream->isStarted = C89STR_TRUE;
+        *pInLenProcessed = 1;
+        return C89STR_SUCCESS;
+    }
+
+    if (outCap == 0) {
+        return ENOMEM;
+    }
+
+    if (pStream->isLE) {
+        result = c89str_utf16le_to_utf8(pUTF8, outCap, pOutLen, pUTF16, inLen, pInLenProcessed, pStream->flags);
+    } else {
+        result = c89str_utf16be_to_utf8(pUTF8, outCap, pOutLen, pUTF16, inLen, pInLenProcessed, pStream->flags);
+    }
+
+    if (*pInLenProcessed > 0) {
+        pStream->isStarted = C89STR_TRUE;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_utf8_to_utf16_stream(c89str_utf_stream* pStream, c89str_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed)
+{
+    if (utf8Len == (size_t)-1 && pUTF8 != NULL) {
+        utf8Len = c89str_strlen(pUTF8);
+    }
+
+    return c89str_utf_stream_feed(pStream, c89str_utf8_to_utf16_stream_convert, sizeof(*pUTF8), 4, sizeof(*pUTF16), pUTF16, utf16Cap, pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed);
+}
+
+C89STR_API errno_t c89str_utf8_to_utf32_stream(c89str_utf_stream* pStream, c89str_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const c89str_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed)
+{
+    if (utf8Len == (size_t)-1 && pUTF8 != NULL) {
+        utf8Len = c89str_strlen(pUTF8);
+    }
+
+    return c89str_utf_stream_feed(pStream, c89str_utf8_to_utf32_stream_convert, sizeof(*pUTF8), 4, sizeof(*pUTF32), pUTF32, utf32Cap, pUTF32Len, pUTF8, utf8Len, pUTF8LenProcessed);
+}
+
+C89STR_API errno_t c89str_utf16_to_utf8_stream(c89str_utf_stream* pStream, c89str_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const c89str_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed)
+{
+    if (utf16Len == (size_t)-1 && pUTF16 != NULL) {
+        utf16Len = 0;
+        while (pUTF16[utf16Len] != 0) {
+            utf16Len += 1;
+        }
+    }
+
+    return c89str_utf_stream_feed(pStream, c89str_utf16_to_utf8_stream_convert, sizeof(*pUTF16), 2, sizeof(*pUTF8), pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed);
+}
+
+
+
+C89STR_API c89str_bool32 c89str_utf32_is_null_or_whitespace(const c89str_utf32* pUTF32, size_t utf32Len)
+{
+    if (pUTF32 == NULL) {
+        return C89STR_TRUE;
+    }
+
+    while (pUTF32[0] != 0 && utf32Len > 0) {
+        c89str_utf32 cp = pUTF32[0];
+
+        pUTF32   += 1;
+        utf32Len -= 1;
+        
+        if (cp >= 0x09 && cp <= 0x0D) {
+            continue;
+        }
+
+        if (cp >= 0x2000 && cp <= 0x200A) {
+            continue;
+        }
+
+        switch (cp) {
+            case 0x0020:
+            case 0x0085:
+            case 0x00A0:
+            case 0x1680:
+            case 0x2028:
+            case 0x2029:
+            case 0x202F:
+            case 0x205F:
+            case 0x3000:
+                continue;
+
+            default:
+                return C89STR_FALSE;
+        }
+    }
+
+    /* Getting here means we reached the end of the string without finding anything other than whitespace which means the string is entire whitespace. */
+    return C89STR_TRUE;
+}
+
+C89STR_API c89str_bool32 c89str_utf32_is_newline(c89str_utf32 utf32)
+{
+    if (utf32 >= 0x0A && utf32 <= 0x0D) {
+        return C89STR_TRUE;
+    }
+
+    if (utf32 == 0x85) {
+        return C89STR_TRUE;
+    }
+
+    if (utf32 >= 0x2028 && utf32 <= 0x2029) {
+        return C89STR_TRUE;
+    }
+
+    return C89STR_FALSE;
+}
+
+C89STR_API c89str_bool32 c89str_utf8_is_null_or_whitespace(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    return c89str_is_null_or_whitespace((const char*)pUTF8, utf8Len);
+}
+
+C89STR_API size_t c89str_utf8_find_next_whitespace(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    return c89str_find_next_whitespace((const char*)pUTF8, utf8Len, NULL);
+}
+
+
+C89STR_API size_t c89str_utf8_ltrim_offset(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    return c89str_ltrim((const char*)pUTF8, utf8Len);
+}
+
+C89STR_API size_t c89str_utf8_rtrim_offset(const c89str_utf8* pUTF8, size_t utf8Len)
+{
+    return c89str_rtrim((const char*)pUTF8, utf8Len);
+}
+
+C89STR_API size_t c89str_utf8_find_next_line(const c89str_utf8* pUTF8, size_t utf8Len, size_t* pThisLineLen)
+{
+    return c89str_find_next_line((const char*)pUTF8, utf8Len, pThisLineLen);
+}
+/* End Unicode */
+
+
+
+/* BEG c89str_builder.c */
+#ifndef C89STR_BUILDER_DEFAULT_CHUNK_SIZE
+#define C89STR_BUILDER_DEFAULT_CHUNK_SIZE   4096
+#endif
+
+#ifndef C89STR_SPRINTF_MIN
+#define C89STR_SPRINTF_MIN 512
+#endif
+
+struct c89str_builder_chunk
+{
+    c89str_builder_chunk* pNext;
+    size_t cap;
+    size_t len;
+    /* The data sits just after the header. */
+};
+
+static C89STR_INLINE char* c89str_builder_chunk_data(c89str_builder_chunk* pChunk)
+{
+    return (char*)(pChunk + 1);
+}
+
+C89STR_API errno_t c89str_builder_init(c89str_builder* pBuilder, size_t chunkSize)
+{
+    if (pBuilder == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pBuilder);
+
+    if (chunkSize == 0) {
+        chunkSize = C89STR_BUILDER_DEFAULT_CHUNK_SIZE;
+    }
+
+    pBuilder->chunkSize = chunkSize;
+
+    return C89STR_SUCCESS;
+}
+
+/* Frees every chunk after the given one. Pass in NULL to free them all. */
+static void c89str_builder_free_chunks_after(c89str_builder* pBuilder, c89str_builder_chunk* pChunk, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_builder_chunk* pNext = (pChunk == NULL) ? pBuilder->pFirstChunk : pChunk->pNext;
+
+    while (pNext != NULL) {
+        c89str_builder_chunk* pNextNext = pNext->pNext;
+        c89str_free(pNext, pAllocationCallbacks);
+        pNext = pNextNext;
+    }
+
+    if (pChunk == NULL) {
+        pBuilder->pFirstChunk = NULL;
+    } else {
+        pChunk->pNext = NULL;
+    }
+
+    pBuilder->pLastChunk = pChunk;
+}
+
+C89STR_API void c89str_builder_uninit(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (pBuilder == NULL) {
+        return;
+    }
+
+    c89str_builder_free_chunks_after(pBuilder, NULL, pAllocationCallbacks);
+    C89STR_ZERO_OBJECT(pBuilder);
+}
+
+C89STR_API size_t c89str_builder_len(const c89str_builder* pBuilder)
+{
+    if (pBuilder == NULL) {
+        return 0;
+    }
+
+    return pBuilder->len;
+}
+
+
+/*
+Appends are all or nothing so we need to be able to undo a partial append. Chunks are only ever added to the end so all
+we need to remember is the last chunk and how full it was.
+*/
+typedef struct
+{
+    c89str_builder_chunk* pLastChunk;
+    size_t lastChunkLen;
+    size_t len;
+} c89str_builder_state;
+
+static void c89str_builder_save_state(const c89str_builder* pBuilder, c89str_builder_state* pState)
+{
+    pState->pLastChunk   = pBuilder->pLastChunk;
+    pState->lastChunkLen = (pBuilder->pLastChunk == NULL) ? 0 : pBuilder->pLastChunk->len;
+    pState->len          = pBuilder->len;
+}
+
+static void c89str_builder_restore_state(c89str_builder* pBuilder, const c89str_builder_state* pState, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_builder_free_chunks_after(pBuilder, pState->pLastChunk, pAllocationCallbacks);
+
+    if (pState->pLastChunk != NULL) {
+        pState->pLastChunk->len = pState->lastChunkLen;
+    }
+
+    pBuilder->len = pState->len;
+}
+
+static c89str_builder_chunk* c89str_builder_new_chunk(c89str_builder* pBuilder, size_t minCap, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_builder_chunk* pChunk;
+    size_t cap = C89STR_MAX(pBuilder->chunkSize, minCap);
+
+    if (cap > (size_t)-1 - sizeof(c89str_builder_chunk)) {
+        return NULL;
+    }
+
+    pChunk = (c89str_builder_chunk*)c89str_malloc(sizeof(c89str_builder_chunk) + cap, pAllocationCallbacks);
+    if (pChunk == NULL) {
+        return NULL;
+    }
+
+    pChunk->pNext = NULL;
+    pChunk->cap   = cap;
+    pChunk->len   = 0;
+
+    if (pBuilder->pLastChunk == NULL) {
+        pBuilder->pFirstChunk = pChunk;
+    } else {
+        pBuilder->pLastChunk->pNext = pChunk;
+    }
+
+    pBuilder->pLastChunk = pChunk;
+
+    return pChunk;
+}
+
+/* This is the same as c89str_builder_append() except it leaves behind whatever it managed to append if it fails. */
+static errno_t c89str_builder_append_internal(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+{
+    c89str_builder_chunk* pChunk = pBuilder->pLastChunk;
+
+    if (otherLen > (size_t)-1 - pBuilder->len) {
+        return ENOMEM;
+    }
+
+    /* Fill up whatever is left of the last chunk, and then put the rest in a new one. */
+    if (pChunk != NULL) {
+        size_t bytesToCopy = C89STR_MIN(otherLen, pChunk->cap - pChunk->len);
+
+        C89STR_COPY_MEMORY(c89str_builder_chunk_data(pChunk) + pChunk->len, pOther, bytesToCopy);
+        pChunk->len   += bytesToCopy;
+        pBuilder->len += bytesToCopy;
+        pOther        += bytesToCopy;
+        otherLen      -= bytesToCopy;
+    }
+
+    if (otherLen > 0) {
+        pChunk = c89str_builder_new_chunk(pBuilder, otherLen, pAllocationCallbacks);
+        if (pChunk == NULL) {
+            return ENOMEM;
+        }
+
+        C89STR_COPY_MEMORY(c89str_builder_chunk_data(pChunk), pOther, otherLen);
+        pChunk->len    = otherLen;
+        pBuilder->len += otherLen;
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_builder_append(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pOther, size_t otherLen)
+{
+    c89str_builder_state state;
+    errno_t result;
+
+    if (pBuilder == NULL || pOther == NULL) {
+        return EINVAL;
+    }
+
+    if (otherLen == (size_t)-1) {
+        otherLen = c89str_strlen(pOther);
+    }
+
+    c89str_builder_save_state(pBuilder, &state);
+
+    result = c89str_builder_append_internal(pBuilder, pAllocationCallbacks, pOther, otherLen);
+    if (result != C89STR_SUCCESS) {
+        c89str_builder_restore_state(pBuilder, &state, pAllocationCallbacks);
+    }
+
+    return result;
+}
+
+
+typedef struct
+{
+    c89str_builder* pBuilder;
+    const c89str_allocation_callbacks* pAllocationCallbacks;
+    errno_t result;
+    char temp[C89STR_SPRINTF_MIN];
+} c89str_builder_sprintf_context;
+
+/*
+The formatter needs a buffer of at least C89STR_SPRINTF_MIN bytes to write into. If the last chunk has that much room
+it writes straight into the chunk. Otherwise it goes into a temporary buffer and gets copied across.
+*/
+static char* c89str_builder_sprintf_buffer(c89str_builder_sprintf_context* pContext)
+{
+    c89str_builder_chunk* pChunk = pContext->pBuilder->pLastChunk;
+
+    if (pChunk != NULL && pChunk->cap - pChunk->len >= C89STR_SPRINTF_MIN) {
+        return c89str_builder_chunk_data(pChunk) + pChunk->len;
+    }
+
+    return pContext->temp;
+}
+
+static char* c89str_builder_sprintf_callback(const char* pBuffer, void* pUserData, size_t len)
+{
+    c89str_builder_sprintf_context* pContext = (c89str_builder_sprintf_context*)pUserData;
+
+    if (pBuffer == pContext->temp) {
+        pContext->result = c89str_builder_append_internal(pContext->pBuilder, pContext->pAllocationCallbacks, pBuffer, len);
+        if (pContext->result != C89STR_SUCCESS) {
+            return NULL;    /* Stops formatting. */
+        }
+    } else {
+        /* It was written straight into the last chunk. */
+        pContext->pBuilder->pLastChunk->len += len;
+        pContext->pBuilder->len             += len;
+    }
+
+    return c89str_builder_sprintf_buffer(pContext);
+}
+
+C89STR_API errno_t c89str_builder_appendv(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, va_list args)
+{
+    c89str_builder_sprintf_context context;
+    c89str_builder_state state;
+
+    if (pBuilder == NULL || pFormat == NULL) {
+        return EINVAL;
+    }
+
+    c89str_builder_save_state(pBuilder, &state);
+
+    context.pBuilder             = pBuilder;
+    context.pAllocationCallbacks = pAllocationCallbacks;
+    context.result               = C89STR_SUCCESS;
+
+    c89str_vsprintfcb(c89str_builder_sprintf_callback, &context, c89str_builder_sprintf_buffer(&context), pFormat, args);
+
+    if (context.result != C89STR_SUCCESS) {
+        c89str_builder_restore_state(pBuilder, &state, pAllocationCallbacks);
+    }
+
+    return context.result;
+}
+
+C89STR_API errno_t c89str_builder_appendf(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const char* pFormat, ...)
+{
+    errno_t result;
+    va_list args;
+
+    va_start(args, pFormat);
+    {
+        result = c89str_builder_appendv(pBuilder, pAllocationCallbacks, pFormat, args);
+    }
+    va_end(args);
+
+    return result;
+}
+
+
+static C89STR_INLINE errno_t c89str_builder_append_code_point(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, c89str_utf32 utf32)
+{
+    c89str_builder_chunk* pChunk = pBuilder->pLastChunk;
+    c89str_utf8 utf8[4];
+    size_t utf8Len;
+
+    /* The common case is that there's room in the last chunk, in which case we can encode straight into it. */
+    if (pChunk != NULL && pChunk->cap - pChunk->len >= 4 && pBuilder->len <= (size_t)-1 - 4) {
+        utf8Len = c89str_utf32_cp_to_utf8(utf32, c89str_builder_chunk_data(pChunk) + pChunk->len, 4);
+        pChunk->len   += utf8Len;
+        pBuilder->len += utf8Len;
+        return C89STR_SUCCESS;
+    }
+
+    utf8Len = c89str_utf32_cp_to_utf8(utf32, utf8, sizeof(utf8));
+    return c89str_builder_append_internal(pBuilder, pAllocationCallbacks, utf8, utf8Len);
+}
+
+static errno_t c89str_builder_append_utf16_internal(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf16* pUTF16, size_t utf16Len, unsigned int flags)
+{
+    errno_t result;
+    size_t iUTF16;
+
+    if (c89str_utf16_has_bom_in_units(pUTF16, utf16Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16   += 1;  /* Skip past the BOM. */
+        utf16Len -= 1;
+    }
+
+    for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+        c89str_utf16 w1 = pUTF16[iUTF16];
+        c89str_utf32 utf32;
+
+        if (w1 < 0xD800 || w1 > 0xDFFF) {
+            /* 1 UTF-16 code unit. */
+            utf32 = w1;
+            iUTF16 += 1;
+        } else if (w1 <= 0xDBFF) {
+            /* 2 UTF-16 code units, or an error. */
+            if (iUTF16 + 1 == utf16Len) {
+                return EINVAL;  /* Ran out of input data. */
+            }
+
+            if (pUTF16[iUTF16 + 1] >= 0xDC00 && pUTF16[iUTF16 + 1] <= 0xDFFF) {
+                utf32 = c89str_utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
+            } else {
+                if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    return C89STR_ECODEPOINT;
+                }
+
+                utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+            }
+
+            iUTF16 += 2;
+        } else {
+            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                return C89STR_ECODEPOINT;
+            }
+
+            utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+            iUTF16 += 1;
+        }
+
+        result = c89str_builder_append_code_point(pBuilder, pAllocationCallbacks, utf32);
+        if (result != C89STR_SUCCESS) {
+            return result;
+        }
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_builder_append_utf16(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf16* pUTF16, size_t utf16Len, unsigned int flags)
+{
+    c89str_builder_state state;
+    errno_t result;
+
+    if (pBuilder == NULL || pUTF16 == NULL) {
+        return EINVAL;
+    }
+
+    if (utf16Len == (size_t)-1) {
+        utf16Len = 0;
+        while (pUTF16[utf16Len] != 0) {
+            utf16Len += 1;
+        }
+    }
+
+    c89str_builder_save_state(pBuilder, &state);
+
+    result = c89str_builder_append_utf16_internal(pBuilder, pAllocationCallbacks, pUTF16, utf16Len, flags);
+    if (result != C89STR_SUCCESS) {
+        c89str_builder_restore_state(pBuilder, &state, pAllocationCallbacks);
+    }
+
+    return result;
+}
+
+static errno_t c89str_builder_append_utf32_internal(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf32* pUTF32, size_t utf32Len, unsigned int flags)
+{
+    errno_t result;
+    size_t iUTF32;
+
+    if (c89str_utf32_has_bom_in_units(pUTF32, utf32Len)) {
+        if ((flags & C89STR_FORBID_BOM) != 0) {
+            return C89STR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32   += 1;  /* Skip past the BOM. */
+        utf32Len -= 1;
+    }
+
+    for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+        c89str_utf32 utf32 = pUTF32[iUTF32];
+
+        if (!c89str_is_valid_code_point(utf32)) {
+            if ((flags & C89STR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                return C89STR_ECODEPOINT;
+            }
+
+            utf32 = C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        result = c89str_builder_append_code_point(pBuilder, pAllocationCallbacks, utf32);
+        if (result != C89STR_SUCCESS) {
+            return result;
+        }
+    }
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_builder_append_utf32(c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks, const c89str_utf32* pUTF32, size_t utf32Len, unsigned int flags)
+{
+    c89str_builder_state state;
+    errno_t result;
+
+    if (pBuilder == NULL || pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    if (utf32Len == (size_t)-1) {
+        utf32Len = 0;
+        while (pUTF32[utf32Len] != 0) {
+            utf32Len += 1;
+        }
+    }
+
+    c89str_builder_save_state(pBuilder, &state);
+
+    result = c89str_builder_append_utf32_internal(pBuilder, pAllocationCallbacks, pUTF32, utf32Len, flags);
+    if (result != C89STR_SUCCESS) {
+        c89str_builder_restore_state(pBuilder, &state, pAllocationCallbacks);
+    }
+
+    return result;
+}
+
+
+C89STR_API c89str c89str_builder_to_c89str(const c89str_builder* pBuilder, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str str;
+    c89str_builder_chunk* pChunk;
+    size_t len;
+
+    if (pBuilder == NULL) {
+        return NULL;
+    }
+
+    if (pBuilder->len > (size_t)-1 - C89STR_MAX_HEADER_SIZE_IN_BYTES - 1) {
+        return NULL;    /* Too big. */
+    }
+
+    str = c89str_new_with_cap(pAllocationCallbacks, pBuilder->len);
+    if (str == NULL) {
+        return NULL;
+    }
+
+    len = 0;
+    for (pChunk = pBuilder->pFirstChunk; pChunk != NULL; pChunk = pChunk->pNext) {
+        C89STR_COPY_MEMORY(str + len, c89str_builder_chunk_data(pChunk), pChunk->len);
+        len += pChunk->len;
+    }
+
+    str[len] = '\0';
+    c89str_set_len(str, len);
+
+    return str;
+}
+
+C89STR_API errno_t c89str_builder_write(const c89str_builder* pBuilder, c89str_builder_write_proc onWrite, void* pUserData)
+{
+    c89str_builder_chunk* pChunk;
+
+    if (pBuilder == NULL || onWrite == NULL) {
+        return EINVAL;
+    }
+
+    for (pChunk = pBuilder->pFirstChunk; pChunk != NULL; pChunk = pChunk->pNext) {
+        if (pChunk->len > 0) {
+            errno_t result = onWrite(pUserData, c89str_builder_chunk_data(pChunk), pChunk->len);
+            if (result != C89STR_SUCCESS) {
+                return result;
+            }
+        }
+    }
+
+    return C89STR_SUCCESS;
+}
+/* END c89str_builder.c */
+
+
+
+
+
+
+
+
+/* BEG c89str_lexer.c */
+/*
+The lexer classifies bytes with a lookup table rather than chains of comparisons, and runs of spaces, digits and
+identifier characters are skipped with SIMD where it's available. Outside of ASCII, only 0xC2, 0xE1, 0xE2 and 0xE3 can
+start a whitespace or new line character. These are flagged in the table so they can be looked at more closely. Every
+other non-ASCII byte can be part of an identifier.
+*/
+#ifndef C89STR_LEXER_MIN_CHUNK_SIZE
+#define C89STR_LEXER_MIN_CHUNK_SIZE     (256*1024)  /* c89str_lexer_tokenize_all_parallel() won't give a thread less than this many bytes. */
+#endif
+
+#define C89STR_LEXER_CHAR_SPACE         0x01    /* '\t' and ' '. Whitespace that isn't a new line. */
+#define C89STR_LEXER_CHAR_NEWLINE       0x02    /* 0x0A - 0x0D */
+#define C89STR_LEXER_CHAR_DIGIT         0x04    /* 0 - 9 */
+#define C89STR_LEXER_CHAR_HEX           0x08    /* 0 - 9, a - f, A - F */
+#define C89STR_LEXER_CHAR_IDENT         0x10    /* Can start an identifier: a - z, A - Z, _ and everything outside of ASCII. */
+#define C89STR_LEXER_CHAR_MB_LEAD       0x20    /* 0xC2, 0xE1, 0xE2, 0xE3. Might be the start of Unicode whitespace. */
+#define C89STR_LEXER_CHAR_IDENT_BODY    0x40    /* Can continue an identifier without needing a closer look: a - z, A - Z, 0 - 9, _ and non-ASCII bytes other than C89STR_LEXER_CHAR_MB_LEAD. */
+
+static const c89str_uint8 c89str_g_lexerCharClass[256] =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02, 0x00, 0x00,   /* 0x00 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   /* 0x10 */
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   /* 0x20 */
+    0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x4C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   /* 0x30 */
+    0x00, 0x58, 0x58, 0x58, 0x58, 0x58, 0x58, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0x40 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x00, 0x00, 0x00, 0x00, 0x50,   /* 0x50 */
+    0x00, 0x58, 0x58, 0x58, 0x58, 0x58, 0x58, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0x60 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00,   /* 0x70 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0x80 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0x90 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0xA0 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0xB0 */
+    0x50, 0x50, 0x30, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0xC0 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0xD0 */
+    0x50, 0x30, 0x30, 0x30, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,   /* 0xE0 */
+    0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50    /* 0xF0 */
+};
+
+#define C89STR_LEXER_SPAN_SPACE         0
+#define C89STR_LEXER_SPAN_DIGITS        1
+#define C89STR_LEXER_SPAN_IDENT         2
+#define C89STR_LEXER_SPAN_IDENT_DASH    3   /* For allowDashesInIdentifiers. */
+
+static C89STR_INLINE c89str_bool32 c89str_lexer_is_in_span(unsigned char c, int span)
+{
+    switch (span)
+    {
+        case C89STR_LEXER_SPAN_SPACE:      return (c89str_g_lexerCharClass[c] & C89STR_LEXER_CHAR_SPACE) != 0;
+        case C89STR_LEXER_SPAN_DIGITS:     return (c89str_g_lexerCharClass[c] & C89STR_LEXER_CHAR_DIGIT) != 0;
+        case C89STR_LEXER_SPAN_IDENT_DASH: return (c89str_g_lexerCharClass[c] & C89STR_LEXER_CHAR_IDENT_BODY) != 0 || c == '-';
+        default:                           return (c89str_g_lexerCharClass[c] & C89STR_LEXER_CHAR_IDENT_BODY) != 0;
+    }
+}
+
+#if defined(C89STR_SUPPORT_SSE2)
+static C89STR_INLINE __m128i c89str_lexer_in_range__sse2(__m128i block, char lo, char count)
+{
+    /* An unsigned range check: (c - lo) <= count. */
+    __m128i x = _mm_sub_epi8(block, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(count)), x);
+}
+
+static size_t c89str_lexer_span__sse2(const char* txt, size_t off, size_t len, int span)
+{
+    unsigned int mask;
+
+    for (; off + 16 <= len; off += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(txt + off));
+        __m128i inSpan;
+
+        if (span == C89STR_LEXER_SPAN_SPACE) {
+            inSpan = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+        } else if (span == C89STR_LEXER_SPAN_DIGITS) {
+            inSpan = c89str_lexer_in_range__sse2(block, '0', 9);
+        } else {
+            __m128i isHigh   = _mm_cmplt_epi8(block, _mm_setzero_si128());
+            __m128i isMBLead = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xC2)), c89str_lexer_in_range__sse2(block, (char)0xE1, 2));
+
+            inSpan = c89str_lexer_in_range__sse2(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 25);    /* Setting bit 5 maps A-Z onto a-z. */
+            inSpan = _mm_or_si128(inSpan, c89str_lexer_in_range__sse2(block, '0', 9));
+            inSpan = _mm_or_si128(inSpan, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+            inSpan = _mm_or_si128(inSpan, _mm_andnot_si128(isMBLead, isHigh));
+            if (span == C89STR_LEXER_SPAN_IDENT_DASH) {
+                inSpan = _mm_or_si128(inSpan, _mm_cmpeq_epi8(block, _mm_set1_epi8('-')));
+            }
+        }
+
+        mask = (unsigned int)_mm_movemask_epi8(inSpan) ^ 0xFFFF;
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
+        }
+    }
+
+    while (off < len && c89str_lexer_is_in_span((unsigned char)txt[off], span)) {
+        off += 1;
+    }
+
+    return off;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_AVX2)
+static C89STR_INLINE __m256i c89str_lexer_in_range__avx2(__m256i block, char lo, char count)
+{
+    __m256i x = _mm256_sub_epi8(block, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(count)), x);
+}
+
+static size_t c89str_lexer_span__avx2(const char* txt, size_t off, size_t len, int span)
+{
+    c89str_uint32 mask;
+
+    for (; off + 32 <= len; off += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(txt + off));
+        __m256i inSpan;
+
+        if (span == C89STR_LEXER_SPAN_SPACE) {
+            inSpan = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+        } else if (span == C89STR_LEXER_SPAN_DIGITS) {
+            inSpan = c89str_lexer_in_range__avx2(block, '0', 9);
+        } else {
+            __m256i isHigh   = _mm256_cmpgt_epi8(_mm256_setzero_si256(), block);
+            __m256i isMBLead = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xC2)), c89str_lexer_in_range__avx2(block, (char)0xE1, 2));
+
+            inSpan = c89str_lexer_in_range__avx2(_mm256_or_si256(block, _mm256_set1_epi8(0x20)), 'a', 25);
+            inSpan = _mm256_or_si256(inSpan, c89str_lexer_in_range__avx2(block, '0', 9));
+            inSpan = _mm256_or_si256(inSpan, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('_')));
+            inSpan = _mm256_or_si256(inSpan, _mm256_andnot_si256(isMBLead, isHigh));
+            if (span == C89STR_LEXER_SPAN_IDENT_DASH) {
+                inSpan = _mm256_or_si256(inSpan, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('-')));
+            }
+        }
+
+        mask = ~(c89str_uint32)_mm256_movemask_epi8(inSpan);
+        if (mask != 0) {
+            return off + c89str_ctz32(mask);
+        }
+    }
+
+    while (off < len && c89str_lexer_is_in_span((unsigned char)txt[off], span)) {
+        off += 1;
+    }
+
+    return off;
+}
+#endif
+
+#if defined(C89STR_SUPPORT_NEON)
+static C89STR_INLINE uint8x16_t c89str_lexer_in_range__neon(uint8x16_t block, c89str_uint8 lo, c89str_uint8 count)
+{
+    return vcleq_u8(vsubq_u8(block, vdupq_n_u8(lo)), vdupq_n_u8(count));
+}
+
+static size_t c89str_lexer_span__neon(const char* txt, size_t off, size_t len, int span)
+{
+    c89str_uint64 mask;
+
+    for (; off + 16 <= len; off += 16) {
+        uint8x16_t block = vld1q_u8((const c89str_uint8*)(txt + off));
+        uint8x16_t inSpan;
+
+        if (span == C89STR_LEXER_SPAN_SPACE) {
+            inSpan = vorrq_u8(vceqq_u8(block, vdupq_n_u8(' ')), vceqq_u8(block, vdupq_n_u8('\t')));
+        } else if (span == C89STR_LEXER_SPAN_DIGITS) {
+            inSpan = c89str_lexer_in_range__neon(block, '0', 9);
+        } else {
+            uint8x16_t isHigh   = vcgeq_u8(block, vdupq_n_u8(0x80));
+            uint8x16_t isMBLead = vorrq_u8(vceqq_u8(block, vdupq_n_u8(0xC2)), c89str_lexer_in_range__neon(block, 0xE1, 2));
+
+            inSpan = c89str_lexer_in_range__neon(vorrq_u8(block, vdupq_n_u8(0x20)), 'a', 25);
+            inSpan = vorrq_u8(inSpan, c89str_lexer_in_range__neon(block, '0', 9));
+            inSpan = vorrq_u8(inSpan, vceqq_u8(block, vdupq_n_u8('_')));
+            inSpan = vorrq_u8(inSpan, vbicq_u8(isHigh, isMBLead));
+            if (span == C89STR_LEXER_SPAN_IDENT_DASH) {
+                inSpan = vorrq_u8(inSpan, vceqq_u8(block, vdupq_n_u8('-')));
+            }
+        }
+
+        mask = ~c89str_neon_movemask_u8x16(inSpan);
+        if (mask != 0) {
+            return off + (c89str_ctz64(mask) / 4);
+        }
+    }
+
+    while (off < len && c89str_lexer_is_in_span((unsigned char)txt[off], span)) {
+        off += 1;
+    }
+
+    return off;
+}
+#endif
+
+/* Returns the offset of the first byte at or after off that isn't part of the span. */
+static size_t c89str_lexer_span(const char* txt, size_t off, size_t len, int span)
+{
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+    C89STR_UNUSED(simdFlags);
+
+#if defined(C89STR_SUPPORT_AVX2)
+    if ((simdFlags & C89STR_SIMD_AVX2) != 0) {
+        return c89str_lexer_span__avx2(txt, off, len, span);
+    }
+#endif
+#if defined(C89STR_SUPPORT_SSE2)
+    if ((simdFlags & C89STR_SIMD_SSE2) != 0) {
+        return c89str_lexer_span__sse2(txt, off, len, span);
+    }
+#endif
+#if defined(C89STR_SUPPORT_NEON)
+    if ((simdFlags & C89STR_SIMD_NEON) != 0) {
+        return c89str_lexer_span__neon(txt, off, len, span);
+    }
+#endif
+
+    while (off < len && c89str_lexer_is_in_span((unsigned char)txt[off], span)) {
+        off += 1;
+    }
+
+    return off;
+}
+
+static C89STR_INLINE size_t c89str_lexer_skip_class(const char* txt, size_t off, size_t len, c89str_uint8 charClass)
+{
+    while (off < len && (c89str_g_lexerCharClass[(unsigned char)txt[off]] & charClass) != 0) {
+        off += 1;
+    }
+
+    return off;
+}
+
+/* Returns the offset just past the run of whitespace starting at off, not including new lines. */
+static size_t c89str_lexer_scan_whitespace(const char* txt, size_t off, size_t len)
+{
+    for (;;) {
+        size_t whitespaceLen;
+
+        off = c89str_lexer_span(txt, off, len, C89STR_LEXER_SPAN_SPACE);
+        if (off == len || (c89str_g_lexerCharClass[(unsigned char)txt[off]] & C89STR_LEXER_CHAR_MB_LEAD) == 0) {
+            break;
+        }
+
+        if (c89str_scan_leading_newline(txt + off, len - off) > 0) {
+            break;  /* U+0085, U+2028 and U+2029 are new lines. */
+        }
+
+        whitespaceLen = c89str_scan_leading_multibyte_whitespace(txt + off, len - off);
+        if (whitespaceLen == 0) {
+            break;
+        }
+
+        off += whitespaceLen;
+    }
+
+    return off;
+}
+
+/* Returns the length of the new line character ending at txt[off], without looking at anything before txt[beg]. */
+static C89STR_INLINE size_t c89str_lexer_newline_len_ending_at(const char* txt, size_t beg, size_t off)
+{
+    unsigned char c = (unsigned char)txt[off];
+
+    if (c >= 0x0A && c <= 0x0D) {
+        return 1;
+    }
+
+    if (c == 0x85) {
+        return (off - beg >= 1 && (unsigned char)txt[off - 1] == 0xC2) ? 2 : 0;
+    }
+
+    if (c == 0xA8 || c == 0xA9) {
+        return (off - beg >= 2 && (unsigned char)txt[off - 2] == 0xE2 && (unsigned char)txt[off - 1] == 0x80) ? 3 : 0;
+    }
+
+    return 0;
+}
+
+/* Returns the offset of the first new line character at or after off, or len if there isn't one. */
+static size_t c89str_lexer_find_newline(const char* txt, size_t off, size_t len)
+{
+    size_t beg = off;
+
+    for (;;) {
+        size_t newlineLen;
+
+        off = c89str_find_line_break_candidate(txt, off, len);
+        if (off == len) {
+            return len;
+        }
+
+        newlineLen = c89str_lexer_newline_len_ending_at(txt, beg, off);
+        if (newlineLen > 0) {
+            return off + 1 - newlineLen;
+        }
+
+        off += 1;
+    }
+}
+
+/* Counts the new line characters in a comment or string. Like new line tokens, \r\n counts as two. */
+static size_t c89str_lexer_count_newlines(const char* txt, size_t len)
+{
+    size_t count = 0;
+    size_t off = 0;
+
+    for (;;) {
+        off = c89str_find_line_break_candidate(txt, off, len);
+        if (off == len) {
+            return count;
+        }
+
+        if (c89str_lexer_newline_len_ending_at(txt, 0, off) > 0) {
+            count += 1;
+        }
+
+        off += 1;
+    }
+}
+
+/*
+The keyword table uses hash and displace. Every keyword is hashed once. The hash picks a bucket, and each bucket gets a
+seed that is searched for at init time such that mixing it into the hashes of the bucket's keywords sends each one to
+an empty slot. The biggest buckets are placed first while there are plenty of empty slots. Looking up a word is then a
+hash, a mix and a single comparison against the keyword in the slot.
+*/
+#define C89STR_LEXER_KEYWORD_EMPTY_SLOT         0xFFFFFFFF
+#define C89STR_LEXER_KEYWORD_MAX_SEED_TRIES     65536   /* How many seeds to try for a bucket before starting again with a bigger table. */
+#define C89STR_LEXER_KEYWORD_MAX_ATTEMPTS       16
+
+static c89str_uint32 c89str_lexer_keyword_hash(const char* str, size_t strLen, c89str_uint32 seed)
+{
+    /* FNV-1a. Keywords are short so this doesn't need to be anything fancy. */
+    c89str_uint32 h = (c89str_uint32)2166136261U ^ seed;
+    size_t i;
+
+    for (i = 0; i < strLen; i += 1) {
+        h ^= (unsigned char)str[i];
+        h *= (c89str_uint32)16777619U;
+    }
+
+    return h;
+}
+
+static c89str_uint32 c89str_lexer_keyword_slot_hash(c89str_uint32 h, c89str_uint32 bucketSeed)
+{
+    /* The finalizer from MurmurHash3 so every bit of the seed has an effect on the slot. */
+    h ^= bucketSeed;
+    h ^= h >> 16;
+    h *= (c89str_uint32)0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= (c89str_uint32)0xC2B2AE35U;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static c89str_uint32 c89str_next_power_of_2_u32(c89str_uint32 x)
+{
+    c89str_uint32 result = 1;
+
+    while (result < x) {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+C89STR_API errno_t c89str_lexer_keyword_table_init(c89str_lexer_keyword_table* pTable, const c89str_lexer_keyword* pKeywords, size_t keywordCount, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_uint32* pTemp;
+    c89str_uint32* pHashes;         /* The hash of each keyword. */
+    c89str_uint32* pOrder;          /* Keyword indices, grouped by bucket. */
+    c89str_uint32* pBucketStarts;   /* Where each bucket starts in pOrder. */
+    c89str_uint32 slotCount;
+    c89str_uint32 bucketCount;
+    c89str_uint32 maxBucketSize;
+    c89str_uint32 iKeyword;
+    c89str_uint32 iBucket;
+    c89str_uint32 iSlot;
+    c89str_uint32 iAttempt;
+    errno_t result = EINVAL;
+
+    if (pTable == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pTable);
+
+    if (pKeywords == NULL && keywordCount > 0) {
+        return EINVAL;
+    }
+
+    if (keywordCount > 0x10000000) {
+        return EINVAL;  /* Too many keywords for 32-bit indices. */
+    }
+
+    pTable->pKeywords     = pKeywords;
+    pTable->keywordCount  = keywordCount;
+    pTable->minKeywordLen = c89str_npos;
+    pTable->maxKeywordLen = 0;
+
+    if (keywordCount == 0) {
+        return C89STR_SUCCESS;  /* Nothing will ever be found. */
+    }
+
+    for (iKeyword = 0; iKeyword < keywordCount; iKeyword += 1) {
+        if (pKeywords[iKeyword].pName == NULL) {
+            return EINVAL;
+        }
+    }
+
+    slotCount   = c89str_next_power_of_2_u32((c89str_uint32)keywordCount * 2);
+    bucketCount = c89str_next_power_of_2_u32(((c89str_uint32)keywordCount + 3) / 4);
+
+    for (iAttempt = 0; iAttempt < C89STR_LEXER_KEYWORD_MAX_ATTEMPTS; iAttempt += 1) {
+        c89str_uint32* pBlock;
+
+        /* Each attempt uses a different hash. Every few attempts the table is made bigger as well. */
+        if (iAttempt > 0 && (iAttempt % 4) == 0) {
+            slotCount *= 2;
+        }
+
+        pTable->hashSeed   = iAttempt * (c89str_uint32)0x9E3779B9U;
+        pTable->slotMask   = slotCount - 1;
+        pTable->bucketMask = bucketCount - 1;
+
+        /* The table is one allocation: the slots, then the bucket seeds, then the keyword lengths. */
+        pBlock = (c89str_uint32*)c89str_malloc(sizeof(c89str_uint32) * (slotCount + bucketCount + keywordCount), pAllocationCallbacks);
+        pTemp  = (c89str_uint32*)c89str_malloc(sizeof(c89str_uint32) * (keywordCount * 2 + bucketCount + 1), pAllocationCallbacks);
+        if (pBlock == NULL || pTemp == NULL) {
+            c89str_free(pBlock, pAllocationCallbacks);
+            c89str_free(pTemp,  pAllocationCallbacks);
+            C89STR_ZERO_OBJECT(pTable);
+            return ENOMEM;
+        }
+
+        pTable->pSlots          = pBlock;
+        pTable->pBucketSeeds    = pBlock + slotCount;
+        pTable->pKeywordLengths = pBlock + slotCount + bucketCount;
+
+        pHashes       = pTemp;
+        pOrder        = pTemp + keywordCount;
+        pBucketStarts = pTemp + keywordCount * 2;
+
+        C89STR_ZERO_MEMORY(pBucketStarts, sizeof(c89str_uint32) * (bucketCount + 1));
+        for (iSlot = 0; iSlot < slotCount; iSlot += 1) {
+            pTable->pSlots[iSlot] = C89STR_LEXER_KEYWORD_EMPTY_SLOT;
+        }
+
+        /* Hash everything and group the keywords by bucket. */
+        for (iKeyword = 0; iKeyword < keywordCount; iKeyword += 1) {
+            size_t keywordLen = c89str_strlen(pKeywords[iKeyword].pName);
+
+            pTable->pKeywordLengths[iKeyword] = (c89str_uint32)keywordLen;
+            pTable->minKeywordLen = C89STR_MIN(pTable->minKeywordLen, keywordLen);
+            pTable->maxKeywordLen = C89STR_MAX(pTable->maxKeywordLen, keywordLen);
+
+            pHashes[iKeyword] = c89str_lexer_keyword_hash(pKeywords[iKeyword].pName, keywordLen, pTable->hashSeed);
+            pBucketStarts[(pHashes[iKeyword] & pTable->bucketMask) + 1] += 1;
+        }
+
+        maxBucketSize = 0;
+        for (iBucket = 0; iBucket < bucketCount; iBucket += 1) {
+            maxBucketSize = C89STR_MAX(maxBucketSize, pBucketStarts[iBucket + 1]);
+            pBucketStarts[iBucket + 1] += pBucketStarts[iBucket];
+        }
+
+        for (iKeyword = 0; iKeyword < keywordCount; iKeyword += 1) {
+            iBucket = pHashes[iKeyword] & pTable->bucketMask;
+            pOrder[pBucketStarts[iBucket]] = iKeyword;
+            pBucketStarts[iBucket] += 1;
+        }
+
+        /* The counting above moved each start to the end of its bucket which is the start of the next one. Shift them back. */
+        for (iBucket = bucketCount; iBucket > 0; iBucket -= 1) {
+            pBucketStarts[iBucket] = pBucketStarts[iBucket - 1];
+        }
+        pBucketStarts[0] = 0;
+
+        /* Place the buckets, biggest first. */
+        result = C89STR_SUCCESS;
+        for (; maxBucketSize > 0 && result == C89STR_SUCCESS; maxBucketSize -= 1) {
+            for (iBucket = 0; iBucket < bucketCount && result == C89STR_SUCCESS; iBucket += 1) {
+                c89str_uint32 bucketBeg = pBucketStarts[iBucket];
+                c89str_uint32 bucketEnd = pBucketStarts[iBucket + 1];
+                c89str_uint32 seed;
+
+                if (bucketEnd - bucketBeg != maxBucketSize) {
+                    continue;
+                }
+
+                for (seed = 0; seed < C89STR_LEXER_KEYWORD_MAX_SEED_TRIES; seed += 1) {
+                    c89str_uint32 iPlaced;
+
+                    for (iPlaced = bucketBeg; iPlaced < bucketEnd; iPlaced += 1) {
+                        c89str_uint32 iSlot = c89str_lexer_keyword_slot_hash(pHashes[pOrder[iPlaced]], seed) & pTable->slotMask;
+                        if (pTable->pSlots[iSlot] != C89STR_LEXER_KEYWORD_EMPTY_SLOT) {
+                            break;
+                        }
+
+                        pTable->pSlots[iSlot] = pOrder[iPlaced];
+                    }
+
+                    if (iPlaced == bucketEnd) {
+                        break;  /* Everything fits. */
+                    }
+
+                    /* Didn't fit. Take back what was placed with this seed and try the next one. */
+                    while (iPlaced > bucketBeg) {
+                        iPlaced -= 1;
+                        pTable->pSlots[c89str_lexer_keyword_slot_hash(pHashes[pOrder[iPlaced]], seed) & pTable->slotMask] = C89STR_LEXER_KEYWORD_EMPTY_SLOT;
+                    }
+                }
+
+                if (seed < C89STR_LEXER_KEYWORD_MAX_SEED_TRIES) {
+                    pTable->pBucketSeeds[iBucket] = seed;
+                } else {
+                    /*
+                    Keywords with the same hash can never be separated. If they're actually the same keyword it's an error,
+                    otherwise we just need a different hash.
+                    */
+                    c89str_uint32 i;
+                    c89str_uint32 j;
+
+                    result = ENOENT;
+                    for (i = bucketBeg; i < bucketEnd; i += 1) {
+                        for (j = i + 1; j < bucketEnd; j += 1) {
+                            if (pTable->pKeywordLengths[pOrder[i]] == pTable->pKeywordLengths[pOrder[j]] && C89STR_COMPARE_MEMORY(pKeywords[pOrder[i]].pName, pKeywords[pOrder[j]].pName, pTable->pKeywordLengths[pOrder[i]]) == 0) {
+                                result = EINVAL;    /* Duplicate keyword. */
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        c89str_free(pTemp, pAllocationCallbacks);
+
+        if (result == C89STR_SUCCESS) {
+            return C89STR_SUCCESS;
+        }
+
+        c89str_free(pBlock, pAllocationCallbacks);
+        pTable->pSlots          = NULL;
+        pTable->pBucketSeeds    = NULL;
+        pTable->pKeywordLengths = NULL;
+
+        if (result == EINVAL) {
+            break;
+        }
+    }
+
+    C89STR_ZERO_OBJECT(pTable);
+    return EINVAL;  /* Either a duplicate keyword or a perfect hash couldn't be found. */
+}
+
+C89STR_API void c89str_lexer_keyword_table_uninit(c89str_lexer_keyword_table* pTable, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (pTable == NULL) {
+        return;
+    }
+
+    c89str_free(pTable->pSlots, pAllocationCallbacks);    /* The other arrays are in the same allocation. */
+    C89STR_ZERO_OBJECT(pTable);
+}
+
+C89STR_API size_t c89str_lexer_keyword_table_find(const c89str_lexer_keyword_table* pTable, const char* str, size_t strLen)
+{
+    c89str_uint32 h;
+    c89str_uint32 iKeyword;
+
+    if (pTable == NULL || str == NULL || pTable->pSlots == NULL) {
+        return c89str_npos;
+    }
+
+    if (strLen == c89str_npos) {
+        strLen = c89str_strlen(str);
+    }
+
+    /* Most identifiers can be ruled out on length alone. */
+    if (strLen < pTable->minKeywordLen || strLen > pTable->maxKeywordLen) {
+        return c89str_npos;
+    }
+
+    h = c89str_lexer_keyword_hash(str, strLen, pTable->hashSeed);
+    iKeyword = pTable->pSlots[c89str_lexer_keyword_slot_hash(h, pTable->pBucketSeeds[h & pTable->bucketMask]) & pTable->slotMask];
+
+    if (iKeyword == C89STR_LEXER_KEYWORD_EMPTY_SLOT || pTable->pKeywordLengths[iKeyword] != strLen || C89STR_COMPARE_MEMORY(str, pTable->pKeywords[iKeyword].pName, strLen) != 0) {
+        return c89str_npos;
+    }
+
+    return iKeyword;
+}
+
+static void c89str_lexer_update_cache(c89str_lexer* pLexer)
+{
+    /* The lengths of the comment tokens are only measured when the options change rather than once for every token. */
+    if (pLexer->cache.pLineCommentOpeningToken != pLexer->options.pLineCommentOpeningToken) {
+        pLexer->cache.pLineCommentOpeningToken  = pLexer->options.pLineCommentOpeningToken;
+        pLexer->cache.lineCommentOpeningLen     = (pLexer->options.pLineCommentOpeningToken != NULL) ? c89str_strlen(pLexer->options.pLineCommentOpeningToken) : 0;
+    }
+
+    if (pLexer->cache.pBlockCommentOpeningToken != pLexer->options.pBlockCommentOpeningToken) {
+        pLexer->cache.pBlockCommentOpeningToken = pLexer->options.pBlockCommentOpeningToken;
+        pLexer->cache.blockCommentOpeningLen    = (pLexer->options.pBlockCommentOpeningToken != NULL) ? c89str_strlen(pLexer->options.pBlockCommentOpeningToken) : 0;
+    }
+
+    if (pLexer->cache.pBlockCommentClosingToken != pLexer->options.pBlockCommentClosingToken) {
+        pLexer->cache.pBlockCommentClosingToken = pLexer->options.pBlockCommentClosingToken;
+        pLexer->cache.blockCommentClosingLen    = (pLexer->options.pBlockCommentClosingToken != NULL) ? c89str_strlen(pLexer->options.pBlockCommentClosingToken) : 0;
+    }
+}
+
+C89STR_API errno_t c89str_lexer_init(c89str_lexer* pLexer, const char* pText, size_t textLen)
+{
+    if (pLexer == NULL) {
+        return EINVAL;  /* Invalid arguments. */
+    }
+
+    C89STR_ZERO_OBJECT(pLexer);
+
+    if (pText == NULL) {
+        return EINVAL;  
+    }
+
+    pLexer->pText      = pText;
+    pLexer->textLen    = textLen;
+    pLexer->textOff    = 0;
+    pLexer->lineNumber = 1;
+
+    /* We do not use the null terminator to know the end of the string so we need to calculate it now. */
+    if (pLexer->textLen == (size_t)-1) {
+        pLexer->textLen = c89str_strlen(pText);
+    }
+
+    pLexer->options.pLineCommentOpeningToken  = "//";
+    pLexer->options.pBlockCommentOpeningToken = "/*";
+    pLexer->options.pBlockCommentClosingToken = "*/";
+
+    c89str_lexer_update_cache(pLexer);
+
+    return 0;
+}
+
+
+static errno_t c89str_lexer_set_token(c89str_lexer* pLexer, c89str_utf32 token, size_t tokenLen)
+{
+    C89STR_ASSERT(pLexer != NULL);
+
+    pLexer->token           = token;
+    pLexer->pTokenStr       = pLexer->pText + pLexer->textOff;
+    pLexer->tokenLen        = tokenLen;
+    pLexer->tokenLineNumber = pLexer->lineNumber;
+    pLexer->textOff        += tokenLen;
+
+    if (token == c89str_token_type_newline) {
+        pLexer->lineNumber += 1;
+    }
+
+    /* We need to parse comments and strings to find line numbers. */
+    if (token == c89str_token_type_comment || token == c89str_token_type_string_double || token == c89str_token_type_string_single) {
+        pLexer->lineNumber += c89str_lexer_count_newlines(pLexer->pTokenStr, pLexer->tokenLen);
+    }
+
+    return 0;
+}
+
+static errno_t c89str_lexer_set_single_char(c89str_lexer* pLexer, c89str_utf32 c)
+{
+    return c89str_lexer_set_token(pLexer, c, 1);
+}
+
+static errno_t c89str_lexer_set_error(c89str_lexer* pLexer, size_t tokenLen)
+{
+    c89str_lexer_set_token(pLexer, c89str_token_type_error, tokenLen);
+    return EINVAL;
+}
+
+static size_t c89str_lexer_parse_integer_suffix(c89str_lexer* pLexer, size_t off) /* Returns the new offset. */
+{
+    const char* txt;
+    size_t len;
+
+    C89STR_ASSERT(pLexer != NULL);
+
+    txt = pLexer->pText;
+    len = pLexer->textLen;
+
+    if (off < len) {
+        if (txt[off] == 'u' || txt[off] == 'U') {
+            off += 1;
+            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                off += 1;
+                if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                    off += 1;   /* Suffix is ull/ULL. */
+                } else {
+                    /* Suffix is ul/UL. */
+                }
+            } else {
+                /* Suffix is u/U. */
+            }
+        } else if (txt[off] == 'l' || txt[off] == 'L') {
+            off += 1;
+            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                off += 1;
+                if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
+                    off += 1;   /* Suffix is llu/LLU. */
+                } else {
+                    /* Suffix is ll/LL. */
+                }
+            } else if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
+                off += 1;   /* Suffix is lu/LU. */
+            } else {
+                /* Suffix is l/L. */
+            }
+        } else {
+            /* No suffix. */
+        }
+    } else {
+        /* No suffix (EOF). */
+    }
+
+    return off;
+}
+
+static size_t c89str_lexer_parse_float_suffix(c89str_lexer* pLexer, size_t off) /* Returns the new offset. */
+{
+    const char* txt;
+    size_t len;
+
+    C89STR_ASSERT(pLexer != NULL);
+
+    txt = pLexer->pText;
+    len = pLexer->textLen;
+
+    /* Supported suffixes: 'f'/'F' (float), 'd'/'D' (double) and 'l'/'L' (long double). */
+    if (off < len) {
+        if (txt[off] == 'f' || txt[off] == 'F' || txt[off] == 'd' || txt[off] == 'D' || txt[off] == 'l' || txt[off] == 'L') {
+            off += 1;
+        }
+    } else {
+        /* No suffix (EOF). */
+    }
+
+    return off;
+}
+
+static errno_t c89str_lexer_parse_suffix_and_set_token(c89str_lexer* pLexer, c89str_utf32 token, size_t off)
+{
+    /* Get past the suffix first. */
+    if (token == c89str_token_type_float_literal_dec || token == c89str_token_type_float_literal_hex) {
+        /* Floating point suffix. */
+        off = c89str_lexer_parse_float_suffix(pLexer, off);
+    } else {
+        /* Assume an integer suffix. */
+        off = c89str_lexer_parse_integer_suffix(pLexer, off);
+    }
+
+    return c89str_lexer_set_token(pLexer, token, (off - pLexer->textOff));
+}
+
+static errno_t c89str_lexer_next_token(c89str_lexer* pLexer)  /* The cache must be up to date before calling this. */
+{
+    int result;
+    const char* txt;
+    size_t off;
+    size_t len;
+
+    C89STR_ASSERT(pLexer != NULL);
+
     /* We need to run this in a loop because we may be wanting to skip certain tokens such as whitespace, newlines and comments. */
     for (;;) {
-        /*
-        When off == len, the end has been reached. The remaining number of bytes is (len - off). txt[off] is the current character. off is variable and can move forward
-        whereas len is constant and remains the same (it represents the length of the string and is required for calculating the number of bytes remaining).
-        */
-        txt = pLexer->pText;
-        off = pLexer->textOff;  /* Moves forward. */
-        len = pLexer->textLen;  /* Constant. */
+        unsigned char c;
+        c89str_uint8 charClass;
+
+        /*
+        When off == len, the end has been reached. The remaining number of bytes is (len - off). txt[off] is the current character. off is variable and can move forward
+        whereas len is constant and remains the same (it represents the length of the string and is required for calculating the number of bytes remaining).
+        */
+        txt = pLexer->pText;
+        off = pLexer->textOff;  /* Moves forward. */
+        len = pLexer->textLen;  /* Constant. */
+
+        if (off == len) {
+            c89str_lexer_set_token(pLexer, c89str_token_type_eof, 0);
+            return ENOMEM;  /* Out of input data. */
+        }
+
+        c = (unsigned char)txt[off];
+        charClass = c89str_g_lexerCharClass[c];
+
+        /* First check if we're on whitespace. Our lexer makes a distinction between whitespace and new line characters. */
+        if ((charClass & (C89STR_LEXER_CHAR_SPACE | C89STR_LEXER_CHAR_NEWLINE | C89STR_LEXER_CHAR_MB_LEAD)) != 0) {
+            size_t newlineLen;
+            size_t whitespaceEnd;
+
+            newlineLen = c89str_scan_leading_newline(txt + off, (len - off));
+            if (newlineLen > 0) {
+                result = c89str_lexer_set_token(pLexer, c89str_token_type_newline, newlineLen);
+                if (pLexer->options.skipNewlines) {
+                    continue;
+                } else {
+                    return result;
+                }
+            }
+
+            /* Whitespace stops at the first new line character. */
+            whitespaceEnd = c89str_lexer_scan_whitespace(txt, off, len);
+            if (whitespaceEnd > off) {
+                result = c89str_lexer_set_token(pLexer, c89str_token_type_whitespace, (whitespaceEnd - off));
+                if (pLexer->options.skipWhitespace) {
+                    continue;
+                } else {
+                    return result;
+                }
+            }
+
+            /* Getting here means it's a non-ASCII character that isn't whitespace. It'll be treated as part of an identifier below. */
+        }
+
+        /* It's not whitespace or a new line. Check if it's a line comment. */
+        if (pLexer->cache.lineCommentOpeningLen > 0 && c == (unsigned char)pLexer->options.pLineCommentOpeningToken[0] && (len - off) >= pLexer->cache.lineCommentOpeningLen &&
+            C89STR_COMPARE_MEMORY(txt + off, pLexer->options.pLineCommentOpeningToken, pLexer->cache.lineCommentOpeningLen) == 0) {
+            /* Found the beginning of a line comment. Note that we do *not* include the new line in the returned token. */
+            size_t lineEnd = c89str_lexer_find_newline(txt, off + pLexer->cache.lineCommentOpeningLen, len);
+
+            result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, (lineEnd - off));
+            if (pLexer->options.skipComments) {
+                continue;
+            } else {
+                return result;
+            }
+        }
+
+        if (pLexer->cache.blockCommentOpeningLen > 0 && c == (unsigned char)pLexer->options.pBlockCommentOpeningToken[0] && (len - off) >= pLexer->cache.blockCommentOpeningLen &&
+            C89STR_COMPARE_MEMORY(txt + off, pLexer->options.pBlockCommentOpeningToken, pLexer->cache.blockCommentOpeningLen) == 0) {
+            /* It's the beginning of a block comment. */
+            errno_t searchResult = ENOENT;
+            size_t tokenLen;
+            size_t openingLen = pLexer->cache.blockCommentOpeningLen;
+            size_t closingLen = pLexer->cache.blockCommentClosingLen;
+
+            off += openingLen;
+            if (closingLen > 0) {
+                searchResult = c89str_findn(txt + off, (len - off), pLexer->options.pBlockCommentClosingToken, closingLen, &tokenLen);
+            }
+
+            if (searchResult != C89STR_SUCCESS) {
+                /* The closing token could not be found. Treat the entire rest of the content as a comment. */
+                result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, (len - off) + openingLen);
+            } else {
+                /* We found the closing token. */
+                result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, tokenLen + openingLen + closingLen);
+            }
+
+            if (pLexer->options.skipComments) {
+                continue;
+            } else {
+                return result;
+            }
+        }
+
+        /* It's not whitespace, new line nor a comment. Check if it's a string. We support both double and single quoted strings. */
+        if (c == '\"' || c == '\'') {
+            off += 1;
+            for (;;) {
+                const char* pQuote = c89str_memchr(txt + off, (len - off), (char)c);
+                if (pQuote == NULL) {
+                    /* The string is not terminated. Like an unterminated block comment, the rest of the content is treated as the string. */
+                    off = len;
+                    break;
+                }
+
+                /* Could be the end of the string. Need to check that the quote is escaped. If so we continue, otherwise we have reached the end. */
+                off = (size_t)(pQuote - txt) + 1;
+                if (pQuote[-1] != '\\') {
+                    break;
+                }
+            }
+
+            return c89str_lexer_set_token(pLexer, (c == '\"') ? c89str_token_type_string_double : c89str_token_type_string_single, (off - pLexer->textOff));
+        }
+
+        /* It's not whitespace, new line, comment, nor a string. Check if it's a number. Using a switch here so we can do a convenient fall-through for handling the 0 special case. */
+        switch (c) {
+            case '0':
+            {
+                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+
+                if ((off+1) < len) {
+                    if (txt[off+1] == 'x' || txt[off+1] == 'X') {
+                        /* Hex integer or float literal. If we find a '.', 'p' or 'P' it means we're looking at a floating-point literal. */
+                        c89str_utf32 token = c89str_token_type_integer_literal_hex;
+
+                        off += 2;   /* +1 for the '0' and +1 for the 'x/X'. */
+                        off = c89str_lexer_skip_class(txt, off, len, C89STR_LEXER_CHAR_HEX);
+
+                        if (off < len && txt[off] == '.') {
+                            token = c89str_token_type_float_literal_hex;
+                            off += 1;
+                            off = c89str_lexer_skip_class(txt, off, len, C89STR_LEXER_CHAR_HEX);
+                        }
+
+                        /* If our next character is an 'p' or 'P' it means we're using scientific notation. */
+                        if (off < len && (txt[off] == 'p' || txt[off] == 'P')) {
+                            /* Scientific notation. */
+                            token = c89str_token_type_float_literal_hex;
+                            off += 1;
+                            if (off < len && (txt[off] == '-' || txt[off] == '+')) {
+                                off += 1;
+                            }
+
+                            /* We must have at least one digit. */
+                            if (off < len && (c89str_g_lexerCharClass[(unsigned char)txt[off]] & C89STR_LEXER_CHAR_HEX) != 0) {
+                                off += 1;
+                            } else {
+                                /* Invalid float literal. */
+                                return c89str_lexer_set_error(pLexer, (off - tokenBeg));
+                            }
+
+                            /* Now we just need to go until we hit the last digit. */
+                            off = c89str_lexer_skip_class(txt, off, len, C89STR_LEXER_CHAR_HEX);
+                        }
+
+                        /* We've reached the end of the literal. Check for a suffix and set the token. */
+                        return c89str_lexer_parse_suffix_and_set_token(pLexer, token, off);
+                    } else if (txt[off+1] == 'b' || txt[off+1] == 'B') {
+                        /* Binary literal. */
+                        off += 2;   /* +1 for '0' and +1 for 'b/B'. */
+                        while (off < len && (txt[off] >= '0' && txt[off] <= '1')) {
+                            off += 1;
+                        }
+
+                        /* We've reached the end of the literal. */
+                        return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_bin, off);
+                    } else {
+                        /* Maybe an octal literal, but could also just be a float starting with 0. If it's float we fall through to the next case statement which will treat it as decimal. */
+                        size_t newOff = off+1;
+
+                        /* First get past all leading zeros. */
+                        while (newOff < len && txt[newOff] == '0') {
+                            newOff += 1;
+                        }
+
+                        /* If the next character is between 1 and 7 it means we have an octal constant. Otherwise we need to fall through and treat it as a decimal literal. */
+                        if (newOff < len && txt[newOff] >= '1' && txt[newOff] <= '7') {
+                            /* It's an octal integer literal. */
+                            off = newOff;
+                            while (off < len && (txt[off] >= '0' && txt[off] <= '7')) {
+                                off += 1;
+                            }
+
+                            /* We've reached the end of the literal. */
+                            return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_oct, off);
+                        } else {
+                            /* It's not an octal literal. Just fall through and treat it as a decimal literal. Note that we have not incremented 'off' at this point. */
+                        }
+                    }
+                }
+            } C89STR_FALLTHROUGH /* fallthrough */;
+
+            case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+            {
+                /* Decimal integer or float literal. We keep looping until we find something that's not a number. If it is a '.', 'e' or 'E' it means we're looking at a floating-point literal. */
+                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+                off = c89str_lexer_span(txt, off + 1, len, C89STR_LEXER_SPAN_DIGITS);
+
+                /* Not a digit. If it's a dot it means we're processing a floating point literal. */
+                if (off < len && (txt[off] == '.' || txt[off] == 'e' || txt[off] == 'E')) {
+                    /* It's a floating point literal. We need to do another digit iteration. */
+                    if (txt[off] == '.') {
+                        off = c89str_lexer_span(txt, off + 1, len, C89STR_LEXER_SPAN_DIGITS);
+                    }
+
+                    /* If our next character is an 'e' or 'E' it means we're using scientific notation. */
+                    if (off < len && (txt[off] == 'e' || txt[off] == 'E')) {
+                        /* Scientific notation. */
+                        off += 1;
+                        if (off < len && (txt[off] == '-' || txt[off] == '+')) {
+                            off += 1;
+                        }
+
+                        /* We must have at least one digit. */
+                        if (off < len && txt[off] >= '0' && txt[off] <= '9') {
+                            off += 1;
+                        } else {
+                            /* Invalid float literal. */
+                            return c89str_lexer_set_error(pLexer, (off - tokenBeg));
+                        }
+
+                        /* Now we just need to go until we hit the last digit. */
+                        off = c89str_lexer_span(txt, off, len, C89STR_LEXER_SPAN_DIGITS);
+                    }
+
+                    /* We've reached the end of the literal. Check for a suffix and set the token. */
+                    return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_float_literal_dec, off);
+                } else {
+                    /* It's a decimal integer literal. Check fo a suffix and set the token. */
+                    return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_dec, off);
+                }
+            } break;
+
+            case '=':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_eqeq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '!':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_noteq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '<':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_lteq, 2);
+                    }
+                    if (txt[off+1] == '<') {
+                        if (off+2 < len) {
+                            if (txt[off+2] == '=') {
+                                return c89str_lexer_set_token(pLexer, c89str_token_type_shleq, 3);
+                            }
+                        }
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_shl, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '>':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_gteq, 2);
+                    }
+                    if (txt[off+1] == '>') {
+                        if (off+2 < len) {
+                            if (txt[off+2] == '=') {
+                                return c89str_lexer_set_token(pLexer, c89str_token_type_shreq, 3);
+                            }
+                        }
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_shr, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '&':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '&') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_andand, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_andeq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '|':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '|') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_oror, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_oreq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '+':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '+') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_plusplus, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_pluseq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '-':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '-') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_minusminus, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_minuseq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '*':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_muleq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '/':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_diveq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);   /* Should never hit this because the '/' character is handled when handling comments. */
+            };
+
+            case '%':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_modeq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '^':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_xoreq, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case ':':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == ':') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_coloncolon, 2);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '.':
+            {
+                if (off+2 < len) {
+                    if(txt[off+1] == '.' && txt[off+2] == '.') {
+                        return c89str_lexer_set_token(pLexer, c89str_token_type_ellipsis, 3);
+                    }
+                }
+                return c89str_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            /*
+            By default we must have an identifier. In our lexer, all special operators are represented using ASCII characters. This means we can use *most* Unicode code points
+            in our identifiers. What we cannot use, however, is any of the Unicode defined whitespace characters (these encompass new line characters). We know that it won't
+            start with a whitespace character because we checked that at the top. However, we need to make sure we don't include any Unicode whitespace characters.
+            */
+            default:
+            {
+                /* We just need to loop until we hit the first disallowed character. We support "_", "a-z", "A-Z", "0-9" and all Unicode characters outside of ASCII except whitespace. */
+                if ((charClass & C89STR_LEXER_CHAR_IDENT) != 0) {
+                    int span = (pLexer->options.allowDashesInIdentifiers) ? C89STR_LEXER_SPAN_IDENT_DASH : C89STR_LEXER_SPAN_IDENT;   /* Dashes enable support for kabab-case. */
+
+                    off += 1;
+                    for (;;) {
+                        off = c89str_lexer_span(txt, off, len, span);
+                        if (off == len || (c89str_g_lexerCharClass[(unsigned char)txt[off]] & C89STR_LEXER_CHAR_MB_LEAD) == 0) {
+                            break;  /* Not a valid character for an identifier. We're done. */
+                        }
+
+                        /* The span stops at anything that might be Unicode whitespace. If it's not whitespace it's still part of the identifier. */
+                        if (c89str_scan_leading_multibyte_whitespace(txt + off, (len - off)) > 0) {
+                            break;
+                        }
+
+                        off += 1;
+                    }
+
+                    if (pLexer->options.pKeywords != NULL) {
+                        size_t iKeyword = c89str_lexer_keyword_table_find(pLexer->options.pKeywords, txt + pLexer->textOff, (off - pLexer->textOff));
+                        if (iKeyword != c89str_npos) {
+                            return c89str_lexer_set_token(pLexer, pLexer->options.pKeywords->pKeywords[iKeyword].token, (off - pLexer->textOff));
+                        }
+                    }
+
+                    return c89str_lexer_set_token(pLexer, c89str_token_type_identifier, (off - pLexer->textOff));
+                } else {
+                    return c89str_lexer_set_single_char(pLexer, txt[off]);
+                }
+            };
+        }
+    }
+
+    /* Shouldn't get here. */
+    /*return 0;*/
+}
+
+C89STR_API errno_t c89str_lexer_next(c89str_lexer* pLexer)
+{
+    if (pLexer == NULL) {
+        return EINVAL;  /* Invalid arguments. */
+    }
+
+    c89str_lexer_update_cache(pLexer);
+
+    return c89str_lexer_next_token(pLexer);
+}
+
+
+C89STR_API errno_t c89str_token_array_init(c89str_token_array* pTokens)
+{
+    if (pTokens == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pTokens);
+    pTokens->ownsBuffers = C89STR_TRUE;
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_token_array_init_with_buffers(c89str_token_array* pTokens, c89str_uint32* pTypes, size_t* pOffsets, size_t* pLengths, size_t* pLines, size_t capacity)
+{
+    if (pTokens == NULL) {
+        return EINVAL;
+    }
+
+    C89STR_ZERO_OBJECT(pTokens);
+
+    if (capacity > 0 && (pTypes == NULL || pOffsets == NULL || pLengths == NULL || pLines == NULL)) {
+        return EINVAL;
+    }
+
+    pTokens->pTypes      = pTypes;
+    pTokens->pOffsets    = pOffsets;
+    pTokens->pLengths    = pLengths;
+    pTokens->pLines      = pLines;
+    pTokens->capacity    = capacity;
+    pTokens->ownsBuffers = C89STR_FALSE;
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API void c89str_token_array_uninit(c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (pTokens == NULL) {
+        return;
+    }
+
+    if (pTokens->ownsBuffers) {
+        c89str_free(pTokens->pOffsets, pAllocationCallbacks);   /* The offsets are at the start of the allocation. */
+    }
+
+    C89STR_ZERO_OBJECT(pTokens);
+}
+
+static errno_t c89str_token_array_reserve(c89str_token_array* pTokens, size_t capacity, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t* pNewOffsets;
+
+    C89STR_ASSERT(pTokens != NULL);
+
+    if (capacity <= pTokens->capacity) {
+        return C89STR_SUCCESS;
+    }
+
+    if (!pTokens->ownsBuffers) {
+        return ENOMEM;  /* The buffers belong to the caller. */
+    }
+
+    if (capacity > ((size_t)-1) / (sizeof(size_t)*3 + sizeof(c89str_uint32))) {
+        return ENOMEM;  /* Too big. */
+    }
+
+    /*
+    The arrays are stored in one allocation which keeps arenas happy. The size_t arrays go first so that the
+    alignment holds for any capacity. A fresh allocation is used rather than a realloc because every array
+    other than the first one moves.
+    */
+    pNewOffsets = (size_t*)c89str_malloc((sizeof(size_t)*3 + sizeof(c89str_uint32)) * capacity, pAllocationCallbacks);
+    if (pNewOffsets == NULL) {
+        return ENOMEM;
+    }
+
+    if (pTokens->count > 0) {
+        C89STR_COPY_MEMORY(pNewOffsets,                pTokens->pOffsets, sizeof(size_t)        * pTokens->count);
+        C89STR_COPY_MEMORY(pNewOffsets + capacity,     pTokens->pLengths, sizeof(size_t)        * pTokens->count);
+        C89STR_COPY_MEMORY(pNewOffsets + capacity * 2, pTokens->pLines,   sizeof(size_t)        * pTokens->count);
+        C89STR_COPY_MEMORY(pNewOffsets + capacity * 3, pTokens->pTypes,   sizeof(c89str_uint32) * pTokens->count);
+    }
+
+    c89str_free(pTokens->pOffsets, pAllocationCallbacks);
+
+    pTokens->pOffsets = pNewOffsets;
+    pTokens->pLengths = pNewOffsets + capacity;
+    pTokens->pLines   = pNewOffsets + capacity * 2;
+    pTokens->pTypes   = (c89str_uint32*)(pNewOffsets + capacity * 3);
+    pTokens->capacity = capacity;
+
+    return C89STR_SUCCESS;
+}
+
+static errno_t c89str_lexer_tokenize_range(c89str_lexer* pLexer, c89str_token_array* pTokens, size_t endOff, c89str_bool32 canGrow, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_uint32* pTypes;
+    size_t* pOffsets;
+    size_t* pLengths;
+    size_t* pLines;
+    size_t count;
+    size_t capacity;
+
+    C89STR_ASSERT(pLexer  != NULL);
+    C89STR_ASSERT(pTokens != NULL);
+
+    /* The array is cached in locals so the loop below isn't going back to memory for them on every token. */
+    pTypes   = pTokens->pTypes;
+    pOffsets = pTokens->pOffsets;
+    pLengths = pTokens->pLengths;
+    pLines   = pTokens->pLines;
+    count    = pTokens->count;
+    capacity = pTokens->capacity;
+
+    for (;;) {
+        size_t prevOff  = pLexer->textOff;
+        size_t prevLine = pLexer->lineNumber;
+        size_t tokenOff;
 
-        if (off == len) {
-            c89str_lexer_set_token(pLexer, c89str_token_type_eof, 0);
-            return ENOMEM;  /* Out of input data. */
+        c89str_lexer_next_token(pLexer);   /* Errors are stored as error tokens so the result isn't needed here. */
+        if (pLexer->token == c89str_token_type_eof) {
+            break;
         }
 
-        /* First check if we're on whitespace. */
-        {
-            size_t whitespaceLen = c89str_ltrim(txt + off, (len - off));
-            if (whitespaceLen > 0) {
-                /* It's whitespace. Our lexer makes a distrinction between whitespace and new line characters so we need to check that too. */
-                size_t thisLineLen;
-                size_t nextLineOff = c89str_find_next_line(txt + off, (len - off), &thisLineLen);
-                if (thisLineLen > whitespaceLen) {
-                    /* There's no new line character within the whitespace area. */
-                    result = c89str_lexer_set_token(pLexer, c89str_token_type_whitespace, whitespaceLen);
-                    if (pLexer->options.skipWhitespace) {
-                        continue;
-                    } else {
-                        return result;
-                    }
-                } else {
-                    /* There's a new line somewhere in the whitespace. */
-                    if (thisLineLen <= whitespaceLen && thisLineLen > 0) {
-                        /* There's a new line character within the whitespace area. */
-                        result = c89str_lexer_set_token(pLexer, c89str_token_type_whitespace, thisLineLen);
-                        if (pLexer->options.skipWhitespace) {
-                            continue;
-                        } else {
-                            return result;
-                        }
-                    } else {
-                        /* It's a new line character. */
-                        C89STR_ASSERT(thisLineLen == 0);
-                        result = c89str_lexer_set_token(pLexer, c89str_token_type_newline, (nextLineOff - thisLineLen));
-                        if (pLexer->options.skipNewlines) {
-                            continue;
-                        } else {
-                            return result;
-                        }
-                    }
-                }
-            }
+        tokenOff = (size_t)(pLexer->pTokenStr - pLexer->pText);
+        if (tokenOff >= endOff) {
+            /* The token belongs to whoever is doing the next range. */
+            pLexer->textOff    = prevOff;
+            pLexer->lineNumber = prevLine;
+            break;
         }
 
-        /* It's not whitespace or a new line. Check if it's a line comment. */
-        if (c89str_begins_with(&txt[off], len - off, pLexer->options.pLineCommentOpeningToken, (size_t)-1)) {
-            /* Found the beginning of a line comment. Note that we do *not* include the new line in the returned token. */
-            size_t thisLineLen;
-            size_t openingLen;
+        if (count == capacity) {
+            errno_t result = ENOMEM;
 
-            openingLen = c89str_strlen(pLexer->options.pLineCommentOpeningToken);
-            
-            off += openingLen;
-            c89str_find_next_line(txt + off, (len - off), &thisLineLen);
-            result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, thisLineLen + openingLen);
-            if (pLexer->options.skipComments) {
-                continue;
-            } else {
+            pTokens->count = count;
+            if (canGrow) {
+                result = c89str_token_array_reserve(pTokens, (capacity == 0) ? 256 : capacity * 2, pAllocationCallbacks);
+            }
+
+            if (result != C89STR_SUCCESS) {
+                /* Rewind so the token can be read again later. */
+                pLexer->textOff    = prevOff;
+                pLexer->lineNumber = prevLine;
                 return result;
             }
+
+            pTypes   = pTokens->pTypes;
+            pOffsets = pTokens->pOffsets;
+            pLengths = pTokens->pLengths;
+            pLines   = pTokens->pLines;
+            capacity = pTokens->capacity;
         }
 
-        if (c89str_begins_with(&txt[off], len - off, pLexer->options.pBlockCommentOpeningToken, (size_t)-1)) {
-            /* It's the beginning of a block comment. */
-            errno_t searchResult;
-            size_t tokenLen;
-            size_t openingLen;
-            size_t closingLen;
+        pTypes  [count] = (c89str_uint32)pLexer->token;
+        pOffsets[count] = tokenOff;
+        pLengths[count] = pLexer->tokenLen;
+        pLines  [count] = pLexer->tokenLineNumber;
+        count += 1;
+    }
 
-            openingLen = c89str_strlen(pLexer->options.pBlockCommentOpeningToken);
-            closingLen = c89str_strlen(pLexer->options.pBlockCommentClosingToken);
-            
-            off += openingLen;
-            searchResult = c89str_findn(txt + off, (len - off), pLexer->options.pBlockCommentClosingToken, closingLen, &tokenLen);
-            if (searchResult != C89STR_SUCCESS) {
-                /* The closing token could not be found. Treat the entire rest of the content as a comment. */
-                result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, (len - off) + openingLen);
-            } else {
-                /* We found the closing token. */
-                result = c89str_lexer_set_token(pLexer, c89str_token_type_comment, tokenLen + openingLen + closingLen);
-            }
+    pTokens->count = count;
 
-            if (pLexer->options.skipComments) {
-                continue;
-            } else {
-                return result;
-            }
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_lexer_tokenize_all(c89str_lexer* pLexer, c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (pLexer == NULL || pTokens == NULL) {
+        return EINVAL;
+    }
+
+    c89str_lexer_update_cache(pLexer);
+
+    /* If we own the buffers we can make a guess at the size up front to avoid growing in most cases. This assumes an average of 8 bytes per token. */
+    if (pTokens->ownsBuffers && pTokens->capacity - pTokens->count < (pLexer->textLen - pLexer->textOff) / 8) {
+        if (c89str_token_array_reserve(pTokens, pTokens->count + (pLexer->textLen - pLexer->textOff) / 8 + 16, pAllocationCallbacks) != C89STR_SUCCESS) {
+            /* Not fatal. We'll try growing in smaller steps as we go. */
         }
+    }
 
-        /* It's not whitespace, new line nor a comment. Check if it's a string. We support both double and single quoted strings. */
-        if (txt[off] == '\"') {
-            off += 1;
-            for (; off < len; off += 1) {
-                if (txt[off] == '\"') {
-                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
-                    C89STR_ASSERT(off > 0);
-                    if (txt[off-1] != '\\') {
-                        /* It's not an escaped double quote which means we've reached the end. */
-                        off += 1;
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_string_double, (off - pLexer->textOff));
-                    }
-                }
-            }
+    return c89str_lexer_tokenize_range(pLexer, pTokens, pLexer->textLen, pTokens->ownsBuffers, pAllocationCallbacks);
+}
+
+
+/*
+Parallel tokenization.
+
+The lexer has no state other than its position in the text so if two lexers land on the start of the same token, they
+will produce the same tokens from that point onward. This is what makes it possible to split the text into chunks and
+lex each one without knowing what came before it. Each chunk starts just after a '\n' which is where a new token
+begins unless the new line is inside a string or block comment. That is only a guess so the chunks are stitched
+together in order on the calling thread. Where a chunk's first token follows on from the end of the previous one, its
+tokens are used as is. Otherwise tokens are lexed one at a time from the end of the previous chunk until one of them
+starts at the same place as a token in the chunk, after which the chunk's tokens can be used. Line numbers are counted
+from the start of each chunk and fixed up while stitching.
+
+The allocation callbacks are only called from the calling thread. The buffers for each chunk are allocated up front
+with a guess at the number of tokens. If a chunk runs out of room its thread stops, the buffer is grown, and the chunk
+carries on from where it stopped in another round.
+*/
+typedef struct
+{
+    c89str_lexer lexer;         /* The position and line number of this lexer are where the chunk stopped. */
+    size_t beg;
+    size_t end;                 /* Tokens starting at or after this offset belong to the next chunk. */
+    c89str_token_array tokens;  /* Line numbers are relative to the start of the chunk. */
+    errno_t result;             /* ENOMEM if the chunk ran out of room and needs another round. */
+} c89str_lexer_tokenize_job;
+
+static void c89str_lexer_tokenize_job_proc(void* pData)
+{
+    c89str_lexer_tokenize_job* pJob = (c89str_lexer_tokenize_job*)pData;
+
+    if (pJob->result != ENOMEM) {
+        return; /* Already done. */
+    }
+
+    pJob->result = c89str_lexer_tokenize_range(&pJob->lexer, &pJob->tokens, pJob->end, C89STR_FALSE, NULL);
+}
+
+static errno_t c89str_lexer_stitch_job(c89str_lexer* pLexer, c89str_token_array* pTokens, const c89str_lexer_tokenize_job* pJob, size_t iFirstToken, size_t lineDelta, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    size_t tokenCount = pJob->tokens.count - iFirstToken;
+    size_t iToken;
+
+    if (pTokens->capacity - pTokens->count < tokenCount && pTokens->ownsBuffers) {
+        c89str_token_array_reserve(pTokens, C89STR_MAX(pTokens->count + tokenCount, pTokens->capacity * 2), pAllocationCallbacks);  /* A failure is handled below by copying what fits. */
+    }
+
+    tokenCount = C89STR_MIN(tokenCount, pTokens->capacity - pTokens->count);
+
+    if (tokenCount > 0) {
+        C89STR_COPY_MEMORY(pTokens->pTypes   + pTokens->count, pJob->tokens.pTypes   + iFirstToken, sizeof(c89str_uint32) * tokenCount);
+        C89STR_COPY_MEMORY(pTokens->pOffsets + pTokens->count, pJob->tokens.pOffsets + iFirstToken, sizeof(size_t)        * tokenCount);
+        C89STR_COPY_MEMORY(pTokens->pLengths + pTokens->count, pJob->tokens.pLengths + iFirstToken, sizeof(size_t)        * tokenCount);
+        for (iToken = 0; iToken < tokenCount; iToken += 1) {
+            pTokens->pLines[pTokens->count + iToken] = pJob->tokens.pLines[iFirstToken + iToken] + lineDelta;
         }
 
-        if (txt[off] == '\'') {
-            off += 1;
-            for (; off < len; off += 1) {
-                if (txt[off] == '\'') {
-                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
-                    C89STR_ASSERT(off > 0);
-                    if (txt[off-1] != '\\') {
-                        /* It's not an escaped double quote which means we've reached the end. */
-                        off += 1;
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_string_double, (off - pLexer->textOff));
-                    }
+        pTokens->count += tokenCount;
+    }
+
+    if (iFirstToken + tokenCount < pJob->tokens.count) {
+        /* Out of room. Put the lexer on the first token that wasn't stored. Lexing from the start of a token gives the same token again. */
+        pLexer->textOff    = pJob->tokens.pOffsets[iFirstToken + tokenCount];
+        pLexer->lineNumber = pJob->tokens.pLines  [iFirstToken + tokenCount] + lineDelta;
+        return ENOMEM;
+    }
+
+    pLexer->textOff    = pJob->lexer.textOff;
+    pLexer->lineNumber = pJob->lexer.lineNumber + lineDelta;
+
+    return C89STR_SUCCESS;
+}
+
+static errno_t c89str_lexer_push_token(c89str_lexer* pLexer, c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    if (pTokens->count == pTokens->capacity) {
+        errno_t result = c89str_token_array_reserve(pTokens, (pTokens->capacity == 0) ? 256 : pTokens->capacity * 2, pAllocationCallbacks);
+        if (result != C89STR_SUCCESS) {
+            return result;
+        }
+    }
+
+    pTokens->pTypes  [pTokens->count] = (c89str_uint32)pLexer->token;
+    pTokens->pOffsets[pTokens->count] = (size_t)(pLexer->pTokenStr - pLexer->pText);
+    pTokens->pLengths[pTokens->count] = pLexer->tokenLen;
+    pTokens->pLines  [pTokens->count] = pLexer->tokenLineNumber;
+    pTokens->count += 1;
+
+    return C89STR_SUCCESS;
+}
+
+C89STR_API errno_t c89str_lexer_tokenize_all_parallel(c89str_lexer* pLexer, size_t threadCount, c89str_token_array* pTokens, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_lexer_tokenize_job* pJobs;
+    size_t jobCount;
+    size_t iJob;
+    size_t textOff;
+    size_t textLen;
+    c89str_bool32 hasPendingJobs;
+    errno_t result = C89STR_SUCCESS;
+
+    if (pLexer == NULL || pTokens == NULL) {
+        return EINVAL;
+    }
+
+    c89str_lexer_update_cache(pLexer);
+
+    textOff = pLexer->textOff;
+    textLen = pLexer->textLen;
+
+    if (threadCount == 0) {
+        threadCount = c89str_get_processor_count();
+    }
+
+    jobCount = C89STR_MIN(threadCount, (textLen - textOff) / C89STR_LEXER_MIN_CHUNK_SIZE);
+    if (jobCount <= 1) {
+        return c89str_lexer_tokenize_all(pLexer, pTokens, pAllocationCallbacks);
+    }
+
+    pJobs = (c89str_lexer_tokenize_job*)c89str_malloc(sizeof(*pJobs) * jobCount, pAllocationCallbacks);
+    if (pJobs == NULL) {
+        return c89str_lexer_tokenize_all(pLexer, pTokens, pAllocationCallbacks);
+    }
+
+    /* Split the text just after the first '\n' following each even split point. */
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        size_t beg = textOff;
+
+        if (iJob > 0) {
+            const char* pNewLine;
+
+            beg = textOff + ((textLen - textOff) / jobCount) * iJob;
+            pNewLine = c89str_memchr(pLexer->pText + beg, textLen - beg, '\n');
+            beg = (pNewLine != NULL) ? (size_t)(pNewLine - pLexer->pText) + 1 : textLen;
+            beg = C89STR_MAX(beg, pJobs[iJob - 1].beg);
+            pJobs[iJob - 1].end = beg;
+        }
+
+        pJobs[iJob].lexer            = *pLexer;
+        pJobs[iJob].lexer.textOff    = beg;
+        pJobs[iJob].lexer.lineNumber = 1;
+        pJobs[iJob].beg              = beg;
+        pJobs[iJob].end              = textLen;
+        pJobs[iJob].result           = ENOMEM;
+
+        c89str_token_array_init(&pJobs[iJob].tokens);
+    }
+
+    /* The buffers are sized on the assumption of 8 bytes per token. They're grown between rounds if that's not enough. */
+    for (;;) {
+        hasPendingJobs = C89STR_FALSE;
+        for (iJob = 0; iJob < jobCount; iJob += 1) {
+            c89str_lexer_tokenize_job* pJob = &pJobs[iJob];
+
+            if (pJob->result == ENOMEM) {
+                size_t newCap = (pJob->tokens.capacity == 0) ? (pJob->end - pJob->beg) / 8 + 64 : pJob->tokens.capacity * 2;
+                if (c89str_token_array_reserve(&pJob->tokens, newCap, pAllocationCallbacks) != C89STR_SUCCESS) {
+                    pJob->result = C89STR_SUCCESS;  /* Give up on this chunk. Whatever it didn't get to will be lexed on this thread while stitching. */
+                } else {
+                    hasPendingJobs = C89STR_TRUE;
                 }
             }
         }
 
-        /* It's not whitespace, new line, comment, nor a string. Check if it's a number. Using a switch here so we can do a convenient fall-through for handling the 0 special case. */
-        switch (txt[off]) {
-            case '0':
-            {
-                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+        if (!hasPendingJobs) {
+            break;
+        }
 
-                if ((off+1) < len) {
-                    if (txt[off+1] == 'x' || txt[off+1] == 'X') {
-                        /* Hex integer or float literal. If we find a '.', 'p' or 'P' it means we're looking at a floating-point literal. */
-                        off += 2;   /* +1 for the '0' and +1 for the 'x/X'. */
-                        while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                            off += 1;
-                        }
+        c89str_run_jobs(c89str_lexer_tokenize_job_proc, pJobs, sizeof(*pJobs), jobCount, pAllocationCallbacks);
+    }
 
-                        if (txt[off] == '.') {
-                            off += 1;
-                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                                off += 1;
-                            }
-                        }
+    /* Now stitch everything together. The first chunk starts where the lexer is so it's always used as is. */
+    for (iJob = 0; iJob < jobCount && result == C89STR_SUCCESS; iJob += 1) {
+        c89str_lexer_tokenize_job* pJob = &pJobs[iJob];
+        size_t iSpeculativeToken = 0;
 
-                        /* If our next character is an 'p' or 'P' it means we're using scientific notation. */
-                        if (txt[off] == 'p' || txt[off] == 'P') {
-                            /* Scientific notation. */
-                            off += 1;
-                            if (off < len && (txt[off] == '-' || txt[off] == '+')) {
-                                off += 1;
-                            }
+        if (pLexer->textOff == pJob->beg) {
+            result = c89str_lexer_stitch_job(pLexer, pTokens, pJob, 0, pLexer->lineNumber - 1, pAllocationCallbacks);
+            iSpeculativeToken = pJob->tokens.count; /* Marks the chunk as stitched. */
+        }
 
-                            /* We must have at least one digit. */
-                            if ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F')) {
-                                off += 1;
-                            } else {
-                                /* Invalid float literal. */
-                                return c89str_lexer_set_error(pLexer, (off - tokenBeg));
-                            }
+        /*
+        Lex sequentially until we find a token that the chunk agrees with. This is also how the end of a chunk that ran out of
+        memory gets lexed. If the lexer has gone past the end of the chunk, such as in a block comment that spans the whole
+        chunk, the chunk is skipped entirely.
+        */
+        while (result == C89STR_SUCCESS && pLexer->textOff < pJob->end) {
+            size_t prevOff  = pLexer->textOff;
+            size_t prevLine = pLexer->lineNumber;
+            size_t tokenOff;
 
-                            /* Now we just need to go until we hit the last digit. */
-                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                                off += 1;
-                            }
-                        }
+            c89str_lexer_next_token(pLexer);
+            if (pLexer->token == c89str_token_type_eof) {
+                break;
+            }
 
-                        /* We've reached the end of the literal. Check for a suffix and set the token. */
-                        return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_float_literal_hex, off);
-                    } else if (txt[off+1] == 'b' || txt[off+1] == 'B') {
-                        /* Binary literal. */
-                        off += 2;   /* +1 for '0' and +1 for 'b/B'. */
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '1')) {
-                            off += 1;
-                        }
+            result = c89str_lexer_push_token(pLexer, pTokens, pAllocationCallbacks);
+            if (result != C89STR_SUCCESS) {
+                pLexer->textOff    = prevOff;
+                pLexer->lineNumber = prevLine;
+                break;
+            }
 
-                        /* We've reached the end of the literal. */
-                        return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_bin, off);
-                    } else {
-                        /* Maybe an octal literal, but could also just be a float starting with 0. If it's float we fall through to the next case statement which will treat it as decimal. */
-                        size_t newOff = off+1;
+            tokenOff = (size_t)(pLexer->pTokenStr - pLexer->pText);
+            while (iSpeculativeToken < pJob->tokens.count && pJob->tokens.pOffsets[iSpeculativeToken] < tokenOff) {
+                iSpeculativeToken += 1;
+            }
 
-                        /* First get past all leading zeros. */
-                        while (newOff < len && txt[newOff] == '0') {
-                            newOff += 1;
-                        }
+            if (iSpeculativeToken < pJob->tokens.count && pJob->tokens.pOffsets[iSpeculativeToken] == tokenOff) {
+                result = c89str_lexer_stitch_job(pLexer, pTokens, pJob, iSpeculativeToken + 1, pLexer->tokenLineNumber - pJob->tokens.pLines[iSpeculativeToken], pAllocationCallbacks);
+                iSpeculativeToken = pJob->tokens.count;
+            }
+        }
+    }
 
-                        /* If the next character is between 1 and 7 it means we have an octal constant. Otherwise we need to fall through and treat it as a decimal literal. */
-                        if (txt[newOff] >= '1' && txt[newOff] <= '7') {
-                            /* It's an octal integer literal. */
-                            off = newOff;
-                            while (off < len && (txt[off] >= '0' && txt[off] <= '7')) {
-                                off += 1;
-                            }
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        c89str_token_array_uninit(&pJobs[iJob].tokens, pAllocationCallbacks);
+    }
 
-                            /* We've reached the end of the literal. */
-                            return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_oct, off);
-                        } else {
-                            /* It's not an octal literal. Just fall through and treat it as a decimal literal. Note that we have not incremented 'off' at this point. */
-                        }
-                    }
-                }
-            } C89STR_FALLTHROUGH /* fallthrough */;
+    c89str_free(pJobs, pAllocationCallbacks);
+
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
+
+    /* This will have nothing left to do other than reading the end of file token, unless the last chunk stopped early on a token it had no room for. */
+    return c89str_lexer_tokenize_range(pLexer, pTokens, textLen, pTokens->ownsBuffers, pAllocationCallbacks);
+}
 
-            case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-            {
-                /* Decimal integer or float literal. We keep looping until we find something that's not a number. If it is a '.', 'e' or 'E' it means we're looking at a floating-point literal. */
-                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
-                off += 1;
-                while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                    off += 1;
-                }
 
-                /* Not a digit. If it's a dot it means we're processing a floating point literal. */
-                if (txt[off] == '.' || txt[off] == 'e' || txt[off] == 'E') {
-                    /* It's a floating point literal. We need to do another digit iteration. */
-                    if (txt[off] == '.') {
-                        off += 1;
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                            off += 1;
-                        }
-                    }
+/*
+Incremental tokenization. A token depends on its own bytes and can look at a few bytes past its end, such as when
+checking for "..." or for Unicode whitespace at the end of an identifier, or when comparing against the opening token
+of a comment. Any token that ends far enough before the edit is therefore unchanged, and since the lexer has no state
+other than its position, lexing from the start of such a token gives the same tokens as before up to the edit.
+*/
+#ifndef C89STR_LEXER_MAX_LOOKAHEAD
+#define C89STR_LEXER_MAX_LOOKAHEAD  4   /* How many bytes past the end of a token the lexer may look at, not counting comment tokens. */
+#endif
 
-                    /* If our next character is an 'e' or 'E' it means we're using scientific notation. */
-                    if (txt[off] == 'e' || txt[off] == 'E') {
-                        /* Scientific notation. */
-                        off += 1;
-                        if (off < len && (txt[off] == '-' || txt[off] == '+')) {
-                            off += 1;
-                        }
+static size_t c89str_token_array_lower_bound(const c89str_token_array* pTokens, size_t beg, size_t offset)    /* Returns the index of the first token at or after beg that starts at or after the offset. */
+{
+    size_t end = pTokens->count;
 
-                        /* We must have at least one digit. */
-                        if (txt[off] >= '0' && txt[off] <= '9') {
-                            off += 1;
-                        } else {
-                            /* Invalid float literal. */
-                            return c89str_lexer_set_error(pLexer, (off - tokenBeg));
-                        }
+    while (beg < end) {
+        size_t mid = beg + (end - beg) / 2;
+        if (pTokens->pOffsets[mid] < offset) {
+            beg = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
 
-                        /* Now we just need to go until we hit the last digit. */
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                            off += 1;
-                        }
-                    }
+    return beg;
+}
 
-                    /* We've reached the end of the literal. Check for a suffix and set the token. */
-                    return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_float_literal_dec, off);
-                } else {
-                    /* It's a decimal integer literal. Check fo a suffix and set the token. */
-                    return c89str_lexer_parse_suffix_and_set_token(pLexer, c89str_token_type_integer_literal_dec, off);
-                }
-            } break;
+C89STR_API errno_t c89str_lexer_retokenize(c89str_lexer* pLexer, c89str_token_array* pTokens, size_t editOff, size_t removedLen, size_t insertedLen, size_t* pFirstToken, size_t* pTokenCount, const c89str_allocation_callbacks* pAllocationCallbacks)
+{
+    c89str_token_array newTokens;
+    size_t lookahead;
+    size_t iFirst;      /* The first old token to be replaced. */
+    size_t iLast;       /* One past the last old token to be replaced. */
+    size_t lo;
+    size_t hi;
+    size_t newCount;
+    size_t tailCount;
+    size_t offsetDelta;
+    size_t lineDelta = 0;
+    size_t iToken;
+    errno_t result;
 
-            case '=':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_eqeq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (pFirstToken != NULL) {
+        *pFirstToken = 0;
+    }
 
-            case '!':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_noteq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (pTokenCount != NULL) {
+        *pTokenCount = 0;
+    }
 
-            case '<':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_lteq, 2);
-                    }
-                    if (txt[off+1] == '<') {
-                        if (off+2 < len) {
-                            if (txt[off+2] == '=') {
-                                return c89str_lexer_set_token(pLexer, c89str_token_type_shleq, 3);
-                            }
-                        }
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_shl, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (pLexer == NULL || pTokens == NULL) {
+        return EINVAL;
+    }
 
-            case '>':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_gteq, 2);
-                    }
-                    if (txt[off+1] == '>') {
-                        if (off+2 < len) {
-                            if (txt[off+2] == '=') {
-                                return c89str_lexer_set_token(pLexer, c89str_token_type_shreq, 3);
-                            }
-                        }
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_shr, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (editOff > pLexer->textLen || insertedLen > pLexer->textLen - editOff) {
+        return EINVAL;  /* The edit doesn't fit in the new text. */
+    }
 
-            case '&':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '&') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_andand, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_andeq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    c89str_lexer_update_cache(pLexer);
 
-            case '|':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '|') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_oror, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_oreq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    /* Find the last token that ends far enough before the edit. The end of each token is also sorted so a binary search works here. */
+    lookahead = C89STR_LEXER_MAX_LOOKAHEAD + C89STR_MAX(pLexer->cache.lineCommentOpeningLen, pLexer->cache.blockCommentOpeningLen);
+    lo = 0;
+    hi = pTokens->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pTokens->pOffsets[mid] + pTokens->pLengths[mid] + lookahead <= editOff) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
 
-            case '+':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '+') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_plusplus, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_pluseq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (lo > 0) {
+        iFirst = lo - 1;
+        pLexer->textOff    = pTokens->pOffsets[iFirst];
+        pLexer->lineNumber = pTokens->pLines[iFirst];
+    } else {
+        iFirst = 0;
+        pLexer->textOff    = 0;
+        pLexer->lineNumber = 1;
+    }
 
-            case '-':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '-') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_minusminus, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_minuseq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    /* Old tokens that start inside the removed text are gone. The search for where the streams meet up again starts after them. */
+    iLast = c89str_token_array_lower_bound(pTokens, iFirst, editOff + removedLen);
 
-            case '*':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_muleq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+    result = c89str_token_array_init(&newTokens);
+    if (result != C89STR_SUCCESS) {
+        return result;
+    }
 
-            case '/':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_diveq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);   /* Should never hit this because the '/' character is handled when handling comments. */
-            };
+    for (;;) {
+        size_t tokenOff;
 
-            case '%':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_modeq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+        c89str_lexer_next_token(pLexer);
+        if (pLexer->token == c89str_token_type_eof) {
+            iLast = pTokens->count; /* Everything to the end was replaced. */
+            break;
+        }
 
-            case '^':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_xoreq, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+        tokenOff = (size_t)(pLexer->pTokenStr - pLexer->pText);
+        if (tokenOff >= editOff + insertedLen) {
+            /* After the edit. If an old token started at the same place, everything from there on is the same as before. */
+            size_t oldTokenOff = tokenOff - insertedLen + removedLen;
 
-            case ':':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == ':') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_coloncolon, 2);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+            while (iLast < pTokens->count && pTokens->pOffsets[iLast] < oldTokenOff) {
+                iLast += 1;
+            }
 
-            case '.':
-            {
-                if (off+2 < len) {
-                    if(txt[off+1] == '.' && txt[off+2] == '.') {
-                        return c89str_lexer_set_token(pLexer, c89str_token_type_ellipsis, 3);
-                    }
-                }
-                return c89str_lexer_set_single_char(pLexer, txt[off]);
-            };
+            if (iLast < pTokens->count && pTokens->pOffsets[iLast] == oldTokenOff) {
+                lineDelta = pLexer->tokenLineNumber - pTokens->pLines[iLast];   /* Can wrap around, but that's fine since it'll wrap back when it's added. */
+                break;
+            }
+        }
 
-            /*
-            By default we must have an identifier. In our lexer, all special operators are represented using ASCII characters. This means we can use *most* Unicode code points
-            in our identifiers. What we cannot use, however, is any of the Unicode defined whitespace characters (these encompass new line characters). We know that it won't
-            start with a whitespace character because we checked that at the top. However, we need to make sure we don't include any Unicode whitespace characters.
-            */
-            default:
-            {
-                /* We just need to loop until we hit the first disallowed character. We support "_", "a-z", "A-Z", "0-9" and all Unicode characters outside of ASCII except whitespace. */
-                if ((txt[off] >= 'a' && txt[off] <= 'z') ||
-                    (txt[off] >= 'A' && txt[off] <= 'Z') ||
-                    (txt[off] == '_')                    ||
-                    ((unsigned char)txt[off] >= 0x80)) {
-                    size_t tokenMaxLen = c89str_find_next_whitespace(txt + off, (len - off), NULL);   /* <-- We'll be using this to ensure we don't include any Unicode whitespace characters. */
-                    size_t tokenLen = 0;
-
-                    while (tokenLen < (len - off)) {
-                        tokenLen += 1;
-                        if (tokenLen == tokenMaxLen) {
-                            break;
-                        }
+        result = c89str_lexer_push_token(pLexer, &newTokens, pAllocationCallbacks);
+        if (result != C89STR_SUCCESS) {
+            c89str_token_array_uninit(&newTokens, pAllocationCallbacks);
+            return result;
+        }
+    }
 
-                        if ((txt[off+tokenLen] >= 'a' && txt[off+tokenLen] <= 'z')                 ||
-                            (txt[off+tokenLen] >= 'A' && txt[off+tokenLen] <= 'Z')                 ||
-                            (txt[off+tokenLen] >= '0' && txt[off+tokenLen] <= '9')                 ||
-                            (txt[off+tokenLen] == '_')                                             ||
-                            (txt[off+tokenLen] == '-' && pLexer->options.allowDashesInIdentifiers) ||   /* Enables support for kabab-case. */
-                            ((unsigned char)txt[off+tokenLen] >= 0x80)) {
-                            continue;   /* Still valid. */
-                        } else {
-                            break;      /* Not a valid character for an identifier. We're done. */
-                        }
-                    }
+    /* Now splice the new tokens in. */
+    tailCount = pTokens->count - iLast;
+    newCount  = iFirst + newTokens.count + tailCount;
+    if (newCount > pTokens->capacity) {
+        result = c89str_token_array_reserve(pTokens, C89STR_MAX(newCount, pTokens->capacity * 2), pAllocationCallbacks);
+        if (result != C89STR_SUCCESS) {
+            c89str_token_array_uninit(&newTokens, pAllocationCallbacks);
+            return result;
+        }
+    }
 
-                    return c89str_lexer_set_token(pLexer, c89str_token_type_identifier, tokenLen);
-                } else {
-                    return c89str_lexer_set_single_char(pLexer, txt[off]);
-                }
-            };
+    if (tailCount > 0 && iFirst + newTokens.count != iLast) {
+        C89STR_MOVE_MEMORY(pTokens->pTypes   + iFirst + newTokens.count, pTokens->pTypes   + iLast, sizeof(c89str_uint32) * tailCount);
+        C89STR_MOVE_MEMORY(pTokens->pOffsets + iFirst + newTokens.count, pTokens->pOffsets + iLast, sizeof(size_t)        * tailCount);
+        C89STR_MOVE_MEMORY(pTokens->pLengths + iFirst + newTokens.count, pTokens->pLengths + iLast, sizeof(size_t)        * tailCount);
+        C89STR_MOVE_MEMORY(pTokens->pLines   + iFirst + newTokens.count, pTokens->pLines   + iLast, sizeof(size_t)        * tailCount);
+    }
+
+    if (newTokens.count > 0) {
+        C89STR_COPY_MEMORY(pTokens->pTypes   + iFirst, newTokens.pTypes,   sizeof(c89str_uint32) * newTokens.count);
+        C89STR_COPY_MEMORY(pTokens->pOffsets + iFirst, newTokens.pOffsets, sizeof(size_t)        * newTokens.count);
+        C89STR_COPY_MEMORY(pTokens->pLengths + iFirst, newTokens.pLengths, sizeof(size_t)        * newTokens.count);
+        C89STR_COPY_MEMORY(pTokens->pLines   + iFirst, newTokens.pLines,   sizeof(size_t)        * newTokens.count);
+    }
+
+    /* The tokens after the edit are the same as before, just moved. Like the line delta, the offset delta can wrap around. */
+    offsetDelta = insertedLen - removedLen;
+    if (offsetDelta != 0 || lineDelta != 0) {
+        for (iToken = iFirst + newTokens.count; iToken < newCount; iToken += 1) {
+            pTokens->pOffsets[iToken] += offsetDelta;
+            pTokens->pLines  [iToken] += lineDelta;
         }
     }
 
-    /* Shouldn't get here. */
-    /*return 0;*/
+    pTokens->count = newCount;
+
+    if (pFirstToken != NULL) {
+        *pFirstToken = iFirst;
+    }
+
+    if (pTokenCount != NULL) {
+        *pTokenCount = newTokens.count;
+    }
+
+    c89str_token_array_uninit(&newTokens, pAllocationCallbacks);
+
+    return C89STR_SUCCESS;
 }
 /* END c89str_lexer.c */
 
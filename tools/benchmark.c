@@ -0,0 +1,812 @@
+/*
+Benchmarks the Unicode conversion routines.
+
+Every converter is run over a set of generated corpora, and throughput is reported in GB/s of input and millions of
+code points per second. Each result is compared against a naive conversion which decodes and encodes one code point
+at a time with no lookup tables or SIMD, which makes it easy to see what the fast paths are buying and to spot
+regressions. Build with optimizations. With GCC and Clang use something like -march=native to enable AVX2:
+
+    cc -O2 -march=native tools/benchmark.c -o benchmark
+
+Useage: benchmark [filter]
+
+Only functions whose name contains the filter are run, so "utf8_to" runs everything that takes UTF-8 as input.
+*/
+#define C89STR_IMPLEMENTATION
+#include "../c89str.h"
+
+#include <time.h>
+
+#define BENCH_CORPUS_CODE_POINTS    (256 * 1024)
+#define BENCH_MIN_SECONDS           0.25
+
+
+/* Random Numbers */
+static c89str_uint32 g_benchRandomState = 0x12345678;
+
+static c89str_uint32 bench_random(void)
+{
+    /* xorshift32. Good enough for generating text and the sequence is the same on every platform. */
+    g_benchRandomState ^= g_benchRandomState << 13;
+    g_benchRandomState ^= g_benchRandomState >> 17;
+    g_benchRandomState ^= g_benchRandomState << 5;
+    return g_benchRandomState;
+}
+
+static c89str_uint32 bench_random_range(c89str_uint32 lo, c89str_uint32 hi)
+{
+    return lo + (bench_random() % (hi - lo + 1));
+}
+
+
+/* Encodings */
+typedef enum
+{
+    bench_encoding_utf8,
+    bench_encoding_utf16ne,
+    bench_encoding_utf16le,
+    bench_encoding_utf16be,
+    bench_encoding_utf32ne,
+    bench_encoding_utf32le,
+    bench_encoding_utf32be,
+    bench_encoding_wchar,       /* Output only. UTF-16 or UTF-32 depending on the size of wchar_t. */
+    bench_encoding_count
+} bench_encoding;
+
+static size_t bench_encoding_unit_size(bench_encoding encoding)
+{
+    switch (encoding)
+    {
+        case bench_encoding_utf8:    return 1;
+        case bench_encoding_utf16ne: return 2;
+        case bench_encoding_utf16le: return 2;
+        case bench_encoding_utf16be: return 2;
+        case bench_encoding_utf32ne: return 4;
+        case bench_encoding_utf32le: return 4;
+        case bench_encoding_utf32be: return 4;
+        case bench_encoding_wchar:   return sizeof(wchar_t);
+        default: return 1;
+    }
+}
+
+/* Whether or not code units of the given encoding need to be byte swapped on this machine. */
+static c89str_bool32 bench_encoding_is_swapped(bench_encoding encoding)
+{
+    if (encoding == bench_encoding_utf16le || encoding == bench_encoding_utf32le) {
+        return c89str_is_big_endian();
+    }
+
+    if (encoding == bench_encoding_utf16be || encoding == bench_encoding_utf32be) {
+        return c89str_is_little_endian();
+    }
+
+    return C89STR_FALSE;
+}
+
+
+/*
+Naive Conversion
+
+This is the baseline. It's the kind of loop you'd write without thinking about performance: decode a code point,
+encode it, repeat. Invalid input is replaced with U+FFFD.
+*/
+static c89str_uint16 bench_swap16(c89str_uint16 x)
+{
+    return (c89str_uint16)((x >> 8) | (x << 8));
+}
+
+static c89str_uint32 bench_swap32(c89str_uint32 x)
+{
+    return (x >> 24) | ((x >> 8) & 0x0000FF00) | ((x << 8) & 0x00FF0000) | (x << 24);
+}
+
+static c89str_utf32 bench_naive_decode(bench_encoding encoding, const void* pIn, size_t inLen, size_t* pIndex)
+{
+    size_t i = *pIndex;
+
+    if (encoding == bench_encoding_utf8) {
+        const c89str_uint8* p = (const c89str_uint8*)pIn;
+        c89str_utf32 cp;
+        size_t extra;
+        size_t j;
+
+        if (p[i] < 0x80) {
+            *pIndex = i + 1;
+            return p[i];
+        } else if (p[i] >= 0xC2 && p[i] <= 0xDF) {
+            cp = p[i] & 0x1F;
+            extra = 1;
+        } else if (p[i] >= 0xE0 && p[i] <= 0xEF) {
+            cp = p[i] & 0x0F;
+            extra = 2;
+        } else if (p[i] >= 0xF0 && p[i] <= 0xF4) {
+            cp = p[i] & 0x07;
+            extra = 3;
+        } else {
+            *pIndex = i + 1;
+            return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        for (j = 1; j <= extra; j += 1) {
+            if (i + j >= inLen || (p[i + j] & 0xC0) != 0x80) {
+                *pIndex = i + j;
+                return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+            }
+
+            cp = (cp << 6) | (p[i + j] & 0x3F);
+        }
+
+        *pIndex = i + 1 + extra;
+
+        if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        return cp;
+    }
+
+    if (encoding == bench_encoding_utf16ne || encoding == bench_encoding_utf16le || encoding == bench_encoding_utf16be) {
+        const c89str_uint16* p = (const c89str_uint16*)pIn;
+        c89str_bool32 isSwapped = bench_encoding_is_swapped(encoding);
+        c89str_uint16 hi = isSwapped ? bench_swap16(p[i]) : p[i];
+        c89str_uint16 lo;
+
+        if (hi < 0xD800 || hi > 0xDFFF) {
+            *pIndex = i + 1;
+            return hi;
+        }
+
+        if (hi >= 0xDC00 || i + 1 >= inLen) {
+            *pIndex = i + 1;
+            return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        lo = isSwapped ? bench_swap16(p[i + 1]) : p[i + 1];
+        if (lo < 0xDC00 || lo > 0xDFFF) {
+            *pIndex = i + 1;
+            return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        *pIndex = i + 2;
+        return 0x10000 + (((c89str_utf32)(hi - 0xD800) << 10) | (lo - 0xDC00));
+    }
+
+    {
+        const c89str_uint32* p = (const c89str_uint32*)pIn;
+        c89str_uint32 cp = bench_encoding_is_swapped(encoding) ? bench_swap32(p[i]) : p[i];
+
+        *pIndex = i + 1;
+
+        if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            return C89STR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        return cp;
+    }
+}
+
+/* Returns the number of code units written. pOut can be NULL in which case only the length is calculated. */
+static size_t bench_naive_encode(bench_encoding encoding, c89str_utf32 cp, void* pOut, size_t outIndex)
+{
+    if (encoding == bench_encoding_wchar) {
+        encoding = (sizeof(wchar_t) == 2) ? bench_encoding_utf16ne : bench_encoding_utf32ne;
+    }
+
+    if (encoding == bench_encoding_utf8) {
+        c89str_uint8* p = (c89str_uint8*)pOut + outIndex;
+
+        if (cp < 0x80) {
+            if (pOut != NULL) {
+                p[0] = (c89str_uint8)cp;
+            }
+            return 1;
+        } else if (cp < 0x800) {
+            if (pOut != NULL) {
+                p[0] = (c89str_uint8)(0xC0 | (cp >> 6));
+                p[1] = (c89str_uint8)(0x80 | (cp & 0x3F));
+            }
+            return 2;
+        } else if (cp < 0x10000) {
+            if (pOut != NULL) {
+                p[0] = (c89str_uint8)(0xE0 | (cp >> 12));
+                p[1] = (c89str_uint8)(0x80 | ((cp >> 6) & 0x3F));
+                p[2] = (c89str_uint8)(0x80 | (cp & 0x3F));
+            }
+            return 3;
+        } else {
+            if (pOut != NULL) {
+                p[0] = (c89str_uint8)(0xF0 | (cp >> 18));
+                p[1] = (c89str_uint8)(0x80 | ((cp >> 12) & 0x3F));
+                p[2] = (c89str_uint8)(0x80 | ((cp >> 6) & 0x3F));
+                p[3] = (c89str_uint8)(0x80 | (cp & 0x3F));
+            }
+            return 4;
+        }
+    }
+
+    if (encoding == bench_encoding_utf16ne || encoding == bench_encoding_utf16le || encoding == bench_encoding_utf16be) {
+        c89str_uint16* p = (c89str_uint16*)pOut + outIndex;
+        c89str_bool32 isSwapped = bench_encoding_is_swapped(encoding);
+
+        if (cp < 0x10000) {
+            if (pOut != NULL) {
+                p[0] = isSwapped ? bench_swap16((c89str_uint16)cp) : (c89str_uint16)cp;
+            }
+            return 1;
+        } else {
+            if (pOut != NULL) {
+                c89str_uint16 hi = (c89str_uint16)(0xD800 + ((cp - 0x10000) >> 10));
+                c89str_uint16 lo = (c89str_uint16)(0xDC00 + ((cp - 0x10000) & 0x3FF));
+                p[0] = isSwapped ? bench_swap16(hi) : hi;
+                p[1] = isSwapped ? bench_swap16(lo) : lo;
+            }
+            return 2;
+        }
+    }
+
+    if (pOut != NULL) {
+        c89str_uint32* p = (c89str_uint32*)pOut + outIndex;
+        p[0] = bench_encoding_is_swapped(encoding) ? bench_swap32(cp) : cp;
+    }
+
+    return 1;
+}
+
+/* Returns the number of code points. pOut can be NULL. */
+static size_t bench_naive_convert(bench_encoding outEncoding, void* pOut, size_t* pOutLen, bench_encoding inEncoding, const void* pIn, size_t inLen)
+{
+    size_t iIn = 0;
+    size_t outLen = 0;
+    size_t codePointCount = 0;
+
+    while (iIn < inLen) {
+        c89str_utf32 cp = bench_naive_decode(inEncoding, pIn, inLen, &iIn);
+        outLen += bench_naive_encode(outEncoding, cp, pOut, outLen);
+        codePointCount += 1;
+    }
+
+    if (pOutLen != NULL) {
+        *pOutLen = outLen;
+    }
+
+    return codePointCount;
+}
+
+
+/*
+Corpora
+
+Each corpus is generated as a list of code points and then encoded into each of the input encodings. The invalid
+corpus is the exception. It's random code units in each encoding so each one is broken in its own way.
+*/
+typedef enum
+{
+    bench_corpus_ascii,
+    bench_corpus_latin1,
+    bench_corpus_cjk,
+    bench_corpus_emoji,
+    bench_corpus_wiki,
+    bench_corpus_invalid,
+    bench_corpus_count
+} bench_corpus_type;
+
+typedef struct
+{
+    const char* pName;
+    void* pData[bench_encoding_count];          /* Indexed by bench_encoding. Only the input encodings are filled. */
+    size_t len[bench_encoding_count];           /* In code units. */
+    size_t codePointCount[bench_encoding_count];
+} bench_corpus;
+
+static c89str_utf32 bench_random_ascii(void)
+{
+    /* Mostly lower case letters with the odd space, capital, digit and bit of punctuation, like English prose. */
+    c89str_uint32 r = bench_random_range(0, 99);
+
+    if (r < 16) {
+        return ' ';
+    } else if (r < 19) {
+        return bench_random_range('A', 'Z');
+    } else if (r < 21) {
+        return bench_random_range('0', '9');
+    } else if (r < 23) {
+        return ".,;:'()\n"[bench_random_range(0, 7)];
+    } else {
+        return bench_random_range('a', 'z');
+    }
+}
+
+static c89str_utf32 bench_random_emoji(void)
+{
+    return bench_random_range(0x1F300, 0x1FAFF);
+}
+
+static c89str_utf32 bench_random_cjk(void)
+{
+    return bench_random_range(0x4E00, 0x9FFF);
+}
+
+/*
+Wikipedia-like text. Mostly ASCII with markup, with words in other scripts mixed in the way a typical article might
+quote foreign names, cite sources and use the odd symbol. The script is chosen per word so runs of each are realistic.
+*/
+static size_t bench_generate_wiki_word(c89str_utf32* pCodePoints, size_t cap)
+{
+    size_t len = 0;
+    size_t wordLen = bench_random_range(2, 9);
+    c89str_uint32 script = bench_random_range(0, 99);
+    size_t i;
+
+    if (script < 3 && cap >= 2) {
+        pCodePoints[len++] = '[';
+        pCodePoints[len++] = '[';
+    }
+
+    for (i = 0; i < wordLen && len < cap; i += 1) {
+        if (script < 80) {
+            pCodePoints[len++] = bench_random_range('a', 'z');
+        } else if (script < 88) {
+            pCodePoints[len++] = (bench_random_range(0, 3) == 0) ? bench_random_range(0xE0, 0xFF) : bench_random_range('a', 'z');   /* Accented Latin. */
+        } else if (script < 93) {
+            pCodePoints[len++] = bench_random_range(0x0430, 0x044F);   /* Cyrillic. */
+        } else if (script < 96) {
+            pCodePoints[len++] = bench_random_range(0x05D0, 0x05EA);   /* Hebrew. */
+        } else if (script < 99) {
+            pCodePoints[len++] = bench_random_cjk();
+        } else {
+            pCodePoints[len++] = bench_random_emoji();
+        }
+    }
+
+    if (script < 3 && cap - len >= 2) {
+        pCodePoints[len++] = ']';
+        pCodePoints[len++] = ']';
+    }
+
+    if (len < cap) {
+        pCodePoints[len++] = (bench_random_range(0, 15) == 0) ? '\n' : ' ';
+    }
+
+    return len;
+}
+
+static void bench_generate_code_points(bench_corpus_type type, c89str_utf32* pCodePoints, size_t count)
+{
+    size_t i = 0;
+
+    while (i < count) {
+        switch (type)
+        {
+            case bench_corpus_ascii:
+            {
+                pCodePoints[i++] = bench_random_ascii();
+            } break;
+
+            case bench_corpus_latin1:
+            {
+                /* Western European text. Mostly ASCII with a high proportion of 2 byte characters. */
+                pCodePoints[i++] = (bench_random_range(0, 3) == 0) ? bench_random_range(0xA0, 0xFF) : bench_random_ascii();
+            } break;
+
+            case bench_corpus_cjk:
+            {
+                pCodePoints[i++] = (bench_random_range(0, 9) == 0) ? bench_random_range(0x3000, 0x3002) : bench_random_cjk();
+            } break;
+
+            case bench_corpus_emoji:
+            {
+                pCodePoints[i++] = (bench_random_range(0, 4) == 0) ? bench_random_ascii() : bench_random_emoji();
+            } break;
+
+            case bench_corpus_wiki:
+            default:
+            {
+                i += bench_generate_wiki_word(pCodePoints + i, count - i);
+            } break;
+        }
+    }
+}
+
+static void bench_generate_invalid(bench_encoding encoding, void* pData, size_t len)
+{
+    size_t i;
+
+    if (encoding == bench_encoding_utf8) {
+        c89str_uint8* p = (c89str_uint8*)pData;
+        for (i = 0; i < len; i += 1) {
+            p[i] = (c89str_uint8)bench_random();
+        }
+
+        /*
+        The UTF-8 decoder doesn't check continuation bytes or reject overlong 4 byte sequences, and an overlong 4 byte
+        sequence asserts when converted to UTF-16. Set a bit in the byte after each F0 so it can't decode as overlong.
+        It's still garbage.
+        */
+        for (i = 0; i + 1 < len; i += 1) {
+            if (p[i] == 0xF0) {
+                p[i + 1] |= 0x10;
+            }
+        }
+    } else if (bench_encoding_unit_size(encoding) == 2) {
+        c89str_uint16* p = (c89str_uint16*)pData;
+        for (i = 0; i < len; i += 1) {
+            /* Biased towards the surrogate range so there's plenty of unpaired surrogates. */
+            p[i] = (c89str_uint16)((bench_random_range(0, 3) == 0) ? bench_random_range(0xD800, 0xDFFF) : bench_random());
+        }
+    } else {
+        c89str_uint32* p = (c89str_uint32*)pData;
+        for (i = 0; i < len; i += 1) {
+            p[i] = (bench_random_range(0, 3) == 0) ? bench_random() : bench_random_range(0, 0x10FFFF);
+        }
+    }
+
+    /* Input that ends part way through a sequence is an error rather than something to replace. Don't let that happen. */
+    for (i = len - 4; i < len; i += 1) {
+        bench_naive_encode(encoding, '\n', pData, i);
+    }
+}
+
+static errno_t bench_corpus_init(bench_corpus* pCorpus, bench_corpus_type type)
+{
+    static const char* pNames[bench_corpus_count] = { "ascii", "latin1", "cjk", "emoji", "wiki", "invalid" };
+    c89str_utf32* pCodePoints = NULL;
+    int encoding;
+
+    C89STR_ZERO_OBJECT(pCorpus);
+    pCorpus->pName = pNames[type];
+
+    if (type != bench_corpus_invalid) {
+        pCodePoints = (c89str_utf32*)c89str_malloc(BENCH_CORPUS_CODE_POINTS * sizeof(*pCodePoints), NULL);
+        if (pCodePoints == NULL) {
+            return ENOMEM;
+        }
+
+        bench_generate_code_points(type, pCodePoints, BENCH_CORPUS_CODE_POINTS);
+    }
+
+    for (encoding = 0; encoding < bench_encoding_wchar; encoding += 1) {
+        size_t len;
+
+        if (pCodePoints != NULL) {
+            bench_naive_convert((bench_encoding)encoding, NULL, &len, bench_encoding_utf32ne, pCodePoints, BENCH_CORPUS_CODE_POINTS);
+        } else {
+            len = (BENCH_CORPUS_CODE_POINTS * 2) / bench_encoding_unit_size((bench_encoding)encoding);
+        }
+
+        pCorpus->pData[encoding] = c89str_malloc(len * bench_encoding_unit_size((bench_encoding)encoding), NULL);
+        if (pCorpus->pData[encoding] == NULL) {
+            c89str_free(pCodePoints, NULL);
+            return ENOMEM;
+        }
+
+        if (pCodePoints != NULL) {
+            bench_naive_convert((bench_encoding)encoding, pCorpus->pData[encoding], NULL, bench_encoding_utf32ne, pCodePoints, BENCH_CORPUS_CODE_POINTS);
+        } else {
+            bench_generate_invalid((bench_encoding)encoding, pCorpus->pData[encoding], len);
+        }
+
+        pCorpus->len[encoding] = len;
+        pCorpus->codePointCount[encoding] = bench_naive_convert(bench_encoding_utf32ne, NULL, NULL, (bench_encoding)encoding, pCorpus->pData[encoding], len);
+    }
+
+    c89str_free(pCodePoints, NULL);
+    return C89STR_SUCCESS;
+}
+
+static void bench_corpus_uninit(bench_corpus* pCorpus)
+{
+    int encoding;
+
+    for (encoding = 0; encoding < bench_encoding_count; encoding += 1) {
+        c89str_free(pCorpus->pData[encoding], NULL);
+    }
+}
+
+
+/*
+Converters
+
+Everything is wrapped in a common signature. The input is always given an explicit length and invalid input is
+replaced rather than treated as an error so that every function does the same amount of work on the invalid corpus.
+*/
+typedef errno_t (* bench_proc)(void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen);
+
+typedef enum
+{
+    bench_kind_convert,
+    bench_kind_len,
+    bench_kind_alloc,
+    bench_kind_stream
+} bench_kind;
+
+typedef struct
+{
+    const char* pName;
+    bench_encoding inEncoding;
+    bench_encoding outEncoding;
+    bench_kind kind;
+    bench_proc proc;
+} bench_converter;
+
+#define BENCH_CONVERT(name, outType, inType) \
+static errno_t bench_##name(void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen) \
+{ \
+    return c89str_##name((outType*)pOut, outCap, pOutLen, (const inType*)pIn, inLen, NULL, 0); \
+}
+
+#define BENCH_LEN(name, inType) \
+static errno_t bench_##name(void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen) \
+{ \
+    (void)pOut; \
+    (void)outCap; \
+    return c89str_##name(pOutLen, (const inType*)pIn, inLen, NULL, 0); \
+}
+
+#define BENCH_ALLOC(name, outType, inType) \
+static errno_t bench_##name(void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen) \
+{ \
+    outType* pAllocated; \
+    errno_t result; \
+    (void)pOut; \
+    (void)outCap; \
+    result = c89str_##name(&pAllocated, pOutLen, (const inType*)pIn, inLen, NULL, 0, NULL); \
+    if (result == C89STR_SUCCESS) { \
+        c89str_free(pAllocated, NULL); \
+    } \
+    return result; \
+}
+
+/* The input is fed in 4KB chunks like it would be when reading from a file. */
+#define BENCH_STREAM(name, outType, inType) \
+static errno_t bench_##name(void* pOut, size_t outCap, size_t* pOutLen, const void* pIn, size_t inLen) \
+{ \
+    c89str_utf_stream stream; \
+    errno_t result = C89STR_SUCCESS; \
+    size_t iIn = 0; \
+    size_t outLen = 0; \
+    c89str_utf_stream_init(&stream, 0); \
+    while (iIn < inLen) { \
+        size_t chunkLen = C89STR_MIN(inLen - iIn, 4096 / sizeof(inType)); \
+        size_t chunkProcessed; \
+        size_t chunkOutLen; \
+        result = c89str_##name(&stream, (outType*)pOut + outLen, outCap - outLen, &chunkOutLen, (const inType*)pIn + iIn, chunkLen, &chunkProcessed); \
+        if (result != C89STR_SUCCESS) { \
+            break; \
+        } \
+        iIn    += chunkProcessed; \
+        outLen += chunkOutLen; \
+    } \
+    if (result == C89STR_SUCCESS) { \
+        result = c89str_utf_stream_finish(&stream); \
+    } \
+    *pOutLen = outLen; \
+    return result; \
+}
+
+BENCH_LEN    (utf8_to_utf16_len,       c89str_utf8)
+BENCH_CONVERT(utf8_to_utf16ne,         c89str_utf16, c89str_utf8)
+BENCH_CONVERT(utf8_to_utf16le,         c89str_utf16, c89str_utf8)
+BENCH_CONVERT(utf8_to_utf16be,         c89str_utf16, c89str_utf8)
+BENCH_ALLOC  (utf8_to_utf16_alloc,     c89str_utf16, c89str_utf8)
+BENCH_STREAM (utf8_to_utf16_stream,    c89str_utf16, c89str_utf8)
+BENCH_LEN    (utf8_to_utf32_len,       c89str_utf8)
+BENCH_CONVERT(utf8_to_utf32ne,         c89str_utf32, c89str_utf8)
+BENCH_CONVERT(utf8_to_utf32le,         c89str_utf32, c89str_utf8)
+BENCH_CONVERT(utf8_to_utf32be,         c89str_utf32, c89str_utf8)
+BENCH_ALLOC  (utf8_to_utf32_alloc,     c89str_utf32, c89str_utf8)
+BENCH_STREAM (utf8_to_utf32_stream,    c89str_utf32, c89str_utf8)
+BENCH_LEN    (utf8_to_wchar_len,       c89str_utf8)
+BENCH_CONVERT(utf8_to_wchar,           wchar_t,      c89str_utf8)
+
+BENCH_LEN    (utf16ne_to_utf8_len,     c89str_utf16)
+BENCH_LEN    (utf16le_to_utf8_len,     c89str_utf16)
+BENCH_LEN    (utf16be_to_utf8_len,     c89str_utf16)
+BENCH_LEN    (utf16_to_utf8_len,       c89str_utf16)
+BENCH_CONVERT(utf16ne_to_utf8,         c89str_utf8,  c89str_utf16)
+BENCH_CONVERT(utf16le_to_utf8,         c89str_utf8,  c89str_utf16)
+BENCH_CONVERT(utf16be_to_utf8,         c89str_utf8,  c89str_utf16)
+BENCH_CONVERT(utf16_to_utf8,           c89str_utf8,  c89str_utf16)
+BENCH_ALLOC  (utf16_to_utf8_alloc,     c89str_utf8,  c89str_utf16)
+BENCH_STREAM (utf16_to_utf8_stream,    c89str_utf8,  c89str_utf16)
+BENCH_LEN    (utf16ne_to_utf32_len,    c89str_utf16)
+BENCH_LEN    (utf16le_to_utf32_len,    c89str_utf16)
+BENCH_LEN    (utf16be_to_utf32_len,    c89str_utf16)
+BENCH_LEN    (utf16_to_utf32_len,      c89str_utf16)
+BENCH_CONVERT(utf16ne_to_utf32ne,      c89str_utf32, c89str_utf16)
+BENCH_CONVERT(utf16le_to_utf32le,      c89str_utf32, c89str_utf16)
+BENCH_CONVERT(utf16be_to_utf32be,      c89str_utf32, c89str_utf16)
+BENCH_CONVERT(utf16_to_utf32,          c89str_utf32, c89str_utf16)
+
+BENCH_LEN    (utf32ne_to_utf8_len,     c89str_utf32)
+BENCH_LEN    (utf32le_to_utf8_len,     c89str_utf32)
+BENCH_LEN    (utf32be_to_utf8_len,     c89str_utf32)
+BENCH_LEN    (utf32_to_utf8_len,       c89str_utf32)
+BENCH_CONVERT(utf32ne_to_utf8,         c89str_utf8,  c89str_utf32)
+BENCH_CONVERT(utf32le_to_utf8,         c89str_utf8,  c89str_utf32)
+BENCH_CONVERT(utf32be_to_utf8,         c89str_utf8,  c89str_utf32)
+BENCH_CONVERT(utf32_to_utf8,           c89str_utf8,  c89str_utf32)
+BENCH_ALLOC  (utf32_to_utf8_alloc,     c89str_utf8,  c89str_utf32)
+BENCH_LEN    (utf32ne_to_utf16_len,    c89str_utf32)
+BENCH_LEN    (utf32le_to_utf16_len,    c89str_utf32)
+BENCH_LEN    (utf32be_to_utf16_len,    c89str_utf32)
+BENCH_LEN    (utf32_to_utf16_len,      c89str_utf32)
+BENCH_CONVERT(utf32ne_to_utf16ne,      c89str_utf16, c89str_utf32)
+BENCH_CONVERT(utf32le_to_utf16le,      c89str_utf16, c89str_utf32)
+BENCH_CONVERT(utf32be_to_utf16be,      c89str_utf16, c89str_utf32)
+BENCH_CONVERT(utf32_to_utf16,          c89str_utf16, c89str_utf32)
+
+#define BENCH_ENTRY(name, in, out, kind) { "c89str_" #name, bench_encoding_##in, bench_encoding_##out, bench_kind_##kind, bench_##name }
+
+/* The functions without an explicit byte order are fed native endian input with no BOM. */
+static const bench_converter g_benchConverters[] =
+{
+    BENCH_ENTRY(utf8_to_utf16_len,       utf8,    utf16ne, len),
+    BENCH_ENTRY(utf8_to_utf16ne,         utf8,    utf16ne, convert),
+    BENCH_ENTRY(utf8_to_utf16le,         utf8,    utf16le, convert),
+    BENCH_ENTRY(utf8_to_utf16be,         utf8,    utf16be, convert),
+    BENCH_ENTRY(utf8_to_utf16_alloc,     utf8,    utf16ne, alloc),
+    BENCH_ENTRY(utf8_to_utf16_stream,    utf8,    utf16ne, stream),
+    BENCH_ENTRY(utf8_to_utf32_len,       utf8,    utf32ne, len),
+    BENCH_ENTRY(utf8_to_utf32ne,         utf8,    utf32ne, convert),
+    BENCH_ENTRY(utf8_to_utf32le,         utf8,    utf32le, convert),
+    BENCH_ENTRY(utf8_to_utf32be,         utf8,    utf32be, convert),
+    BENCH_ENTRY(utf8_to_utf32_alloc,     utf8,    utf32ne, alloc),
+    BENCH_ENTRY(utf8_to_utf32_stream,    utf8,    utf32ne, stream),
+    BENCH_ENTRY(utf8_to_wchar_len,       utf8,    wchar,   len),
+    BENCH_ENTRY(utf8_to_wchar,           utf8,    wchar,   convert),
+
+    BENCH_ENTRY(utf16ne_to_utf8_len,     utf16ne, utf8,    len),
+    BENCH_ENTRY(utf16le_to_utf8_len,     utf16le, utf8,    len),
+    BENCH_ENTRY(utf16be_to_utf8_len,     utf16be, utf8,    len),
+    BENCH_ENTRY(utf16_to_utf8_len,       utf16ne, utf8,    len),
+    BENCH_ENTRY(utf16ne_to_utf8,         utf16ne, utf8,    convert),
+    BENCH_ENTRY(utf16le_to_utf8,         utf16le, utf8,    convert),
+    BENCH_ENTRY(utf16be_to_utf8,         utf16be, utf8,    convert),
+    BENCH_ENTRY(utf16_to_utf8,           utf16ne, utf8,    convert),
+    BENCH_ENTRY(utf16_to_utf8_alloc,     utf16ne, utf8,    alloc),
+    BENCH_ENTRY(utf16_to_utf8_stream,    utf16ne, utf8,    stream),
+    BENCH_ENTRY(utf16ne_to_utf32_len,    utf16ne, utf32ne, len),
+    BENCH_ENTRY(utf16le_to_utf32_len,    utf16le, utf32le, len),
+    BENCH_ENTRY(utf16be_to_utf32_len,    utf16be, utf32be, len),
+    BENCH_ENTRY(utf16_to_utf32_len,      utf16ne, utf32ne, len),
+    BENCH_ENTRY(utf16ne_to_utf32ne,      utf16ne, utf32ne, convert),
+    BENCH_ENTRY(utf16le_to_utf32le,      utf16le, utf32le, convert),
+    BENCH_ENTRY(utf16be_to_utf32be,      utf16be, utf32be, convert),
+    BENCH_ENTRY(utf16_to_utf32,          utf16ne, utf32ne, convert),
+
+    BENCH_ENTRY(utf32ne_to_utf8_len,     utf32ne, utf8,    len),
+    BENCH_ENTRY(utf32le_to_utf8_len,     utf32le, utf8,    len),
+    BENCH_ENTRY(utf32be_to_utf8_len,     utf32be, utf8,    len),
+    BENCH_ENTRY(utf32_to_utf8_len,       utf32ne, utf8,    len),
+    BENCH_ENTRY(utf32ne_to_utf8,         utf32ne, utf8,    convert),
+    BENCH_ENTRY(utf32le_to_utf8,         utf32le, utf8,    convert),
+    BENCH_ENTRY(utf32be_to_utf8,         utf32be, utf8,    convert),
+    BENCH_ENTRY(utf32_to_utf8,           utf32ne, utf8,    convert),
+    BENCH_ENTRY(utf32_to_utf8_alloc,     utf32ne, utf8,    alloc),
+    BENCH_ENTRY(utf32ne_to_utf16_len,    utf32ne, utf16ne, len),
+    BENCH_ENTRY(utf32le_to_utf16_len,    utf32le, utf16le, len),
+    BENCH_ENTRY(utf32be_to_utf16_len,    utf32be, utf16be, len),
+    BENCH_ENTRY(utf32_to_utf16_len,      utf32ne, utf16ne, len),
+    BENCH_ENTRY(utf32ne_to_utf16ne,      utf32ne, utf16ne, convert),
+    BENCH_ENTRY(utf32le_to_utf16le,      utf32le, utf16le, convert),
+    BENCH_ENTRY(utf32be_to_utf16be,      utf32be, utf16be, convert),
+    BENCH_ENTRY(utf32_to_utf16,          utf32ne, utf16ne, convert)
+};
+
+
+/* Timing */
+static double bench_seconds(clock_t start, clock_t end)
+{
+    return (double)(end - start) / CLOCKS_PER_SEC;
+}
+
+/* Runs the converter until at least BENCH_MIN_SECONDS has passed and returns the average time of one run. */
+static double bench_time_converter(const bench_converter* pConverter, void* pOut, size_t outCap, const void* pIn, size_t inLen, errno_t* pResult)
+{
+    size_t outLen;
+    size_t runCount = 0;
+    clock_t start;
+    clock_t end;
+
+    *pResult = pConverter->proc(pOut, outCap, &outLen, pIn, inLen);  /* Warm up. */
+
+    start = clock();
+    do {
+        pConverter->proc(pOut, outCap, &outLen, pIn, inLen);
+        runCount += 1;
+        end = clock();
+    } while (bench_seconds(start, end) < BENCH_MIN_SECONDS);
+
+    return bench_seconds(start, end) / (double)runCount;
+}
+
+static double bench_time_naive(const bench_converter* pConverter, void* pOut, const void* pIn, size_t inLen)
+{
+    size_t outLen;
+    size_t runCount = 0;
+    void* pNaiveOut = (pConverter->kind == bench_kind_len) ? NULL : pOut;
+    clock_t start;
+    clock_t end;
+
+    start = clock();
+    do {
+        bench_naive_convert(pConverter->outEncoding, pNaiveOut, &outLen, pConverter->inEncoding, pIn, inLen);
+        runCount += 1;
+        end = clock();
+    } while (bench_seconds(start, end) < BENCH_MIN_SECONDS);
+
+    return bench_seconds(start, end) / (double)runCount;
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* pFilter = (argc > 1) ? argv[1] : NULL;
+    bench_corpus corpora[bench_corpus_count];
+    size_t outCap;
+    void* pOut;
+    size_t iConverter;
+    int iCorpus;
+    c89str_uint32 simdFlags = c89str_get_simd_flags();
+
+    for (iCorpus = 0; iCorpus < bench_corpus_count; iCorpus += 1) {
+        if (bench_corpus_init(&corpora[iCorpus], (bench_corpus_type)iCorpus) != C89STR_SUCCESS) {
+            printf("Out of memory.\n");
+            return 1;
+        }
+    }
+
+    /* Big enough for any input converted to any output. 4 bytes per input byte plus the null terminator. */
+    outCap = BENCH_CORPUS_CODE_POINTS * 4 * 4 + 1;
+    pOut = c89str_malloc(outCap, NULL);
+    if (pOut == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    printf("SIMD:%s%s%s%s\n",
+        ((simdFlags & C89STR_SIMD_SSE2) != 0) ? " SSE2" : "",
+        ((simdFlags & C89STR_SIMD_AVX2) != 0) ? " AVX2" : "",
+        ((simdFlags & C89STR_SIMD_NEON) != 0) ? " NEON" : "",
+        (simdFlags == 0) ? " none" : "");
+    printf("%-32s %-8s %9s %10s %11s %8s\n", "Function", "Corpus", "GB/s", "Mcp/s", "Naive GB/s", "Speedup");
+
+    for (iConverter = 0; iConverter < C89STR_COUNTOF(g_benchConverters); iConverter += 1) {
+        const bench_converter* pConverter = &g_benchConverters[iConverter];
+
+        if (pFilter != NULL && strstr(pConverter->pName, pFilter) == NULL) {
+            continue;
+        }
+
+        for (iCorpus = 0; iCorpus < bench_corpus_count; iCorpus += 1) {
+            const bench_corpus* pCorpus = &corpora[iCorpus];
+            const void* pIn = pCorpus->pData[pConverter->inEncoding];
+            size_t inLen = pCorpus->len[pConverter->inEncoding];
+            double inBytes = (double)inLen * bench_encoding_unit_size(pConverter->inEncoding);
+            double codePoints = (double)pCorpus->codePointCount[pConverter->inEncoding];
+            size_t outCapInUnits = outCap / bench_encoding_unit_size(pConverter->outEncoding);
+            errno_t result;
+            double seconds;
+            double naiveSeconds;
+
+            seconds = bench_time_converter(pConverter, pOut, outCapInUnits, pIn, inLen, &result);
+            naiveSeconds = bench_time_naive(pConverter, pOut, pIn, inLen);
+
+            printf("%-32s %-8s %9.3f %10.1f %11.3f %7.1fx%s\n",
+                pConverter->pName,
+                pCorpus->pName,
+                inBytes / seconds / 1e9,
+                codePoints / seconds / 1e6,
+                inBytes / naiveSeconds / 1e9,
+                naiveSeconds / seconds,
+                (result != C89STR_SUCCESS) ? " (failed)" : "");
+        }
+    }
+
+    c89str_free(pOut, NULL);
+    for (iCorpus = 0; iCorpus < bench_corpus_count; iCorpus += 1) {
+        bench_corpus_uninit(&corpora[iCorpus]);
+    }
+
+    return 0;
+}